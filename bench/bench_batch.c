@@ -0,0 +1,54 @@
+/**
+ * \file bench/bench_batch.c
+ * \brief Benchmark for alloc_new_batch() and alloc_del_batch().
+ * \details Compares allocating and freeing groups of same-size blocks
+ * with the batch entry points against a loop of single calls.
+ * */
+
+#include "bench_utils.h"
+#include <alloc.h>
+
+#define ROUNDS 20000
+#define BATCH 64
+
+typedef struct result {
+	double ns;
+	size_t ops;
+} result_t;
+
+static int run(result_t *res, int batch, size_t size) {
+	void *ptrs[BATCH];
+	double start = bench_now();
+	for (size_t r = 0; r < ROUNDS; r++) {
+		if (batch) {
+			if (alloc_new_batch(size, BATCH, ptrs)) return 1;
+		} else {
+			for (size_t i = 0; i < BATCH; i++)
+				if (!(ptrs[i] = alloc_new(size))) return 1;
+		}
+		for (size_t i = 0; i < BATCH; i++) *(unsigned char*)ptrs[i] = 1;
+		if (batch) {
+			alloc_del_batch(ptrs, BATCH);
+		} else {
+			for (size_t i = 0; i < BATCH; i++) alloc_del(ptrs[i]);
+		}
+		res->ops += BATCH;
+	}
+	res->ns = bench_now() - start;
+	return 0;
+}
+
+int main(void) {
+	size_t sizes[] = {16, 128, 512, 1024, 2048};
+	printf("bench_batch\n");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		result_t single = {0};
+		result_t batch = {0};
+		if (run(&single, 0, sizes[i])) return 1;
+		if (run(&batch, 1, sizes[i])) return 1;
+		printf("%5zuB x %d single %6.2f ns/block batch %6.2f ns/block\n",
+			sizes[i], BATCH, single.ns / (double)single.ops,
+			batch.ns / (double)batch.ops);
+	}
+	return 0;
+}
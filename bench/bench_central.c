@@ -0,0 +1,120 @@
+/**
+ * \file bench/bench_central.c
+ * \brief Benchmark for the central free lists.
+ * \details Compares the lock-free central stack of the library against a
+ * mutex-guarded stack of the same layout. Every thread pops a batch and
+ * pushes it back, so all threads contend on a single size class.
+ * */
+
+#include "bench_utils.h"
+#include "alloc_utils.h"
+
+#define MAX_THREADS 64
+#define BATCHES 256
+#define OPS (1024LU * 1024 * 4)
+
+typedef struct locked {
+	pthread_mutex_t mutex;
+	void *head;
+	size_t count;
+} locked_t;
+
+static central_t g_lock_free;
+static locked_t g_locked = {PTHREAD_MUTEX_INITIALIZER, NULL, 0};
+static size_t g_rounds;
+
+static void locked_push(locked_t *central, void *head, void *tail, size_t count) {
+	*(void**)tail = NULL;
+	pthread_mutex_lock(&central->mutex);
+	NEXT_BATCH(head) = central->head;
+	central->head = head;
+	central->count += count;
+	pthread_mutex_unlock(&central->mutex);
+}
+
+static void *locked_pop(locked_t *central, void **tail, size_t *count) {
+	pthread_mutex_lock(&central->mutex);
+	void *head = central->head;
+	size_t n = 0;
+	void *last = head;
+	if (head) {
+		for (n = 1; *(void**)last; n++) last = *(void**)last;
+		central->head = NEXT_BATCH(head);
+		central->count -= n;
+	}
+	pthread_mutex_unlock(&central->mutex);
+	if (!head) return NULL;
+	*tail = last;
+	*count = n;
+	return head;
+}
+
+static void *lock_free_worker(void *arg) {
+	(void)arg;
+	void *tail;
+	size_t count;
+	for (size_t r = 0; r < g_rounds; r++) {
+		void *head = central_pop(&g_lock_free, &tail, &count);
+		if (head && central_push(&g_lock_free, head, tail, count)) return arg;
+	}
+	return NULL;
+}
+
+static void *locked_worker(void *arg) {
+	(void)arg;
+	void *tail;
+	size_t count;
+	for (size_t r = 0; r < g_rounds; r++) {
+		void *head = locked_pop(&g_locked, &tail, &count);
+		if (head) locked_push(&g_locked, head, tail, count);
+	}
+	return NULL;
+}
+
+static int fill() {
+	for (size_t b = 0; b < BATCHES; b++) {
+		void *head = NULL;
+		void *tail = NULL;
+		for (size_t i = 0; i < TCACHE_BATCH; i++) {
+			void *data = alloc_new(MIN_ALLOC_SIZE);
+			if (!data) return 1;
+			*(void**)data = head;
+			if (!head) tail = data;
+			head = data;
+		}
+		if (central_push(&g_lock_free, head, tail, TCACHE_BATCH)) return 1;
+		void *copy = NULL;
+		void *copy_tail = NULL;
+		for (size_t i = 0; i < TCACHE_BATCH; i++) {
+			void *data = alloc_new(MIN_ALLOC_SIZE);
+			if (!data) return 1;
+			*(void**)data = copy;
+			if (!copy) copy_tail = data;
+			copy = data;
+		}
+		locked_push(&g_locked, copy, copy_tail, TCACHE_BATCH);
+	}
+	return 0;
+}
+
+static double run(void *(*fn)(void*), size_t threads) {
+	pthread_t workers[MAX_THREADS];
+	g_rounds = OPS / threads;
+	double start = bench_now();
+	for (size_t t = 0; t < threads; t++)
+		pthread_create(&workers[t], NULL, fn, NULL);
+	for (size_t t = 0; t < threads; t++) pthread_join(workers[t], NULL);
+	return (double)OPS / ((bench_now() - start) / 1e9) / 1e6;
+}
+
+int main(void) {
+	printf("bench_central\n");
+	if (fill()) return 1;
+	for (size_t t = 1; t <= MAX_THREADS; t *= 2) {
+		double lock_free = run(lock_free_worker, t);
+		double locked = run(locked_worker, t);
+		printf("%3zu threads lock-free %8.2f Mops/s mutex %8.2f Mops/s\n",
+			t, lock_free, locked);
+	}
+	return 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * \file bench/bench_fast.c
+ * \brief Benchmark for alloc_new_fast().
+ * \details Compares pairs of allocations and frees of small blocks served
+ * by the inline alloc_new_fast(), by a call to alloc_new() and by malloc().
+ * Building with RELEASE=1 shows the cost of the error reporting on top of
+ * it.
+ * */
+
+#include "bench_utils.h"
+#include <alloc.h>
+#include <stdlib.h>
+
+#define ROUNDS (1024LU * 64)
+#define LIVE 32
+
+typedef enum path {
+	PATH_INLINE,
+	PATH_CALL,
+	PATH_MALLOC,
+} path_t;
+
+static volatile uintptr_t g_sink;
+
+static double run(path_t path, size_t size) {
+	alloc_fast_t *fast = alloc_fast_get();
+	if (!fast) return -1;
+	unsigned char *bufs[LIVE];
+	uintptr_t sink = 0;
+	double start = bench_now();
+	for (size_t r = 0; r < ROUNDS; r++) {
+		for (size_t i = 0; i < LIVE; i++) {
+			if (path == PATH_INLINE) bufs[i] = alloc_new_fast(fast, size);
+			else if (path == PATH_CALL) bufs[i] = alloc_new(size);
+			else bufs[i] = malloc(size);
+			if (!bufs[i]) return -1;
+			bufs[i][0] = (unsigned char)r;
+			sink += (uintptr_t)bufs[i];
+		}
+		for (size_t i = 0; i < LIVE; i++) {
+			if (path == PATH_MALLOC) free(bufs[i]);
+			else alloc_del(bufs[i]);
+		}
+	}
+	g_sink = sink;
+	return (bench_now() - start) / (ROUNDS * LIVE);
+}
+
+int main(void) {
+	size_t sizes[] = {16, 64, 256, 512};
+	printf("bench_fast\n");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		if (run(PATH_INLINE, sizes[i]) < 0) return 1;
+		double inline_ns = run(PATH_INLINE, sizes[i]);
+		double call_ns = run(PATH_CALL, sizes[i]);
+		double malloc_ns = run(PATH_MALLOC, sizes[i]);
+		if (inline_ns < 0 || call_ns < 0 || malloc_ns < 0) return 1;
+		printf("%4zuB inline %6.2f ns call %6.2f ns malloc %6.2f ns per new+del\n",
+			sizes[i], inline_ns, call_ns, malloc_ns);
+	}
+	return 0;
+}
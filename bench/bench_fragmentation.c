@@ -0,0 +1,55 @@
+/**
+ * \file bench/bench_fragmentation.c
+ * \brief Benchmark for fragmentation under a mixed-size trace.
+ * \details Replays a deterministic trace of random frees and mixed-size
+ * allocations and compares the resident memory of the process against the
+ * number of bytes the trace keeps alive.
+ * */
+
+#include "bench_utils.h"
+#include <alloc.h>
+#include <string.h>
+
+#define SLOTS 20000
+#define STEPS 2000000
+#define MAX_SIZE 4000
+
+static uint64_t g_state = 88172645463325252LU;
+
+static size_t trace_size() {
+	uint64_t r = bench_rand(&g_state);
+	if (r % 2) return 1 + (size_t)(r >> 8) % 256;
+	return 1 + (size_t)(r >> 8) % MAX_SIZE;
+}
+
+int main(void) {
+	static void *slots[SLOTS];
+	static size_t sizes[SLOTS];
+	size_t live = 0;
+	size_t base = bench_rss();
+	size_t peak = 0;
+	for (size_t i = 0; i < STEPS; i++) {
+		size_t slot = (size_t)(bench_rand(&g_state) % SLOTS);
+		if (slots[slot]) {
+			alloc_del(slots[slot]);
+			live -= sizes[slot];
+		}
+		sizes[slot] = trace_size();
+		slots[slot] = alloc_new(sizes[slot]);
+		if (!slots[slot]) return 1;
+		memset(slots[slot], 1, sizes[slot]);
+		live += sizes[slot];
+		if (i % 10000 == 0) {
+			size_t used = bench_rss() - base;
+			if (used > peak) peak = used;
+		}
+	}
+	size_t used = bench_rss() - base;
+	printf("bench_fragmentation\n");
+	printf("live bytes      %12zu\n", live);
+	printf("resident bytes  %12zu\n", used);
+	printf("peak resident   %12zu\n", peak > used ? peak : used);
+	printf("overhead        %12.2f x live\n", (double)used / (double)live);
+	for (size_t i = 0; i < SLOTS; i++) alloc_del(slots[i]);
+	return 0;
+}
@@ -0,0 +1,72 @@
+/**
+ * \file bench/bench_large.c
+ * \brief Benchmark for blocks too big for an arena.
+ * \details Compares allocating, touching and freeing blocks of 8 KiB to
+ * 8 MiB with alloc_new() and alloc_del() against mapping and unmapping
+ * them with mmap() and munmap(). The number of system calls the library
+ * makes per block is taken from its stats.
+ * */
+
+#include "bench_utils.h"
+#include <alloc.h>
+#include <sys/mman.h>
+
+#define ROUNDS 2000
+#define LIVE 4
+
+static double run_mmap(size_t size) {
+	unsigned char *bufs[LIVE];
+	double start = bench_now();
+	for (size_t r = 0; r < ROUNDS; r++) {
+		for (size_t i = 0; i < LIVE; i++) {
+			bufs[i] = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+			if (bufs[i] == MAP_FAILED) return -1;
+			bufs[i][0] = 1;
+			bufs[i][size - 1] = 1;
+		}
+		for (size_t i = 0; i < LIVE; i++) munmap(bufs[i], size);
+	}
+	return (bench_now() - start) / (ROUNDS * LIVE);
+}
+
+static double run_alloc(size_t size, double *syscalls) {
+	unsigned char *bufs[LIVE];
+	alloc_stats_t before;
+	alloc_stats_t after;
+	if (alloc_stats(&before)) return -1;
+	double start = bench_now();
+	for (size_t r = 0; r < ROUNDS; r++) {
+		for (size_t i = 0; i < LIVE; i++) {
+			if (!(bufs[i] = alloc_new(size))) return -1;
+			bufs[i][0] = 1;
+			bufs[i][size - 1] = 1;
+		}
+		for (size_t i = 0; i < LIVE; i++) alloc_del(bufs[i]);
+	}
+	double ns = (bench_now() - start) / (ROUNDS * LIVE);
+	if (alloc_stats(&after)) return -1;
+	*syscalls = (double)(
+		after.mmap_calls - before.mmap_calls +
+		after.munmap_calls - before.munmap_calls +
+		after.madvise_calls - before.madvise_calls
+	) / (ROUNDS * LIVE);
+	return ns;
+}
+
+int main(void) {
+	size_t sizes[] = {
+		1024LU * 8, 1024LU * 64, 1024LU * 256,
+		1024LU * 1024, 1024LU * 1024 * 2, 1024LU * 1024 * 8
+	};
+	printf("bench_large\n");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		double syscalls = 0;
+		double mmap_ns = run_mmap(sizes[i]);
+		double alloc_ns = run_alloc(sizes[i], &syscalls);
+		if (mmap_ns < 0 || alloc_ns < 0) return 1;
+		printf("%6zuKiB mmap %10.0f ns alloc %10.0f ns %6.2f syscalls/block\n",
+			sizes[i] / 1024, mmap_ns, alloc_ns, syscalls);
+	}
+	return 0;
+}
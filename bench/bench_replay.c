@@ -0,0 +1,504 @@
+/**
+ * \file bench/bench_replay.c
+ * \brief Replays allocation traces.
+ * \details Replays a trace written by a build with ALLOC_TRACE into the
+ * library or into glibc malloc and reports the time, the peak resident
+ * memory and the fragmentation, which is the part of the peak memory that
+ * wasn't live. Every thread of the trace gets a thread of its own and the
+ * records are handed to them in the order of their sequence numbers. A
+ * thread waits for the records of other threads that touched the same
+ * object before, so a block freed by another thread is freed after it's
+ * allocated. Records that don't match the live objects, like a free racing
+ * with the end of the trace, are counted and skipped. The trace is read one
+ * chunk at a time, so it doesn't have to fit in memory, and the memory of
+ * the replay itself is mapped directly, so it's the same for both
+ * allocators. Without arguments a synthetic trace of threads that free
+ * each other's blocks is written to a temporary file and replayed into
+ * both.
+ * Usage: bench_replay [trace [alloc|malloc]]
+ * */
+
+#include "bench_utils.h"
+#include "alloc_utils.h"
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAX_WORKERS 256
+#define QUEUE_SIZE 4096
+#define MAX_OBJECTS (1LU << 24)
+#define LG_TABLE 16
+#define SAMPLE_OPS 16384
+#define TOUCH_STRIDE 4096
+#define CMD_STOP 3
+#define GEN_THREADS 4
+#define GEN_OPS (1024LU * 512)
+#define GEN_LIVE 16384
+#define GEN_PHASE 65536
+#define GEN_FLUSH 4096
+
+typedef struct allocator {
+	const char *name;
+	void *(*new_fn)(size_t);
+	void (*del_fn)(void*);
+	void *(*resize_fn)(void*, size_t);
+} allocator_t;
+
+typedef struct cmd {
+	uint32_t op;
+	uint32_t obj;
+	uint64_t ver;
+	size_t size;
+} cmd_t;
+
+typedef struct worker {
+	pthread_t thread;
+	atomic_size_t head;
+	atomic_size_t tail;
+	cmd_t cmds[QUEUE_SIZE];
+} worker_t;
+
+typedef struct object {
+	_Atomic uint64_t ver;
+	unsigned char *ptr;
+} object_t;
+
+typedef struct entry {
+	uint64_t id;
+	uint64_t obj;
+} entry_t;
+
+typedef struct pending pending_t;
+
+struct pending {
+	pending_t *next;
+	trace_record_t last;
+	trace_record_t rec;
+	const unsigned char *pos;
+	const unsigned char *end;
+	trace_chunk_t chunk;
+	unsigned char data[TRACE_BUF_SIZE];
+};
+
+typedef struct gen_buf {
+	trace_record_t last;
+	trace_chunk_t chunk;
+	unsigned char data[TRACE_BUF_SIZE];
+} gen_buf_t;
+
+typedef struct result {
+	size_t ops;
+	size_t mismatched;
+	double ns;
+	size_t peak_rss;
+	size_t peak_heap;
+	size_t peak_live;
+} result_t;
+
+static const allocator_t *g_allocator;
+static worker_t *g_workers[MAX_WORKERS];
+static object_t *g_objects;
+static uint64_t *g_vers;
+static size_t *g_sizes;
+static uint32_t *g_free_objs;
+static size_t g_free_count;
+static size_t g_obj_count;
+static entry_t *g_table;
+static size_t g_table_lg;
+static size_t g_table_count;
+static pending_t *g_pending;
+static pending_t *g_spare;
+static size_t g_live;
+
+static void *alloc_resize_fn(void *ptr, size_t size) {
+	return alloc_resize(&ptr, size) ? NULL : ptr;
+}
+
+static const allocator_t g_allocators[] = {
+	{"alloc", alloc_new, alloc_del, alloc_resize_fn},
+	{"malloc", malloc, free, realloc},
+};
+
+static void *map(size_t size) {
+	void *ptr = MMAP_NORESERVE(size);
+	return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+	const unsigned char *pos = data;
+	while (len) {
+		ssize_t n = write(fd, pos, len);
+		if (n <= 0) return 1;
+		pos += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+static int read_all(int fd, void *data, size_t len) {
+	unsigned char *pos = data;
+	while (len) {
+		ssize_t n = read(fd, pos, len);
+		if (n <= 0) return 1;
+		pos += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+static void touch(unsigned char *ptr, size_t size) {
+	for (size_t off = 0; off < size; off += TOUCH_STRIDE) ptr[off] = 1;
+	ptr[size - 1] = 1;
+}
+
+static void *worker_run(void *arg) {
+	worker_t *worker = arg;
+	for (size_t head = 0;; head++) {
+		while (atomic_load_explicit(&worker->tail, memory_order_acquire) == head)
+			sched_yield();
+		cmd_t cmd = worker->cmds[head % QUEUE_SIZE];
+		if (cmd.op == CMD_STOP) return NULL;
+		object_t *obj = &g_objects[cmd.obj];
+		while (atomic_load_explicit(&obj->ver, memory_order_acquire) != cmd.ver)
+			sched_yield();
+		if (cmd.op == TRACE_NEW) {
+			if ((obj->ptr = g_allocator->new_fn(cmd.size)))
+				touch(obj->ptr, cmd.size);
+		} else if (cmd.op == TRACE_DEL) {
+			if (obj->ptr) g_allocator->del_fn(obj->ptr);
+			obj->ptr = NULL;
+		} else if (obj->ptr) {
+			unsigned char *ptr = g_allocator->resize_fn(obj->ptr, cmd.size);
+			if (ptr) touch(obj->ptr = ptr, cmd.size);
+		}
+		atomic_store_explicit(&obj->ver, cmd.ver + 1, memory_order_release);
+		atomic_store_explicit(&worker->head, head + 1, memory_order_release);
+	}
+}
+
+static worker_t *worker_get(uint32_t thread) {
+	worker_t **worker = &g_workers[thread % MAX_WORKERS];
+	if (*worker) return *worker;
+	if (!(*worker = map(sizeof(worker_t)))) return NULL;
+	if (pthread_create(&(*worker)->thread, NULL, worker_run, *worker)) {
+		munmap(*worker, sizeof(worker_t));
+		return *worker = NULL;
+	}
+	return *worker;
+}
+
+static int worker_push(uint32_t thread, uint32_t op, uint64_t obj, size_t size) {
+	worker_t *worker = worker_get(thread);
+	if (!worker) return 1;
+	size_t tail = atomic_load_explicit(&worker->tail, memory_order_relaxed);
+	while (
+		tail - atomic_load_explicit(&worker->head, memory_order_acquire) ==
+		QUEUE_SIZE
+	) sched_yield();
+	worker->cmds[tail % QUEUE_SIZE] = (cmd_t){
+		op, (uint32_t)obj, op == CMD_STOP ? 0 : g_vers[obj]++, size
+	};
+	atomic_store_explicit(&worker->tail, tail + 1, memory_order_release);
+	return 0;
+}
+
+static entry_t *table_slot(uint64_t id) {
+	size_t mask = ((size_t)1 << g_table_lg) - 1;
+	size_t i = PROF_HASH(id >> 4, g_table_lg);
+	while (g_table[i].id && g_table[i].id != id) i = (i + 1) & mask;
+	return &g_table[i];
+}
+
+static int table_insert(uint64_t id, uint64_t obj) {
+	if ((g_table_count + 1) * 2 > (size_t)1 << g_table_lg) {
+		entry_t *old = g_table;
+		size_t old_size = (size_t)1 << g_table_lg;
+		if (!(g_table = map(sizeof(entry_t) << (g_table_lg + 1)))) return 1;
+		g_table_lg++;
+		for (size_t i = 0; i < old_size; i++)
+			if (old[i].id) *table_slot(old[i].id) = old[i];
+		munmap(old, sizeof(entry_t) * old_size);
+	}
+	*table_slot(id) = (entry_t){id, obj};
+	g_table_count++;
+	return 0;
+}
+
+static void table_remove(entry_t *entry) {
+	size_t mask = ((size_t)1 << g_table_lg) - 1;
+	size_t i = (size_t)(entry - g_table);
+	for (size_t j = (i + 1) & mask; g_table[j].id; j = (j + 1) & mask) {
+		size_t home = PROF_HASH(g_table[j].id >> 4, g_table_lg);
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			g_table[i] = g_table[j];
+			i = j;
+		}
+	}
+	g_table[i].id = 0;
+	g_table_count--;
+}
+
+static int replay_del(uint32_t thread, entry_t *entry) {
+	uint64_t obj = entry->obj;
+	table_remove(entry);
+	g_live -= g_sizes[obj];
+	g_free_objs[g_free_count++] = (uint32_t)obj;
+	return worker_push(thread, TRACE_DEL, obj, 0);
+}
+
+static int replay_new(uint32_t thread, uint64_t id, size_t size) {
+	uint64_t obj;
+	if (g_free_count) obj = g_free_objs[--g_free_count];
+	else if (g_obj_count < MAX_OBJECTS) obj = g_obj_count++;
+	else return 1;
+	if (table_insert(id, obj)) return 1;
+	g_sizes[obj] = size;
+	g_live += size;
+	return worker_push(thread, TRACE_NEW, obj, size);
+}
+
+static int replay_record(const trace_record_t *rec, result_t *res) {
+	if (!rec->id) {
+		res->mismatched++;
+		return 0;
+	}
+	entry_t *entry = table_slot(rec->id);
+	if (rec->op == TRACE_NEW) {
+		if (entry->id) {
+			res->mismatched++;
+			if (replay_del(rec->thread, entry)) return 1;
+		}
+		return replay_new(rec->thread, rec->id, rec->size);
+	}
+	if (!entry->id) {
+		res->mismatched++;
+		if (rec->op == TRACE_DEL || !rec->new_id) return 0;
+		if (table_slot(rec->new_id)->id) return 0;
+		return replay_new(rec->thread, rec->new_id, rec->size);
+	}
+	if (rec->op == TRACE_DEL) return replay_del(rec->thread, entry);
+	uint64_t obj = entry->obj;
+	if (rec->new_id != rec->id) {
+		table_remove(entry);
+		entry_t *other = table_slot(rec->new_id);
+		if (other->id) {
+			res->mismatched++;
+			if (replay_del(rec->thread, other)) return 1;
+		}
+		if (table_insert(rec->new_id, obj)) return 1;
+	}
+	g_live += rec->size - g_sizes[obj];
+	g_sizes[obj] = rec->size;
+	return worker_push(rec->thread, TRACE_RESIZE, obj, rec->size);
+}
+
+static int pending_read(int fd, bool *eof) {
+	pending_t *p = g_spare;
+	if (p) g_spare = p->next;
+	else if (!(p = map(sizeof(pending_t)))) return 1;
+	if (read_all(fd, &p->chunk, sizeof(trace_chunk_t))) {
+		p->next = g_spare;
+		g_spare = p;
+		*eof = true;
+		return 0;
+	}
+	if (p->chunk.magic != TRACE_MAGIC || p->chunk.len > TRACE_BUF_SIZE)
+		return 1;
+	if (read_all(fd, p->data, p->chunk.len)) return 1;
+	p->pos = p->data;
+	p->end = p->data + p->chunk.len;
+	p->last = (trace_record_t){
+		.seq = p->chunk.seq, .time = p->chunk.time, .thread = p->chunk.thread
+	};
+	if (p->pos == p->end) {
+		p->next = g_spare;
+		g_spare = p;
+		return 0;
+	}
+	if (trace_decode(&p->pos, p->end, &p->last, &p->rec)) return 1;
+	p->next = g_pending;
+	g_pending = p;
+	return 0;
+}
+
+static int pending_next(pending_t **link) {
+	pending_t *p = *link;
+	if (p->pos < p->end) return trace_decode(&p->pos, p->end, &p->last, &p->rec);
+	*link = p->next;
+	p->next = g_spare;
+	g_spare = p;
+	return 0;
+}
+
+static void sample(size_t base, result_t *res) {
+	size_t rss = bench_rss();
+	if (rss > res->peak_rss) res->peak_rss = rss;
+	if (rss > base && rss - base > res->peak_heap) res->peak_heap = rss - base;
+	if (g_live > res->peak_live) res->peak_live = g_live;
+}
+
+static int replay(int fd, result_t *res) {
+	g_objects = map(sizeof(object_t) * MAX_OBJECTS);
+	g_vers = map(sizeof(uint64_t) * MAX_OBJECTS);
+	g_sizes = map(sizeof(size_t) * MAX_OBJECTS);
+	g_free_objs = map(sizeof(uint32_t) * MAX_OBJECTS);
+	g_table_lg = LG_TABLE;
+	g_table = map(sizeof(entry_t) << g_table_lg);
+	if (!g_objects || !g_vers || !g_sizes || !g_free_objs || !g_table) return 1;
+	size_t base = bench_rss();
+	bool eof = false;
+	uint64_t seq = 0;
+	double start = bench_now();
+	for (;;) {
+		pending_t **link = NULL;
+		for (pending_t **p = &g_pending; *p; p = &(*p)->next)
+			if ((*p)->rec.seq == seq) link = p;
+		if (!link && !eof) {
+			if (pending_read(fd, &eof)) return 1;
+			continue;
+		}
+		if (!link) {
+			if (!g_pending) break;
+			pending_t **min = &g_pending;
+			for (pending_t **p = &g_pending; *p; p = &(*p)->next)
+				if ((*p)->rec.seq < (*min)->rec.seq) min = p;
+			seq = (*min)->rec.seq;
+			continue;
+		}
+		do {
+			if (replay_record(&(*link)->rec, res)) return 1;
+			if (++res->ops % SAMPLE_OPS == 0) sample(base, res);
+			seq++;
+			if (pending_next(link)) return 1;
+		} while (*link && (*link)->rec.seq == seq);
+	}
+	for (size_t i = 0; i < MAX_WORKERS; i++) {
+		if (!g_workers[i]) continue;
+		if (worker_push((uint32_t)i, CMD_STOP, 0, 0)) return 1;
+		pthread_join(g_workers[i]->thread, NULL);
+	}
+	res->ns = bench_now() - start;
+	sample(base, res);
+	return 0;
+}
+
+static int run(const char *path, const allocator_t *allocator) {
+	pid_t pid = fork();
+	if (pid < 0) return 1;
+	if (!pid) {
+		result_t res = {0};
+		g_allocator = allocator;
+		int fd = open(path, O_RDONLY);
+		if (fd < 0 || replay(fd, &res)) _exit(1);
+		double frag = res.peak_heap ?
+			1.0 - (double)res.peak_live / (double)res.peak_heap : 0;
+		printf("%-6s %10zu ops %9.1f ms %7.2f Mops/s peak rss %8zu KiB "
+			"fragmentation %5.1f%% %zu mismatched\n",
+			allocator->name, res.ops, res.ns / 1e6,
+			(double)res.ops / (res.ns / 1e9) / 1e6, res.peak_rss / 1024,
+			frag < 0 ? 0 : frag * 100, res.mismatched);
+		fflush(stdout);
+		_exit(0);
+	}
+	int status;
+	if (waitpid(pid, &status, 0) < 0) return 1;
+	return !WIFEXITED(status) || WEXITSTATUS(status);
+}
+
+static int gen_flush(int fd, gen_buf_t *buf) {
+	if (!buf->chunk.len) return 0;
+	if (write_all(fd, &buf->chunk, sizeof(trace_chunk_t) + buf->chunk.len))
+		return 1;
+	buf->chunk.len = 0;
+	return 0;
+}
+
+static int gen_record(int fd, gen_buf_t *buf, trace_record_t *rec) {
+	if (buf->chunk.len + TRACE_RECORD_MAX > TRACE_BUF_SIZE && gen_flush(fd, buf))
+		return 1;
+	if (!buf->chunk.len) {
+		buf->chunk = (trace_chunk_t){
+			TRACE_MAGIC, rec->seq, rec->time, rec->thread, 0
+		};
+		buf->last = (trace_record_t){
+			.seq = rec->seq, .time = rec->time, .thread = rec->thread
+		};
+	}
+	buf->chunk.len +=
+		(uint32_t)trace_encode(buf->data + buf->chunk.len, &buf->last, rec);
+	return 0;
+}
+
+static size_t gen_size(uint64_t *seed) {
+	uint64_t r = bench_rand(seed);
+	if (r % 100 < 70) return 16 + (r >> 8) % 240;
+	if (r % 100 < 95) return 256 + (r >> 8) % (1024 * 8);
+	return 1024 * 8 + (r >> 8) % (1024 * 248);
+}
+
+static int generate(int fd) {
+	static gen_buf_t bufs[GEN_THREADS];
+	static uint64_t ids[GEN_LIVE];
+	size_t live = 0;
+	uint64_t next_id = 0x10000;
+	uint64_t seed = 0x9E3779B97F4A7C15LLU;
+	for (uint64_t seq = 0; seq < GEN_OPS; seq++) {
+		uint64_t r = bench_rand(&seed);
+		size_t target = (seq / GEN_PHASE) % 2 ? GEN_LIVE / 8 : GEN_LIVE;
+		trace_record_t rec = {
+			.seq = seq, .time = seq * 100,
+			.thread = (uint32_t)(r % GEN_THREADS)
+		};
+		bool grow = live < target ? r % 10 < 6 : r % 10 < 4;
+		if (!live || (grow && live < GEN_LIVE)) {
+			rec.op = TRACE_NEW;
+			rec.id = ids[live++] = next_id += 16;
+			rec.size = gen_size(&seed);
+		} else {
+			size_t i = (size_t)(bench_rand(&seed) % live);
+			rec.id = ids[i];
+			if (r % 10 == 9) {
+				rec.op = TRACE_RESIZE;
+				rec.new_id = ids[i] = r & 0x100 ? rec.id : (next_id += 16);
+				rec.size = gen_size(&seed);
+			} else {
+				rec.op = TRACE_DEL;
+				ids[i] = ids[--live];
+			}
+		}
+		if (gen_record(fd, &bufs[rec.thread], &rec)) return 1;
+		if ((seq + 1) % GEN_FLUSH) continue;
+		for (size_t t = 0; t < GEN_THREADS; t++)
+			if (gen_flush(fd, &bufs[t])) return 1;
+	}
+	for (size_t t = 0; t < GEN_THREADS; t++)
+		if (gen_flush(fd, &bufs[t])) return 1;
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	printf("bench_replay\n");
+	fflush(stdout);
+	size_t count = sizeof(g_allocators) / sizeof(*g_allocators);
+	if (argc > 1) {
+		int ret = 0;
+		for (size_t i = 0; i < count; i++)
+			if (argc < 3 || !strcmp(argv[2], g_allocators[i].name))
+				ret |= run(argv[1], &g_allocators[i]);
+		return ret;
+	}
+	char path[] = "/tmp/bench_replay_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) return 1;
+	int ret = generate(fd);
+	close(fd);
+	struct stat st;
+	if (!ret && !stat(path, &st))
+		printf("synthetic trace %zu ops %zu KiB\n",
+			(size_t)GEN_OPS, (size_t)st.st_size / 1024);
+	fflush(stdout);
+	for (size_t i = 0; i < count && !ret; i++)
+		ret = run(path, &g_allocators[i]);
+	unlink(path);
+	return ret;
+}
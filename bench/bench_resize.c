@@ -0,0 +1,75 @@
+/**
+ * \file bench/bench_resize.c
+ * \brief Benchmark for alloc_resize().
+ * \details Compares alloc_resize() against the copying strategy of
+ * allocating a new block, copying the old content over and freeing the
+ * old block, for incrementally growing buffers.
+ * */
+
+#include "bench_utils.h"
+#include <alloc.h>
+#include <string.h>
+
+#define ROUNDS 2000
+#define STEP 16
+#define MAX_SMALL 4000
+#define MIN_LARGE (1024LU * 8)
+#define MAX_LARGE (1024LU * 1024 * 64)
+
+typedef struct result {
+	double ns;
+	size_t ops;
+	size_t moves;
+} result_t;
+
+static int copy_resize(void **ptr, size_t old_size, size_t size) {
+	void *new_ptr = alloc_new(size);
+	if (!new_ptr) return 1;
+	memcpy(new_ptr, *ptr, old_size < size ? old_size : size);
+	alloc_del(*ptr);
+	*ptr = new_ptr;
+	return 0;
+}
+
+static int grow(result_t *res, int copy, size_t from, size_t to, size_t rounds,
+		size_t (*next)(size_t)) {
+	double start = bench_now();
+	for (size_t r = 0; r < rounds; r++) {
+		void *ptr = alloc_new(from);
+		if (!ptr) return 1;
+		memset(ptr, 1, from);
+		for (size_t size = from; size < to; size = next(size)) {
+			void *old = ptr;
+			if (copy ? copy_resize(&ptr, size, next(size)) :
+				alloc_resize(&ptr, next(size))) return 1;
+			((unsigned char*)ptr)[next(size) - 1] = 1;
+			res->moves += ptr != old;
+			res->ops++;
+		}
+		alloc_del(ptr);
+	}
+	res->ns = bench_now() - start;
+	return 0;
+}
+
+static size_t add_step(size_t size) { return size + STEP; }
+static size_t double_size(size_t size) { return size * 2; }
+
+static void print(const char *name, result_t *res) {
+	printf("%-28s %10zu resizes %10zu moves %10.1f ns/resize\n",
+		name, res->ops, res->moves, res->ns / (double)res->ops);
+}
+
+int main(void) {
+	result_t res[4] = {0};
+	if (grow(&res[0], 1, STEP, MAX_SMALL, ROUNDS, add_step)) return 1;
+	if (grow(&res[1], 0, STEP, MAX_SMALL, ROUNDS, add_step)) return 1;
+	if (grow(&res[2], 1, MIN_LARGE, MAX_LARGE, ROUNDS / 100, double_size)) return 1;
+	if (grow(&res[3], 0, MIN_LARGE, MAX_LARGE, ROUNDS / 100, double_size)) return 1;
+	printf("bench_resize\n");
+	print("small +16B copy", &res[0]);
+	print("small +16B alloc_resize", &res[1]);
+	print("large x2 copy", &res[2]);
+	print("large x2 alloc_resize", &res[3]);
+	return 0;
+}
@@ -0,0 +1,57 @@
+/**
+ * \file bench/bench_sized.c
+ * \brief Benchmark for alloc_del_sized().
+ * \details Compares freeing cold small blocks with alloc_del() against
+ * alloc_del_sized(), which skips the checks that tell the kinds of blocks
+ * apart and computes the size class from the size instead of reading it
+ * from the slab. The blocks are spread
+ * over many slabs and freed in random order, so their metadata isn't in
+ * the cache.
+ * */
+
+#include "bench_utils.h"
+#include <alloc.h>
+#include <stdlib.h>
+
+#define COUNT (1024LU * 1024)
+#define ROUNDS 8
+
+static void *g_ptrs[COUNT];
+
+static double run(int sized, size_t size, uint64_t *seed) {
+	for (size_t i = 0; i < COUNT; i++)
+		if (!(g_ptrs[i] = alloc_new(size))) return -1;
+	for (size_t i = COUNT - 1; i > 0; i--) {
+		size_t j = (size_t)(bench_rand(seed) % (i + 1));
+		void *tmp = g_ptrs[i];
+		g_ptrs[i] = g_ptrs[j];
+		g_ptrs[j] = tmp;
+	}
+	double start = bench_now();
+	if (sized) {
+		for (size_t i = 0; i < COUNT; i++) alloc_del_sized(g_ptrs[i], size);
+	} else {
+		for (size_t i = 0; i < COUNT; i++) alloc_del(g_ptrs[i]);
+	}
+	return (bench_now() - start) / COUNT;
+}
+
+int main(void) {
+	size_t sizes[] = {16, 64, 256};
+	uint64_t seed = 1;
+	printf("bench_sized\n");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		double del_ns = 0;
+		double sized_ns = 0;
+		for (size_t r = 0; r < ROUNDS; r++) {
+			double del = run(0, sizes[i], &seed);
+			double sized = run(1, sizes[i], &seed);
+			if (del < 0 || sized < 0) return 1;
+			del_ns += del / ROUNDS;
+			sized_ns += sized / ROUNDS;
+		}
+		printf("%4zuB alloc_del %6.2f ns alloc_del_sized %6.2f ns per cold free\n",
+			sizes[i], del_ns, sized_ns);
+	}
+	return 0;
+}
@@ -0,0 +1,298 @@
+/**
+ * \file bench/bench_suite.c
+ * \brief Benchmark suite comparing the alloc library against glibc malloc.
+ * \details Every workload runs in its own child process, once on top of
+ * the alloc library and once on top of glibc malloc, and reports the
+ * throughput, the latency percentiles of single operations and the peak
+ * resident memory of the workload. Latencies include the cost of reading
+ * the clock, which is the same for both allocators.
+ * */
+
+#include "bench_utils.h"
+#include <alloc.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define MAX_SAMPLES (1LU << 20)
+#define BATCH 64
+#define CLASS_OPS (1LU << 21)
+#define CHURN_SLOTS 10000
+#define CHURN_OPS (1LU << 21)
+#define MAX_CHURN_SIZE 4096
+#define QUEUE_SIZE 4096
+#define QUEUE_OPS (1LU << 20)
+#define RESIZE_ROUNDS 200
+#define LARGE_OPS (1LU << 14)
+#define ALIGNED_OPS (1LU << 16)
+#define MAX_ALIGNED_SIZE (1024LU * 64)
+#define TIMED(rec, expr) do {\
+	double t0 = bench_now();\
+	expr;\
+	record((rec), bench_now() - t0);\
+} while (0)
+
+/** Allocator struct containing the entry points of an allocator. */
+typedef struct allocator {
+	const char *name;
+	void *(*new)(size_t size);
+	void *(*new_aligned)(size_t size, size_t alignment);
+	void (*del)(void *ptr);
+	int (*resize)(void **ptr, size_t size);
+} allocator_t;
+
+/** Recorder struct containing a reservoir of latency samples. */
+typedef struct recorder {
+	double *samples;
+	size_t count;
+	size_t ops;
+	uint64_t state;
+} recorder_t;
+
+/** Workload struct containing a named benchmark and its parameter. */
+typedef struct workload {
+	const char *name;
+	int (*run)(const allocator_t *a, recorder_t *rec, size_t arg);
+	size_t arg;
+} workload_t;
+
+static int glibc_resize(void **ptr, size_t size) {
+	void *new_ptr = realloc(*ptr, size);
+	if (!new_ptr) return 1;
+	*ptr = new_ptr;
+	return 0;
+}
+
+static void *glibc_new_aligned(size_t size, size_t alignment) {
+	return aligned_alloc(alignment, size);
+}
+
+static const allocator_t g_allocators[] = {
+	{"alloc", alloc_new, alloc_new_aligned, alloc_del, alloc_resize},
+	{"glibc", malloc, glibc_new_aligned, free, glibc_resize},
+};
+
+static int recorder_init(recorder_t *rec) {
+	rec->samples = mmap(NULL, MAX_SAMPLES * sizeof(double),
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (rec->samples == MAP_FAILED) return 1;
+	memset(rec->samples, 0, MAX_SAMPLES * sizeof(double));
+	rec->count = 0;
+	rec->ops = 0;
+	rec->state = 88172645463325252LU;
+	return 0;
+}
+
+static void record(recorder_t *rec, double ns) {
+	rec->ops++;
+	if (rec->count < MAX_SAMPLES) {
+		rec->samples[rec->count++] = ns;
+	} else {
+		uint64_t i = bench_rand(&rec->state) % rec->ops;
+		if (i < MAX_SAMPLES) rec->samples[i] = ns;
+	}
+}
+
+static void recorder_merge(recorder_t *dst, recorder_t *src) {
+	for (size_t i = 0; i < src->count; i++) record(dst, src->samples[i]);
+	dst->ops += src->ops - src->count;
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(recorder_t *rec, double p) {
+	if (!rec->count) return 0;
+	return rec->samples[(size_t)((double)(rec->count - 1) * p)];
+}
+
+/** Allocates and frees batches of objects of a single size. */
+static int run_class(const allocator_t *a, recorder_t *rec, size_t size) {
+	void *objs[BATCH];
+	for (size_t r = 0; r < CLASS_OPS / BATCH / 2; r++) {
+		for (size_t i = 0; i < BATCH; i++) {
+			TIMED(rec, objs[i] = a->new(size));
+			if (!objs[i]) return 1;
+			*(char*)objs[i] = 1;
+		}
+		for (size_t i = 0; i < BATCH; i++) TIMED(rec, a->del(objs[i]));
+	}
+	return 0;
+}
+
+/** Frees random slots and refills them with random sizes. */
+static int run_churn(const allocator_t *a, recorder_t *rec, size_t max_size) {
+	static void *slots[CHURN_SLOTS];
+	uint64_t state = 2463534242LU;
+	for (size_t i = 0; i < CHURN_OPS / 2; i++) {
+		size_t slot = (size_t)(bench_rand(&state) % CHURN_SLOTS);
+		size_t size = 1 + (size_t)(bench_rand(&state) % max_size);
+		if (slots[slot]) TIMED(rec, a->del(slots[slot]));
+		TIMED(rec, slots[slot] = a->new(size));
+		if (!slots[slot]) return 1;
+		memset(slots[slot], 1, size < 64 ? size : 64);
+	}
+	for (size_t i = 0; i < CHURN_SLOTS; i++) if (slots[i]) a->del(slots[i]);
+	return 0;
+}
+
+/** Queue struct containing a single-producer single-consumer ring. */
+typedef struct queue {
+	void *slots[QUEUE_SIZE];
+	_Atomic size_t head;
+	_Atomic size_t tail;
+	const allocator_t *a;
+	recorder_t rec;
+	size_t size;
+	int failed;
+} queue_t;
+
+static void *consumer(void *arg) {
+	queue_t *q = arg;
+	for (size_t i = 0; i < QUEUE_OPS; i++) {
+		size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+		while (atomic_load_explicit(&q->tail, memory_order_acquire) == head)
+			sched_yield();
+		void *obj = q->slots[head % QUEUE_SIZE];
+		atomic_store_explicit(&q->head, head + 1, memory_order_release);
+		TIMED(&q->rec, q->a->del(obj));
+	}
+	return NULL;
+}
+
+/** Allocates objects on one thread and frees them on another. */
+static int run_queue(const allocator_t *a, recorder_t *rec, size_t size) {
+	static queue_t q;
+	q.a = a;
+	q.size = size;
+	if (recorder_init(&q.rec)) return 1;
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, consumer, &q)) return 1;
+	for (size_t i = 0; i < QUEUE_OPS; i++) {
+		void *obj;
+		TIMED(rec, obj = a->new(size));
+		if (!obj) return 1;
+		*(char*)obj = 1;
+		size_t tail = atomic_load_explicit(&q.tail, memory_order_relaxed);
+		while (tail - atomic_load_explicit(&q.head, memory_order_acquire) == QUEUE_SIZE)
+			sched_yield();
+		q.slots[tail % QUEUE_SIZE] = obj;
+		atomic_store_explicit(&q.tail, tail + 1, memory_order_release);
+	}
+	pthread_join(thread, NULL);
+	recorder_merge(rec, &q.rec);
+	return 0;
+}
+
+/** Grows buffers by a fixed step and by doubling. */
+static int run_resize(const allocator_t *a, recorder_t *rec, size_t step) {
+	for (size_t r = 0; r < RESIZE_ROUNDS; r++) {
+		void *ptr = a->new(step);
+		if (!ptr) return 1;
+		for (size_t size = step; size < 8192; size += step) {
+			int ret;
+			TIMED(rec, ret = a->resize(&ptr, size + step));
+			if (ret) return 1;
+			((char*)ptr)[size + step - 1] = 1;
+		}
+		for (size_t size = 8192; size < (1LU << 20); size *= 2) {
+			int ret;
+			TIMED(rec, ret = a->resize(&ptr, size * 2));
+			if (ret) return 1;
+			((char*)ptr)[size * 2 - 1] = 1;
+		}
+		a->del(ptr);
+	}
+	return 0;
+}
+
+/** Allocates and frees blocks larger than an arena. */
+static int run_large(const allocator_t *a, recorder_t *rec, size_t max_size) {
+	uint64_t state = 2463534242LU;
+	for (size_t i = 0; i < LARGE_OPS; i++) {
+		size_t size = max_size / 16 + (size_t)(bench_rand(&state) % max_size);
+		char *ptr;
+		TIMED(rec, ptr = a->new(size));
+		if (!ptr) return 1;
+		ptr[0] = 1;
+		ptr[size - 1] = 1;
+		TIMED(rec, a->del(ptr));
+	}
+	return 0;
+}
+
+/** Allocates and frees medium blocks aligned to a power of two. */
+static int run_aligned(const allocator_t *a, recorder_t *rec, size_t alignment) {
+	void *objs[BATCH];
+	uint64_t state = 2463534242LU;
+	for (size_t r = 0; r < ALIGNED_OPS / BATCH / 2; r++) {
+		for (size_t i = 0; i < BATCH; i++) {
+			size_t size = 1024 + (size_t)(bench_rand(&state) % MAX_ALIGNED_SIZE);
+			TIMED(rec, objs[i] = a->new_aligned(size, alignment));
+			if (!objs[i] || (uintptr_t)objs[i] % alignment) return 1;
+			((char*)objs[i])[size - 1] = 1;
+		}
+		for (size_t i = 0; i < BATCH; i++) TIMED(rec, a->del(objs[i]));
+	}
+	return 0;
+}
+
+static const workload_t g_workloads[] = {
+	{"class 16B", run_class, 16},
+	{"class 64B", run_class, 64},
+	{"class 256B", run_class, 256},
+	{"class 1KiB", run_class, 1024},
+	{"class 4000B", run_class, 4000},
+	{"churn 1-4KiB", run_churn, MAX_CHURN_SIZE},
+	{"prod/cons 64B", run_queue, 64},
+	{"prod/cons 1KiB", run_queue, 1024},
+	{"resize +16B", run_resize, 16},
+	{"large 64KiB-1MiB", run_large, 1LU << 20},
+	{"aligned 4KiB", run_aligned, 4096},
+	{"aligned 64KiB", run_aligned, 1LU << 16},
+};
+
+static int run(const workload_t *w, const allocator_t *a) {
+	recorder_t rec;
+	if (recorder_init(&rec)) return 1;
+	size_t base = bench_rss();
+	double start = bench_now();
+	if (w->run(a, &rec, w->arg)) return 1;
+	double secs = (bench_now() - start) / 1e9;
+	size_t peak = bench_peak_rss();
+	qsort(rec.samples, rec.count, sizeof(double), cmp_double);
+	printf("%-18s %-6s %8.2f Mops/s p50 %6.0f ns p99 %7.0f ns p999 %8.0f ns"
+		" peak %8zu KiB\n",
+		w->name, a->name, (double)rec.ops / secs / 1e6,
+		percentile(&rec, 0.5), percentile(&rec, 0.99),
+		percentile(&rec, 0.999), (peak > base ? peak - base : 0) / 1024);
+	fflush(stdout);
+	return 0;
+}
+
+int main(void) {
+	printf("bench_suite\n");
+	fflush(stdout);
+	int ret = 0;
+	for (size_t w = 0; w < sizeof(g_workloads) / sizeof(*g_workloads); w++) {
+		for (size_t a = 0; a < sizeof(g_allocators) / sizeof(*g_allocators); a++) {
+			pid_t pid = fork();
+			if (pid < 0) return 1;
+			if (!pid) _exit(run(&g_workloads[w], &g_allocators[a]));
+			int status;
+			if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+				WEXITSTATUS(status)) {
+				fprintf(stderr, "%s %s failed\n",
+					g_workloads[w].name, g_allocators[a].name);
+				ret = 1;
+			}
+		}
+	}
+	return ret;
+}
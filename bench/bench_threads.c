@@ -0,0 +1,75 @@
+/**
+ * \file bench/bench_threads.c
+ * \brief Benchmark for multi-threaded scaling.
+ * \details Runs the same small-object workloads on 1 to 64 threads:
+ * local churn, where every thread frees its own objects, and handoff,
+ * where every thread frees the objects its neighbour allocated in the
+ * previous round.
+ * */
+
+#include "bench_utils.h"
+#include <alloc.h>
+#include <pthread.h>
+
+#define MAX_THREADS 64
+#define BATCH 1024
+#define OPS (1024LU * 1024 * 4)
+
+typedef struct worker {
+	pthread_t thread;
+	size_t id;
+	size_t rounds;
+	void *objs[BATCH];
+} worker_t;
+
+static worker_t g_workers[MAX_THREADS];
+static size_t g_num_threads;
+static pthread_barrier_t g_barrier;
+
+static size_t obj_size(size_t i) {
+	return 16 + (i * 7919) % 496;
+}
+
+static void *churn(void *arg) {
+	worker_t *w = arg;
+	for (size_t r = 0; r < w->rounds; r++) {
+		for (size_t i = 0; i < BATCH; i++) w->objs[i] = alloc_new(obj_size(i));
+		for (size_t i = 0; i < BATCH; i++) alloc_del(w->objs[i]);
+	}
+	return NULL;
+}
+
+static void *handoff(void *arg) {
+	worker_t *w = arg;
+	worker_t *next = &g_workers[(w->id + 1) % g_num_threads];
+	for (size_t r = 0; r < w->rounds; r++) {
+		for (size_t i = 0; i < BATCH; i++) w->objs[i] = alloc_new(obj_size(i));
+		pthread_barrier_wait(&g_barrier);
+		for (size_t i = 0; i < BATCH; i++) alloc_del(next->objs[i]);
+		pthread_barrier_wait(&g_barrier);
+	}
+	return NULL;
+}
+
+static void run(const char *name, void *(*fn)(void*), size_t threads) {
+	g_num_threads = threads;
+	pthread_barrier_init(&g_barrier, NULL, (unsigned)threads);
+	double start = bench_now();
+	for (size_t t = 0; t < threads; t++) {
+		g_workers[t].id = t;
+		g_workers[t].rounds = OPS / BATCH / 2 / threads;
+		pthread_create(&g_workers[t].thread, NULL, fn, &g_workers[t]);
+	}
+	for (size_t t = 0; t < threads; t++) pthread_join(g_workers[t].thread, NULL);
+	double secs = (bench_now() - start) / 1e9;
+	pthread_barrier_destroy(&g_barrier);
+	printf("%-8s %3zu threads %8.2f Mops/s %8zu KiB rss\n",
+		name, threads, (double)OPS / secs / 1e6, bench_rss() / 1024);
+}
+
+int main(void) {
+	printf("bench_threads\n");
+	for (size_t t = 1; t <= MAX_THREADS; t *= 2) run("churn", churn, t);
+	for (size_t t = 1; t <= MAX_THREADS; t *= 2) run("handoff", handoff, t);
+	return 0;
+}
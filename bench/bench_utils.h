@@ -0,0 +1,52 @@
+/**
+ * \file bench/bench_utils.h
+ * \brief Helpers shared by the benchmarks.
+ * \details This file contains the definitions of the timing, memory
+ * measurement and random number helpers used by the benchmarks.
+ * */
+
+#ifndef BENCH_UTILS_H
+#define BENCH_UTILS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+/** Returns a monotonic timestamp in nanoseconds. */
+static inline double bench_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/** Returns the resident set size of the process in bytes. */
+static inline size_t bench_rss() {
+	size_t pages = 0;
+	size_t resident = 0;
+	FILE *file = fopen("/proc/self/statm", "r");
+	if (!file) return 0;
+	if (fscanf(file, "%zu %zu", &pages, &resident) != 2) resident = 0;
+	fclose(file);
+	return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/** Returns the peak resident set size of the process in bytes. */
+static inline size_t bench_peak_rss() {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage)) return 0;
+	return (size_t)usage.ru_maxrss * 1024;
+}
+
+/** Returns the next number of a xorshift random number generator.
+ * \param state The state of the generator. It must not be 0. */
+static inline uint64_t bench_rand(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+#endif
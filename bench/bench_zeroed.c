@@ -0,0 +1,57 @@
+/**
+ * \file bench/bench_zeroed.c
+ * \brief Benchmark for alloc_new_zeroed().
+ * \details Compares allocating large zero-filled buffers with
+ * alloc_new_zeroed() against alloc_new() followed by memset(). Only one
+ * byte of every buffer is written, like a sparse table would be, so the
+ * cost of faulting in the pages shows in both the time and the RSS.
+ * */
+
+#include "bench_utils.h"
+#include <alloc.h>
+#include <string.h>
+
+#define ROUNDS 64
+#define LIVE 8
+
+typedef struct result {
+	double ns;
+	size_t rss;
+} result_t;
+
+static int run(result_t *res, int zeroed, size_t size) {
+	unsigned char *bufs[LIVE];
+	size_t base = bench_rss();
+	double start = bench_now();
+	for (size_t r = 0; r < ROUNDS; r++) {
+		for (size_t i = 0; i < LIVE; i++) {
+			if (zeroed) {
+				if (!(bufs[i] = alloc_new_zeroed(size))) return 1;
+			} else {
+				if (!(bufs[i] = alloc_new(size))) return 1;
+				memset(bufs[i], 0, size);
+			}
+			bufs[i][(r * 4099) % size] = 1;
+		}
+		size_t rss = bench_rss();
+		if (rss > base && rss - base > res->rss) res->rss = rss - base;
+		for (size_t i = 0; i < LIVE; i++) alloc_del(bufs[i]);
+	}
+	res->ns = (bench_now() - start) / (ROUNDS * LIVE);
+	return 0;
+}
+
+int main(void) {
+	size_t sizes[] = {1024LU * 16, 1024LU * 256, 1024LU * 1024 * 4};
+	printf("bench_zeroed\n");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		result_t memset_res = {0};
+		result_t zeroed_res = {0};
+		if (run(&memset_res, 0, sizes[i])) return 1;
+		if (run(&zeroed_res, 1, sizes[i])) return 1;
+		printf("%6zuKiB new+memset %10.0f ns %8zu KiB rss zeroed %10.0f ns %8zu KiB rss\n",
+			sizes[i] / 1024, memset_res.ns, memset_res.rss / 1024,
+			zeroed_res.ns, zeroed_res.rss / 1024);
+	}
+	return 0;
+}
@@ -32,7 +32,146 @@ SOFTWARE.
 #ifndef ALLOC_H
 #define ALLOC_H
 
+#include <stdalign.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/** Largest size served by alloc_new_fast() without calling the library. */
+#define ALLOC_FAST_MAX_SIZE (size_t)512
+
+/** Log2 of the upper bound of the size class of a size served by
+ * alloc_new_fast(). */
+#define ALLOC_FAST_LG(size)\
+	(size_t)(sizeof(unsigned long) * 8 - 1 - (size_t)__builtin_clzl(\
+		(unsigned long)((size) - 1) | (alignof(max_align_t) * 4)))
+
+/** Index of the size class of a size served by alloc_new_fast(). Each
+ * power of two is split into four classes, like the size classes of the
+ * library. */
+#define ALLOC_FAST_CLASS(size)\
+	(size_t)(((ALLOC_FAST_LG((size)) -\
+		(size_t)__builtin_ctzl(alignof(max_align_t)) - 2) << 2) +\
+		(((size) - 1) >> (ALLOC_FAST_LG((size)) - 2)))
+
+/** Number of size classes served by alloc_new_fast(). */
+#define ALLOC_FAST_CLASSES\
+	(size_t)(ALLOC_FAST_CLASS(ALLOC_FAST_MAX_SIZE) + 1)
+
+/** Stats struct containing a snapshot of the allocator counters. */
+typedef struct alloc_stats {
+	/** Bytes handed out in live blocks. */
+	size_t live_bytes;
+	/** Bytes mapped for arena pages, slab pages, mmap() blocks and heaps. */
+	size_t mapped_bytes;
+	/** Bytes spent on the headers of live blocks. */
+	size_t header_bytes;
+	/** Share of the mapped bytes not handed out in live blocks. */
+	double fragmentation;
+	/** Number of arena and page run pages in use. */
+	size_t arena_count;
+	/** Number of slab pages in use. */
+	size_t slab_count;
+	/** Number of live blocks allocated with mmap(). */
+	size_t mmap_count;
+	/** Number of thread heaps, including the parked heaps of exited threads. */
+	size_t thread_count;
+	/** Number of allocations served by the thread cache. */
+	size_t fast_path;
+	/** Number of allocations served by slabs, arenas or mmap(). */
+	size_t slow_path;
+	/** Number of calls to mmap(). */
+	size_t mmap_calls;
+	/** Number of calls to munmap(). */
+	size_t munmap_calls;
+	/** Number of calls to mremap(). */
+	size_t mremap_calls;
+	/** Number of calls to madvise(). */
+	size_t madvise_calls;
+	/** Bytes of released arena pages not yet returned to the kernel. */
+	size_t dirty_bytes;
+} alloc_stats_t;
+
+/** Class stats struct containing the counters of a size class. */
+typedef struct alloc_class_stats {
+	/** Size of the blocks of the class. */
+	size_t size;
+	/** Number of live blocks. */
+	size_t count;
+	/** Number of blocks allocated since the start of the program. */
+	size_t total;
+	/** Number of free blocks in the central free list. */
+	size_t cached;
+} alloc_class_stats_t;
+
+/** Config struct containing the policy for returning released pages to the
+ * kernel. It can also be set with the ALLOC_DECAY_MS, ALLOC_MAX_DIRTY and
+ * ALLOC_BACKGROUND environment variables. */
+typedef struct alloc_config {
+	/** Milliseconds a released page is kept before it's purged with
+	 * madvise(). 0 purges pages as soon as they are released. */
+	size_t decay_ms;
+	/** Bytes of released pages a thread may keep before the oldest ones are
+	 * purged regardless of their age. */
+	size_t max_dirty_bytes;
+	/** Whether a background thread purges the decayed pages. Otherwise they
+	 * are purged by the allocating threads every few slow path allocations. */
+	bool background;
+} alloc_config_t;
+
+/** Enum containing the output formats of the heap profile. */
+typedef enum alloc_prof_format {
+	/** Heap profile of gperftools understood by pprof, with the live and the
+	 * allocated objects and bytes of every call site. */
+	ALLOC_PROF_PPROF,
+	/** Folded stacks of the live bytes of every call site. */
+	ALLOC_PROF_FOLDED,
+	/** Folded stacks of the bytes allocated per second by every call site. */
+	ALLOC_PROF_FOLDED_RATE,
+} alloc_prof_format_t;
+
+/** Cache stats struct containing the counters of an object cache. */
+typedef struct alloc_cache_stats {
+	/** Size of the objects. */
+	size_t size;
+	/** Number of objects handed out and not put back. */
+	size_t live;
+	/** Number of constructed objects on the free list. */
+	size_t free;
+	/** Number of objects handed out since the cache was created. */
+	size_t gets;
+	/** Number of objects handed out from the free list. */
+	size_t hits;
+	/** Number of calls to the constructor. */
+	size_t ctor_calls;
+} alloc_cache_stats_t;
+
+/** Fast path struct containing the free blocks and the budget of
+ * alloc_new_fast() of a thread. It belongs to the thread that got it from
+ * alloc_fast_get() and its fields are only changed by alloc_new_fast() and
+ * the library. */
+typedef struct alloc_fast {
+	/** Bytes alloc_new_fast() may still hand out before it calls
+	 * alloc_fast_refill(). */
+	int64_t budget;
+	/** Bytes granted with the last budget. */
+	int64_t granted;
+	/** First free block of each size class. The blocks are linked through
+	 * their first word. */
+	void *heads[ALLOC_FAST_CLASSES];
+	/** Number of blocks handed out since they were last counted in the
+	 * stats, for each size class. */
+	size_t counts[ALLOC_FAST_CLASSES];
+} alloc_fast_t;
+
+/** Region struct containing the state of a bump allocator.
+ * Forward declaration. */
+typedef struct alloc_region alloc_region_t;
+
+/** Cache struct containing the constructed objects of a type.
+ * Forward declaration. */
+typedef struct alloc_cache alloc_cache_t;
 
 /** Allocates a new block of memory.
  * \param size The size of the memory to be allocated. 
@@ -40,12 +179,60 @@ SOFTWARE.
  * It sets errno on failure. */
 void *alloc_new(size_t size);
 
-/** Deallocates a block of memory.
+/** Allocates a new block of memory aligned to a power of two.
+ * The block is freed with alloc_del(). Once it's resized with
+ * alloc_resize() it's only guaranteed to be aligned to alignof(max_align_t).
+ * \param size The size of the memory to be allocated.
+ * \param alignment The alignment of the memory. It must be a power of two.
+ * \return A pointer to the newly allocated memory or NULL on failure.
+ * It sets errno on failure. */
+void *alloc_new_aligned(size_t size, size_t alignment);
+
+/** Allocates a new block of zero-filled memory. Blocks the kernel has just
+ * zero-filled, like fresh mmap() mappings and unused arena space, are
+ * handed out without being cleared again, so their pages aren't touched.
+ * \param size The size of the memory to be allocated.
+ * \return A pointer to the newly allocated memory or NULL on failure.
+ * It sets errno on failure. */
+void *alloc_new_zeroed(size_t size);
+
+/** Deallocates a block of memory. Freeing a block twice is an error. Small
+ * blocks have no header, so outside of debug mode their double frees are
+ * only caught when nothing else of their size was freed in between.
  * \param ptr Pointer to the memory to be deallocated.
  * It sets errno on failure. */
 void alloc_del(void *ptr);
 
-/** Allocates a new block and copies the old content over.
+/** Deallocates a block of memory whose size is known. The size must be the
+ * size the block was allocated or last resized with. Small blocks skip the
+ * checks alloc_del() needs to tell the kinds of blocks apart and go
+ * straight to the thread cache of the size class of their size, without
+ * reading their slab. Other blocks are freed like with alloc_del(). Blocks
+ * allocated with alloc_new_aligned() must be freed with alloc_del(). A
+ * wrong size is only caught in debug mode, where it must match the block
+ * exactly.
+ * \param ptr Pointer to the memory to be deallocated.
+ * \param size The size of the memory to be deallocated.
+ * It sets errno on failure. */
+void alloc_del_sized(void *ptr, size_t size);
+
+/** Allocates blocks of memory of the same size at once.
+ * \param size The size of each block.
+ * \param count The number of blocks to be allocated.
+ * \param ptrs Pointer to the array the blocks are written to.
+ * \return 0 on success and 1 on failure. No blocks are allocated on failure.
+ * It sets errno on failure. */
+int alloc_new_batch(size_t size, size_t count, void **ptrs);
+
+/** Deallocates blocks of memory at once.
+ * \param ptrs Pointer to the array of blocks to be deallocated.
+ * \param count The number of blocks.
+ * It sets errno on failure. */
+void alloc_del_batch(void **ptrs, size_t count);
+
+/** Resizes a block of memory.
+ * The block is resized in place when possible. Otherwise a new block is
+ * allocated, the old content is copied over and the old block is freed.
  * \param ptr Pointer to the pointer that's associated with the memory block
  * to be resized.
  * \param size The size of the new block.
@@ -53,4 +240,180 @@ void alloc_del(void *ptr);
  * It sets errno on failure. */
 int alloc_resize(void **ptr, size_t size);
 
+/** Collects the counters of every thread.
+ * \param stats Pointer to the stats struct to be filled.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_stats(alloc_stats_t *stats);
+
+/** Collects the counters of the calling thread. Blocks freed by other
+ * threads are counted as live by the thread that allocated them and
+ * subtracted from the thread that freed them, so the live, mapped and
+ * header bytes and the mmap() count of a thread that frees more than it
+ * allocates wrap around below 0. They're meant to be read as signed values,
+ * like (ptrdiff_t)stats->live_bytes. The counters of alloc_stats() are the
+ * sums of every thread and don't wrap.
+ * \param stats Pointer to the stats struct to be filled.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_stats_thread(alloc_stats_t *stats);
+
+/** Collects the counters of a size class of every thread.
+ * \param index The index of the size class, starting from 0.
+ * \param stats Pointer to the class stats struct to be filled.
+ * \return 0 on success and 1 on failure or if there are no more classes.
+ * It sets errno on failure. */
+int alloc_stats_class(size_t index, alloc_class_stats_t *stats);
+
+/** Sets the policy for returning released pages to the kernel.
+ * \param config Pointer to the config struct to be applied.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_config(const alloc_config_t *config);
+
+/** Gets the policy for returning released pages to the kernel.
+ * \param config Pointer to the config struct to be filled.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_config_get(alloc_config_t *config);
+
+/** Returns the released pages of every thread and the cached mappings and
+ * empty slabs of the calling thread to the kernel. Blocks freed into the
+ * heaps of exited threads are released first.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_purge();
+
+/** Sets the mean number of bytes between two sampled allocations.
+ * Sampled allocations record the backtrace of their call site. It can also
+ * be set with the ALLOC_PROF_RATE environment variable.
+ * \param rate The mean sampling interval in bytes. 0 disables sampling.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_prof_enable(size_t rate);
+
+/** Writes the heap profile collected from the sampled allocations.
+ * \param file The file to write the profile to.
+ * \param format The format of the profile.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_prof_dump(FILE *file, alloc_prof_format_t format);
+
+/** Creates a region whose blocks are released together.
+ * A region may only be used by the thread that created it.
+ * \return A pointer to the new region or NULL on failure.
+ * It sets errno on failure. */
+alloc_region_t *alloc_region_create();
+
+/** Allocates a new block of memory in a region. The block has no header
+ * and can't be freed or resized on its own.
+ * \param region The region to allocate from.
+ * \param size The size of the memory to be allocated.
+ * \return A pointer to the newly allocated memory or NULL on failure.
+ * It sets errno on failure. */
+void *alloc_region_new(alloc_region_t *region, size_t size);
+
+/** Releases every block of a region at once. The pages of the region are
+ * kept for the blocks allocated after the reset.
+ * \param region The region to be reset.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_region_reset(alloc_region_t *region);
+
+/** Releases every block of a region and the region itself.
+ * \param region The region to be destroyed.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_region_destroy(alloc_region_t *region);
+
+/** Creates a cache of objects of the same type. Objects put back into the
+ * cache stay constructed, so the constructor only runs when the cache has
+ * no free object and the destructor only when the cache is destroyed.
+ * A cache may be shared by threads.
+ * \param size The size of the objects.
+ * \param align The alignment of the objects. It must be a power of two or 0
+ * for the alignment of alloc_new().
+ * \param ctor The function that initializes a new object or NULL.
+ * \param dtor The function that finalizes an object before it's freed or
+ * NULL.
+ * \return A pointer to the new cache or NULL on failure.
+ * It sets errno on failure. */
+alloc_cache_t *alloc_cache_create(size_t size, size_t align,
+	void (*ctor)(void*), void (*dtor)(void*));
+
+/** Takes an object from a cache, constructing a new one if the cache has no
+ * free object.
+ * \param cache The cache to take the object from.
+ * \return A pointer to the object or NULL on failure.
+ * It sets errno on failure. */
+void *alloc_cache_get(alloc_cache_t *cache);
+
+/** Puts an object back into the cache it was taken from. The object must
+ * be left in its constructed state.
+ * \param cache The cache the object was taken from.
+ * \param obj Pointer to the object.
+ * It sets errno on failure. */
+void alloc_cache_put(alloc_cache_t *cache, void *obj);
+
+/** Collects the counters of a cache.
+ * \param cache The cache whose counters are to be collected.
+ * \param stats Pointer to the cache stats struct to be filled.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_cache_stats(alloc_cache_t *cache, alloc_cache_stats_t *stats);
+
+/** Destroys the free objects of a cache and the cache itself. Objects
+ * still handed out stay valid and are freed with alloc_del().
+ * \param cache The cache to be destroyed.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_cache_destroy(alloc_cache_t *cache);
+
+/** Gets the fast path state of the calling thread for alloc_new_fast().
+ * The pointer stays valid until the thread exits and must not be used by
+ * other threads.
+ * \return A pointer to the fast path state or NULL on failure.
+ * It sets errno on failure. */
+alloc_fast_t *alloc_fast_get();
+
+/** Allocates a new block of memory for alloc_new_fast() when it can't take
+ * one from its free blocks. It counts the blocks handed out since the last
+ * call in the stats and in the profiler, releases the blocks other threads
+ * freed to the calling thread, purges decayed pages every few calls, refills
+ * the free blocks of the size class and grants a new budget.
+ * \param fast The fast path state of the calling thread.
+ * \param size The size of the memory to be allocated.
+ * \return A pointer to the newly allocated memory or NULL on failure.
+ * It sets errno on failure. */
+void *alloc_fast_refill(alloc_fast_t *fast, size_t size);
+
+/** Allocates a new block of memory inline, without calling the library.
+ * Blocks up to ALLOC_FAST_MAX_SIZE are taken from the free blocks of the
+ * thread until its budget of at most 64 KiB is used up. Bigger sizes, an
+ * empty size class and a used up budget call alloc_fast_refill(), so the
+ * housekeeping of alloc_new() runs at least once per budget. The budget is
+ * 0 while the profiler is about to sample or the debug mode or the trace is
+ * on, so every allocation goes through the library then. The blocks are
+ * freed with alloc_del(). They're counted in the stats when the thread
+ * next calls alloc_fast_refill() or reads the stats, so until then frees of
+ * them on other threads can make the totals of alloc_stats() run behind.
+ * \param fast The fast path state of the calling thread from
+ * alloc_fast_get().
+ * \param size The size of the memory to be allocated.
+ * \return A pointer to the newly allocated memory or NULL on failure.
+ * It sets errno on failure. */
+static inline void *alloc_new_fast(alloc_fast_t *fast, size_t size) {
+	if (size - 1 < ALLOC_FAST_MAX_SIZE && fast->budget >= (int64_t)size) {
+		size_t i = ALLOC_FAST_CLASS(size);
+		void *data = fast->heads[i];
+		if (data) {
+			fast->heads[i] = *(void**)data;
+			fast->budget -= (int64_t)size;
+			fast->counts[i]++;
+			return data;
+		}
+	}
+	return alloc_fast_refill(fast, size);
+}
+
 #endif
@@ -0,0 +1,184 @@
+/*
+MIT License
+
+Copyright (c) 2025 broskobandi
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/**
+ * \file preload/alloc_preload.c
+ * \brief Malloc interposition layer for the alloc library.
+ * \details This file contains the definitions of the standard allocation
+ * functions mapped onto the alloc library so it can be loaded into
+ * unmodified programs with LD_PRELOAD. Allocations made while the library
+ * itself is allocating are served from a static bootstrap buffer.
+ * */
+
+#include "alloc_utils.h"
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define BOOTSTRAP_SIZE (1024LU * 64)
+#define IS_BOOTSTRAP(data)\
+	((uintptr_t)(data) - (uintptr_t)g_bootstrap < BOOTSTRAP_SIZE)
+#define BOOTSTRAP_SIZE_OF(data)\
+	(*(size_t*)((unsigned char*)(data) - MIN_ALLOC_SIZE))
+
+/** Global buffer serving allocations made from within the library. */
+static alignas(max_align_t) unsigned char g_bootstrap[BOOTSTRAP_SIZE];
+
+/** Global offset of the unused part of the bootstrap buffer. */
+static atomic_size_t g_bootstrap_offset = 0;
+
+/** Global depth of the calls into the library on the calling thread. */
+static _Thread_local int g_depth = 0;
+
+/** Allocates a block from the bootstrap buffer. Such blocks are never freed.
+ * \param size The size of the block to be allocated.
+ * \return A pointer to the block or NULL if the buffer is exhausted. */
+static void *bootstrap_new(size_t size) {
+	size_t total = MIN_ALLOC_SIZE + ROUNDUP(size);
+	size_t offset = atomic_fetch_add(&g_bootstrap_offset, total);
+	if (offset + total > BOOTSTRAP_SIZE) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	unsigned char *data = g_bootstrap + offset + MIN_ALLOC_SIZE;
+	BOOTSTRAP_SIZE_OF(data) = size;
+	return data;
+}
+
+/** Allocates a block aligned to a power of two.
+ * \param alignment The alignment of the block.
+ * \param size The size of the block.
+ * \return A pointer to the block or NULL on failure. It sets errno on
+ * failure. */
+static void *aligned_new(size_t alignment, size_t size) {
+	if (!alignment || alignment & (alignment - 1)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (g_depth) {
+		if (alignment <= MIN_ALLOC_SIZE) return bootstrap_new(size);
+		errno = ENOMEM;
+		return NULL;
+	}
+	int error = errno;
+	g_depth++;
+	void *data = alloc_new_aligned(size ? size : 1, alignment);
+	g_depth--;
+	errno = data ? error : ENOMEM;
+	return data;
+}
+
+void *malloc(size_t size) {
+	if (g_depth) return bootstrap_new(size);
+	int error = errno;
+	g_depth++;
+	void *data = alloc_new(size ? size : 1);
+	g_depth--;
+	errno = data ? error : ENOMEM;
+	return data;
+}
+
+void free(void *ptr) {
+	if (!ptr || IS_BOOTSTRAP(ptr)) return;
+	int error = errno;
+	g_depth++;
+	alloc_del(ptr);
+	g_depth--;
+	errno = error;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	size_t total;
+	if (__builtin_mul_overflow(nmemb, size, &total)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (g_depth) return bootstrap_new(total);
+	int error = errno;
+	g_depth++;
+	void *data = alloc_new_zeroed(total ? total : 1);
+	g_depth--;
+	errno = data ? error : ENOMEM;
+	return data;
+}
+
+void *realloc(void *ptr, size_t size) {
+	if (!ptr) return malloc(size);
+	if (!size) {
+		free(ptr);
+		return NULL;
+	}
+	if (IS_BOOTSTRAP(ptr)) {
+		void *data = malloc(size);
+		if (!data) return NULL;
+		size_t old_size = BOOTSTRAP_SIZE_OF(ptr);
+		memcpy(data, ptr, old_size < size ? old_size : size);
+		return data;
+	}
+	int error = errno;
+	g_depth++;
+	int ret = alloc_resize(&ptr, size);
+	g_depth--;
+	errno = ret ? ENOMEM : error;
+	return ret ? NULL : ptr;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+	if (alignment % sizeof(void*)) return EINVAL;
+	int error = errno;
+	void *data = aligned_new(alignment, size);
+	int ret = data ? 0 : errno;
+	errno = error;
+	if (data) *memptr = data;
+	return ret;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+	return aligned_new(alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+	return aligned_new(alignment, size);
+}
+
+void *valloc(size_t size) {
+	return aligned_new((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size) {
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	return aligned_new(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void *ptr) {
+	if (!ptr) return 0;
+	if (IS_BOOTSTRAP(ptr)) return BOOTSTRAP_SIZE_OF(ptr);
+#ifdef ALLOC_DEBUG
+	size_t size;
+	if (DEBUG_ON() && (size = debug_size(ptr))) return size;
+#endif
+	if (IS_SLAB(ptr)) return SLAB(ptr)->size;
+	return PTR(ptr)->size;
+}
@@ -32,10 +32,12 @@ SOFTWARE.
 #include "alloc_utils.h"
 #include <pthread.h>
 
-/** Global instance of the arena struct that acts as the head in the linked list. */
+/** Global instance of the arena struct that acts as the head in the linked list.
+ * It starts out full so blocks are only ever carved from chunk pages, which
+ * outlive the thread. */
 // _Thread_local arena_t g_arena_head;
 // arena_t g_arena_head = {0};
-_Thread_local arena_t g_arena_head = {0};
+_Thread_local arena_t g_arena_head = {.offset = ARENA_BUFF_SIZE};
 
 /** Global instance of the arena struct that acts as the tail in the linked list. */
 // _Thread_local arena_t *g_arena_tail = &g_arena_head;
@@ -43,11 +45,256 @@ _Thread_local arena_t *g_arena_tail = NULL;
 // arena_t *g_arena_tail = NULL;
 
 /** Global instance of an array of linked lists containing free pointers. */
-_Thread_local ptr_t *g_free_ptr_tails[NUM_ALLOC_SIZES] = {0};
-// ptr_t *g_free_ptr_tails[NUM_ALLOC_SIZES] = {0};
+_Thread_local ptr_t *g_free_ptr_tails[NUM_SIZE_CLASSES] = {0};
+// ptr_t *g_free_ptr_tails[NUM_SIZE_CLASSES] = {0};
 
-/** Global instance of a mutex object. */
-// pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+/** Global pointer to the reserved region slab pages are carved from. */
+unsigned char *g_slab_region = NULL;
+
+/** Global array of slab descriptors, one for each page of the slab region. */
+slab_t *g_slabs = NULL;
+
+/** Global number of slab pages handed out from the slab region. */
+atomic_size_t g_slab_count = 0;
+
+/** Global once flag guarding the mapping of the slab region. */
+pthread_once_t g_slab_once = PTHREAD_ONCE_INIT;
+
+/** Global instance of an array of linked lists containing slabs with
+ * free slots. */
+_Thread_local slab_t *g_slab_tails[NUM_SLAB_SIZES] = {0};
+
+/** Global instance of a linked list containing empty slabs. */
+_Thread_local slab_t *g_slab_pool = NULL;
+
+/** Global number of empty slabs in the pool of the calling thread. */
+_Thread_local size_t g_slab_pool_count = 0;
+
+/** Global instance of a linked list containing purged empty slabs shared
+ * by all threads. */
+slab_t *g_slab_free = NULL;
+
+/** Global number of slabs in the shared pool. */
+atomic_size_t g_slab_free_count = 0;
+
+/** Global mutex guarding the shared pool of slabs. */
+pthread_mutex_t g_slab_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Global pointer to the heap struct owned by the calling thread. */
+_Thread_local heap_t *g_heap = NULL;
+
+/** Global pointer to the page heap structs are carved from. */
+heap_t *g_heap_page = NULL;
+
+/** Global number of heap structs carved from the current heap page. */
+size_t g_heap_count = 0;
+
+/** Global mutex guarding the allocation of heap structs. */
+pthread_mutex_t g_heap_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Global instance of a linked list containing every heap struct. */
+heap_t *g_heaps = NULL;
+
+/** Global instance of a linked list containing the heaps of exited threads
+ * waiting to be adopted. */
+heap_t *g_orphans = NULL;
+
+/** Global key whose destructor parks the heap of an exiting thread. */
+pthread_key_t g_heap_key;
+
+/** Global once flag guarding the creation of the heap key. */
+pthread_once_t g_heap_once = PTHREAD_ONCE_INIT;
+
+/** Global instance of a linked list containing the chunks reserved by the
+ * calling thread. */
+_Thread_local chunk_t *g_chunks = NULL;
+
+/** Global number of released pages in the chunks of the calling thread. */
+_Thread_local size_t g_chunk_free_pages = 0;
+
+/** Global instance of an array of mappings the calling thread keeps for
+ * reuse, oldest first. */
+_Thread_local map_t g_map_cache[MAP_CACHE_COUNT] = {0};
+
+/** Global number of mappings in the map cache of the calling thread. */
+_Thread_local size_t g_map_count = 0;
+
+/** Global number of bytes in the map cache of the calling thread. */
+_Thread_local size_t g_map_bytes = 0;
+
+/** Global number of milliseconds released pages are kept before being purged. */
+atomic_size_t g_decay_ms = DECAY_MS;
+
+/** Global number of bytes of released pages a heap may keep. */
+atomic_size_t g_max_dirty = MAX_DIRTY;
+
+/** Global number of slow path allocations since the calling thread last
+ * purged its decayed pages. */
+_Thread_local size_t g_decay_tick = 0;
+
+/** Global mutex serializing changes of the config. */
+pthread_mutex_t g_config_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Global mutex guarding the state of the background decay thread. */
+pthread_mutex_t g_decay_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Global condition variable waking the background decay thread. */
+pthread_cond_t g_decay_cond = PTHREAD_COND_INITIALIZER;
+
+/** Global handle of the background decay thread. */
+pthread_t g_decay_thread;
+
+/** Global flag telling whether the background decay thread is running. */
+bool g_decay_running = false;
+
+/** Global mean number of bytes between two sampled allocations. */
+atomic_size_t g_prof_rate = 0;
+
+/** Global time sampling was enabled at in milliseconds. */
+_Atomic uint64_t g_prof_start = 0;
+
+/** Global number of bytes the calling thread allocates before the next
+ * sample. */
+_Thread_local int64_t g_prof_bytes = 0;
+
+/** Global state of the random generator of the calling thread. */
+_Thread_local uint64_t g_prof_seed = 0;
+
+/** Global flag telling whether the calling thread is taking a sample. */
+_Thread_local bool g_prof_busy = false;
+
+/** Global mutex guarding the sites and the live blocks of the profile. */
+pthread_mutex_t g_prof_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Global hash table of the sampled call sites. */
+prof_site_t g_prof_sites[PROF_SITES];
+
+/** Global hash table of the sampled blocks that are still allocated. */
+prof_live_t g_prof_live[PROF_LIVE];
+
+/** Global number of sampled blocks that are still allocated. */
+atomic_size_t g_prof_live_count = 0;
+
+/** Global array of counters of the sampled blocks hashed to each slot, so
+ * frees can tell that a block wasn't sampled without taking the mutex. */
+atomic_uint g_prof_filter[PROF_FILTER];
+
+/** Global instance of an array of thread caches, one for each size class. */
+_Thread_local tcache_t g_tcache[NUM_SIZE_CLASSES] = {0};
+
+/** Global instance of the fast path state of alloc_new_fast(). */
+_Thread_local alloc_fast_t g_fast = {0};
+
+/** Global array of central free lists, one for each NUMA node and size
+ * class. */
+central_t g_central[NUMA_MAX_NODES][NUM_SIZE_CLASSES] = {0};
+
+/** Global number of NUMA nodes. */
+size_t g_numa_nodes = 1;
+
+/** Global flag telling whether the NUMA topology is faked. */
+bool g_numa_fake = false;
+
+/** Global NUMA node the calling thread last ran on. */
+_Thread_local size_t g_node = 0;
+
+#ifdef ALLOC_DEBUG
+/** Global set of the enabled debug features. They are off until they are
+ * selected with ALLOC_DEBUG. */
+atomic_uint g_debug = 0;
+
+/** Global flag telling whether the calling thread is inside the debug layer. */
+_Thread_local bool g_debug_busy = false;
+
+/** Global mutex guarding the debug table and the quarantine. */
+pthread_mutex_t g_debug_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Global hash table of the blocks allocated in debug mode. */
+debug_block_t *g_debug_blocks = NULL;
+
+/** Global base 2 logarithm of the number of entries in the debug table. */
+size_t g_debug_lg = 0;
+
+/** Global number of used entries in the debug table. */
+size_t g_debug_count = 0;
+
+/** Global ring of the freed blocks held back from reuse. */
+void *g_quarantine[QUARANTINE_COUNT];
+
+/** Global index of the oldest block in the quarantine. */
+size_t g_quarantine_head = 0;
+
+/** Global number of blocks in the quarantine. */
+size_t g_quarantine_count = 0;
+
+/** Global number of bytes in the quarantine. */
+size_t g_quarantine_bytes = 0;
+#endif
+
+#ifdef ALLOC_TRACE
+/** Global flag telling whether allocations are traced. */
+atomic_bool g_trace_on = false;
+
+/** Global flag telling whether the calling thread is inside the trace
+ * writer or in a call that's traced as a whole. */
+_Thread_local bool g_trace_busy = false;
+
+/** Global trace slot of the calling thread. */
+_Thread_local trace_slot_t *g_trace_slot = NULL;
+
+/** Global sequence number of the next trace record. */
+_Atomic uint64_t g_trace_seq = 0;
+
+/** Global time of the monotonic clock in nanoseconds when the trace was
+ * started. */
+uint64_t g_trace_start = 0;
+
+/** Global number of threads that got a trace slot. */
+atomic_uint g_trace_threads = 0;
+
+/** Global file descriptor of the trace file. */
+int g_trace_fd = -1;
+
+/** Global mutex guarding the trace slots, the buffer pool and the queue. */
+pthread_mutex_t g_trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Global condition variable that wakes up the trace thread. */
+pthread_cond_t g_trace_cond = PTHREAD_COND_INITIALIZER;
+
+/** Global handle of the trace thread. */
+pthread_t g_trace_thread;
+
+/** Global flag telling whether the trace thread is running. */
+bool g_trace_running = false;
+
+/** Global linked list of the trace slots. */
+trace_slot_t *g_trace_slots = NULL;
+
+/** Global linked list of the unused trace buffers. */
+trace_buf_t *g_trace_pool = NULL;
+
+/** Global head of the queue of trace buffers waiting to be written. */
+trace_buf_t *g_trace_queue = NULL;
+
+/** Global tail of the queue of trace buffers waiting to be written. */
+trace_buf_t *g_trace_queue_tail = NULL;
+#endif
+
+/** Registers the fork handlers of the library and reads the config from the
+ * environment when it's loaded. */
+__attribute__((constructor))
+static void alloc_init() {
+	pthread_atfork(fork_prepare, fork_parent, fork_child);
+	config_env();
+}
+
+#ifdef ALLOC_TRACE
+/** Writes the rest of the trace when the library is unloaded. */
+__attribute__((destructor))
+static void alloc_fini() {
+	if (trace_stop()) ERROR_SET("Failed to stop trace.");
+}
+#endif
 
 /** Allocates a new block of memory.
  * \param size The size of the memory to be allocated. 
@@ -55,25 +302,155 @@ _Thread_local ptr_t *g_free_ptr_tails[NUM_ALLOC_SIZES] = {0};
  * It sets errno on failure. */
 void *alloc_new(size_t size) {
 	if (!size) RET_ERR("size cannot be 0.", NULL);
-	if (!g_arena_tail) g_arena_tail = &g_arena_head;
-	// pthread_mutex_lock(&g_mutex);
-	if (TOTAL_SIZE(size) > ARENA_SIZE) {
-		void *ptr = mmap_use(size);
-		// pthread_mutex_unlock(&g_mutex);
+	if (size > SIZE_MAX / 2) RET_ERR("size is too big.", NULL);
+#ifdef ALLOC_DEBUG
+	if (DEBUG_ON()) {
+		void *ptr = debug_new(size, MIN_ALLOC_SIZE);
+		if (ptr) TRACE(TRACE_NEW, ptr, NULL, size);
 		return ptr;
 	}
-	if (g_free_ptr_tails[FREE_PTR_INDEX(size)] && TOTAL_SIZE(size) <= ARENA_SIZE) {
-		void *ptr = free_ptr_use(size);
-		// pthread_mutex_unlock(&g_mutex);
+#endif
+	void *ptr = block_new(size, NULL);
+	if (!ptr) RET_ERR("Failed to allocate memory.", NULL);
+	stats_new(block_size(ptr), !IS_SLAB(ptr), 1);
+	if ((g_prof_bytes -= (int64_t)size) < 0) prof_sample(ptr, size);
+	TRACE(TRACE_NEW, ptr, NULL, size);
+	return ptr;
+}
+
+/** Allocates a new block of zero-filled memory. Blocks the kernel has just
+ * zero-filled, like fresh mmap() mappings and unused arena space, are
+ * handed out without being cleared again, so their pages aren't touched.
+ * \param size The size of the memory to be allocated.
+ * \return A pointer to the newly allocated memory or NULL on failure.
+ * It sets errno on failure. */
+void *alloc_new_zeroed(size_t size) {
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (size > SIZE_MAX / 2) RET_ERR("size is too big.", NULL);
+#ifdef ALLOC_DEBUG
+	if (DEBUG_ON()) {
+		void *ptr = debug_new(size, MIN_ALLOC_SIZE);
+		if (ptr) memset(ptr, 0, size);
+		if (ptr) TRACE(TRACE_NEW, ptr, NULL, size);
 		return ptr;
 	}
-	if (!g_free_ptr_tails[FREE_PTR_INDEX(size)] && TOTAL_SIZE(size) <= ARENA_SIZE) {
-		void *ptr = arena_use(size);
-		// pthread_mutex_unlock(&g_mutex);
+#endif
+	bool zero = false;
+	void *ptr = block_new(size, &zero);
+	if (!ptr) RET_ERR("Failed to allocate memory.", NULL);
+	if (!zero) memset(ptr, 0, size);
+	stats_new(block_size(ptr), !IS_SLAB(ptr), 1);
+	if ((g_prof_bytes -= (int64_t)size) < 0) prof_sample(ptr, size);
+	TRACE(TRACE_NEW, ptr, NULL, size);
+	return ptr;
+}
+
+/** Allocates a new block of memory aligned to a power of two.
+ * Blocks that fit in a slab are taken from the thread cache or the slabs of
+ * the size class whose objects are naturally aligned. Larger blocks and
+ * small ones no slab can hold are carved from page runs, which start on a
+ * page, and blocks too big for a run take a cached mapping or are allocated
+ * with mmap().
+ * \param size The size of the memory to be allocated.
+ * \param alignment The alignment of the memory. It must be a power of two.
+ * \return A pointer to the newly allocated memory or NULL on failure.
+ * It sets errno on failure. */
+void *alloc_new_aligned(size_t size, size_t alignment) {
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (!alignment || alignment & (alignment - 1))
+		RET_ERR("alignment must be a power of two.", NULL);
+#ifdef ALLOC_DEBUG
+	if (DEBUG_ON()) {
+		void *ptr = debug_new(size, alignment);
+		if (ptr) TRACE(TRACE_NEW, ptr, NULL, size);
 		return ptr;
 	}
-	// pthread_mutex_unlock(&g_mutex);
-	RET_ERR("Failed to allocate memory.", NULL);
+#endif
+	if (alignment <= MIN_ALLOC_SIZE) return alloc_new(size);
+	if (!g_heap && heap_init()) RET_ERR("Failed to initialize heap.", NULL);
+	if (atomic_load_explicit(&g_heap->remote_free, memory_order_relaxed))
+		if (remote_free_drain()) ERROR_SET("Failed to release remote frees.");
+	void *ptr = NULL;
+	if (size <= SLAB_MAX_SIZE) {
+		size_t aligned = ALIGN_UP(size, alignment);
+		if (
+			aligned <= SLAB_MAX_SIZE &&
+			!(CLASS_SIZE(SIZE_CLASS(aligned)) % alignment)
+		) {
+			if ((ptr = tcache_use(aligned))) STAT_INC(fast_path);
+			else if ((ptr = slab_use(aligned))) STAT_INC(slow_path);
+		}
+	}
+	if (!ptr) {
+		if (size <= MAX_RUN_ALLOC_SIZE && alignment <= RUN_MAX_ALIGNMENT)
+			ptr = run_use_aligned(size, alignment);
+		else if (!(ptr = map_cache_use(size, alignment)))
+			ptr = mmap_use_aligned(size, alignment);
+		if (!ptr) RET_ERR("Failed to allocate aligned memory.", NULL);
+		STAT_INC(slow_path);
+	}
+	stats_new(block_size(ptr), !IS_SLAB(ptr), 1);
+	if ((g_prof_bytes -= (int64_t)size) < 0) prof_sample(ptr, size);
+	TRACE(TRACE_NEW, ptr, NULL, size);
+	RET_OK(ptr);
+}
+
+/** Allocates blocks of memory of the same size at once.
+ * The size class is computed once and the blocks are taken as chains from
+ * the thread cache and as contiguous runs from slabs. Small blocks no slab
+ * can hold are carved from arenas.
+ * \param size The size of each block.
+ * \param count The number of blocks to be allocated.
+ * \param ptrs Pointer to the array the blocks are written to.
+ * \return 0 on success and 1 on failure. No blocks are allocated on failure.
+ * It sets errno on failure. */
+int alloc_new_batch(size_t size, size_t count, void **ptrs) {
+	if (!size) RET_ERR("size cannot be 0.", 1);
+	if (size > SIZE_MAX / 2) RET_ERR("size is too big.", 1);
+	if (!ptrs) RET_ERR("ptrs cannot be NULL.", 1);
+	if (!count) RET_OK(0);
+#ifdef ALLOC_DEBUG
+	if (DEBUG_ON()) {
+		for (size_t i = 0; i < count; i++) {
+			if ((ptrs[i] = debug_new(size, MIN_ALLOC_SIZE))) continue;
+			TRACE_PAUSE(true);
+			alloc_del_batch(ptrs, i);
+			TRACE_PAUSE(false);
+			RET_ERR("Failed to allocate memory.", 1);
+		}
+		for (size_t i = 0; i < count; i++)
+			TRACE(TRACE_NEW, ptrs[i], NULL, size);
+		RET_OK(0);
+	}
+#endif
+	if (!g_heap && heap_init()) RET_ERR("Failed to initialize heap.", 1);
+	if (atomic_load_explicit(&g_heap->remote_free, memory_order_relaxed))
+		if (remote_free_drain()) ERROR_SET("Failed to release remote frees.");
+	size_t n = 0;
+	if (size <= MAX_ARENA_ALLOC_SIZE) n = tcache_use_batch(size, count, ptrs);
+	STAT_ADD(fast_path, n);
+	STAT_ADD(slow_path, count - n);
+	if (size <= SLAB_MAX_SIZE) n += slab_use_batch(size, count - n, ptrs + n);
+	bool arena = TOTAL_SIZE(size) <= ARENA_BUFF_SIZE;
+	for (; n < count; n++) {
+		if (!arena) ptrs[n] = large_use(size, NULL);
+		else if (free_ptr_find(size) < NUM_SIZE_CLASSES)
+			ptrs[n] = free_ptr_use(size);
+		else ptrs[n] = arena_use(size);
+		if (!ptrs[n]) break;
+	}
+	for (size_t i = 0; i < n; i++)
+		stats_new(block_size(ptrs[i]), !IS_SLAB(ptrs[i]), 1);
+	if (n < count) {
+		TRACE_PAUSE(true);
+		alloc_del_batch(ptrs, n);
+		TRACE_PAUSE(false);
+		RET_ERR("Failed to allocate memory.", 1);
+	}
+	if ((g_prof_bytes -= (int64_t)(size * count)) < 0)
+		prof_sample(ptrs[count - 1], size);
+	for (size_t i = 0; i < count; i++) TRACE(TRACE_NEW, ptrs[i], NULL, size);
+	RET_OK(0);
 }
 
 /** Deallocates a block of memory.
@@ -81,12 +458,96 @@ void *alloc_new(size_t size) {
  * It sets errno on failure. */
 void alloc_del(void *ptr) {
 	if (!ptr) RET_ERR("ptr cannot be NULL.");
-	// pthread_mutex_lock(&g_mutex);
-	if (ptr_free(ptr)) ERROR_SET("Failed to free pointer.");
-	// pthread_mutex_unlock(&g_mutex);
+	TRACE(TRACE_DEL, ptr, NULL, 0);
+#ifdef ALLOC_DEBUG
+	if (DEBUG_ON() && debug_size(ptr)) {
+		if (debug_del(ptr)) RET_ERR("Failed to free pointer.");
+		return;
+	}
+#endif
+	if (!g_heap && heap_init()) RET_ERR("Failed to initialize heap.");
+	size_t size = block_size(ptr);
+	bool header = !IS_SLAB(ptr);
+	if (atomic_load_explicit(&g_prof_live_count, memory_order_relaxed))
+		prof_free(ptr);
+	if (tcache_free(ptr)) ERROR_SET("Failed to free pointer.");
+	else stats_del(size, header, 1);
+}
+
+/** Deallocates a block of memory whose size is known. The size must be the
+ * size the block was allocated or last resized with. Small blocks skip the
+ * checks alloc_del() needs to tell the kinds of blocks apart and go
+ * straight to the thread cache of the size class of their size, without
+ * reading their slab. Other blocks are freed like with alloc_del(). Blocks
+ * allocated with alloc_new_aligned() must be freed with alloc_del(). A
+ * wrong size is only caught in debug mode, where it must match the block
+ * exactly.
+ * \param ptr Pointer to the memory to be deallocated.
+ * \param size The size of the memory to be deallocated.
+ * It sets errno on failure. */
+void alloc_del_sized(void *ptr, size_t size) {
+	if (!ptr) RET_ERR("ptr cannot be NULL.");
+#ifdef ALLOC_DEBUG
+	if (DEBUG_ON()) {
+		if (!debug_size_match(ptr, size)) RET_ERR("Size mismatch detected.");
+		alloc_del(ptr);
+		return;
+	}
+#endif
+	if (!size || size > SLAB_MAX_SIZE || !IS_SLAB(ptr)) {
+		alloc_del(ptr);
+		return;
+	}
+	TRACE(TRACE_DEL, ptr, NULL, 0);
+	if (!g_heap && heap_init()) RET_ERR("Failed to initialize heap.");
+	if (atomic_load_explicit(&g_prof_live_count, memory_order_relaxed))
+		prof_free(ptr);
+	if (tcache_free_sized(ptr, size)) ERROR_SET("Failed to free pointer.");
+	else stats_del(CLASS_SIZE(SIZE_CLASS(size)), false, 1);
 }
 
-/** Allocates a new block and copies the old content over.
+/** Deallocates blocks of memory at once.
+ * Consecutive blocks of the same size class are pushed to the thread cache
+ * as a single chain.
+ * \param ptrs Pointer to the array of blocks to be deallocated.
+ * \param count The number of blocks.
+ * It sets errno on failure. */
+void alloc_del_batch(void **ptrs, size_t count) {
+	if (!ptrs) RET_ERR("ptrs cannot be NULL.");
+	for (size_t i = 0; i < count; i++)
+		if (ptrs[i]) TRACE(TRACE_DEL, ptrs[i], NULL, 0);
+#ifdef ALLOC_DEBUG
+	if (DEBUG_ON()) {
+		int ret = 0;
+		TRACE_PAUSE(true);
+		for (size_t i = 0; i < count; i++) {
+			if (!ptrs[i]) ret = 1;
+			else if (!debug_size(ptrs[i])) alloc_del(ptrs[i]);
+			else if (debug_del(ptrs[i])) ret = 1;
+		}
+		TRACE_PAUSE(false);
+		if (ret) RET_ERR("Failed to free pointers.");
+		return;
+	}
+#endif
+	if (!g_heap && heap_init()) RET_ERR("Failed to initialize heap.");
+	for (size_t i = 0; i < count; i++) {
+		void *ptr = ptrs[i];
+		if (!ptr) continue;
+		if (IS_SLAB(ptr) ? !!SLAB(ptr)->size : PTR(ptr)->state == VALID)
+			stats_del(block_size(ptr), !IS_SLAB(ptr), 1);
+		if (atomic_load_explicit(&g_prof_live_count, memory_order_relaxed))
+			prof_free(ptr);
+	}
+	if (tcache_free_batch(ptrs, count)) ERROR_SET("Failed to free pointers.");
+}
+
+/** Resizes a block of memory.
+ * Slab objects are resized in place within their size class, so their
+ * class still follows from their size, and arena blocks whenever they fit.
+ * Blocks allocated with mmap() are remapped with mremap(). Otherwise a new
+ * block is allocated, the old content is copied over and the old block
+ * is freed.
  * \param ptr Pointer to the pointer that's associated with the memory block
  * to be resized.
  * \param size The size of the new block.
@@ -94,16 +555,385 @@ void alloc_del(void *ptr) {
  * It sets errno on failure. */
 int alloc_resize(void **ptr, size_t size) {
 	if (!size) RET_ERR("size cannot be 0.", 1);
+	if (size > SIZE_MAX / 2) RET_ERR("size is too big.", 1);
 	if (!ptr || !*ptr) RET_ERR("ptr cannot be NULL.", 1);
-	void *new_ptr = alloc_new(size);
-	if (new_ptr) {
-		size_t size_to_copy =
-			PTR(ptr)->size > size ?
-			size : PTR(ptr)->size;
-		memcpy(new_ptr, *ptr, size_to_copy);
-		*ptr = new_ptr;
+#ifdef ALLOC_DEBUG
+	if (DEBUG_ON() && debug_size(*ptr)) {
+		void *old_ptr = *ptr;
+		if (debug_resize(ptr, size)) RET_ERR("Failed to resize block.", 1);
+		TRACE(TRACE_RESIZE, old_ptr, *ptr, size);
 		RET_OK(0);
+	}
+#endif
+	size_t old_size;
+	if (IS_SLAB(*ptr)) {
+		old_size = SLAB(*ptr)->size;
+		if (size <= old_size && SIZE_CLASS(size) == SIZE_CLASS(old_size)) {
+			TRACE(TRACE_RESIZE, *ptr, *ptr, size);
+			RET_OK(0);
+		}
+	} else if (PTR(*ptr)->arena) {
+		old_size = PTR(*ptr)->size;
+		if (TOTAL_SIZE(size) <= ARENA_BUFF_SIZE && !arena_resize(*ptr, size)) {
+			stats_del(old_size, true, 1);
+			stats_new(PTR(*ptr)->size, true, 1);
+			TRACE(TRACE_RESIZE, *ptr, *ptr, size);
+			RET_OK(0);
+		}
+	} else if (PTR(*ptr)->pages) {
+		old_size = PTR(*ptr)->size;
+		if (TOTAL_SIZE(size) > ARENA_BUFF_SIZE && !run_resize(*ptr, size)) {
+			stats_del(old_size, true, 1);
+			stats_new(size, true, 1);
+			TRACE(TRACE_RESIZE, *ptr, *ptr, size);
+			RET_OK(0);
+		}
 	} else {
-		RET_ERR("Failed to allocate new memory.", 1);
+		old_size = PTR(*ptr)->size;
+		if (TOTAL_SIZE(size) > ARENA_BUFF_SIZE) {
+			if (atomic_load_explicit(&g_prof_live_count, memory_order_relaxed))
+				prof_free(*ptr);
+			void *new_ptr = mmap_resize(*ptr, size);
+			if (!new_ptr) RET_ERR("Failed to remap memory.", 1);
+			stats_del(old_size, true, 1);
+			stats_new(size, true, 1);
+			TRACE(TRACE_RESIZE, *ptr, new_ptr, size);
+			*ptr = new_ptr;
+			RET_OK(0);
+		}
+	}
+	TRACE_PAUSE(true);
+	void *new_ptr = alloc_new(size);
+	TRACE_PAUSE(false);
+	if (!new_ptr) RET_ERR("Failed to allocate new memory.", 1);
+	memcpy(new_ptr, *ptr, old_size > size ? size : old_size);
+	TRACE(TRACE_RESIZE, *ptr, new_ptr, size);
+	TRACE_PAUSE(true);
+	alloc_del(*ptr);
+	TRACE_PAUSE(false);
+	*ptr = new_ptr;
+	RET_OK(0);
+}
+
+/** Collects the counters of every thread.
+ * \param stats Pointer to the stats struct to be filled.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_stats(alloc_stats_t *stats) {
+	if (!stats) RET_ERR("stats cannot be NULL.", 1);
+	fast_fold();
+	memset(stats, 0, sizeof(alloc_stats_t));
+	pthread_mutex_lock(&g_heap_mutex);
+	for (heap_t *heap = g_heaps; heap; heap = heap->next)
+		stats_add(stats, heap);
+	pthread_mutex_unlock(&g_heap_mutex);
+	stats_finish(stats);
+	RET_OK(0);
+}
+
+/** Collects the counters of the calling thread. Blocks freed by other
+ * threads are counted as live by the thread that allocated them and
+ * subtracted from the thread that freed them, so the live, mapped and
+ * header bytes and the mmap() count of a thread that frees more than it
+ * allocates wrap around below 0. They're meant to be read as signed values,
+ * like (ptrdiff_t)stats->live_bytes. The counters of alloc_stats() are the
+ * sums of every thread and don't wrap.
+ * \param stats Pointer to the stats struct to be filled.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_stats_thread(alloc_stats_t *stats) {
+	if (!stats) RET_ERR("stats cannot be NULL.", 1);
+	if (heap_init()) RET_ERR("Failed to initialize heap.", 1);
+	fast_fold();
+	memset(stats, 0, sizeof(alloc_stats_t));
+	stats_add(stats, g_heap);
+	stats_finish(stats);
+	RET_OK(0);
+}
+
+/** Collects the counters of a size class of every thread.
+ * \param index The index of the size class, starting from 0.
+ * \param stats Pointer to the class stats struct to be filled.
+ * \return 0 on success and 1 on failure or if there are no more classes.
+ * It sets errno on failure. */
+int alloc_stats_class(size_t index, alloc_class_stats_t *stats) {
+	if (!stats) RET_ERR("stats cannot be NULL.", 1);
+	if (index >= NUM_SIZE_CLASSES) RET_ERR("index is out of range.", 1);
+	fast_fold();
+	memset(stats, 0, sizeof(alloc_class_stats_t));
+	stats->size = CLASS_SIZE(index);
+	pthread_mutex_lock(&g_heap_mutex);
+	for (heap_t *heap = g_heaps; heap; heap = heap->next) {
+		stats->count +=
+			STAT_LOAD(heap, class_new[index]) - STAT_LOAD(heap, class_del[index]);
+		stats->total += STAT_LOAD(heap, class_new[index]);
+	}
+	pthread_mutex_unlock(&g_heap_mutex);
+	for (size_t n = 0; n < NUMA_MAX_NODES; n++)
+		stats->cached += atomic_load_explicit(&g_central[n][index].count,
+			memory_order_relaxed);
+	RET_OK(0);
+}
+
+/** Sets the policy for returning released pages to the kernel.
+ * The pages of the calling thread are purged right away under the new
+ * policy, the pages of other threads on their next tick or by the
+ * background thread.
+ * \param config Pointer to the config struct to be applied.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_config(const alloc_config_t *config) {
+	if (!config) RET_ERR("config cannot be NULL.", 1);
+	pthread_mutex_lock(&g_config_mutex);
+	atomic_store(&g_decay_ms, config->decay_ms);
+	atomic_store(&g_max_dirty, config->max_dirty_bytes);
+	int ret = config->background ? decay_start() : decay_stop();
+	pthread_mutex_unlock(&g_config_mutex);
+	if (ret) RET_ERR("Failed to configure background decay thread.", 1);
+	if (g_heap && heap_decay(g_heap, clock_ms()))
+		RET_ERR("Failed to purge pages.", 1);
+	RET_OK(0);
+}
+
+/** Gets the policy for returning released pages to the kernel.
+ * \param config Pointer to the config struct to be filled.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_config_get(alloc_config_t *config) {
+	if (!config) RET_ERR("config cannot be NULL.", 1);
+	config->decay_ms = atomic_load(&g_decay_ms);
+	config->max_dirty_bytes = atomic_load(&g_max_dirty);
+	pthread_mutex_lock(&g_decay_mutex);
+	config->background = g_decay_running;
+	pthread_mutex_unlock(&g_decay_mutex);
+	RET_OK(0);
+}
+
+/** Returns the released pages of every thread and the cached mappings and
+ * empty slabs of the calling thread to the kernel. Blocks freed into the
+ * heaps of exited threads are released first.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_purge() {
+	if (decay_all(UINT64_MAX)) RET_ERR("Failed to purge pages.", 1);
+	if (map_cache_flush()) RET_ERR("Failed to release cached mappings.", 1);
+	if (slab_pool_flush()) RET_ERR("Failed to release slabs.", 1);
+	RET_OK(0);
+}
+
+/** Sets the mean number of bytes between two sampled allocations.
+ * The calling thread draws its next sampling interval right away, other
+ * threads pick the new rate up when their current interval runs out.
+ * \param rate The mean sampling interval in bytes. 0 disables sampling.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_prof_enable(size_t rate) {
+	if (rate > SIZE_MAX / 2) RET_ERR("rate is too big.", 1);
+	if (rate && !atomic_load(&g_prof_rate))
+		atomic_store(&g_prof_start, clock_ms());
+	atomic_store(&g_prof_rate, rate);
+	fast_revoke();
+	g_prof_bytes = rate ? prof_interval(rate) : PROF_RECHECK;
+	RET_OK(0);
+}
+
+/** Writes the heap profile collected from the sampled allocations.
+ * The sites are copied into a private mapping first, so writing the
+ * profile may allocate without holding the profile mutex.
+ * \param file The file to write the profile to.
+ * \param format The format of the profile.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_prof_dump(FILE *file, alloc_prof_format_t format) {
+	if (!file) RET_ERR("file cannot be NULL.", 1);
+	if (format > ALLOC_PROF_FOLDED_RATE) RET_ERR("Invalid format.", 1);
+	prof_site_t *sites = (prof_site_t*)MMAP(sizeof(g_prof_sites));
+	if (sites == MAP_FAILED) RET_ERR("Failed to map copy of profile.", 1);
+	pthread_mutex_lock(&g_prof_mutex);
+	memcpy(sites, g_prof_sites, sizeof(g_prof_sites));
+	pthread_mutex_unlock(&g_prof_mutex);
+	int ret = prof_write(file, sites, format, clock_ms() - atomic_load(&g_prof_start));
+	munmap(sites, sizeof(g_prof_sites));
+	if (ret) RET_ERR("Failed to write profile.", 1);
+	RET_OK(0);
+}
+
+/** Creates a region whose blocks are released together.
+ * A region may only be used by the thread that created it.
+ * \return A pointer to the new region or NULL on failure.
+ * It sets errno on failure. */
+alloc_region_t *alloc_region_create() {
+	if (!g_heap && heap_init()) RET_ERR("Failed to initialize heap.", NULL);
+	region_page_t *page = (region_page_t*)page_use();
+	if (!page) RET_ERR("Failed to allocate region page.", NULL);
+	page->next = NULL;
+	alloc_region_t *region =
+		(alloc_region_t*)((unsigned char*)page + REGION_PAGE_HEADER);
+	region->head = page;
+	region->page = page;
+	region->offset = REGION_START;
+	region->large = NULL;
+	region->owner = g_heap;
+	RET_OK(region);
+}
+
+/** Allocates a new block of memory in a region. The block has no header
+ * and can't be freed or resized on its own.
+ * \param region The region to allocate from.
+ * \param size The size of the memory to be allocated.
+ * \return A pointer to the newly allocated memory or NULL on failure.
+ * It sets errno on failure. */
+void *alloc_region_new(alloc_region_t *region, size_t size) {
+	if (!region) RET_ERR("region cannot be NULL.", NULL);
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (size > SIZE_MAX / 2) RET_ERR("size is too big.", NULL);
+	if (region->owner != g_heap) RET_ERR("region is owned by another thread.", NULL);
+	return region_use(region, size);
+}
+
+/** Releases every block of a region at once. The pages of the region are
+ * kept for the blocks allocated after the reset.
+ * \param region The region to be reset.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_region_reset(alloc_region_t *region) {
+	if (!region) RET_ERR("region cannot be NULL.", 1);
+	if (region->owner != g_heap) RET_ERR("region is owned by another thread.", 1);
+	int ret = region_release(region);
+	region->page = region->head;
+	region->offset = REGION_START;
+	if (ret) RET_ERR("Failed to release large blocks.", 1);
+	RET_OK(0);
+}
+
+/** Releases every block of a region and the region itself.
+ * \param region The region to be destroyed.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_region_destroy(alloc_region_t *region) {
+	if (!region) RET_ERR("region cannot be NULL.", 1);
+	if (region->owner != g_heap) RET_ERR("region is owned by another thread.", 1);
+	int ret = region_release(region);
+	region_page_t *page = region->head;
+	while (page) {
+		region_page_t *next = page->next;
+		if (page_free((arena_t*)page)) ret = 1;
+		page = next;
 	}
+	if (ret) RET_ERR("Failed to release region.", 1);
+	RET_OK(0);
+}
+
+/** Creates a cache of objects of the same type. Objects put back into the
+ * cache stay constructed, so the constructor only runs when the cache has
+ * no free object and the destructor only when the cache is destroyed.
+ * A cache may be shared by threads.
+ * \param size The size of the objects.
+ * \param align The alignment of the objects. It must be a power of two or 0
+ * for the alignment of alloc_new().
+ * \param ctor The function that initializes a new object or NULL.
+ * \param dtor The function that finalizes an object before it's freed or
+ * NULL.
+ * \return A pointer to the new cache or NULL on failure.
+ * It sets errno on failure. */
+alloc_cache_t *alloc_cache_create(size_t size, size_t align,
+	void (*ctor)(void*), void (*dtor)(void*)) {
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (size > SIZE_MAX / 4) RET_ERR("size is too big.", NULL);
+	if (align & (align - 1)) RET_ERR("align must be a power of two.", NULL);
+	alloc_cache_t *cache = alloc_new(sizeof(alloc_cache_t));
+	if (!cache) RET_ERR("Failed to allocate cache.", NULL);
+	memset(cache, 0, sizeof(alloc_cache_t));
+	cache->size = size;
+	cache->align = align;
+	cache->link = ALIGN_UP(size, alignof(void*));
+	cache->ctor = ctor;
+	cache->dtor = dtor;
+	RET_OK(cache);
+}
+
+/** Takes an object from a cache, constructing a new one if the cache has no
+ * free object.
+ * \param cache The cache to take the object from.
+ * \return A pointer to the object or NULL on failure.
+ * It sets errno on failure. */
+void *alloc_cache_get(alloc_cache_t *cache) {
+	if (!cache) RET_ERR("cache cannot be NULL.", NULL);
+	void *obj = cache_use(cache);
+	if (!obj) RET_ERR("Failed to get object.", NULL);
+	return obj;
+}
+
+/** Puts an object back into the cache it was taken from. The object must
+ * be left in its constructed state.
+ * \param cache The cache the object was taken from.
+ * \param obj Pointer to the object.
+ * It sets errno on failure. */
+void alloc_cache_put(alloc_cache_t *cache, void *obj) {
+	if (!cache) RET_ERR("cache cannot be NULL.");
+	if (!obj) RET_ERR("obj cannot be NULL.");
+	if (cache_free(cache, obj)) RET_ERR("Failed to put object.");
+}
+
+/** Collects the counters of a cache.
+ * \param cache The cache whose counters are to be collected.
+ * \param stats Pointer to the cache stats struct to be filled.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_cache_stats(alloc_cache_t *cache, alloc_cache_stats_t *stats) {
+	if (!cache) RET_ERR("cache cannot be NULL.", 1);
+	if (!stats) RET_ERR("stats cannot be NULL.", 1);
+	stats->size = cache->size;
+	stats->free = atomic_load_explicit(&cache->free.count, memory_order_relaxed);
+	stats->ctor_calls =
+		atomic_load_explicit(&cache->ctor_calls, memory_order_relaxed);
+	stats->gets = atomic_load_explicit(&cache->gets, memory_order_relaxed);
+	stats->hits = stats->gets > stats->ctor_calls ?
+		stats->gets - stats->ctor_calls : 0;
+	stats->live = stats->ctor_calls > stats->free ?
+		stats->ctor_calls - stats->free : 0;
+	RET_OK(0);
+}
+
+/** Destroys the free objects of a cache and the cache itself. Objects
+ * still handed out stay valid and are freed with alloc_del().
+ * \param cache The cache to be destroyed.
+ * \return 0 on success and 1 on failure.
+ * It sets errno on failure. */
+int alloc_cache_destroy(alloc_cache_t *cache) {
+	if (!cache) RET_ERR("cache cannot be NULL.", 1);
+	if (cache_drain(cache)) RET_ERR("Failed to drain cache.", 1);
+	alloc_del(cache);
+	RET_OK(0);
+}
+
+/** Gets the fast path state of the calling thread for alloc_new_fast(),
+ * initializing the heap of the thread on first use.
+ * \return A pointer to the fast path state or NULL on failure.
+ * It sets errno on failure. */
+alloc_fast_t *alloc_fast_get() {
+	if (!g_heap && heap_init()) RET_ERR("Failed to initialize heap.", NULL);
+	RET_OK(&g_fast);
+}
+
+/** Allocates a new block of memory on the slow path of alloc_new_fast().
+ * The blocks it handed out are counted first, then alloc_new() releases the
+ * remote frees of the thread and a decay tick purges the decayed pages
+ * every few calls. A new budget is granted last, so it accounts for the
+ * next profiler sample, and the free blocks of the size class are refilled
+ * if there's a budget to spend them.
+ * \param fast The fast path state of the calling thread.
+ * \param size The size of the memory to be allocated.
+ * \return A pointer to the newly allocated memory or NULL on failure.
+ * It sets errno on failure. */
+void *alloc_fast_refill(alloc_fast_t *fast, size_t size) {
+	if (fast != &g_fast) RET_ERR("fast must belong to the calling thread.", NULL);
+	if (!g_heap && heap_init()) RET_ERR("Failed to initialize heap.", NULL);
+	fast_fold();
+	void *ptr = alloc_new(size);
+	if (!ptr) RET_ERR("Failed to allocate memory.", NULL);
+	decay_tick();
+	fast_grant();
+	if (g_fast.budget && size <= ALLOC_FAST_MAX_SIZE) fast_stash(SIZE_CLASS(size));
+	RET_OK(ptr);
 }
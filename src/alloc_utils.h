@@ -40,10 +40,46 @@ SOFTWARE.
 #include <sys/mman.h>
 #include <string.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <errno.h>
 
-#define ARENA_SIZE 1024LU * 4
-// #define ARENA_SIZE 1024LU * 32
-// #define ARENA_SIZE 1024LU * 128
+#ifdef ALLOC_RELEASE
+#undef ERROR_SET
+#undef RET_ERR
+#undef RET_OK
+#define ERROR_SET(msg) ((void)0)
+#define RET_ERR(msg, ...) return __VA_ARGS__
+#define RET_OK(...) return __VA_ARGS__
+#endif
+
+#define ARENA_SIZE (1024LU * 4)
+// #define ARENA_SIZE (1024LU * 32)
+// #define ARENA_SIZE (1024LU * 128)
+#define ARENA_BUFF_SIZE\
+	(size_t)(ARENA_SIZE - 4 * alignof(max_align_t))
+#define CHUNK_SIZE (1024LU * 1024 * 4)
+#define CHUNK_PAGES\
+	(size_t)(CHUNK_SIZE / ARENA_SIZE)
+#define CHUNK(page)\
+	((chunk_t*)((uintptr_t)(page) & ~(uintptr_t)(CHUNK_SIZE - 1)))
+#define CHUNK_PAGE_INDEX(page)\
+	(size_t)(((uintptr_t)(page) & (CHUNK_SIZE - 1)) / ARENA_SIZE)
+#ifdef MADV_FREE
+#define PAGE_PURGE_ADVICE MADV_FREE
+#else
+#define PAGE_PURGE_ADVICE MADV_DONTNEED
+#endif
 #define ROUNDUP(size)\
 	(size_t)(((size) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1))
 #define PTR_ALIGNED_SIZE\
@@ -51,21 +87,174 @@ SOFTWARE.
 #define TOTAL_SIZE(size)\
 	(size_t)(PTR_ALIGNED_SIZE + ROUNDUP(size))
 #define MIN_ALLOC_SIZE alignof(max_align_t)
-#define NUM_ALLOC_SIZES\
-	(size_t)((ARENA_SIZE - PTR_ALIGNED_SIZE) / MIN_ALLOC_SIZE)
-#define FREE_PTR_INDEX(size)\
-	(size_t)(((TOTAL_SIZE((size)) - PTR_ALIGNED_SIZE) / MIN_ALLOC_SIZE) - 1)
+#define MAX_ARENA_ALLOC_SIZE\
+	(size_t)(ARENA_BUFF_SIZE - PTR_ALIGNED_SIZE)
+#define RUN_MAX_PAGES 256
+#define MAX_RUN_ALLOC_SIZE\
+	(size_t)(RUN_MAX_PAGES * ARENA_SIZE - PTR_ALIGNED_SIZE)
+#define RUN_PAGES(size)\
+	(size_t)(PAGE_CEIL(TOTAL_SIZE((size))) / ARENA_SIZE)
+#define RUN_HEAD(ptr)\
+	((arena_t*)((uintptr_t)(ptr) & ~(uintptr_t)(ARENA_SIZE - 1)))
+#define RUN_SPAN(ptr, size)\
+	(size_t)(PAGE_CEIL(((uintptr_t)(ptr) & (ARENA_SIZE - 1)) +\
+		TOTAL_SIZE((size))) / ARENA_SIZE)
+#define RUN_MAX_ALIGNMENT\
+	(size_t)(CHUNK_SIZE / 4)
+#define LG_MIN_ALLOC_SIZE\
+	(size_t)__builtin_ctzl(MIN_ALLOC_SIZE)
+#define SIZE_CLASS_LG(size)\
+	(size_t)(sizeof(unsigned long) * 8 - 1 - (size_t)__builtin_clzl(\
+		(unsigned long)((size) - 1) | (MIN_ALLOC_SIZE * 4)))
+#define SIZE_CLASS(size)\
+	(size_t)(((SIZE_CLASS_LG((size)) - LG_MIN_ALLOC_SIZE - 2) << 2) +\
+		(((size) - 1) >> (SIZE_CLASS_LG((size)) - 2)))
+#define CLASS_SIZE(index)\
+	(size_t)((index) < 4 ? ((index) + 1) * MIN_ALLOC_SIZE :\
+		(((index) % 4 + 5) << ((index) / 4 + LG_MIN_ALLOC_SIZE - 1)) <\
+		MAX_ARENA_ALLOC_SIZE ?\
+		(((index) % 4 + 5) << ((index) / 4 + LG_MIN_ALLOC_SIZE - 1)) :\
+		MAX_ARENA_ALLOC_SIZE)
+#define NUM_SIZE_CLASSES\
+	(size_t)(SIZE_CLASS(MAX_ARENA_ALLOC_SIZE) + 1)
+#define BLOCK_SIZE(size)\
+	(size_t)(PTR_ALIGNED_SIZE + CLASS_SIZE(SIZE_CLASS((size))))
+#define FREE_CLASS(capacity)\
+	(size_t)(SIZE_CLASS((capacity)) -\
+		(CLASS_SIZE(SIZE_CLASS((capacity))) > (capacity)))
 #define MMAP(size)\
 	mmap(NULL, (size), PROT_WRITE | PROT_READ, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0)
+#define MMAP_PAGE_SIZE (1024LU * 4)
+#define PAGE_FLOOR(addr)\
+	((uintptr_t)(addr) & ~(uintptr_t)(MMAP_PAGE_SIZE - 1))
+#define PAGE_CEIL(addr)\
+	PAGE_FLOOR((uintptr_t)(addr) + MMAP_PAGE_SIZE - 1)
+#define ALIGN_UP(value, alignment)\
+	(((value) + (alignment) - 1) & ~((alignment) - 1))
+#define STAT_ADD(field, value) do {\
+	if (g_heap) atomic_store_explicit(&g_heap->stats.field,\
+		atomic_load_explicit(&g_heap->stats.field, memory_order_relaxed) +\
+		(size_t)(value), memory_order_relaxed);\
+} while (0)
+#define STAT_INC(field) STAT_ADD(field, 1)
+#define STAT_LOAD(heap, field)\
+	atomic_load_explicit(&(heap)->stats.field, memory_order_relaxed)
+#define REGION_PAGE_HEADER\
+	(size_t)ROUNDUP(sizeof(region_page_t))
+#define REGION_START\
+	(size_t)(REGION_PAGE_HEADER + ROUNDUP(sizeof(alloc_region_t)))
+#define MAX_REGION_ALLOC_SIZE\
+	(size_t)(ARENA_SIZE - REGION_PAGE_HEADER)
 #define PTR(data)\
 	((ptr_t*)((unsigned char*)data - PTR_ALIGNED_SIZE))
+#define TCACHE_MAX 64
+#define TCACHE_BATCH 32
+#define FAST_BUDGET (1024LL * 64)
+#define FAST_BATCH 64
+#define CENTRAL_MAX 1024
+#define CENTRAL_TAG_SHIFT 48
+#define CENTRAL_PTR(head)\
+	((void*)(uintptr_t)((head) & (((uint64_t)1 << CENTRAL_TAG_SHIFT) - 1)))
+#define CENTRAL_FITS(addr, size)\
+	((uintptr_t)(addr) + (size) <= (uintptr_t)1 << CENTRAL_TAG_SHIFT)
+#define CENTRAL_HEAD(head, ptr)\
+	((((head) >> CENTRAL_TAG_SHIFT) + 1) << CENTRAL_TAG_SHIFT |\
+		(uint64_t)(uintptr_t)(ptr))
+#define NEXT_BATCH(data) (((void**)(data))[1])
+#define CACHE_LINK(cache, obj)\
+	((void*)((unsigned char*)(obj) + (cache)->link))
+#define CACHE_OBJ(cache, link)\
+	((void*)((unsigned char*)(link) - (cache)->link))
+#define SLAB_SIZE ARENA_SIZE
+#define SLAB_MAX_SIZE\
+	(size_t)(SLAB_SIZE / 8)
+#define NUM_SLAB_SIZES\
+	(size_t)(SIZE_CLASS(SLAB_MAX_SIZE) + 1)
+#define NUM_SLABS (size_t)(1LU << 18)
+#define SLAB_REGION_SIZE\
+	(size_t)(NUM_SLABS * SLAB_SIZE)
+#define SLAB_POOL_MAX 16
+#define MMAP_NORESERVE(size)\
+	mmap(NULL, (size), PROT_WRITE | PROT_READ,\
+		MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0)
+#define IS_SLAB(data)\
+	(g_slab_region &&\
+	 (uintptr_t)(data) - (uintptr_t)g_slab_region < SLAB_REGION_SIZE)
+#define SLAB(data)\
+	(&g_slabs[((uintptr_t)(data) - (uintptr_t)g_slab_region) / SLAB_SIZE])
+#define SLAB_PAGE(slab)\
+	(g_slab_region + (size_t)((slab) - g_slabs) * SLAB_SIZE)
+#define DECAY_MS 1000
+#define MAX_DIRTY (1024LU * 1024 * 16)
+#define DECAY_TICK 256
+#define MAP_CACHE_COUNT 8
+#define MAP_CACHE_BYTES (1024LU * 1024 * 32)
+#define DECAY_STEPS 8
+#define NUMA_MAX_NODES 8
+#define NUMA_MASK_BITS (sizeof(unsigned long) * 8)
+#define NUMA_MPOL_PREFERRED 1
+#define CENTRAL(i)\
+	(&g_central[g_node % NUMA_MAX_NODES][(i)])
+#define PROF_DEPTH 32
+#define PROF_SKIP 2
+#define LG_PROF_SITES 12
+#define PROF_SITES (1LU << LG_PROF_SITES)
+#define LG_PROF_LIVE 16
+#define PROF_LIVE (1LU << LG_PROF_LIVE)
+#define LG_PROF_FILTER 14
+#define PROF_FILTER (1LU << LG_PROF_FILTER)
+#define PROF_RECHECK (1LL << 24)
+#define PROF_HASH(value, lg)\
+	(size_t)(((uint64_t)(value) * 0x9E3779B97F4A7C15LLU) >> (64 - (lg)))
+#define PROF_PTR_HASH(data, lg)\
+	PROF_HASH((uintptr_t)(data) >> 4, (lg))
+#ifdef ALLOC_DEBUG
+#define DEBUG_CANARY 1
+#define DEBUG_POISON 2
+#define DEBUG_QUARANTINE 4
+#define DEBUG_GUARD 8
+#define DEBUG_ABORT 16
+#define DEBUG_SIZE 32
+#define DEBUG_ALL 63
+#define DEBUG_REDZONE MIN_ALLOC_SIZE
+#define CANARY_BYTE 0xAC
+#define POISON_BYTE 0xDF
+#define LG_DEBUG_BLOCKS 12
+#define QUARANTINE_COUNT 1024
+#define QUARANTINE_BYTES (1024LU * 1024 * 4)
+#define DEBUG_ON()\
+	(atomic_load_explicit(&g_debug, memory_order_relaxed) && !g_debug_busy)
+#endif
+#define TRACE_MAGIC 0x315254434F4C4C41LLU
+#define TRACE_BUF_SIZE (1024LU * 64)
+#define TRACE_RECORD_MAX 64
+#define TRACE_FLUSH_MS 100
+#define ZIGZAG(value)\
+	((uint64_t)(value) << 1 ^ (uint64_t)((int64_t)(value) >> 63))
+#define UNZIGZAG(value)\
+	((uint64_t)((value) >> 1) ^ (uint64_t)-(int64_t)((value) & 1))
+#ifdef ALLOC_TRACE
+#define TRACE(op, id, new_id, size)\
+	trace_record((op), (id), (new_id), (size))
+#define TRACE_PAUSE(paused) (g_trace_busy = (paused))
+#else
+#define TRACE(op, id, new_id, size)\
+	((void)(op), (void)(id), (void)(new_id), (void)(size))
+#define TRACE_PAUSE(paused) ((void)(paused))
+#endif
 
 /** Enum containing the possible pointer states. */
 typedef enum ptr_state {
 	FREE,
 	VALID,
+	REMOTE,
+	CACHED,
 } ptr_state_t;
 
+/** Heap struct containing the state shared with other threads.
+ * Forward declaration. */
+typedef struct heap heap_t;
+
 /** Arena struct tontaining the main memory buffer and metadata.
  * Forward declaration. */
 typedef struct arena arena_t;
@@ -84,17 +273,345 @@ struct ptr {
 	ptr_t *next_free;
 	ptr_t *prev_free;
 	ptr_state_t state;
+	uint32_t pages;
+};
+
+/** Stats struct containing the counters of a heap.
+ * Forward declaration. */
+typedef struct stats stats_t;
+
+/** Stats struct containing the counters of a heap. Every counter only
+ * grows and is only written by the owner thread, so updates are plain
+ * relaxed stores and other threads aggregate them on demand. */
+struct stats {
+	atomic_size_t new_bytes;
+	atomic_size_t del_bytes;
+	atomic_size_t ptr_new;
+	atomic_size_t ptr_del;
+	atomic_size_t fast_path;
+	atomic_size_t slow_path;
+	atomic_size_t mapped_bytes;
+	atomic_size_t unmapped_bytes;
+	atomic_size_t arena_new;
+	atomic_size_t arena_del;
+	atomic_size_t mmap_new;
+	atomic_size_t mmap_del;
+	atomic_size_t mmap_calls;
+	atomic_size_t munmap_calls;
+	atomic_size_t mremap_calls;
+	atomic_size_t madvise_calls;
+	atomic_size_t class_new[NUM_SIZE_CLASSES];
+	atomic_size_t class_del[NUM_SIZE_CLASSES];
+};
+
+/** Dirty page struct containing the metadata of a released page that
+ * wasn't purged yet.
+ * Forward declaration. */
+typedef struct dirty dirty_t;
+
+/** Dirty page struct containing the metadata of a released page that
+ * wasn't purged yet. It occupies the first bytes of the page itself. */
+struct dirty {
+	dirty_t *next;
+	dirty_t *prev;
+	uint64_t time;
+};
+
+/** Slab struct containing the out-of-band metadata of a slab page.
+ * Forward declaration. */
+typedef struct slab slab_t;
+
+/** Slab struct containing the out-of-band metadata of a slab page.
+ * Every slab page serves objects of a single size so the objects
+ * themselves carry no header. The node is the NUMA node the page is
+ * bound to. */
+struct slab {
+	void *free;
+	size_t offset;
+	size_t size;
+	size_t used;
+	size_t capacity;
+	heap_t *owner;
+	size_t node;
+	slab_t *next;
+	slab_t *prev;
 };
 
 /** Arena struct tontaining the main memory buffer and metadata. */
 struct arena {
-	alignas(max_align_t) unsigned char buff[ARENA_SIZE];
+	alignas(max_align_t) unsigned char buff[ARENA_BUFF_SIZE];
 	size_t offset;
+	size_t clean;
 	ptr_t *ptrs_tail;
+	heap_t *owner;
 	arena_t *next;
 	arena_t *prev;
 };
 
+_Static_assert(sizeof(arena_t) <= ARENA_SIZE, "arena_t must fit in a page.");
+_Static_assert(sizeof(uintptr_t) == sizeof(uint64_t),
+	"The tagged heads of the central free lists need 64-bit pointers.");
+_Static_assert(ALLOC_FAST_MAX_SIZE == SLAB_MAX_SIZE,
+	"alloc_new_fast() must only serve slab sizes.");
+
+/** Chunk struct containing the metadata of a reserved region that
+ * arena pages are carved from.
+ * Forward declaration. */
+typedef struct chunk chunk_t;
+
+/** Chunk struct containing the metadata of a reserved region that
+ * arena pages and page runs are carved from. It occupies the first page of
+ * the chunk and is bound to the NUMA node of the thread that reserved it.
+ * The owner is the heap of that thread. Released pages still on the dirty
+ * list of the owner are marked in the dirty bitmap. */
+struct chunk {
+	chunk_t *next;
+	size_t offset;
+	size_t free;
+	size_t node;
+	heap_t *owner;
+	uint64_t free_pages[CHUNK_PAGES / 64];
+	uint64_t dirty_pages[CHUNK_PAGES / 64];
+};
+
+/** Map struct containing a mapping kept for reuse after the large block
+ * it held was freed.
+ * Forward declaration. */
+typedef struct map map_t;
+
+/** Map struct containing a mapping kept for reuse after the large block
+ * it held was freed. */
+struct map {
+	void *head;
+	size_t len;
+};
+
+/** Heap struct containing the state shared with other threads.
+ * Its address identifies the owner thread of arenas and slabs. Heaps are
+ * never unmapped so blocks can be handed over to them after their owner
+ * thread exited. The stats live on their own cache lines so remote frees
+ * don't contend with the owner updating them. The released pages of the
+ * owner are kept in the dirty list, oldest first, until they decay. When
+ * the owner thread exits, its thread local state is parked in the heap and
+ * the heap is put on the orphan list until a new thread adopts it. */
+struct heap {
+	alignas(64) _Atomic(void*) remote_free;
+	heap_t *next;
+	alignas(64) pthread_mutex_t dirty_mutex;
+	dirty_t *dirty_head;
+	dirty_t *dirty_tail;
+	atomic_size_t dirty_count;
+	alignas(64) stats_t stats;
+	heap_t *orphan_next;
+	arena_t *arenas;
+	arena_t *arena_tail;
+	ptr_t *free_ptr_tails[NUM_SIZE_CLASSES];
+	slab_t *slab_tails[NUM_SLAB_SIZES];
+	chunk_t *chunks;
+	size_t chunk_free_pages;
+};
+
+/** Region page struct containing the header of a page owned by a region.
+ * Forward declaration. */
+typedef struct region_page region_page_t;
+
+/** Region page struct containing the header of a page owned by a region.
+ * The rest of the page is handed out by bumping the offset of the region. */
+struct region_page {
+	region_page_t *next;
+};
+
+/** Region large struct containing a block of a region allocated with
+ * mmap().
+ * Forward declaration. */
+typedef struct region_large region_large_t;
+
+/** Region large struct containing a block of a region allocated with
+ * mmap(). It's bumped from the region itself. */
+struct region_large {
+	region_large_t *next;
+	void *data;
+};
+
+/** Region struct containing the state of a bump allocator whose blocks are
+ * released together. It lives at the start of its first page. */
+struct alloc_region {
+	region_page_t *head;
+	region_page_t *page;
+	size_t offset;
+	region_large_t *large;
+	heap_t *owner;
+};
+
+/** Thread cache struct containing a linked list of free blocks of a
+ * size class that are kept ready for the calling thread.
+ * Forward declaration. */
+typedef struct tcache tcache_t;
+
+/** Thread cache struct containing a linked list of free blocks of a
+ * size class that are kept ready for the calling thread. The blocks are
+ * linked through their first word. */
+struct tcache {
+	void *head;
+	size_t count;
+};
+
+/** Central struct containing a lock-free stack of batches of free blocks
+ * of a size class that are shared by all threads.
+ * Forward declaration. */
+typedef struct central central_t;
+
+/** Central struct containing a lock-free stack of batches of free blocks
+ * of a size class that are shared by all threads. The blocks of a batch
+ * are linked through their first word and the batches through the second
+ * word of their first block. The upper bits of the head hold a tag that is
+ * bumped on every change, so a batch popped and pushed back by another
+ * thread in the meantime doesn't pass for the old head (ABA). */
+struct central {
+	_Atomic uint64_t head;
+	atomic_size_t count;
+};
+
+/** Cache struct containing the constructed objects of a type. The free
+ * objects are kept on a central free list, linked through two words placed
+ * after the object, so their constructed state is left intact. */
+struct alloc_cache {
+	central_t free;
+	size_t size;
+	size_t align;
+	size_t link;
+	void (*ctor)(void*);
+	void (*dtor)(void*);
+	atomic_size_t gets;
+	atomic_size_t ctor_calls;
+};
+
+/** Profile site struct containing the counters of a sampled call site.
+ * Forward declaration. */
+typedef struct prof_site prof_site_t;
+
+/** Profile site struct containing the counters of a sampled call site.
+ * The counters are estimates of every allocation, not just the sampled
+ * ones. A site with a depth of 0 is unused. */
+struct prof_site {
+	uint64_t hash;
+	size_t depth;
+	void *frames[PROF_DEPTH];
+	size_t alloc_count;
+	size_t alloc_bytes;
+	size_t live_count;
+	size_t live_bytes;
+};
+
+/** Profile live struct containing a sampled block that's still allocated.
+ * Forward declaration. */
+typedef struct prof_live prof_live_t;
+
+/** Profile live struct containing a sampled block that's still allocated.
+ * An entry with a NULL pointer is unused. */
+struct prof_live {
+	void *data;
+	prof_site_t *site;
+	size_t count;
+	size_t bytes;
+};
+
+/** Enum containing the operations recorded in a trace. */
+typedef enum trace_op {
+	TRACE_NEW,
+	TRACE_DEL,
+	TRACE_RESIZE,
+} trace_op_t;
+
+/** Trace chunk struct containing the header of a chunk of a trace.
+ * Forward declaration. */
+typedef struct trace_chunk trace_chunk_t;
+
+/** Trace chunk struct containing the header of a chunk of a trace. A trace
+ * is a stream of chunks, each of them holding len bytes of records of one
+ * thread right after the header. The sequence number and the time of the
+ * first record are stored in the header and every record is encoded as
+ * the difference from the one before it, so a chunk can be decoded on its
+ * own. */
+struct trace_chunk {
+	uint64_t magic;
+	uint64_t seq;
+	uint64_t time;
+	uint32_t thread;
+	uint32_t len;
+};
+
+/** Trace record struct containing a decoded record of a trace.
+ * Forward declaration. */
+typedef struct trace_record trace_record_t;
+
+/** Trace record struct containing a decoded record of a trace. The
+ * sequence number orders the records of all threads, the time is in
+ * nanoseconds since the trace was started and the id is the address of the
+ * block. Only resized blocks have a new id. */
+struct trace_record {
+	uint64_t seq;
+	uint64_t time;
+	uint64_t id;
+	uint64_t new_id;
+	uint64_t size;
+	uint32_t thread;
+	trace_op_t op;
+};
+
+#ifdef ALLOC_TRACE
+/** Trace buffer struct containing a chunk of a trace being filled or
+ * waiting to be written.
+ * Forward declaration. */
+typedef struct trace_buf trace_buf_t;
+
+/** Trace buffer struct containing a chunk of a trace being filled or
+ * waiting to be written. The data follows the header so the chunk is
+ * written with one call. The last record is the base of the next one. */
+struct trace_buf {
+	trace_buf_t *next;
+	trace_record_t last;
+	trace_chunk_t chunk;
+	unsigned char data[TRACE_BUF_SIZE];
+};
+
+/** Trace slot struct containing the trace buffer of a thread.
+ * Forward declaration. */
+typedef struct trace_slot trace_slot_t;
+
+/** Trace slot struct containing the trace buffer of a thread. The mutex
+ * is only contended when the trace thread takes the buffer. The slot of an
+ * exited thread is unused and it's given to the next new thread. */
+struct trace_slot {
+	pthread_mutex_t mutex;
+	trace_slot_t *next;
+	trace_buf_t *buf;
+	uint32_t thread;
+	bool used;
+};
+#endif
+
+#ifdef ALLOC_DEBUG
+/** Debug block struct containing the out-of-band metadata of a block
+ * allocated in debug mode.
+ * Forward declaration. */
+typedef struct debug_block debug_block_t;
+
+/** Debug block struct containing the out-of-band metadata of a block
+ * allocated in debug mode. The block is surrounded by canaries from base
+ * up to data and from the end of the block up to the end of the redzone.
+ * A guarded block has its own mapping with a guard page on both sides of
+ * it. An entry with a NULL pointer is unused. */
+struct debug_block {
+	void *data;
+	unsigned char *base;
+	size_t size;
+	size_t len;
+	ptr_state_t state;
+	bool poisoned;
+};
+#endif
+
 /** Global instance of the arena struct that acts as the head in the linked list.
  * Forward declaration. */
 extern _Thread_local arena_t g_arena_head;
@@ -107,153 +624,3482 @@ extern _Thread_local arena_t *g_arena_tail;
 
 /** Global instance of an array of linked lists containing free pointers.
  * Forward declaration. */
-extern _Thread_local ptr_t *g_free_ptr_tails[NUM_ALLOC_SIZES];
-// extern ptr_t *g_free_ptr_tails[NUM_ALLOC_SIZES];
+extern _Thread_local ptr_t *g_free_ptr_tails[NUM_SIZE_CLASSES];
+// extern ptr_t *g_free_ptr_tails[NUM_SIZE_CLASSES];
 
-/** Expands the arena by allocating a new node with mmap().
- * \return 0 on success or 1 on failure. */
-static inline int arena_expand() {
-	g_arena_tail->next = (arena_t*)MMAP(sizeof(arena_t));
-	if (!g_arena_tail->next) RET_ERR("Failed to allocate new arena with mmap.", 1);
-	g_arena_tail->next->prev = g_arena_tail;
-	g_arena_tail = g_arena_tail->next;
-	g_arena_tail->next = NULL;
-	g_arena_tail->offset = 0;
-	g_arena_tail->ptrs_tail = NULL;
-	RET_OK(0);
-}
+/** Global pointer to the reserved region slab pages are carved from.
+ * Forward declaration. */
+extern unsigned char *g_slab_region;
 
-/** Removes an arena node from the linked list.
- * \param arena The arena node to be deleted.
- * \return 0 on success or 1 on failure. */
-static inline int arena_del(arena_t *arena) {
-	if (!arena) RET_ERR("arena cannot be NULL.", 1);
-	if (arena == &g_arena_head) RET_ERR("arena head cannot be deleted.", 1);
-	if (arena->prev && arena->next) {
-		arena->prev->next = arena->next;
-		arena->next->prev = arena->prev;
-		if (munmap(arena, sizeof(arena_t))) RET_ERR("Failed to unmap arena.", 1);
-	} else if (!arena->next) {
-		g_arena_tail = arena->prev;
-		if (munmap(g_arena_tail->next, sizeof(arena_t)))
-			RET_ERR("Failed to unmap arena.", 1);
-		g_arena_tail->next = NULL;
-	}
-	RET_OK(0);
-}
+/** Global array of slab descriptors, one for each page of the slab region.
+ * Forward declaration. */
+extern slab_t *g_slabs;
 
-/** Resets all global variables. Unmaps heap memory.
- * \return 0 on success or 1 on failure. */
-static inline int reset() {
-	error_reset();
-	while (g_arena_tail && g_arena_tail->prev) {
-		g_arena_tail = g_arena_tail->prev;
-		if (munmap(g_arena_tail->next, sizeof(arena_t)) == -1)
-			RET_ERR("Failed to unmap arena.", 1);
-	}
-	memset(&g_arena_head, 0, sizeof(arena_t));
-	g_arena_tail = &g_arena_head;
-	memset(g_free_ptr_tails, 0, sizeof(g_free_ptr_tails));
-	RET_OK(0);
-}
+/** Global number of slab pages handed out from the slab region.
+ * Forward declaration. */
+extern atomic_size_t g_slab_count;
 
-/** Returns a pointer to a memory block allocated in the arena.
- * \param size The size of the block to be allocated. 
- * \return The pointer to the allocated data or NULL on failure. */
-static inline void *arena_use(size_t size) {
-	if (!size) RET_ERR("size cannot be 0.", NULL);
-	if (TOTAL_SIZE(size) > ARENA_SIZE) RET_ERR("size is too big.", NULL);
-	if (g_arena_tail->offset + TOTAL_SIZE(size) > ARENA_SIZE)
-		if (arena_expand()) RET_ERR("Failed to expand arena.", NULL);
-	if (!g_arena_tail->ptrs_tail) {
-		g_arena_tail->ptrs_tail = (ptr_t*)&g_arena_tail->buff[g_arena_tail->offset];
-	} else {
-		g_arena_tail->ptrs_tail->next_valid =
-			(ptr_t*)&g_arena_tail->buff[g_arena_tail->offset];
-		g_arena_tail->ptrs_tail->next_valid->prev_valid =
-			g_arena_tail->ptrs_tail;
-		g_arena_tail->ptrs_tail =
-			g_arena_tail->ptrs_tail->next_valid;
-	}
-	g_arena_tail->ptrs_tail->next_valid = NULL;
-	g_arena_tail->ptrs_tail->size = size;
-	g_arena_tail->ptrs_tail->state = VALID;
-	g_arena_tail->ptrs_tail->arena = g_arena_tail;
-	g_arena_tail->ptrs_tail->data = 
-		(unsigned char*)g_arena_tail->ptrs_tail + PTR_ALIGNED_SIZE;
-	g_arena_tail->offset += TOTAL_SIZE(size);
-	RET_OK(g_arena_tail->ptrs_tail->data);
-}
+/** Global once flag guarding the mapping of the slab region.
+ * Forward declaration. */
+extern pthread_once_t g_slab_once;
 
-/** Marks a pointer and its associated data free.
- * \param data The poiter to the data to be freed.
- * \return 0 on sucecss or 1 on failure. */
-static inline int ptr_free(void *data) {
-	if (!data) RET_ERR("data cannot be NULL.", 1);
-	ptr_t *ptr = (ptr_t*)((unsigned char*)data - PTR_ALIGNED_SIZE);
-	if (ptr->state != VALID) RET_ERR("Invalid argument.", 1);
-	if (!ptr->arena) {
-		if (munmap(ptr, TOTAL_SIZE(ptr->size)) == -1)
-			RET_ERR("Failed to unmap memory with munmap().", 1);
-		RET_OK(0);
-	}
-	if (
-		!ptr->arena->ptrs_tail->prev_valid &&
-		ptr->arena->prev &&
-		ptr->arena->prev->offset < ARENA_SIZE - MIN_ALLOC_SIZE - PTR_ALIGNED_SIZE
-	) {
-		arena_del(ptr->arena);
-		RET_OK(0);
-	}
-	size_t i = FREE_PTR_INDEX(ptr->size);
-	if (!g_free_ptr_tails[i]) {
-		g_free_ptr_tails[i] = ptr;
-		ptr->prev_free = NULL;
-	} else {
-		g_free_ptr_tails[i]->next_free = ptr;
-		g_free_ptr_tails[i]->next_free->prev_free = g_free_ptr_tails[i];
-		g_free_ptr_tails[i] = g_free_ptr_tails[i]->next_free;
-	}
-	g_free_ptr_tails[i]->next_free = NULL;
-	g_free_ptr_tails[i]->state = FREE;
-	RET_OK(0);
-}
+/** Global instance of an array of linked lists containing slabs with
+ * free slots.
+ * Forward declaration. */
+extern _Thread_local slab_t *g_slab_tails[NUM_SLAB_SIZES];
 
-/** Reuses a pointer and its associated data that was previously marked free.
- * \param size The size of the memory block to be reused. 
- * \return A pointer to the memory block or NULL on failure. */
-static inline void *free_ptr_use(size_t size) {
-	if (!size) RET_ERR("size cannot be 0.", NULL);
-	ptr_t *ptr = g_free_ptr_tails[FREE_PTR_INDEX(size)];
-	if (!g_free_ptr_tails[FREE_PTR_INDEX(size)])
-		RET_ERR("No matching free pointer found.", NULL);
-	if (ptr->prev_free) {
-		ptr->prev_free->next_free = NULL;
-		g_free_ptr_tails[FREE_PTR_INDEX(size)] = ptr->prev_free;
-	} else {
-		g_free_ptr_tails[FREE_PTR_INDEX(size)] = NULL;
-	}
-	ptr->next_free = NULL;
-	ptr->prev_free = NULL;
-	ptr->state = VALID;
-	RET_OK(ptr->data);
-}
+/** Global instance of a linked list containing empty slabs.
+ * Forward declaration. */
+extern _Thread_local slab_t *g_slab_pool;
 
-/** Allocates a block of memory in the heap using mmap().
- * \param size The size of the memory block to be allocated. 
- * \return A pointer to the memory block or NULL on failure. */
-static inline void *mmap_use(size_t size) {
-	if (!size) RET_ERR("size cannot be 0.", NULL);
-	if (TOTAL_SIZE(size) <= ARENA_SIZE) RET_ERR("size is too small.", NULL);
-	ptr_t *ptr = (ptr_t*)MMAP(TOTAL_SIZE(size));
-	if (!ptr) RET_ERR("Failed to allocate ptr with mmap().", NULL);
-	ptr->data = (unsigned char*)ptr + PTR_ALIGNED_SIZE;
-	ptr->state = VALID;
-	ptr->arena = NULL;
-	ptr->prev_valid = NULL;
-	ptr->next_valid = NULL;
-	ptr->size = size;
-	RET_OK(ptr->data);
-}
+/** Global number of empty slabs in the pool of the calling thread.
+ * Forward declaration. */
+extern _Thread_local size_t g_slab_pool_count;
+
+/** Global instance of a linked list containing purged empty slabs shared
+ * by all threads.
+ * Forward declaration. */
+extern slab_t *g_slab_free;
+
+/** Global number of slabs in the shared pool.
+ * Forward declaration. */
+extern atomic_size_t g_slab_free_count;
+
+/** Global mutex guarding the shared pool of slabs.
+ * Forward declaration. */
+extern pthread_mutex_t g_slab_mutex;
+
+/** Global pointer to the heap struct owned by the calling thread.
+ * Forward declaration. */
+extern _Thread_local heap_t *g_heap;
+
+/** Global pointer to the page heap structs are carved from.
+ * Forward declaration. */
+extern heap_t *g_heap_page;
+
+/** Global number of heap structs carved from the current heap page.
+ * Forward declaration. */
+extern size_t g_heap_count;
+
+/** Global mutex guarding the allocation of heap structs.
+ * Forward declaration. */
+extern pthread_mutex_t g_heap_mutex;
+
+/** Global instance of a linked list containing every heap struct.
+ * Forward declaration. */
+extern heap_t *g_heaps;
+
+/** Global instance of a linked list containing the heaps of exited threads
+ * waiting to be adopted.
+ * Forward declaration. */
+extern heap_t *g_orphans;
+
+/** Global key whose destructor parks the heap of an exiting thread.
+ * Forward declaration. */
+extern pthread_key_t g_heap_key;
+
+/** Global once flag guarding the creation of the heap key.
+ * Forward declaration. */
+extern pthread_once_t g_heap_once;
+
+/** Global instance of a linked list containing the chunks reserved by the
+ * calling thread.
+ * Forward declaration. */
+extern _Thread_local chunk_t *g_chunks;
+
+/** Global number of released pages in the chunks of the calling thread.
+ * Forward declaration. */
+extern _Thread_local size_t g_chunk_free_pages;
+
+/** Global instance of an array of mappings the calling thread keeps for
+ * reuse, oldest first.
+ * Forward declaration. */
+extern _Thread_local map_t g_map_cache[MAP_CACHE_COUNT];
+
+/** Global number of mappings in the map cache of the calling thread.
+ * Forward declaration. */
+extern _Thread_local size_t g_map_count;
+
+/** Global number of bytes in the map cache of the calling thread.
+ * Forward declaration. */
+extern _Thread_local size_t g_map_bytes;
+
+/** Global number of milliseconds released pages are kept before being purged.
+ * Forward declaration. */
+extern atomic_size_t g_decay_ms;
+
+/** Global number of bytes of released pages a heap may keep.
+ * Forward declaration. */
+extern atomic_size_t g_max_dirty;
+
+/** Global number of slow path allocations since the calling thread last
+ * purged its decayed pages.
+ * Forward declaration. */
+extern _Thread_local size_t g_decay_tick;
+
+/** Global mutex serializing changes of the config.
+ * Forward declaration. */
+extern pthread_mutex_t g_config_mutex;
+
+/** Global mutex guarding the state of the background decay thread.
+ * Forward declaration. */
+extern pthread_mutex_t g_decay_mutex;
+
+/** Global condition variable waking the background decay thread.
+ * Forward declaration. */
+extern pthread_cond_t g_decay_cond;
+
+/** Global handle of the background decay thread.
+ * Forward declaration. */
+extern pthread_t g_decay_thread;
+
+/** Global flag telling whether the background decay thread is running.
+ * Forward declaration. */
+extern bool g_decay_running;
+
+/** Global mean number of bytes between two sampled allocations.
+ * Forward declaration. */
+extern atomic_size_t g_prof_rate;
+
+/** Global time sampling was enabled at in milliseconds.
+ * Forward declaration. */
+extern _Atomic uint64_t g_prof_start;
+
+/** Global number of bytes the calling thread allocates before the next
+ * sample.
+ * Forward declaration. */
+extern _Thread_local int64_t g_prof_bytes;
+
+/** Global state of the random generator of the calling thread.
+ * Forward declaration. */
+extern _Thread_local uint64_t g_prof_seed;
+
+/** Global flag telling whether the calling thread is taking a sample.
+ * Forward declaration. */
+extern _Thread_local bool g_prof_busy;
+
+/** Global mutex guarding the sites and the live blocks of the profile.
+ * Forward declaration. */
+extern pthread_mutex_t g_prof_mutex;
+
+/** Global hash table of the sampled call sites.
+ * Forward declaration. */
+extern prof_site_t g_prof_sites[PROF_SITES];
+
+/** Global hash table of the sampled blocks that are still allocated.
+ * Forward declaration. */
+extern prof_live_t g_prof_live[PROF_LIVE];
+
+/** Global number of sampled blocks that are still allocated.
+ * Forward declaration. */
+extern atomic_size_t g_prof_live_count;
+
+/** Global array of counters of the sampled blocks hashed to each slot, so
+ * frees can tell that a block wasn't sampled without taking the mutex.
+ * Forward declaration. */
+extern atomic_uint g_prof_filter[PROF_FILTER];
+
+/** Global instance of an array of thread caches, one for each size class.
+ * Forward declaration. */
+extern _Thread_local tcache_t g_tcache[NUM_SIZE_CLASSES];
+
+/** Global instance of the fast path state of alloc_new_fast().
+ * Forward declaration. */
+extern _Thread_local alloc_fast_t g_fast;
+
+/** Global array of central free lists, one for each NUMA node and size
+ * class.
+ * Forward declaration. */
+extern central_t g_central[NUMA_MAX_NODES][NUM_SIZE_CLASSES];
+
+/** Global number of NUMA nodes.
+ * Forward declaration. */
+extern size_t g_numa_nodes;
+
+/** Global flag telling whether the NUMA topology is faked.
+ * Forward declaration. */
+extern bool g_numa_fake;
+
+/** Global NUMA node the calling thread last ran on.
+ * Forward declaration. */
+extern _Thread_local size_t g_node;
+
+#ifdef ALLOC_DEBUG
+/** Global set of the enabled debug features.
+ * Forward declaration. */
+extern atomic_uint g_debug;
+
+/** Global flag telling whether the calling thread is inside the debug layer.
+ * Forward declaration. */
+extern _Thread_local bool g_debug_busy;
+
+/** Global mutex guarding the debug table and the quarantine.
+ * Forward declaration. */
+extern pthread_mutex_t g_debug_mutex;
+
+/** Global hash table of the blocks allocated in debug mode.
+ * Forward declaration. */
+extern debug_block_t *g_debug_blocks;
+
+/** Global base 2 logarithm of the number of entries in the debug table.
+ * Forward declaration. */
+extern size_t g_debug_lg;
+
+/** Global number of used entries in the debug table.
+ * Forward declaration. */
+extern size_t g_debug_count;
+
+/** Global ring of the freed blocks held back from reuse.
+ * Forward declaration. */
+extern void *g_quarantine[QUARANTINE_COUNT];
+
+/** Global index of the oldest block in the quarantine.
+ * Forward declaration. */
+extern size_t g_quarantine_head;
+
+/** Global number of blocks in the quarantine.
+ * Forward declaration. */
+extern size_t g_quarantine_count;
+
+/** Global number of bytes in the quarantine.
+ * Forward declaration. */
+extern size_t g_quarantine_bytes;
+#endif
+
+#ifdef ALLOC_TRACE
+/** Global flag telling whether allocations are traced.
+ * Forward declaration. */
+extern atomic_bool g_trace_on;
+
+/** Global flag telling whether the calling thread is inside the trace
+ * writer or in a call that's traced as a whole.
+ * Forward declaration. */
+extern _Thread_local bool g_trace_busy;
+
+/** Global trace slot of the calling thread.
+ * Forward declaration. */
+extern _Thread_local trace_slot_t *g_trace_slot;
+
+/** Global sequence number of the next trace record.
+ * Forward declaration. */
+extern _Atomic uint64_t g_trace_seq;
+
+/** Global time of the monotonic clock in nanoseconds when the trace was
+ * started.
+ * Forward declaration. */
+extern uint64_t g_trace_start;
+
+/** Global number of threads that got a trace slot.
+ * Forward declaration. */
+extern atomic_uint g_trace_threads;
+
+/** Global file descriptor of the trace file.
+ * Forward declaration. */
+extern int g_trace_fd;
+
+/** Global mutex guarding the trace slots, the buffer pool and the queue.
+ * Forward declaration. */
+extern pthread_mutex_t g_trace_mutex;
+
+/** Global condition variable that wakes up the trace thread.
+ * Forward declaration. */
+extern pthread_cond_t g_trace_cond;
+
+/** Global handle of the trace thread.
+ * Forward declaration. */
+extern pthread_t g_trace_thread;
+
+/** Global flag telling whether the trace thread is running.
+ * Forward declaration. */
+extern bool g_trace_running;
+
+/** Global linked list of the trace slots.
+ * Forward declaration. */
+extern trace_slot_t *g_trace_slots;
+
+/** Global linked list of the unused trace buffers.
+ * Forward declaration. */
+extern trace_buf_t *g_trace_pool;
+
+/** Global head of the queue of trace buffers waiting to be written.
+ * Forward declaration. */
+extern trace_buf_t *g_trace_queue;
+
+/** Global tail of the queue of trace buffers waiting to be written.
+ * Forward declaration. */
+extern trace_buf_t *g_trace_queue_tail;
+#endif
+
+/** Parses a list of NUMA nodes in the format of sysfs, like "0-3,5".
+ * \param list The list of nodes.
+ * \return The highest node of the list plus 1, or 1 if the list is empty. */
+static inline size_t numa_parse(const char *list) {
+	if (!list) return 1;
+	size_t nodes = 1;
+	size_t node = 0;
+	bool digits = false;
+	for (;; list++) {
+		if (*list >= '0' && *list <= '9') {
+			node = node * 10 + (size_t)(*list - '0');
+			digits = true;
+			continue;
+		}
+		if (digits && node + 1 > nodes) nodes = node + 1;
+		node = 0;
+		digits = false;
+		if (!*list) return nodes;
+	}
+}
+
+/** Detects the number of NUMA nodes from sysfs, falling back to a single
+ * node if it's not available. The ALLOC_NUMA_NODES environment variable
+ * fakes a topology of that many nodes instead, with the CPUs spread over
+ * them round robin and memory left unbound.
+ * \return 0 on success or 1 on failure. */
+static inline int numa_init() {
+	const char *env = getenv("ALLOC_NUMA_NODES");
+	if (env) {
+		size_t nodes = (size_t)strtoull(env, NULL, 10);
+		g_numa_nodes = nodes ? nodes : 1;
+		g_numa_fake = true;
+		RET_OK(0);
+	}
+	g_numa_nodes = 1;
+	g_numa_fake = false;
+	int fd = open("/sys/devices/system/node/online", O_RDONLY | O_CLOEXEC);
+	if (fd == -1) RET_OK(0);
+	char buff[256];
+	ssize_t len = read(fd, buff, sizeof(buff) - 1);
+	close(fd);
+	if (len < 0) RET_ERR("Failed to read NUMA nodes.", 1);
+	buff[len] = '\0';
+	g_numa_nodes = numa_parse(buff);
+	RET_OK(0);
+}
+
+/** Returns the NUMA node of the CPU the calling thread runs on.
+ * \return The node or 0 on single node machines. */
+static inline size_t numa_node() {
+	if (g_numa_nodes <= 1) return 0;
+	unsigned cpu = 0;
+	unsigned node = 0;
+	if (syscall(SYS_getcpu, &cpu, &node, NULL)) return 0;
+	return g_numa_fake ? cpu % g_numa_nodes : node;
+}
+
+/** Makes memory that wasn't touched yet prefer a NUMA node with mbind().
+ * It does nothing on single node machines and with a faked topology.
+ * \param addr The start of the memory. It must be page aligned.
+ * \param len The length of the memory.
+ * \param node The node to be preferred.
+ * \return 0 on success or 1 on failure. */
+static inline int numa_bind(void *addr, size_t len, size_t node) {
+	if (g_numa_nodes <= 1 || g_numa_fake) RET_OK(0);
+	if (node >= NUMA_MASK_BITS) RET_ERR("node is out of range.", 1);
+	unsigned long mask = 1LU << node;
+	if (syscall(SYS_mbind, addr, len, NUMA_MPOL_PREFERRED, &mask,
+		NUMA_MASK_BITS + 1, 0)) RET_ERR("Failed to bind memory with mbind().", 1);
+	RET_OK(0);
+}
+
+/** Reserves a new chunk aligned to its size with mmap() and binds it to the
+ * NUMA node of the calling thread. Chunks mapped above the addresses the
+ * tagged heads of the central free lists can hold are given back.
+ * With ALLOC_HUGEPAGES defined the chunk is advised to use huge pages.
+ * \return 0 on success or 1 on failure. */
+static inline int chunk_new() {
+	unsigned char *map = (unsigned char*)MMAP_NORESERVE(CHUNK_SIZE * 2);
+	if (map == MAP_FAILED) RET_ERR("Failed to reserve chunk with mmap().", 1);
+	unsigned char *chunk = (unsigned char*)CHUNK(map + CHUNK_SIZE - 1);
+	size_t head = (size_t)(chunk - map);
+	if (head && munmap(map, head))
+		RET_ERR("Failed to trim chunk with munmap().", 1);
+	if (munmap(chunk + CHUNK_SIZE, CHUNK_SIZE - head))
+		RET_ERR("Failed to trim chunk with munmap().", 1);
+	STAT_INC(mmap_calls);
+	STAT_ADD(munmap_calls, head ? 2 : 1);
+	if (!CENTRAL_FITS(chunk, CHUNK_SIZE)) {
+		munmap(chunk, CHUNK_SIZE);
+		STAT_INC(munmap_calls);
+		RET_ERR("Chunk is above the address range of the central free lists.", 1);
+	}
+	if (numa_bind(chunk, CHUNK_SIZE, g_node)) ERROR_SET("Failed to bind chunk.");
+#ifdef ALLOC_HUGEPAGES
+	madvise(chunk, CHUNK_SIZE, MADV_HUGEPAGE);
+#endif
+	chunk_t *c = (chunk_t*)chunk;
+	c->offset = 1;
+	c->free = 0;
+	c->node = g_node;
+	c->owner = g_heap;
+	memset(c->free_pages, 0, sizeof(c->free_pages));
+	memset(c->dirty_pages, 0, sizeof(c->dirty_pages));
+	c->next = g_chunks;
+	g_chunks = c;
+	RET_OK(0);
+}
+
+/** Returns the time of the monotonic clock in milliseconds.
+ * \return The time in milliseconds. */
+static inline uint64_t clock_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/** Returns the time of the monotonic clock in nanoseconds.
+ * \return The time in nanoseconds. */
+static inline uint64_t clock_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/** Returns the memory of a run of released pages to the kernel with a
+ * single madvise().
+ * \param heap The heap the pages were released to or NULL.
+ * \param page The first page to be purged.
+ * \param count The number of pages.
+ * \return 0 on success or 1 on failure. */
+static inline int pages_purge(heap_t *heap, arena_t *page, size_t count) {
+	if (!page) RET_ERR("page cannot be NULL.", 1);
+	if (!count) RET_ERR("count cannot be 0.", 1);
+	if (madvise(page, count * ARENA_SIZE, PAGE_PURGE_ADVICE))
+		RET_ERR("Failed to release pages with madvise().", 1);
+	if (heap) atomic_fetch_add_explicit(
+		&heap->stats.madvise_calls, 1, memory_order_relaxed);
+	RET_OK(0);
+}
+
+/** Returns the memory of a released page to the kernel with madvise().
+ * \param heap The heap the page was released to or NULL.
+ * \param page The page to be purged.
+ * \return 0 on success or 1 on failure. */
+static inline int page_purge(heap_t *heap, arena_t *page) {
+	if (pages_purge(heap, page, 1)) RET_ERR("Failed to purge page.", 1);
+	RET_OK(0);
+}
+
+/** Appends a released page to the dirty list of a heap.
+ * The dirty mutex of the heap must be held.
+ * \param heap The heap the page is released to.
+ * \param page The released page.
+ * \param time The time of the release in milliseconds. */
+static inline void dirty_push(heap_t *heap, arena_t *page, uint64_t time) {
+	dirty_t *dirty = (dirty_t*)page;
+	size_t i = CHUNK_PAGE_INDEX(page);
+	CHUNK(page)->dirty_pages[i / 64] |= 1LLU << (i % 64);
+	dirty->time = time;
+	dirty->next = NULL;
+	dirty->prev = heap->dirty_tail;
+	if (heap->dirty_tail) heap->dirty_tail->next = dirty;
+	else heap->dirty_head = dirty;
+	heap->dirty_tail = dirty;
+	atomic_store_explicit(&heap->dirty_count,
+		atomic_load_explicit(&heap->dirty_count, memory_order_relaxed) + 1,
+		memory_order_relaxed);
+}
+
+/** Removes a page from the dirty list of a heap.
+ * The dirty mutex of the heap must be held.
+ * \param heap The heap the page was released to.
+ * \param dirty The page to be removed. */
+static inline void dirty_unlink(heap_t *heap, dirty_t *dirty) {
+	size_t i = CHUNK_PAGE_INDEX(dirty);
+	CHUNK(dirty)->dirty_pages[i / 64] &= ~(1LLU << (i % 64));
+	if (dirty->prev) dirty->prev->next = dirty->next;
+	else heap->dirty_head = dirty->next;
+	if (dirty->next) dirty->next->prev = dirty->prev;
+	else heap->dirty_tail = dirty->prev;
+	atomic_store_explicit(&heap->dirty_count,
+		atomic_load_explicit(&heap->dirty_count, memory_order_relaxed) - 1,
+		memory_order_relaxed);
+}
+
+/** Returns a page of a chunk if it's on the dirty list of a heap and due to
+ * be purged, because it's older than the decay time or the heap holds more
+ * than the dirty limit. The dirty mutex of the heap must be held.
+ * \param heap The heap the page was released to.
+ * \param c The chunk of the page.
+ * \param i The index of the page in the chunk.
+ * \param now The current time in milliseconds.
+ * \param decay The decay time in milliseconds.
+ * \param max The dirty limit in pages.
+ * \return The page or NULL if it's not due. */
+static inline dirty_t *dirty_due(
+	heap_t *heap, chunk_t *c, size_t i, uint64_t now, uint64_t decay, size_t max
+) {
+	if (!i || i >= CHUNK_PAGES || !(c->dirty_pages[i / 64] & (1LLU << (i % 64))))
+		return NULL;
+	dirty_t *dirty = (dirty_t*)((unsigned char*)c + i * ARENA_SIZE);
+	if (now >= dirty->time && now - dirty->time >= decay) return dirty;
+	if (atomic_load_explicit(&heap->dirty_count, memory_order_relaxed) > max)
+		return dirty;
+	return NULL;
+}
+
+/** Purges the released pages of a heap that are older than the decay time,
+ * then the oldest ones while the heap holds more than the dirty limit.
+ * Neighbours of a page in its chunk that are due as well are purged along
+ * with it, so a released run takes a single madvise().
+ * \param heap The heap whose pages are to be purged.
+ * \param now The current time in milliseconds. UINT64_MAX purges every page.
+ * \return 0 on success or 1 on failure. */
+static inline int heap_decay(heap_t *heap, uint64_t now) {
+	if (!heap) RET_ERR("heap cannot be NULL.", 1);
+	uint64_t decay = atomic_load_explicit(&g_decay_ms, memory_order_relaxed);
+	size_t max = atomic_load_explicit(&g_max_dirty, memory_order_relaxed) /
+		ARENA_SIZE;
+	int ret = 0;
+	pthread_mutex_lock(&heap->dirty_mutex);
+	while (heap->dirty_head) {
+		chunk_t *c = CHUNK(heap->dirty_head);
+		size_t first = CHUNK_PAGE_INDEX(heap->dirty_head);
+		size_t last = first;
+		if (!dirty_due(heap, c, first, now, decay, max)) break;
+		dirty_unlink(heap, heap->dirty_head);
+		dirty_t *dirty;
+		while ((dirty = dirty_due(heap, c, first - 1, now, decay, max))) {
+			dirty_unlink(heap, dirty);
+			first--;
+		}
+		while ((dirty = dirty_due(heap, c, last + 1, now, decay, max))) {
+			dirty_unlink(heap, dirty);
+			last++;
+		}
+		arena_t *page = (arena_t*)((unsigned char*)c + first * ARENA_SIZE);
+		if (pages_purge(heap, page, last - first + 1)) ret = 1;
+	}
+	pthread_mutex_unlock(&heap->dirty_mutex);
+	if (ret) RET_ERR("Failed to purge pages.", 1);
+	RET_OK(0);
+}
+
+/** Carves a page out of the chunks of the calling thread on its NUMA node.
+ * Released pages are reused first, the lowest one of the newest chunk that
+ * has any, so single pages pack the front of the chunks and leave longer
+ * free runs behind them. Then the newest chunk is bumped and a new chunk is
+ * reserved only when all of them are used up. Pages bumped from a chunk
+ * are zero-filled by the kernel, including their clean mark, while reused
+ * pages are marked as not known to be zero.
+ * \return A pointer to the page or NULL on failure. */
+static inline arena_t *page_use() {
+	if (g_chunk_free_pages) {
+		arena_t *page = NULL;
+		if (g_heap) pthread_mutex_lock(&g_heap->dirty_mutex);
+		for (chunk_t *c = g_chunks; c && !page; c = c->next) {
+			if (!c->free || c->node != g_node) continue;
+			for (size_t i = 0; i < CHUNK_PAGES / 64 && !page; i++) {
+				if (!c->free_pages[i]) continue;
+				size_t bit = (size_t)__builtin_ctzll(c->free_pages[i]);
+				page = (arena_t*)((unsigned char*)c + (i * 64 + bit) * ARENA_SIZE);
+			}
+		}
+		if (page) {
+			size_t i = CHUNK_PAGE_INDEX(page);
+			if (g_heap && CHUNK(page)->dirty_pages[i / 64] & (1LLU << (i % 64)))
+				dirty_unlink(g_heap, (dirty_t*)page);
+			CHUNK(page)->free_pages[i / 64] &= ~(1LLU << (i % 64));
+			CHUNK(page)->free--;
+			g_chunk_free_pages--;
+		}
+		if (g_heap) pthread_mutex_unlock(&g_heap->dirty_mutex);
+		if (page) {
+			page->clean = ARENA_BUFF_SIZE;
+			STAT_INC(arena_new);
+			RET_OK(page);
+		}
+	}
+	chunk_t *c = g_chunks;
+	while (c && c->node != g_node) c = c->next;
+	if (!c || c->offset == CHUNK_PAGES) {
+		if (chunk_new()) RET_ERR("Failed to reserve new chunk.", NULL);
+		c = g_chunks;
+	}
+	STAT_INC(arena_new);
+	RET_OK((arena_t*)((unsigned char*)c + c->offset++ * ARENA_SIZE));
+}
+
+/** Finds a run of released pages in a chunk.
+ * \param c The chunk to be searched.
+ * \param count The number of pages in the run.
+ * \return The index of the first page of the run or 0 if there's none. */
+static inline size_t chunk_find_run(chunk_t *c, size_t count) {
+	size_t len = 0;
+	for (size_t i = 1; i < c->offset; i++) {
+		if (!(i % 64) && !c->free_pages[i / 64]) {
+			len = 0;
+			i += 63;
+			continue;
+		}
+		if (!(c->free_pages[i / 64] & (1LLU << (i % 64)))) len = 0;
+		else if (++len == count) return i + 1 - count;
+	}
+	return 0;
+}
+
+/** Carves a run of contiguous pages out of the chunks of the calling
+ * thread on its NUMA node. Released pages are reused first, taking them off
+ * the dirty list, then the newest chunk is bumped and a new chunk is
+ * reserved if the run doesn't fit in it.
+ * \param count The number of pages in the run.
+ * \param zero Pointer to a flag set if the run is known to be zero-filled
+ * or NULL.
+ * \return A pointer to the first page of the run or NULL on failure. */
+static inline arena_t *pages_use(size_t count, bool *zero) {
+	if (!count || count >= CHUNK_PAGES) RET_ERR("Invalid argument.", NULL);
+	if (g_chunk_free_pages >= count) {
+		arena_t *page = NULL;
+		if (g_heap) pthread_mutex_lock(&g_heap->dirty_mutex);
+		for (chunk_t *c = g_chunks; c && !page; c = c->next) {
+			if (c->free < count || c->node != g_node) continue;
+			size_t first = chunk_find_run(c, count);
+			if (!first) continue;
+			for (size_t i = first; i < first + count; i++) {
+				arena_t *p = (arena_t*)((unsigned char*)c + i * ARENA_SIZE);
+				if (g_heap && c->dirty_pages[i / 64] & (1LLU << (i % 64)))
+					dirty_unlink(g_heap, (dirty_t*)p);
+				c->free_pages[i / 64] &= ~(1LLU << (i % 64));
+			}
+			c->free -= count;
+			g_chunk_free_pages -= count;
+			page = (arena_t*)((unsigned char*)c + first * ARENA_SIZE);
+		}
+		if (g_heap) pthread_mutex_unlock(&g_heap->dirty_mutex);
+		if (page) {
+			if (zero) *zero = false;
+			STAT_ADD(arena_new, count);
+			RET_OK(page);
+		}
+	}
+	chunk_t *c = g_chunks;
+	while (c && c->node != g_node) c = c->next;
+	if (!c || c->offset + count > CHUNK_PAGES) {
+		if (chunk_new()) RET_ERR("Failed to reserve new chunk.", NULL);
+		c = g_chunks;
+	}
+	arena_t *page = (arena_t*)((unsigned char*)c + c->offset * ARENA_SIZE);
+	c->offset += count;
+	if (zero) *zero = true;
+	STAT_ADD(arena_new, count);
+	RET_OK(page);
+}
+
+/** Returns a run of contiguous pages to their chunk. The pages are put on
+ * the dirty list of the heap of the calling thread and purged once they
+ * decay, or purged right away if the decay time is 0.
+ * \param page The first page of the run.
+ * \param count The number of pages in the run.
+ * \return 0 on success or 1 on failure. */
+static inline int pages_free(arena_t *page, size_t count) {
+	if (!page) RET_ERR("page cannot be NULL.", 1);
+	size_t first = CHUNK_PAGE_INDEX(page);
+	chunk_t *c = CHUNK(page);
+	if (!count || !first || first + count > CHUNK_PAGES)
+		RET_ERR("Invalid argument.", 1);
+	for (size_t i = first; i < first + count; i++)
+		if (c->free_pages[i / 64] & (1LLU << (i % 64)))
+			RET_ERR("Invalid argument.", 1);
+	STAT_ADD(arena_del, count);
+	if (!g_heap || !atomic_load_explicit(&g_decay_ms, memory_order_relaxed)) {
+		if (madvise(page, count * ARENA_SIZE, PAGE_PURGE_ADVICE))
+			RET_ERR("Failed to release pages with madvise().", 1);
+		STAT_INC(madvise_calls);
+		for (size_t i = first; i < first + count; i++)
+			c->free_pages[i / 64] |= 1LLU << (i % 64);
+		c->free += count;
+		g_chunk_free_pages += count;
+		RET_OK(0);
+	}
+	uint64_t now = clock_ms();
+	pthread_mutex_lock(&g_heap->dirty_mutex);
+	for (size_t i = first; i < first + count; i++) {
+		c->free_pages[i / 64] |= 1LLU << (i % 64);
+		dirty_push(g_heap, (arena_t*)((unsigned char*)c + i * ARENA_SIZE), now);
+	}
+	c->free += count;
+	g_chunk_free_pages += count;
+	pthread_mutex_unlock(&g_heap->dirty_mutex);
+	if (heap_decay(g_heap, now)) RET_ERR("Failed to purge pages.", 1);
+	RET_OK(0);
+}
+
+/** Returns a page to its chunk. The page is put on the dirty list of the
+ * heap of the calling thread and purged once it decays, or purged right
+ * away if the decay time is 0.
+ * \param page The page to be released.
+ * \return 0 on success or 1 on failure. */
+static inline int page_free(arena_t *page) {
+	if (pages_free(page, 1)) RET_ERR("Failed to release page.", 1);
+	RET_OK(0);
+}
+
+/** Purges the decayed pages of the calling thread once every DECAY_TICK
+ * calls and looks up the NUMA node of the thread again, in case it was
+ * migrated. It's called on the slow path of allocations. */
+static inline void decay_tick() {
+	if (++g_decay_tick < DECAY_TICK) return;
+	g_decay_tick = 0;
+	g_node = numa_node();
+	if (
+		atomic_load_explicit(&g_heap->dirty_count, memory_order_relaxed) &&
+		heap_decay(g_heap, clock_ms())
+	) ERROR_SET("Failed to purge decayed pages.");
+}
+
+/** Releases the blocks other threads handed over to parked heaps.
+ * Forward declaration. */
+static inline int orphan_drain();
+
+/** Purges the decayed pages of every heap, including the heaps of threads
+ * that already exited. Blocks freed into those heaps by other threads are
+ * released first, so their pages can be purged as well.
+ * \param now The current time in milliseconds. UINT64_MAX purges every page.
+ * \return 0 on success or 1 on failure. */
+static inline int decay_all(uint64_t now) {
+	int ret = 0;
+	pthread_mutex_lock(&g_heap_mutex);
+	if (orphan_drain()) ret = 1;
+	for (heap_t *heap = g_heaps; heap; heap = heap->next)
+		if (heap_decay(heap, now)) ret = 1;
+	pthread_mutex_unlock(&g_heap_mutex);
+	if (ret) RET_ERR("Failed to purge pages.", 1);
+	RET_OK(0);
+}
+
+/** Entry point of the background decay thread. It wakes up DECAY_STEPS
+ * times per decay time, but at least once a second, and purges the
+ * decayed pages of every heap until it's stopped.
+ * \param arg Unused.
+ * \return NULL. */
+static inline void *decay_thread(void *arg) {
+	(void)arg;
+	pthread_mutex_lock(&g_decay_mutex);
+	while (g_decay_running) {
+		size_t interval =
+			atomic_load_explicit(&g_decay_ms, memory_order_relaxed) / DECAY_STEPS;
+		if (!interval || interval > 1000) interval = interval ? 1000 : 1;
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += (time_t)(interval / 1000);
+		ts.tv_nsec += (long)(interval % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&g_decay_cond, &g_decay_mutex, &ts);
+		if (!g_decay_running) break;
+		pthread_mutex_unlock(&g_decay_mutex);
+		if (decay_all(clock_ms())) ERROR_SET("Failed to purge decayed pages.");
+		pthread_mutex_lock(&g_decay_mutex);
+	}
+	pthread_mutex_unlock(&g_decay_mutex);
+	return NULL;
+}
+
+/** Starts the background decay thread or wakes it up to pick up a new
+ * decay time if it's already running.
+ * \return 0 on success or 1 on failure. */
+static inline int decay_start() {
+	pthread_mutex_lock(&g_decay_mutex);
+	if (g_decay_running) {
+		pthread_cond_signal(&g_decay_cond);
+		pthread_mutex_unlock(&g_decay_mutex);
+		RET_OK(0);
+	}
+	g_decay_running = true;
+	if (pthread_create(&g_decay_thread, NULL, decay_thread, NULL)) {
+		g_decay_running = false;
+		pthread_mutex_unlock(&g_decay_mutex);
+		RET_ERR("Failed to create decay thread.", 1);
+	}
+	pthread_mutex_unlock(&g_decay_mutex);
+	RET_OK(0);
+}
+
+/** Stops the background decay thread if it's running.
+ * \return 0 on success or 1 on failure. */
+static inline int decay_stop() {
+	pthread_mutex_lock(&g_decay_mutex);
+	if (!g_decay_running) {
+		pthread_mutex_unlock(&g_decay_mutex);
+		RET_OK(0);
+	}
+	g_decay_running = false;
+	pthread_cond_signal(&g_decay_cond);
+	pthread_mutex_unlock(&g_decay_mutex);
+	if (pthread_join(g_decay_thread, NULL))
+		RET_ERR("Failed to join decay thread.", 1);
+	RET_OK(0);
+}
+
+/** Writes a value to a buffer as a varint of 7 bits per byte, lowest bits
+ * first. The high bit of a byte is set if more bytes follow.
+ * \param buf The buffer to write to. It must have room for 10 bytes.
+ * \param value The value to be written.
+ * \return The number of bytes written. */
+static inline size_t trace_put(unsigned char *buf, uint64_t value) {
+	size_t len = 0;
+	while (value >= 0x80) {
+		buf[len++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	buf[len++] = (unsigned char)value;
+	return len;
+}
+
+/** Reads a varint written by trace_put() and moves the position past it.
+ * \param pos The position to read from.
+ * \param end The end of the buffer.
+ * \param value The value read.
+ * \return 0 on success or 1 on failure. */
+static inline int trace_get(
+	const unsigned char **pos, const unsigned char *end, uint64_t *value
+) {
+	if (!pos || !*pos || !end || !value) RET_ERR("Invalid arguments.", 1);
+	*value = 0;
+	for (unsigned shift = 0; *pos < end && shift < 64; shift += 7) {
+		unsigned char byte = *(*pos)++;
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) RET_OK(0);
+	}
+	RET_ERR("Truncated varint.", 1);
+}
+
+/** Encodes a trace record as the difference from the last one. A record is
+ * the op in one byte followed by the varints of the sequence number, time
+ * and id differences, the size unless it's freed and the difference of the
+ * new id if it's resized.
+ * \param buf The buffer to write to. It must have room for
+ * TRACE_RECORD_MAX bytes.
+ * \param last The last record. It's replaced by the new one.
+ * \param rec The record to be encoded.
+ * \return The number of bytes written. */
+static inline size_t trace_encode(
+	unsigned char *buf, trace_record_t *last, const trace_record_t *rec
+) {
+	size_t len = 0;
+	buf[len++] = (unsigned char)rec->op;
+	len += trace_put(buf + len, rec->seq - last->seq);
+	len += trace_put(buf + len, rec->time - last->time);
+	len += trace_put(buf + len, ZIGZAG(rec->id - last->id));
+	if (rec->op != TRACE_DEL) len += trace_put(buf + len, rec->size);
+	if (rec->op == TRACE_RESIZE)
+		len += trace_put(buf + len, ZIGZAG(rec->new_id - rec->id));
+	*last = *rec;
+	return len;
+}
+
+/** Decodes a trace record encoded by trace_encode() and moves the position
+ * past it.
+ * \param pos The position to read from.
+ * \param end The end of the chunk.
+ * \param last The last record. It's replaced by the new one.
+ * \param rec The decoded record. It gets the thread of the last one.
+ * \return 0 on success or 1 on failure. */
+static inline int trace_decode(
+	const unsigned char **pos, const unsigned char *end,
+	trace_record_t *last, trace_record_t *rec
+) {
+	if (!pos || !*pos || !end || !last || !rec)
+		RET_ERR("Invalid arguments.", 1);
+	if (*pos >= end || **pos > TRACE_RESIZE) RET_ERR("Invalid record.", 1);
+	trace_record_t next = *last;
+	uint64_t value = 0;
+	next.op = (trace_op_t)*(*pos)++;
+	if (trace_get(pos, end, &value)) RET_ERR("Truncated record.", 1);
+	next.seq += value;
+	if (trace_get(pos, end, &value)) RET_ERR("Truncated record.", 1);
+	next.time += value;
+	if (trace_get(pos, end, &value)) RET_ERR("Truncated record.", 1);
+	next.id += UNZIGZAG(value);
+	next.size = 0;
+	next.new_id = 0;
+	if (next.op != TRACE_DEL && trace_get(pos, end, &next.size))
+		RET_ERR("Truncated record.", 1);
+	if (next.op == TRACE_RESIZE) {
+		if (trace_get(pos, end, &value)) RET_ERR("Truncated record.", 1);
+		next.new_id = next.id + UNZIGZAG(value);
+	}
+	*last = next;
+	*rec = next;
+	RET_OK(0);
+}
+
+#ifdef ALLOC_TRACE
+/** Takes a trace buffer from the pool or maps a new one. The caller must
+ * hold the trace mutex.
+ * \return A pointer to the empty buffer or NULL on failure. */
+static inline trace_buf_t *trace_buf_get() {
+	trace_buf_t *buf = g_trace_pool;
+	if (buf) {
+		g_trace_pool = buf->next;
+	} else {
+		buf = (trace_buf_t*)MMAP(sizeof(trace_buf_t));
+		if (buf == MAP_FAILED) RET_ERR("Failed to map trace buffer.", NULL);
+	}
+	buf->next = NULL;
+	buf->chunk.len = 0;
+	RET_OK(buf);
+}
+
+/** Appends a trace buffer to the queue of the trace thread and wakes it
+ * up. The caller must hold the trace mutex.
+ * \param buf The buffer to be written. */
+static inline void trace_queue(trace_buf_t *buf) {
+	buf->next = NULL;
+	if (g_trace_queue_tail) g_trace_queue_tail->next = buf;
+	else g_trace_queue = buf;
+	g_trace_queue_tail = buf;
+	pthread_cond_signal(&g_trace_cond);
+}
+
+/** Assigns a trace slot to the calling thread. The slot of an exited
+ * thread is reused if there's one, otherwise a new one is mapped. Every
+ * thread gets a new thread id either way.
+ * \return A pointer to the slot or NULL on failure. */
+static inline trace_slot_t *trace_slot_get() {
+	pthread_mutex_lock(&g_trace_mutex);
+	trace_slot_t *slot = g_trace_slots;
+	while (slot && slot->used) slot = slot->next;
+	if (!slot) {
+		slot = (trace_slot_t*)MMAP(sizeof(trace_slot_t));
+		if (slot == MAP_FAILED) {
+			pthread_mutex_unlock(&g_trace_mutex);
+			RET_ERR("Failed to map trace slot.", NULL);
+		}
+		pthread_mutex_init(&slot->mutex, NULL);
+		slot->buf = NULL;
+		slot->next = g_trace_slots;
+		g_trace_slots = slot;
+	}
+	slot->used = true;
+	slot->thread = atomic_fetch_add(&g_trace_threads, 1);
+	pthread_mutex_unlock(&g_trace_mutex);
+	RET_OK(slot);
+}
+
+/** Records an operation in the trace buffer of the calling thread. The
+ * sequence number is taken with the slot locked, so the records of a
+ * thread are in order even if the trace thread takes the buffer in
+ * between. Frees have to be recorded before the block is released and
+ * allocations after, so a reused address is never recorded out of order.
+ * \param op The operation.
+ * \param id The address of the block.
+ * \param new_id The new address of a resized block.
+ * \param size The size of the block. */
+static inline void trace_record(
+	trace_op_t op, void *id, void *new_id, size_t size
+) {
+	if (!atomic_load_explicit(&g_trace_on, memory_order_relaxed)) return;
+	if (g_trace_busy) return;
+	g_trace_busy = true;
+	trace_slot_t *slot = g_trace_slot;
+	if (!slot && !(slot = g_trace_slot = trace_slot_get())) {
+		g_trace_busy = false;
+		return;
+	}
+	pthread_mutex_lock(&slot->mutex);
+	trace_buf_t *buf = slot->buf;
+	if (!buf || buf->chunk.len + TRACE_RECORD_MAX > TRACE_BUF_SIZE) {
+		pthread_mutex_lock(&g_trace_mutex);
+		if (buf) trace_queue(buf);
+		buf = slot->buf = trace_buf_get();
+		pthread_mutex_unlock(&g_trace_mutex);
+	}
+	if (buf) {
+		trace_record_t rec = {
+			.seq = atomic_fetch_add(&g_trace_seq, 1),
+			.time = clock_ns() - g_trace_start,
+			.id = (uint64_t)(uintptr_t)id,
+			.new_id = (uint64_t)(uintptr_t)new_id,
+			.size = size,
+			.thread = slot->thread,
+			.op = op,
+		};
+		if (!buf->chunk.len) {
+			buf->chunk = (trace_chunk_t){
+				TRACE_MAGIC, rec.seq, rec.time, slot->thread, 0
+			};
+			buf->last = (trace_record_t){
+				.seq = rec.seq, .time = rec.time, .thread = slot->thread
+			};
+		}
+		buf->chunk.len +=
+			(uint32_t)trace_encode(buf->data + buf->chunk.len, &buf->last, &rec);
+	}
+	pthread_mutex_unlock(&slot->mutex);
+	g_trace_busy = false;
+}
+
+/** Moves the trace buffers that hold records from every slot to the queue
+ * of the trace thread. The slots get a new buffer on their next record. */
+static inline void trace_flush() {
+	pthread_mutex_lock(&g_trace_mutex);
+	trace_slot_t *slots = g_trace_slots;
+	pthread_mutex_unlock(&g_trace_mutex);
+	for (trace_slot_t *slot = slots; slot; slot = slot->next) {
+		pthread_mutex_lock(&slot->mutex);
+		if (slot->buf && slot->buf->chunk.len) {
+			pthread_mutex_lock(&g_trace_mutex);
+			trace_queue(slot->buf);
+			pthread_mutex_unlock(&g_trace_mutex);
+			slot->buf = NULL;
+		}
+		pthread_mutex_unlock(&slot->mutex);
+	}
+}
+
+/** Writes the queued trace buffers to the trace file in order and returns
+ * them to the pool. The caller must hold the trace mutex, which is released
+ * during the writes.
+ * \return 0 on success or 1 on failure. */
+static inline int trace_write() {
+	int ret = 0;
+	while (g_trace_queue) {
+		trace_buf_t *head = g_trace_queue;
+		trace_buf_t *tail = g_trace_queue_tail;
+		g_trace_queue = NULL;
+		g_trace_queue_tail = NULL;
+		pthread_mutex_unlock(&g_trace_mutex);
+		for (trace_buf_t *buf = head; buf && !ret; buf = buf->next) {
+			const unsigned char *data = (const unsigned char*)&buf->chunk;
+			size_t len = sizeof(trace_chunk_t) + buf->chunk.len;
+			while (len) {
+				ssize_t n = write(g_trace_fd, data, len);
+				if (n < 0 && errno == EINTR) continue;
+				if (n <= 0) {
+					ret = 1;
+					break;
+				}
+				data += n;
+				len -= (size_t)n;
+			}
+		}
+		pthread_mutex_lock(&g_trace_mutex);
+		tail->next = g_trace_pool;
+		g_trace_pool = head;
+	}
+	if (ret) RET_ERR("Failed to write trace.", 1);
+	RET_OK(0);
+}
+
+/** Entry point of the trace thread. It writes the buffers that fill up as
+ * soon as they're queued and takes the buffers of every thread once per
+ * TRACE_FLUSH_MS, so quiet threads don't hold back their records for long.
+ * It takes them once more and writes everything when it's stopped.
+ * \param arg Unused.
+ * \return NULL. */
+static inline void *trace_thread(void *arg) {
+	(void)arg;
+	g_trace_busy = true;
+	uint64_t next_flush = clock_ms() + TRACE_FLUSH_MS;
+	pthread_mutex_lock(&g_trace_mutex);
+	bool running = true;
+	while (running) {
+		if (!g_trace_queue && g_trace_running) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += TRACE_FLUSH_MS * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&g_trace_cond, &g_trace_mutex, &ts);
+		}
+		running = g_trace_running;
+		if (!running || clock_ms() >= next_flush) {
+			pthread_mutex_unlock(&g_trace_mutex);
+			trace_flush();
+			pthread_mutex_lock(&g_trace_mutex);
+			next_flush = clock_ms() + TRACE_FLUSH_MS;
+		}
+		if (trace_write()) ERROR_SET("Failed to write trace.");
+	}
+	pthread_mutex_unlock(&g_trace_mutex);
+	return NULL;
+}
+
+/** Opens the trace file and starts the trace thread and the recording.
+ * \param path The path of the trace file. It's truncated.
+ * \return 0 on success or 1 on failure. */
+static inline int trace_start(const char *path) {
+	if (!path) RET_ERR("path cannot be NULL.", 1);
+	pthread_mutex_lock(&g_trace_mutex);
+	if (g_trace_running) {
+		pthread_mutex_unlock(&g_trace_mutex);
+		RET_ERR("Trace is already running.", 1);
+	}
+	g_trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (g_trace_fd < 0) {
+		pthread_mutex_unlock(&g_trace_mutex);
+		RET_ERR("Failed to open trace file.", 1);
+	}
+	atomic_store(&g_trace_seq, 0);
+	g_trace_start = clock_ns();
+	g_trace_running = true;
+	if (pthread_create(&g_trace_thread, NULL, trace_thread, NULL)) {
+		g_trace_running = false;
+		close(g_trace_fd);
+		g_trace_fd = -1;
+		pthread_mutex_unlock(&g_trace_mutex);
+		RET_ERR("Failed to create trace thread.", 1);
+	}
+	pthread_mutex_unlock(&g_trace_mutex);
+	atomic_store(&g_trace_on, true);
+	RET_OK(0);
+}
+
+/** Stops the recording, writes the rest of the trace and closes the trace
+ * file if the trace is running. Records made by threads racing with it may
+ * be lost.
+ * \return 0 on success or 1 on failure. */
+static inline int trace_stop() {
+	atomic_store(&g_trace_on, false);
+	pthread_mutex_lock(&g_trace_mutex);
+	if (!g_trace_running) {
+		pthread_mutex_unlock(&g_trace_mutex);
+		RET_OK(0);
+	}
+	g_trace_running = false;
+	pthread_cond_signal(&g_trace_cond);
+	pthread_mutex_unlock(&g_trace_mutex);
+	if (pthread_join(g_trace_thread, NULL))
+		RET_ERR("Failed to join trace thread.", 1);
+	int ret = close(g_trace_fd);
+	g_trace_fd = -1;
+	if (ret) RET_ERR("Failed to close trace file.", 1);
+	RET_OK(0);
+}
+
+/** Queues the trace buffer of an exiting thread and gives up its slot. */
+static inline void trace_exit() {
+	trace_slot_t *slot = g_trace_slot;
+	if (!slot) return;
+	pthread_mutex_lock(&slot->mutex);
+	pthread_mutex_lock(&g_trace_mutex);
+	if (slot->buf && slot->buf->chunk.len) trace_queue(slot->buf);
+	else if (slot->buf) {
+		slot->buf->next = g_trace_pool;
+		g_trace_pool = slot->buf;
+	}
+	slot->used = false;
+	pthread_mutex_unlock(&g_trace_mutex);
+	slot->buf = NULL;
+	pthread_mutex_unlock(&slot->mutex);
+	g_trace_slot = NULL;
+}
+#endif
+
+/** Reads the config from the ALLOC_DECAY_MS, ALLOC_MAX_DIRTY and
+ * ALLOC_BACKGROUND environment variables, the sampling rate of the
+ * profiler from the ALLOC_PROF_RATE environment variable, in debug
+ * builds, the debug features from the ALLOC_DEBUG environment variable
+ * and, in trace builds, the trace file from the ALLOC_TRACE environment
+ * variable. The NUMA topology is detected as well.
+ * \return 0 on success or 1 on failure. */
+static inline int config_env() {
+	if (numa_init()) RET_ERR("Failed to detect NUMA topology.", 1);
+	const char *env = getenv("ALLOC_DECAY_MS");
+	if (env) atomic_store(&g_decay_ms, (size_t)strtoull(env, NULL, 10));
+	env = getenv("ALLOC_MAX_DIRTY");
+	if (env) atomic_store(&g_max_dirty, (size_t)strtoull(env, NULL, 10));
+	env = getenv("ALLOC_PROF_RATE");
+	if (env) {
+		atomic_store(&g_prof_start, clock_ms());
+		atomic_store(&g_prof_rate, (size_t)strtoull(env, NULL, 10));
+	}
+#ifdef ALLOC_DEBUG
+	env = getenv("ALLOC_DEBUG");
+	if (env) atomic_store(&g_debug, (unsigned)strtoul(env, NULL, 10));
+#endif
+#ifdef ALLOC_TRACE
+	env = getenv("ALLOC_TRACE");
+	if (env && trace_start(env)) RET_ERR("Failed to start trace.", 1);
+#endif
+	env = getenv("ALLOC_BACKGROUND");
+	if (env && strtoull(env, NULL, 10) && decay_start())
+		RET_ERR("Failed to start decay thread.", 1);
+	RET_OK(0);
+}
+
+/** Expands the arena by carving a new node out of a chunk.
+ * \return 0 on success or 1 on failure. */
+static inline int arena_expand() {
+	g_arena_tail->next = page_use();
+	if (!g_arena_tail->next) RET_ERR("Failed to allocate new arena page.", 1);
+	g_arena_tail->next->prev = g_arena_tail;
+	g_arena_tail = g_arena_tail->next;
+	g_arena_tail->next = NULL;
+	g_arena_tail->offset = 0;
+	g_arena_tail->ptrs_tail = NULL;
+	g_arena_tail->owner = g_heap;
+	RET_OK(0);
+}
+
+/** Removes an arena node from the linked list.
+ * \param arena The arena node to be deleted.
+ * \return 0 on success or 1 on failure. */
+static inline int arena_del(arena_t *arena) {
+	if (!arena) RET_ERR("arena cannot be NULL.", 1);
+	if (arena == &g_arena_head) RET_ERR("arena head cannot be deleted.", 1);
+	if (arena->prev && arena->next) {
+		arena->prev->next = arena->next;
+		arena->next->prev = arena->prev;
+		if (page_free(arena)) RET_ERR("Failed to release arena.", 1);
+	} else if (!arena->next) {
+		g_arena_tail = arena->prev;
+		g_arena_tail->next = NULL;
+		if (page_free(arena)) RET_ERR("Failed to release arena.", 1);
+	}
+	RET_OK(0);
+}
+
+/** Returns a pointer to a memory block allocated in the arena.
+ * \param size The size of the block to be allocated. 
+ * \return The pointer to the allocated data or NULL on failure. */
+static inline void *arena_use(size_t size) {
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (TOTAL_SIZE(size) > ARENA_BUFF_SIZE) RET_ERR("size is too big.", NULL);
+	if (g_arena_tail->offset + BLOCK_SIZE(size) > ARENA_BUFF_SIZE)
+		if (arena_expand()) RET_ERR("Failed to expand arena.", NULL);
+	if (!g_arena_tail->ptrs_tail) {
+		g_arena_tail->ptrs_tail = (ptr_t*)&g_arena_tail->buff[g_arena_tail->offset];
+		g_arena_tail->ptrs_tail->prev_valid = NULL;
+	} else {
+		g_arena_tail->ptrs_tail->next_valid =
+			(ptr_t*)&g_arena_tail->buff[g_arena_tail->offset];
+		g_arena_tail->ptrs_tail->next_valid->prev_valid =
+			g_arena_tail->ptrs_tail;
+		g_arena_tail->ptrs_tail =
+			g_arena_tail->ptrs_tail->next_valid;
+	}
+	g_arena_tail->ptrs_tail->next_valid = NULL;
+	g_arena_tail->ptrs_tail->size = size;
+	g_arena_tail->ptrs_tail->state = VALID;
+	g_arena_tail->ptrs_tail->arena = g_arena_tail;
+	g_arena_tail->ptrs_tail->data = 
+		(unsigned char*)g_arena_tail->ptrs_tail + PTR_ALIGNED_SIZE;
+	g_arena_tail->offset += BLOCK_SIZE(size);
+	RET_OK(g_arena_tail->ptrs_tail->data);
+}
+
+/** Hands a block over to the heap of the thread that owns it.
+ * The block is pushed onto the lock-free remote free list of the owner
+ * heap and released by the owner on its next allocation.
+ * \param heap The heap owning the block.
+ * \param data The pointer to the block. */
+static inline void remote_free_push(heap_t *heap, void *data) {
+	void *head = atomic_load_explicit(&heap->remote_free, memory_order_relaxed);
+	do {
+		*(void**)data = head;
+	} while (!atomic_compare_exchange_weak_explicit(
+		&heap->remote_free, &head, data,
+		memory_order_release, memory_order_relaxed));
+}
+
+/** Returns the number of bytes a block in an arena can hold. A block
+ * extends up to the header of the next block or to the offset of its arena.
+ * \param ptr The header of the block.
+ * \return The capacity of the block. */
+static inline size_t ptr_capacity(ptr_t *ptr) {
+	unsigned char *end = ptr->next_valid ?
+		(unsigned char*)ptr->next_valid : &ptr->arena->buff[ptr->arena->offset];
+	return (size_t)(end - (unsigned char*)ptr) - PTR_ALIGNED_SIZE;
+}
+
+/** Removes a block from the address ordered list of its arena.
+ * The space of the block is taken over by the previous block.
+ * \param ptr The header of the block. */
+static inline void ptr_unlink(ptr_t *ptr) {
+	if (ptr->prev_valid) ptr->prev_valid->next_valid = ptr->next_valid;
+	if (ptr->next_valid) ptr->next_valid->prev_valid = ptr->prev_valid;
+	else ptr->arena->ptrs_tail = ptr->prev_valid;
+}
+
+/** Pushes a block onto the free list of the largest size class it can
+ * hold and marks it free.
+ * \param ptr The header of the block. */
+static inline void free_ptr_push(ptr_t *ptr) {
+	size_t i = FREE_CLASS(ptr_capacity(ptr));
+	ptr->next_free = NULL;
+	ptr->prev_free = g_free_ptr_tails[i];
+	if (g_free_ptr_tails[i]) g_free_ptr_tails[i]->next_free = ptr;
+	g_free_ptr_tails[i] = ptr;
+	ptr->state = FREE;
+}
+
+/** Removes a block from the free list it was pushed onto.
+ * It must be called before the neighbours of the block change.
+ * \param ptr The header of the block. */
+static inline void free_ptr_unlink(ptr_t *ptr) {
+	if (ptr->prev_free) ptr->prev_free->next_free = ptr->next_free;
+	if (ptr->next_free) ptr->next_free->prev_free = ptr->prev_free;
+	else g_free_ptr_tails[FREE_CLASS(ptr_capacity(ptr))] = ptr->prev_free;
+	ptr->next_free = NULL;
+	ptr->prev_free = NULL;
+}
+
+/** Merges a block with the free blocks next to it in its arena.
+ * The free neighbours are taken off their free lists, so no two free
+ * blocks are ever adjacent.
+ * \param ptr The header of the block.
+ * \return The header of the merged block. */
+static inline ptr_t *ptr_coalesce(ptr_t *ptr) {
+	ptr_t *next = ptr->next_valid;
+	if (next && next->state == FREE) {
+		free_ptr_unlink(next);
+		ptr_unlink(next);
+	}
+	ptr_t *prev = ptr->prev_valid;
+	if (prev && prev->state == FREE) {
+		free_ptr_unlink(prev);
+		ptr_unlink(ptr);
+		ptr = prev;
+	}
+	return ptr;
+}
+
+/** Allocates a block too big for an arena in a run of pages carved from
+ * the chunks of the calling thread.
+ * \param size The size of the block to be allocated.
+ * \param zero Pointer to a flag set if the block is known to be zero-filled
+ * or NULL.
+ * \return A pointer to the block or NULL on failure. */
+static inline void *run_use(size_t size, bool *zero) {
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (TOTAL_SIZE(size) <= ARENA_BUFF_SIZE) RET_ERR("size is too small.", NULL);
+	if (size > MAX_RUN_ALLOC_SIZE) RET_ERR("size is too big.", NULL);
+	ptr_t *ptr = (ptr_t*)pages_use(RUN_PAGES(size), zero);
+	if (!ptr) RET_ERR("Failed to carve page run.", NULL);
+	ptr->data = (unsigned char*)ptr + PTR_ALIGNED_SIZE;
+	ptr->state = VALID;
+	ptr->arena = NULL;
+	ptr->prev_valid = NULL;
+	ptr->next_valid = NULL;
+	ptr->size = size;
+	ptr->pages = (uint32_t)RUN_PAGES(size);
+	RET_OK(ptr->data);
+}
+
+/** Allocates a block aligned to a power of two in a run of pages carved
+ * from the chunks of the calling thread. Runs start on a page, so alignments
+ * up to the page size only move the header within the first page. Bigger
+ * alignments carve enough pages to find an aligned address and return the
+ * pages before and after the block to their chunk.
+ * \param size The size of the block to be allocated.
+ * \param alignment The alignment of the block.
+ * \return A pointer to the block or NULL on failure. */
+static inline void *run_use_aligned(size_t size, size_t alignment) {
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (size > MAX_RUN_ALLOC_SIZE) RET_ERR("size is too big.", NULL);
+	if (!alignment || alignment & (alignment - 1))
+		RET_ERR("alignment must be a power of two.", NULL);
+	if (alignment > RUN_MAX_ALIGNMENT) RET_ERR("alignment is too big.", NULL);
+	if (alignment < MIN_ALLOC_SIZE) alignment = MIN_ALLOC_SIZE;
+	size_t skip = alignment > ARENA_SIZE ? alignment - PTR_ALIGNED_SIZE :
+		ALIGN_UP(PTR_ALIGNED_SIZE, alignment) - PTR_ALIGNED_SIZE;
+	size_t count = PAGE_CEIL(skip + TOTAL_SIZE(size)) / ARENA_SIZE;
+	unsigned char *run = (unsigned char*)pages_use(count, NULL);
+	if (!run) RET_ERR("Failed to carve page run.", NULL);
+	unsigned char *data = (unsigned char*)ALIGN_UP(
+		(uintptr_t)run + PTR_ALIGNED_SIZE, (uintptr_t)alignment);
+	ptr_t *ptr = PTR(data);
+	unsigned char *head = (unsigned char*)RUN_HEAD(ptr);
+	size_t lead = (size_t)(head - run) / ARENA_SIZE;
+	size_t pages = RUN_SPAN(ptr, size);
+	if (lead && pages_free((arena_t*)run, lead))
+		RET_ERR("Failed to release pages.", NULL);
+	if (count > lead + pages &&
+		pages_free((arena_t*)(head + pages * ARENA_SIZE), count - lead - pages))
+		RET_ERR("Failed to release pages.", NULL);
+	ptr->data = data;
+	ptr->state = VALID;
+	ptr->arena = NULL;
+	ptr->prev_valid = NULL;
+	ptr->next_valid = NULL;
+	ptr->size = size;
+	ptr->pages = (uint32_t)pages;
+	RET_OK(ptr->data);
+}
+
+/** Returns the pages of a block allocated in a page run to their chunk.
+ * \param data The pointer to the block.
+ * \return 0 on success or 1 on failure. */
+static inline int run_free(void *data) {
+	if (!data) RET_ERR("data cannot be NULL.", 1);
+	ptr_t *ptr = PTR(data);
+	if (ptr->state != VALID || ptr->arena || !ptr->pages)
+		RET_ERR("Invalid argument.", 1);
+	ptr->state = FREE;
+	if (pages_free(RUN_HEAD(ptr), ptr->pages))
+		RET_ERR("Failed to release page run.", 1);
+	RET_OK(0);
+}
+
+/** Resizes a block allocated in a page run in place. The block can grow
+ * up to the pages of its run, and when a block of the calling thread
+ * shrinks, the pages it no longer spans are returned to their chunk.
+ * \param data The pointer to the block to be resized.
+ * \param size The new size of the block.
+ * \return 0 on success or 1 if the block cannot be resized in place. */
+static inline int run_resize(void *data, size_t size) {
+	if (!data) RET_ERR("data cannot be NULL.", 1);
+	if (!size) RET_ERR("size cannot be 0.", 1);
+	if (TOTAL_SIZE(size) <= ARENA_BUFF_SIZE) RET_ERR("size is too small.", 1);
+	if (size > MAX_RUN_ALLOC_SIZE) RET_ERR("size is too big.", 1);
+	ptr_t *ptr = PTR(data);
+	if (ptr->state != VALID || ptr->arena || !ptr->pages)
+		RET_ERR("Invalid argument.", 1);
+	size_t pages = RUN_SPAN(ptr, size);
+	if (pages > ptr->pages) RET_ERR("Not enough pages left in run.", 1);
+	if (pages < ptr->pages && CHUNK(ptr)->owner == g_heap) {
+		arena_t *tail = (arena_t*)((unsigned char*)RUN_HEAD(ptr) + pages * ARENA_SIZE);
+		if (pages_free(tail, ptr->pages - pages))
+			RET_ERR("Failed to release pages.", 1);
+		ptr->pages = (uint32_t)pages;
+	}
+	ptr->size = size;
+	RET_OK(0);
+}
+
+/** Keeps the mapping of a freed block for reuse instead of unmapping it.
+ * The oldest mappings are unmapped to make room, so the cache holds at most
+ * MAP_CACHE_COUNT mappings and MAP_CACHE_BYTES bytes. Only threads with a
+ * heap keep mappings, so they're unmapped when the thread exits.
+ * \param head The start of the mapping.
+ * \param len The length of the mapping in bytes.
+ * \return 0 if the mapping is kept or 1 if it has to be unmapped. */
+static inline int map_cache_put(void *head, size_t len) {
+	if (!head) RET_ERR("head cannot be NULL.", 1);
+	if (!g_heap || len > MAP_CACHE_BYTES / 4)
+		RET_ERR("Mapping cannot be kept.", 1);
+	while (g_map_count == MAP_CACHE_COUNT || g_map_bytes + len > MAP_CACHE_BYTES) {
+		map_t *map = &g_map_cache[0];
+		if (munmap(map->head, map->len))
+			RET_ERR("Failed to unmap memory with munmap().", 1);
+		STAT_ADD(unmapped_bytes, map->len);
+		STAT_INC(munmap_calls);
+		g_map_bytes -= map->len;
+		memmove(g_map_cache, g_map_cache + 1, --g_map_count * sizeof(map_t));
+	}
+	g_map_cache[g_map_count++] = (map_t){head, len};
+	g_map_bytes += len;
+	RET_OK(0);
+}
+
+/** Allocates a block too big for a page run in the cached mapping that
+ * fits it best. The block is placed at the first address of the mapping with
+ * the alignment and the pages the block doesn't span are unmapped.
+ * \param size The size of the block to be allocated.
+ * \param alignment The alignment of the block. It must be a power of two.
+ * \return A pointer to the block or NULL if no cached mapping fits. */
+static inline void *map_cache_use(size_t size, size_t alignment) {
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (!alignment || alignment & (alignment - 1))
+		RET_ERR("alignment must be a power of two.", NULL);
+	if (size > SIZE_MAX / 2 || alignment > SIZE_MAX / 4)
+		RET_ERR("size is too big.", NULL);
+	size_t best = g_map_count;
+	size_t best_len = 0;
+	for (size_t i = 0; i < g_map_count; i++) {
+		uintptr_t head = (uintptr_t)g_map_cache[i].head;
+		uintptr_t data = ALIGN_UP(head + PTR_ALIGNED_SIZE, (uintptr_t)alignment);
+		size_t len = PAGE_CEIL(data - head + ROUNDUP(size));
+		if (g_map_cache[i].len < len) continue;
+		if (best == g_map_count || g_map_cache[i].len < g_map_cache[best].len) {
+			best = i;
+			best_len = len;
+		}
+	}
+	if (best == g_map_count) RET_ERR("No matching mapping cached.", NULL);
+	map_t map = g_map_cache[best];
+	g_map_bytes -= map.len;
+	g_map_count--;
+	memmove(g_map_cache + best, g_map_cache + best + 1,
+		(g_map_count - best) * sizeof(map_t));
+	unsigned char *data = (unsigned char*)ALIGN_UP(
+		(uintptr_t)map.head + PTR_ALIGNED_SIZE, (uintptr_t)alignment);
+	unsigned char *head = (unsigned char*)PAGE_FLOOR(PTR(data));
+	unsigned char *tail = (unsigned char*)map.head + best_len;
+	size_t lead = (size_t)(head - (unsigned char*)map.head);
+	if (map.len > best_len) {
+		if (munmap(tail, map.len - best_len)) {
+			munmap(map.head, map.len);
+			RET_ERR("Failed to trim mapping with munmap().", NULL);
+		}
+		STAT_ADD(unmapped_bytes, map.len - best_len);
+		STAT_INC(munmap_calls);
+	}
+	if (lead) {
+		if (munmap(map.head, lead)) {
+			munmap(head, best_len - lead);
+			RET_ERR("Failed to trim mapping with munmap().", NULL);
+		}
+		STAT_ADD(unmapped_bytes, lead);
+		STAT_INC(munmap_calls);
+	}
+	STAT_INC(mmap_new);
+	ptr_t *ptr = PTR(data);
+	ptr->data = data;
+	ptr->state = VALID;
+	ptr->arena = NULL;
+	ptr->prev_valid = NULL;
+	ptr->next_valid = NULL;
+	ptr->size = size;
+	ptr->pages = 0;
+	RET_OK(ptr->data);
+}
+
+/** Unmaps the cached mappings of the calling thread.
+ * \return 0 on success or 1 on failure. */
+static inline int map_cache_flush() {
+	int ret = 0;
+	for (size_t i = 0; i < g_map_count; i++) {
+		if (munmap(g_map_cache[i].head, g_map_cache[i].len)) ret = 1;
+		STAT_ADD(unmapped_bytes, g_map_cache[i].len);
+		STAT_INC(munmap_calls);
+	}
+	g_map_count = 0;
+	g_map_bytes = 0;
+	if (ret) RET_ERR("Failed to unmap memory with munmap().", 1);
+	RET_OK(0);
+}
+
+/** Marks a pointer and its associated data free.
+ * Arena blocks are merged with their free neighbours. A merged block at the
+ * end of the current arena is given back to the arena, an arena that
+ * becomes empty is returned to its chunk and everything else is pushed
+ * onto a free list. Page runs are returned to their chunk and the mappings
+ * of bigger blocks are kept in the map cache if they fit.
+ * \param data The poiter to the data to be freed.
+ * \return 0 on sucecss or 1 on failure. */
+static inline int ptr_free(void *data) {
+	if (!data) RET_ERR("data cannot be NULL.", 1);
+	ptr_t *ptr = (ptr_t*)((unsigned char*)data - PTR_ALIGNED_SIZE);
+	if (ptr->state != VALID) RET_ERR("Invalid argument.", 1);
+	if (!ptr->arena && ptr->pages) {
+		heap_t *owner = CHUNK(ptr)->owner;
+		if (owner != g_heap) {
+			ptr->state = REMOTE;
+			remote_free_push(owner, data);
+			RET_OK(0);
+		}
+		if (run_free(data)) RET_ERR("Failed to free page run.", 1);
+		RET_OK(0);
+	}
+	if (!ptr->arena) {
+		unsigned char *head = (unsigned char*)PAGE_FLOOR(ptr);
+		size_t len = (size_t)((unsigned char*)ptr - head) + TOTAL_SIZE(ptr->size);
+		if (map_cache_put(head, PAGE_CEIL(len))) {
+			if (munmap(head, len) == -1)
+				RET_ERR("Failed to unmap memory with munmap().", 1);
+			STAT_ADD(unmapped_bytes, PAGE_CEIL(len));
+			STAT_INC(munmap_calls);
+		}
+		STAT_INC(mmap_del);
+		RET_OK(0);
+	}
+	if (ptr->arena->owner != g_heap) {
+		ptr->state = REMOTE;
+		remote_free_push(ptr->arena->owner, data);
+		RET_OK(0);
+	}
+	ptr = ptr_coalesce(ptr);
+	arena_t *arena = ptr->arena;
+	if (
+		!ptr->prev_valid && !ptr->next_valid &&
+		arena != g_arena_tail && arena != &g_arena_head
+	) {
+		ptr->state = FREE;
+		if (arena_del(arena)) RET_ERR("Failed to delete arena.", 1);
+		RET_OK(0);
+	}
+	if (!ptr->next_valid && arena == g_arena_tail) {
+		if (arena->clean < arena->offset) arena->clean = arena->offset;
+		arena->offset = (size_t)((unsigned char*)ptr - arena->buff);
+		ptr_unlink(ptr);
+		ptr->state = FREE;
+		RET_OK(0);
+	}
+	free_ptr_push(ptr);
+	RET_OK(0);
+}
+
+/** Finds the smallest size class with a free block that can hold a size.
+ * \param size The size of the block.
+ * \return The index of the size class or NUM_SIZE_CLASSES if there's none. */
+static inline size_t free_ptr_find(size_t size) {
+	size_t i = SIZE_CLASS(size);
+	while (i < NUM_SIZE_CLASSES && !g_free_ptr_tails[i]) i++;
+	return i;
+}
+
+/** Reuses a pointer and its associated data that was previously marked free.
+ * The block is taken from the smallest size class that can hold the size
+ * and whatever it doesn't need is split off as a new free block.
+ * \param size The size of the memory block to be reused. 
+ * \return A pointer to the memory block or NULL on failure. */
+static inline void *free_ptr_use(size_t size) {
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (size > MAX_ARENA_ALLOC_SIZE) RET_ERR("size is too big.", NULL);
+	size_t i = free_ptr_find(size);
+	if (i == NUM_SIZE_CLASSES) RET_ERR("No matching free pointer found.", NULL);
+	ptr_t *ptr = g_free_ptr_tails[i];
+	free_ptr_unlink(ptr);
+	size_t capacity = CLASS_SIZE(SIZE_CLASS(size));
+	if (ptr_capacity(ptr) >= capacity + PTR_ALIGNED_SIZE + MIN_ALLOC_SIZE) {
+		ptr_t *rest = (ptr_t*)((unsigned char*)ptr->data + capacity);
+		rest->data = (unsigned char*)rest + PTR_ALIGNED_SIZE;
+		rest->arena = ptr->arena;
+		rest->prev_valid = ptr;
+		rest->next_valid = ptr->next_valid;
+		if (ptr->next_valid) ptr->next_valid->prev_valid = rest;
+		else ptr->arena->ptrs_tail = rest;
+		ptr->next_valid = rest;
+		free_ptr_push(rest);
+	}
+	ptr->size = size;
+	ptr->state = VALID;
+	RET_OK(ptr->data);
+}
+
+/** Allocates a block of memory in the heap using mmap(), preferring the
+ * NUMA node of the calling thread.
+ * \param size The size of the memory block to be allocated. 
+ * \return A pointer to the memory block or NULL on failure. */
+static inline void *mmap_use(size_t size) {
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (TOTAL_SIZE(size) <= ARENA_BUFF_SIZE) RET_ERR("size is too small.", NULL);
+	ptr_t *ptr = (ptr_t*)MMAP(TOTAL_SIZE(size));
+	if (ptr == MAP_FAILED) RET_ERR("Failed to allocate ptr with mmap().", NULL);
+	if (numa_bind(ptr, TOTAL_SIZE(size), g_node)) ERROR_SET("Failed to bind ptr.");
+	STAT_ADD(mapped_bytes, PAGE_CEIL(TOTAL_SIZE(size)));
+	STAT_INC(mmap_calls);
+	STAT_INC(mmap_new);
+	ptr->data = (unsigned char*)ptr + PTR_ALIGNED_SIZE;
+	ptr->state = VALID;
+	ptr->arena = NULL;
+	ptr->prev_valid = NULL;
+	ptr->next_valid = NULL;
+	ptr->size = size;
+	ptr->pages = 0;
+	RET_OK(ptr->data);
+}
+
+/** Allocates a block aligned to a power of two with mmap(), preferring the
+ * NUMA node of the calling thread.
+ * The mapping is trimmed to the pages spanned by the header and the block,
+ * so alignments up to the page size cost at most one extra page.
+ * \param size The size of the block to be allocated.
+ * \param alignment The alignment of the block.
+ * \return A pointer to the allocated block or NULL on failure. */
+static inline void *mmap_use_aligned(size_t size, size_t alignment) {
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (!alignment || alignment & (alignment - 1))
+		RET_ERR("alignment must be a power of two.", NULL);
+	if (alignment < PTR_ALIGNED_SIZE) alignment = PTR_ALIGNED_SIZE;
+	if (size > SIZE_MAX / 2 || alignment > SIZE_MAX / 4)
+		RET_ERR("size is too big.", NULL);
+	size_t total = TOTAL_SIZE(size) + alignment - PTR_ALIGNED_SIZE;
+	unsigned char *map = (unsigned char*)MMAP(total);
+	if (map == MAP_FAILED) RET_ERR("Failed to allocate ptr with mmap().", NULL);
+	unsigned char *data = (unsigned char*)ALIGN_UP(
+		(uintptr_t)map + PTR_ALIGNED_SIZE, (uintptr_t)alignment);
+	unsigned char *head = (unsigned char*)PAGE_FLOOR(PTR(data));
+	unsigned char *tail = (unsigned char*)PAGE_CEIL(data + ROUNDUP(size));
+	if (head > map && munmap(map, (size_t)(head - map)))
+		RET_ERR("Failed to trim ptr with munmap().", NULL);
+	if (map + total > tail && munmap(tail, (size_t)(map + total - tail)))
+		RET_ERR("Failed to trim ptr with munmap().", NULL);
+	if (numa_bind(head, (size_t)(tail - head), g_node))
+		ERROR_SET("Failed to bind ptr.");
+	STAT_ADD(mapped_bytes, tail - head);
+	STAT_INC(mmap_calls);
+	STAT_ADD(munmap_calls, (head > map) + (map + total > tail));
+	STAT_INC(mmap_new);
+	ptr_t *ptr = PTR(data);
+	ptr->data = data;
+	ptr->state = VALID;
+	ptr->arena = NULL;
+	ptr->prev_valid = NULL;
+	ptr->next_valid = NULL;
+	ptr->size = size;
+	ptr->pages = 0;
+	RET_OK(ptr->data);
+}
+
+/** Resizes a block allocated in an arena in place.
+ * Any block can shrink within its size class or grow up to its capacity,
+ * but only the last block of an arena owned by the calling thread can
+ * shrink to a smaller size class or grow into the unused tail of the arena.
+ * \param data The pointer to the block to be resized.
+ * \param size The new size of the block.
+ * \return 0 on success or 1 if the block cannot be resized in place. */
+static inline int arena_resize(void *data, size_t size) {
+	if (!data) RET_ERR("data cannot be NULL.", 1);
+	if (!size) RET_ERR("size cannot be 0.", 1);
+	if (size > MAX_ARENA_ALLOC_SIZE) RET_ERR("size is too big.", 1);
+	ptr_t *ptr = PTR(data);
+	if (ptr->state != VALID || !ptr->arena) RET_ERR("Invalid argument.", 1);
+	arena_t *arena = ptr->arena;
+	if (arena->owner == g_heap && arena->ptrs_tail == ptr) {
+		size_t offset = (size_t)((unsigned char*)ptr - arena->buff) +
+			BLOCK_SIZE(size);
+		if (offset > ARENA_BUFF_SIZE) RET_ERR("Not enough space left in arena.", 1);
+		if (arena->clean < arena->offset) arena->clean = arena->offset;
+		arena->offset = offset;
+		ptr->size = size;
+		RET_OK(0);
+	}
+	if (CLASS_SIZE(SIZE_CLASS(size)) > ptr_capacity(ptr))
+		RET_ERR("Block is not the last one in its arena.", 1);
+	if (SIZE_CLASS(size) >= SIZE_CLASS(ptr->size)) ptr->size = size;
+	RET_OK(0);
+}
+
+/** Resizes a block allocated with mmap() using mremap().
+ * \param data The pointer to the block to be resized.
+ * \param size The new size of the block.
+ * \return A pointer to the possibly moved block or NULL on failure. */
+static inline void *mmap_resize(void *data, size_t size) {
+	if (!data) RET_ERR("data cannot be NULL.", NULL);
+	if (TOTAL_SIZE(size) <= ARENA_BUFF_SIZE) RET_ERR("size is too small.", NULL);
+	ptr_t *ptr = PTR(data);
+	if (ptr->state != VALID || ptr->arena || ptr->pages)
+		RET_ERR("Invalid argument.", NULL);
+	unsigned char *head = (unsigned char*)PAGE_FLOOR(ptr);
+	size_t offset = (size_t)((unsigned char*)ptr - head);
+	size_t old_len = PAGE_CEIL(offset + TOTAL_SIZE(ptr->size));
+	size_t new_len = PAGE_CEIL(offset + TOTAL_SIZE(size));
+	head = (unsigned char*)mremap(head, offset + TOTAL_SIZE(ptr->size),
+		offset + TOTAL_SIZE(size), MREMAP_MAYMOVE);
+	if (head == MAP_FAILED) RET_ERR("Failed to remap ptr with mremap().", NULL);
+	if (new_len > old_len) STAT_ADD(mapped_bytes, new_len - old_len);
+	else STAT_ADD(unmapped_bytes, old_len - new_len);
+	STAT_INC(mremap_calls);
+	ptr = (ptr_t*)(head + offset);
+	ptr->data = (unsigned char*)ptr + PTR_ALIGNED_SIZE;
+	ptr->size = size;
+	RET_OK(ptr->data);
+}
+
+/** Allocates a block too big for an arena. Blocks up to
+ * MAX_RUN_ALLOC_SIZE are carved from page runs, bigger ones take a cached
+ * mapping or are allocated with mmap().
+ * \param size The size of the block to be allocated.
+ * \param zero Pointer to a flag set if the block is known to be zero-filled
+ * or NULL.
+ * \return A pointer to the block or NULL on failure. */
+static inline void *large_use(size_t size, bool *zero) {
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (TOTAL_SIZE(size) <= ARENA_BUFF_SIZE) RET_ERR("size is too small.", NULL);
+	void *ptr = NULL;
+	if (size <= MAX_RUN_ALLOC_SIZE) {
+		ptr = run_use(size, zero);
+	} else if ((ptr = map_cache_use(size, MIN_ALLOC_SIZE))) {
+		if (zero) *zero = false;
+	} else if ((ptr = mmap_use(size)) && zero) {
+		*zero = true;
+	}
+	if (!ptr) RET_ERR("Failed to allocate large block.", NULL);
+	RET_OK(ptr);
+}
+
+/** Maps the slab region and its descriptor array. A region above the
+ * addresses the tagged heads of the central free lists can hold is given
+ * back, which leaves slabs disabled, and small blocks are then carved from
+ * arenas and page runs instead.
+ * Called through pthread_once() by slab_region_init(). */
+static inline void slab_region_map() {
+	void *region = MMAP_NORESERVE(SLAB_REGION_SIZE);
+	if (region == MAP_FAILED) return;
+	if (!CENTRAL_FITS(region, SLAB_REGION_SIZE)) {
+		munmap(region, SLAB_REGION_SIZE);
+		return;
+	}
+	void *slabs = MMAP_NORESERVE(NUM_SLABS * sizeof(slab_t));
+	if (slabs == MAP_FAILED) {
+		munmap(region, SLAB_REGION_SIZE);
+		return;
+	}
+	g_slabs = (slab_t*)slabs;
+	g_slab_region = (unsigned char*)region;
+}
+
+/** Reserves the slab region on first use.
+ * \return 0 on success or 1 on failure. */
+static inline int slab_region_init() {
+	if (pthread_once(&g_slab_once, slab_region_map))
+		RET_ERR("Failed to initialize slab region.", 1);
+	if (!g_slab_region) RET_ERR("Failed to map slab region with mmap().", 1);
+	RET_OK(0);
+}
+
+/** Removes a slab from the linked list of slabs with free slots.
+ * \param slab The slab to be removed. */
+static inline void slab_unlink(slab_t *slab) {
+	size_t i = SIZE_CLASS(slab->size);
+	if (slab->prev) slab->prev->next = slab->next;
+	if (slab->next) slab->next->prev = slab->prev;
+	else g_slab_tails[i] = slab->prev;
+	slab->next = NULL;
+	slab->prev = NULL;
+}
+
+/** Appends a slab to the linked list of slabs with free slots.
+ * \param slab The slab to be appended. */
+static inline void slab_link(slab_t *slab) {
+	size_t i = SIZE_CLASS(slab->size);
+	slab->next = NULL;
+	slab->prev = g_slab_tails[i];
+	if (g_slab_tails[i]) g_slab_tails[i]->next = slab;
+	g_slab_tails[i] = slab;
+}
+
+/** Takes a slab page from the pool of the calling thread, the shared pool
+ * or the slab region and prepares it for serving objects of a single size.
+ * Pages not taken from the pool of the calling thread are bound to the NUMA
+ * node of the thread.
+ * \param size The size of the objects the slab will serve.
+ * \return A pointer to the slab or NULL on failure. */
+static inline slab_t *slab_new(size_t size) {
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (size > SLAB_MAX_SIZE) RET_ERR("size is too big.", NULL);
+	if (slab_region_init()) RET_ERR("Failed to initialize slab region.", NULL);
+	slab_t *slab = g_slab_pool;
+	bool fresh = !slab;
+	if (slab) {
+		g_slab_pool = slab->next;
+		g_slab_pool_count--;
+	} else if (atomic_load_explicit(&g_slab_free_count, memory_order_relaxed)) {
+		pthread_mutex_lock(&g_slab_mutex);
+		if ((slab = g_slab_free)) {
+			g_slab_free = slab->next;
+			atomic_fetch_sub(&g_slab_free_count, 1);
+		}
+		pthread_mutex_unlock(&g_slab_mutex);
+	}
+	if (!slab) {
+		size_t i = atomic_fetch_add(&g_slab_count, 1);
+		if (i >= NUM_SLABS) {
+			atomic_fetch_sub(&g_slab_count, 1);
+			RET_ERR("Slab region exhausted.", NULL);
+		}
+		slab = &g_slabs[i];
+	}
+	slab->free = NULL;
+	slab->offset = 0;
+	slab->size = CLASS_SIZE(SIZE_CLASS(size));
+	slab->used = 0;
+	slab->capacity = SLAB_SIZE / slab->size;
+	slab->owner = g_heap;
+	if (fresh) {
+		slab->node = g_node;
+		if (numa_bind(SLAB_PAGE(slab), SLAB_SIZE, g_node))
+			ERROR_SET("Failed to bind slab.");
+	}
+	slab_link(slab);
+	RET_OK(slab);
+}
+
+/** Returns a pointer to an object allocated in a slab.
+ * \param size The size of the object to be allocated.
+ * \return The pointer to the allocated object or NULL on failure. */
+static inline void *slab_use(size_t size) {
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (size > SLAB_MAX_SIZE) RET_ERR("size is too big.", NULL);
+	slab_t *slab = g_slab_tails[SIZE_CLASS(size)];
+	if (!slab && !(slab = slab_new(size)))
+		RET_ERR("Failed to create new slab.", NULL);
+	void *data = slab->free;
+	if (data) {
+		slab->free = *(void**)data;
+	} else {
+		data = SLAB_PAGE(slab) + slab->offset;
+		slab->offset += slab->size;
+	}
+	if (++slab->used == slab->capacity) slab_unlink(slab);
+	RET_OK(data);
+}
+
+/** Purges the page of an empty slab and puts the slab into the shared
+ * pool, so any thread can reuse it.
+ * \param slab The empty slab. It must not be linked.
+ * \return 0 on success or 1 on failure. */
+static inline int slab_release(slab_t *slab) {
+	if (!slab) RET_ERR("slab cannot be NULL.", 1);
+	slab->size = 0;
+	int ret = page_purge(g_heap, (arena_t*)SLAB_PAGE(slab));
+	pthread_mutex_lock(&g_slab_mutex);
+	slab->next = g_slab_free;
+	g_slab_free = slab;
+	atomic_fetch_add(&g_slab_free_count, 1);
+	pthread_mutex_unlock(&g_slab_mutex);
+	if (ret) RET_ERR("Failed to purge slab.", 1);
+	RET_OK(0);
+}
+
+/** Puts an empty slab into the pool of the calling thread. Once the pool
+ * holds SLAB_POOL_MAX slabs, the slab is released to the shared pool
+ * instead.
+ * \param slab The empty slab. It must not be linked.
+ * \return 0 on success or 1 on failure. */
+static inline int slab_pool_put(slab_t *slab) {
+	if (!slab) RET_ERR("slab cannot be NULL.", 1);
+	if (g_slab_pool_count >= SLAB_POOL_MAX) {
+		if (slab_release(slab)) RET_ERR("Failed to release slab.", 1);
+		RET_OK(0);
+	}
+	slab->size = 0;
+	slab->next = g_slab_pool;
+	g_slab_pool = slab;
+	g_slab_pool_count++;
+	RET_OK(0);
+}
+
+/** Releases every slab in the pool of the calling thread to the shared
+ * pool.
+ * \return 0 on success or 1 on failure. */
+static inline int slab_pool_flush() {
+	int ret = 0;
+	while (g_slab_pool) {
+		slab_t *slab = g_slab_pool;
+		g_slab_pool = slab->next;
+		if (slab_release(slab)) ret = 1;
+	}
+	g_slab_pool_count = 0;
+	if (ret) RET_ERR("Failed to release slabs.", 1);
+	RET_OK(0);
+}
+
+/** Returns an object to the slab it was allocated from.
+ * Empty slabs other than the last one of their size are moved to the pool.
+ * \param data The pointer to the object to be freed.
+ * \return 0 on success or 1 on failure. */
+static inline int slab_free(void *data) {
+	if (!data) RET_ERR("data cannot be NULL.", 1);
+	if (!IS_SLAB(data)) RET_ERR("Invalid argument.", 1);
+	slab_t *slab = SLAB(data);
+	if (
+		!slab->size || !slab->used ||
+		((uintptr_t)data - (uintptr_t)SLAB_PAGE(slab)) % slab->size
+	) RET_ERR("Invalid argument.", 1);
+	if (slab->owner != g_heap) {
+		remote_free_push(slab->owner, data);
+		RET_OK(0);
+	}
+	if (slab->used-- == slab->capacity) slab_link(slab);
+	*(void**)data = slab->free;
+	slab->free = data;
+	if (!slab->used && (slab->prev || slab->next)) {
+		slab_unlink(slab);
+		if (slab_pool_put(slab)) RET_ERR("Failed to pool slab.", 1);
+	}
+	RET_OK(0);
+}
+
+/** Releases the blocks other threads handed over to the calling thread.
+ * \return 0 on success or 1 on failure. */
+static inline int remote_free_drain() {
+	void *data = atomic_exchange_explicit(
+		&g_heap->remote_free, NULL, memory_order_acquire);
+	int ret = 0;
+	while (data) {
+		void *next = *(void**)data;
+		if (IS_SLAB(data)) {
+			if (slab_free(data)) ret = 1;
+		} else {
+			PTR(data)->state = VALID;
+			if (ptr_free(data)) ret = 1;
+		}
+		data = next;
+	}
+	if (ret) RET_ERR("Failed to release remote free list.", 1);
+	RET_OK(0);
+}
+
+/** Returns the NUMA node of the memory of a cached block.
+ * \param data The pointer to the block.
+ * \return The node of the slab or chunk of the block. */
+static inline size_t block_node(void *data) {
+	return IS_SLAB(data) ? SLAB(data)->node : CHUNK(PTR(data)->arena)->node;
+}
+
+/** Returns a cached block to the slab or arena it was allocated from.
+ * \param data The pointer to the block to be released.
+ * \return 0 on success or 1 on failure. */
+static inline int block_release(void *data) {
+	if (!data) RET_ERR("data cannot be NULL.", 1);
+	if (IS_SLAB(data)) {
+		if (slab_free(data)) RET_ERR("Failed to free slab object.", 1);
+		RET_OK(0);
+	}
+	PTR(data)->state = VALID;
+	if (ptr_free(data)) RET_ERR("Failed to free pointer.", 1);
+	RET_OK(0);
+}
+
+/** Counts the blocks handed out by alloc_new_fast() in the stats of the
+ * calling thread and in the bytes left until the next
+ * profiler sample. The rest of the budget is kept. */
+static inline void fast_fold() {
+	if (g_fast.budget == g_fast.granted) return;
+	g_prof_bytes -= g_fast.granted - g_fast.budget;
+	g_fast.granted = g_fast.budget;
+	for (size_t i = 0; i < ALLOC_FAST_CLASSES; i++) {
+		size_t count = g_fast.counts[i];
+		if (!count) continue;
+		STAT_ADD(fast_path, count);
+		STAT_ADD(new_bytes, CLASS_SIZE(i) * count);
+		STAT_ADD(class_new[i], count);
+		g_fast.counts[i] = 0;
+	}
+}
+
+/** Grants alloc_new_fast() a new budget. It's at most
+ * FAST_BUDGET and the bytes left until the next profiler sample, and it's
+ * 0 while the debug layer or the trace writer has to see every block. */
+static inline void fast_grant() {
+	int64_t budget = g_prof_bytes < FAST_BUDGET ? g_prof_bytes : FAST_BUDGET;
+	if (budget < 0 || !g_heap) budget = 0;
+#ifdef ALLOC_DEBUG
+	if (atomic_load_explicit(&g_debug, memory_order_relaxed)) budget = 0;
+#endif
+#ifdef ALLOC_TRACE
+	if (atomic_load_explicit(&g_trace_on, memory_order_relaxed)) budget = 0;
+#endif
+	g_fast.budget = budget;
+	g_fast.granted = budget;
+}
+
+/** Counts the blocks handed out by alloc_new_fast() and takes its budget
+ * away, so its next allocation calls into the library. */
+static inline void fast_revoke() {
+	fast_fold();
+	g_fast.budget = 0;
+	g_fast.granted = 0;
+}
+
+/** Moves the arenas, free lists, slabs and chunks of the calling thread
+ * into a heap and clears them.
+ * \param heap The heap the state is parked in. */
+static inline void heap_park(heap_t *heap) {
+	heap->arenas = g_arena_head.next;
+	heap->arena_tail = g_arena_tail;
+	memcpy(heap->free_ptr_tails, g_free_ptr_tails, sizeof(g_free_ptr_tails));
+	memcpy(heap->slab_tails, g_slab_tails, sizeof(g_slab_tails));
+	heap->chunks = g_chunks;
+	heap->chunk_free_pages = g_chunk_free_pages;
+	g_arena_head.next = NULL;
+	g_arena_tail = NULL;
+	memset(g_free_ptr_tails, 0, sizeof(g_free_ptr_tails));
+	memset(g_slab_tails, 0, sizeof(g_slab_tails));
+	g_chunks = NULL;
+	g_chunk_free_pages = 0;
+}
+
+/** Moves the state parked in a heap into the thread local state of the
+ * calling thread.
+ * \param heap The heap the state is taken from. */
+static inline void heap_load(heap_t *heap) {
+	g_arena_head.next = heap->arenas;
+	if (heap->arenas) heap->arenas->prev = &g_arena_head;
+	g_arena_tail = heap->arenas ? heap->arena_tail : &g_arena_head;
+	memcpy(g_free_ptr_tails, heap->free_ptr_tails, sizeof(g_free_ptr_tails));
+	memcpy(g_slab_tails, heap->slab_tails, sizeof(g_slab_tails));
+	g_chunks = heap->chunks;
+	g_chunk_free_pages = heap->chunk_free_pages;
+}
+
+/** Parks the heap of an exiting thread so a new thread can adopt it. It's
+ * the destructor of the heap key. The blocks of alloc_new_fast() are
+ * counted, its free blocks and the thread cache are returned to the slabs
+ * and arenas, the blocks handed over by other threads are released, empty
+ * slabs are released to the shared pool, empty pages are purged and the
+ * thread local state is moved into the heap before it's put on the orphan
+ * list. Blocks freed later by other
+ * destructors of the thread are handed over to the parked heap.
+ * \param arg The heap of the exiting thread. */
+static inline void heap_exit(void *arg) {
+	heap_t *heap = (heap_t*)arg;
+	if (!heap || heap != g_heap) return;
+	fast_revoke();
+#ifdef ALLOC_TRACE
+	trace_exit();
+#endif
+	for (size_t i = 0; i < ALLOC_FAST_CLASSES; i++) {
+		while (g_fast.heads[i]) {
+			void *data = g_fast.heads[i];
+			g_fast.heads[i] = *(void**)data;
+			if (block_release(data)) ERROR_SET("Failed to release cached block.");
+		}
+	}
+	for (size_t i = 0; i < NUM_SIZE_CLASSES; i++) {
+		while (g_tcache[i].head) {
+			void *data = g_tcache[i].head;
+			g_tcache[i].head = *(void**)data;
+			if (block_release(data)) ERROR_SET("Failed to release cached block.");
+		}
+		g_tcache[i].count = 0;
+	}
+	if (remote_free_drain()) ERROR_SET("Failed to release remote frees.");
+	if (map_cache_flush()) ERROR_SET("Failed to release cached mappings.");
+	if (g_arena_tail != &g_arena_head && !g_arena_tail->ptrs_tail)
+		if (arena_del(g_arena_tail)) ERROR_SET("Failed to release arena.");
+	for (size_t i = 0; i < NUM_SLAB_SIZES; i++) {
+		slab_t *slab = g_slab_tails[i];
+		while (slab) {
+			slab_t *prev = slab->prev;
+			if (!slab->used) {
+				slab_unlink(slab);
+				if (slab_release(slab)) ERROR_SET("Failed to release slab.");
+			}
+			slab = prev;
+		}
+	}
+	if (slab_pool_flush()) ERROR_SET("Failed to release slabs.");
+	if (heap_decay(heap, UINT64_MAX)) ERROR_SET("Failed to purge pages.");
+	heap_park(heap);
+	g_heap = NULL;
+	pthread_mutex_lock(&g_heap_mutex);
+	heap->orphan_next = g_orphans;
+	g_orphans = heap;
+	pthread_mutex_unlock(&g_heap_mutex);
+}
+
+/** Creates the heap key. It's called once. */
+static inline void heap_key_create() {
+	if (pthread_key_create(&g_heap_key, heap_exit))
+		ERROR_SET("Failed to create heap key.");
+}
+
+/** Takes a heap from the orphan list and moves its parked state into the
+ * thread local state of the calling thread. The caller must hold the heap
+ * mutex.
+ * \return A pointer to the adopted heap or NULL if there's none. */
+static inline heap_t *heap_adopt() {
+	heap_t *heap = g_orphans;
+	if (!heap) RET_OK(NULL);
+	g_orphans = heap->orphan_next;
+	heap->orphan_next = NULL;
+	heap_load(heap);
+	RET_OK(heap);
+}
+
+/** Releases the blocks other threads handed over to parked heaps. The state
+ * of each parked heap with remote frees is loaded into the calling thread
+ * for the drain and parked again, and the state of the calling thread is
+ * restored last. Empty slabs are released to the shared pool if the calling
+ * thread has no heap of its own. The caller must hold the heap mutex.
+ * \return 0 on success or 1 on failure. */
+static inline int orphan_drain() {
+	heap_t *self = g_heap;
+	bool parked = false;
+	int ret = 0;
+	for (heap_t *heap = g_orphans; heap; heap = heap->orphan_next) {
+		if (!atomic_load_explicit(&heap->remote_free, memory_order_relaxed))
+			continue;
+		if (self && !parked) {
+			heap_park(self);
+			parked = true;
+		}
+		heap_load(heap);
+		g_heap = heap;
+		g_arena_head.owner = heap;
+		if (remote_free_drain()) ret = 1;
+		heap_park(heap);
+	}
+	g_heap = self;
+	g_arena_head.owner = self;
+	if (parked) heap_load(self);
+	if (!self && slab_pool_flush()) ret = 1;
+	if (ret) RET_ERR("Failed to release remote frees of parked heaps.", 1);
+	RET_OK(0);
+}
+
+/** Assigns a heap struct to the calling thread on first use. The heap of
+ * an exited thread is adopted if there's one, otherwise a new one is carved
+ * from the heap page. The heap is registered with the heap key so it's
+ * parked again when the thread exits.
+ * \return 0 on success or 1 on failure. */
+static inline int heap_init() {
+	if (g_heap) RET_OK(0);
+	pthread_once(&g_heap_once, heap_key_create);
+	pthread_mutex_lock(&g_heap_mutex);
+	g_node = numa_node();
+	if (!(g_heap = heap_adopt())) {
+		if (!g_heap_page || g_heap_count == ARENA_SIZE / sizeof(heap_t)) {
+			heap_t *page = (heap_t*)MMAP(ARENA_SIZE);
+			if (page == MAP_FAILED) {
+				pthread_mutex_unlock(&g_heap_mutex);
+				RET_ERR("Failed to allocate heap page with mmap().", 1);
+			}
+			g_heap_page = page;
+			g_heap_count = 0;
+		}
+		g_heap = &g_heap_page[g_heap_count++];
+		pthread_mutex_init(&g_heap->dirty_mutex, NULL);
+		g_heap->next = g_heaps;
+		g_heaps = g_heap;
+		g_arena_tail = &g_arena_head;
+		if (g_heap_count == 1) {
+			STAT_ADD(mapped_bytes, ARENA_SIZE);
+			STAT_INC(mmap_calls);
+		}
+	}
+	g_arena_head.owner = g_heap;
+	pthread_mutex_unlock(&g_heap_mutex);
+	if (pthread_setspecific(g_heap_key, g_heap))
+		ERROR_SET("Failed to register heap.");
+	RET_OK(0);
+}
+
+/** Resets all global variables. Unmaps heap memory.
+ * \return 0 on success or 1 on failure. */
+static inline int reset() {
+	error_reset();
+	if (heap_init()) RET_ERR("Failed to initialize heap.", 1);
+	if (map_cache_flush()) RET_ERR("Failed to release cached mappings.", 1);
+	while (g_arena_tail && g_arena_tail->prev) {
+		g_arena_tail = g_arena_tail->prev;
+		if (page_free(g_arena_tail->next))
+			RET_ERR("Failed to release arena.", 1);
+	}
+	if (heap_decay(g_heap, UINT64_MAX)) RET_ERR("Failed to purge pages.", 1);
+	memset(&g_arena_head, 0, sizeof(arena_t));
+	g_arena_head.offset = ARENA_BUFF_SIZE;
+	g_arena_head.owner = g_heap;
+	g_arena_tail = &g_arena_head;
+	memset(g_free_ptr_tails, 0, sizeof(g_free_ptr_tails));
+	if (g_slab_region) {
+		memset(g_slabs, 0, atomic_load(&g_slab_count) * sizeof(slab_t));
+		atomic_store(&g_slab_count, 0);
+	}
+	memset(g_slab_tails, 0, sizeof(g_slab_tails));
+	g_slab_pool = NULL;
+	g_slab_pool_count = 0;
+	g_slab_free = NULL;
+	atomic_store(&g_slab_free_count, 0);
+	g_orphans = NULL;
+	atomic_store(&g_heap->remote_free, NULL);
+	for (heap_t *heap = g_heaps; heap; heap = heap->next)
+		memset(&heap->stats, 0, sizeof(stats_t));
+	memset(g_tcache, 0, sizeof(g_tcache));
+	memset(&g_fast, 0, sizeof(g_fast));
+	for (size_t n = 0; n < NUMA_MAX_NODES; n++) {
+		for (size_t i = 0; i < NUM_SIZE_CLASSES; i++) {
+			atomic_store(&g_central[n][i].head, 0);
+			atomic_store(&g_central[n][i].count, 0);
+		}
+	}
+	g_numa_nodes = 1;
+	g_numa_fake = false;
+	g_node = 0;
+	atomic_store(&g_prof_rate, 0);
+	g_prof_bytes = 0;
+	memset(g_prof_sites, 0, sizeof(g_prof_sites));
+	memset(g_prof_live, 0, sizeof(g_prof_live));
+	memset(g_prof_filter, 0, sizeof(g_prof_filter));
+	atomic_store(&g_prof_live_count, 0);
+#ifdef ALLOC_DEBUG
+	atomic_store(&g_debug, 0);
+	if (g_debug_blocks) {
+		for (size_t i = 0; i < (size_t)1 << g_debug_lg; i++)
+			if (g_debug_blocks[i].data && g_debug_blocks[i].len)
+				munmap(g_debug_blocks[i].base - MMAP_PAGE_SIZE, g_debug_blocks[i].len);
+		munmap(g_debug_blocks, sizeof(debug_block_t) << g_debug_lg);
+	}
+	g_debug_blocks = NULL;
+	g_debug_lg = 0;
+	g_debug_count = 0;
+	g_quarantine_head = 0;
+	g_quarantine_count = 0;
+	g_quarantine_bytes = 0;
+#endif
+#ifdef ALLOC_TRACE
+	if (trace_stop()) RET_ERR("Failed to stop trace.", 1);
+#endif
+	RET_OK(0);
+}
+
+/** Pushes a chain of blocks onto a central free list as one batch. The
+ * head of the list keeps an ABA tag above bit CENTRAL_TAG_SHIFT, so blocks
+ * at higher addresses are refused.
+ * \param central Pointer to the central free list.
+ * \param head The first block of the chain.
+ * \param tail The last block of the chain.
+ * \param count The number of blocks in the chain.
+ * \return 0 on success or 1 on failure. */
+static inline int central_push(central_t *central, void *head, void *tail, size_t count) {
+	if (!central || !head || !tail) RET_ERR("Invalid argument.", 1);
+	if (!CENTRAL_FITS(head, MIN_ALLOC_SIZE))
+		RET_ERR("Block is above the address range of the central free lists.", 1);
+	*(void**)tail = NULL;
+	uint64_t old = atomic_load_explicit(&central->head, memory_order_relaxed);
+	do NEXT_BATCH(head) = CENTRAL_PTR(old);
+	while (!atomic_compare_exchange_weak_explicit(&central->head, &old,
+		CENTRAL_HEAD(old, head), memory_order_release, memory_order_relaxed));
+	atomic_fetch_add_explicit(&central->count, count, memory_order_relaxed);
+	RET_OK(0);
+}
+
+/** Pops a batch of blocks from a central free list. The second word of the
+ * head batch may be overwritten by a thread that popped it in the meantime,
+ * but then the tag has changed and the exchange is retried. Slabs and
+ * arenas are never unmapped, so the read itself is always safe.
+ * \param central Pointer to the central free list.
+ * \param tail Pointer to the variable the last block is written to.
+ * \param count Pointer to the variable the number of blocks is written to.
+ * \return The first block of the batch or NULL if the central free list is
+ * empty. */
+static inline void *central_pop(central_t *central, void **tail, size_t *count) {
+	uint64_t old = atomic_load_explicit(&central->head, memory_order_acquire);
+	void *head;
+	do {
+		if (!(head = CENTRAL_PTR(old))) return NULL;
+	} while (!atomic_compare_exchange_weak_explicit(&central->head, &old,
+		CENTRAL_HEAD(old, NEXT_BATCH(head)),
+		memory_order_acquire, memory_order_acquire));
+	size_t n = 1;
+	void *last = head;
+	while (*(void**)last) {
+		last = *(void**)last;
+		n++;
+	}
+	atomic_fetch_sub_explicit(&central->count, n, memory_order_relaxed);
+	*tail = last;
+	*count = n;
+	return head;
+}
+
+/** Moves a batch of blocks from the central free list of a size class on
+ * the NUMA node of the calling thread to the thread cache.
+ * \param i The index of the size class.
+ * \return The number of blocks moved. */
+static inline size_t central_refill(size_t i) {
+	void *tail;
+	size_t count;
+	void *head = central_pop(CENTRAL(i), &tail, &count);
+	if (!head) return 0;
+	*(void**)tail = g_tcache[i].head;
+	g_tcache[i].head = head;
+	g_tcache[i].count += count;
+	return count;
+}
+
+/** Moves a batch of blocks from the thread cache of a size class to the
+ * central free list of the NUMA node of the calling thread. Blocks that
+ * don't fit in the central free list are returned to their slabs or
+ * arenas.
+ * \param i The index of the size class.
+ * \return 0 on success or 1 on failure. */
+static inline int central_flush(size_t i) {
+	void *head = g_tcache[i].head;
+	if (!head) RET_OK(0);
+	void *tail = head;
+	size_t count = 1;
+	while (count < TCACHE_BATCH && *(void**)tail) {
+		tail = *(void**)tail;
+		count++;
+	}
+	g_tcache[i].head = *(void**)tail;
+	g_tcache[i].count -= count;
+	central_t *central = CENTRAL(i);
+	size_t cached = atomic_load_explicit(&central->count, memory_order_relaxed);
+	if (cached + count <= CENTRAL_MAX) {
+		if (central_push(central, head, tail, count))
+			RET_ERR("Failed to push batch.", 1);
+		RET_OK(0);
+	}
+	*(void**)tail = NULL;
+	int ret = 0;
+	while (head) {
+		void *next = *(void**)head;
+		if (block_release(head)) ret = 1;
+		head = next;
+	}
+	if (ret) RET_ERR("Failed to release blocks.", 1);
+	RET_OK(0);
+}
+
+/** Takes a free block of the size class of a size from the thread cache,
+ * refilling the thread cache from the central free list if it's empty.
+ * \param size The size of the block to be allocated.
+ * \return A pointer to the block or NULL if none is cached. */
+static inline void *tcache_use(size_t size) {
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (size > MAX_ARENA_ALLOC_SIZE) RET_ERR("size is too big.", NULL);
+	size_t i = SIZE_CLASS(size);
+	tcache_t *tcache = &g_tcache[i];
+	if (!tcache->head && !central_refill(i))
+		RET_ERR("No matching cached block found.", NULL);
+	void *data = tcache->head;
+	tcache->head = *(void**)data;
+	tcache->count--;
+	if (!IS_SLAB(data)) {
+		PTR(data)->size = size;
+		PTR(data)->state = VALID;
+	}
+	RET_OK(data);
+}
+
+/** Puts a block into the thread cache of its size class, flushing a batch
+ * to the central free list if the thread cache is full. Blocks allocated
+ * with mmap() and arena blocks no bigger than SLAB_MAX_SIZE are freed
+ * directly instead, so the small size classes only ever hold slab objects,
+ * and blocks on another NUMA node than the calling thread are returned to
+ * their slabs or arenas. Slab blocks have no
+ * state to check, so a double free is only caught when the block is still
+ * at the head of the thread cache; the debug mode catches all of them.
+ * \param data The pointer to the block to be freed.
+ * \return 0 on success or 1 on failure. */
+static inline int tcache_free(void *data) {
+	if (!data) RET_ERR("data cannot be NULL.", 1);
+	size_t i;
+	if (IS_SLAB(data)) {
+		if (!SLAB(data)->size) RET_ERR("Invalid argument.", 1);
+		i = SIZE_CLASS(SLAB(data)->size);
+		if (g_tcache[i].head == data) RET_ERR("Double free detected.", 1);
+	} else {
+		ptr_t *ptr = PTR(data);
+		if (ptr->state != VALID) RET_ERR("Invalid argument.", 1);
+		if (!ptr->arena || ptr->size <= SLAB_MAX_SIZE) {
+			if (ptr_free(data)) RET_ERR("Failed to free pointer.", 1);
+			RET_OK(0);
+		}
+		ptr->state = CACHED;
+		i = SIZE_CLASS(ptr->size);
+	}
+	if (g_numa_nodes > 1 && block_node(data) != g_node) {
+		if (block_release(data)) RET_ERR("Failed to release block.", 1);
+		RET_OK(0);
+	}
+	tcache_t *tcache = &g_tcache[i];
+	*(void**)data = tcache->head;
+	tcache->head = data;
+	if (++tcache->count > TCACHE_MAX && central_flush(i))
+		RET_ERR("Failed to flush thread cache.", 1);
+	RET_OK(0);
+}
+
+/** Puts a slab block freed with a known size into the thread cache of its
+ * size class, flushing a batch to the central free list if the thread cache
+ * is full. The size class is computed from the size without reading the
+ * slab, which holds since slab objects are only resized in place within
+ * their size class. Blocks allocated with an alignment sit in a bigger
+ * class than their size and must not be freed this way. Blocks on another
+ * NUMA node than the calling thread are returned to their slabs.
+ * \param data The pointer to the block to be freed.
+ * \param size The size the block was allocated or last resized with.
+ * \return 0 on success or 1 on failure. */
+static inline int tcache_free_sized(void *data, size_t size) {
+	if (!data) RET_ERR("data cannot be NULL.", 1);
+	if (!size || size > SLAB_MAX_SIZE || !IS_SLAB(data))
+		RET_ERR("Invalid argument.", 1);
+	if (g_numa_nodes > 1 && block_node(data) != g_node) {
+		if (block_release(data)) RET_ERR("Failed to release block.", 1);
+		RET_OK(0);
+	}
+	size_t i = SIZE_CLASS(size);
+	tcache_t *tcache = &g_tcache[i];
+	if (tcache->head == data) RET_ERR("Double free detected.", 1);
+	*(void**)data = tcache->head;
+	tcache->head = data;
+	if (++tcache->count > TCACHE_MAX && central_flush(i))
+		RET_ERR("Failed to flush thread cache.", 1);
+	RET_OK(0);
+}
+
+/** Takes up to count free blocks of the size class of a size from the
+ * thread cache, refilling the thread cache from the central free list as
+ * needed.
+ * \param size The size of the blocks to be allocated.
+ * \param count The number of blocks to be taken.
+ * \param ptrs Pointer to the array the blocks are written to.
+ * \return The number of blocks taken. */
+static inline size_t tcache_use_batch(size_t size, size_t count, void **ptrs) {
+	size_t i = SIZE_CLASS(size);
+	tcache_t *tcache = &g_tcache[i];
+	size_t n = 0;
+	while (n < count && (tcache->head || central_refill(i))) {
+		void *data = tcache->head;
+		tcache->head = *(void**)data;
+		tcache->count--;
+		if (!IS_SLAB(data)) {
+			PTR(data)->size = size;
+			PTR(data)->state = VALID;
+		}
+		ptrs[n++] = data;
+	}
+	return n;
+}
+
+/** Takes up to count objects of a size from the slabs of the calling
+ * thread. Each slab hands out its free slots first and then a contiguous
+ * run of its unused tail.
+ * \param size The size of the objects to be allocated.
+ * \param count The number of objects to be taken.
+ * \param ptrs Pointer to the array the objects are written to.
+ * \return The number of objects taken. */
+static inline size_t slab_use_batch(size_t size, size_t count, void **ptrs) {
+	size_t i = SIZE_CLASS(size);
+	size_t n = 0;
+	while (n < count) {
+		slab_t *slab = g_slab_tails[i];
+		if (!slab && !(slab = slab_new(size))) break;
+		unsigned char *page = SLAB_PAGE(slab);
+		while (n < count && slab->used < slab->capacity) {
+			void *data = slab->free;
+			if (data) {
+				slab->free = *(void**)data;
+			} else {
+				data = page + slab->offset;
+				slab->offset += slab->size;
+			}
+			slab->used++;
+			ptrs[n++] = data;
+		}
+		if (slab->used == slab->capacity) slab_unlink(slab);
+	}
+	return n;
+}
+
+/** Refills the free blocks of alloc_new_fast() of a size class with up to
+ * FAST_BATCH blocks from the thread cache and the slabs of the calling
+ * thread once it has none left. The thread cache of these classes only
+ * holds slab objects, so fast_fold() counts the blocks without headers.
+ * \param i The index of the size class. */
+static inline void fast_stash(size_t i) {
+	if (i >= ALLOC_FAST_CLASSES || g_fast.heads[i]) return;
+	void *ptrs[FAST_BATCH];
+	size_t n = tcache_use_batch(CLASS_SIZE(i), FAST_BATCH, ptrs);
+	n += slab_use_batch(CLASS_SIZE(i), FAST_BATCH - n, ptrs + n);
+	while (n) {
+		*(void**)ptrs[--n] = g_fast.heads[i];
+		g_fast.heads[i] = ptrs[n];
+	}
+}
+
+/** Puts a chain of blocks of a size class into the thread cache, flushing
+ * batches to the central free list while the thread cache is full.
+ * \param i The index of the size class.
+ * \param head The first block of the chain.
+ * \param tail The last block of the chain.
+ * \param count The number of blocks in the chain.
+ * \return 0 on success or 1 on failure. */
+static inline int tcache_push(size_t i, void *head, void *tail, size_t count) {
+	if (!head || !tail) RET_ERR("Invalid argument.", 1);
+	tcache_t *tcache = &g_tcache[i];
+	*(void**)tail = tcache->head;
+	tcache->head = head;
+	tcache->count += count;
+	while (tcache->count > TCACHE_MAX)
+		if (central_flush(i)) RET_ERR("Failed to flush thread cache.", 1);
+	RET_OK(0);
+}
+
+/** Puts blocks into the thread caches of their size classes. Consecutive
+ * blocks of the same size class are chained and pushed at once. Blocks
+ * allocated with mmap() and arena blocks no bigger than SLAB_MAX_SIZE are
+ * freed directly instead and blocks on another NUMA node than the calling
+ * thread are returned to their slabs or arenas. Slab blocks that are
+ * already at the head of the chain or the thread cache are skipped as
+ * double frees.
+ * \param ptrs Pointer to the array of blocks to be freed.
+ * \param count The number of blocks.
+ * \return 0 on success or 1 if any of the blocks couldn't be freed. */
+static inline int tcache_free_batch(void **ptrs, size_t count) {
+	if (!ptrs) RET_ERR("ptrs cannot be NULL.", 1);
+	int ret = 0;
+	size_t i = 0;
+	void *head = NULL;
+	void *tail = NULL;
+	size_t n = 0;
+	for (size_t j = 0; j < count; j++) {
+		void *data = ptrs[j];
+		size_t c;
+		if (!data) {
+			ret = 1;
+			continue;
+		}
+		if (IS_SLAB(data)) {
+			if (!SLAB(data)->size) {
+				ret = 1;
+				continue;
+			}
+			c = SIZE_CLASS(SLAB(data)->size);
+			if (g_tcache[c].head == data || (n && c == i && head == data)) {
+				ret = 1;
+				continue;
+			}
+		} else {
+			ptr_t *ptr = PTR(data);
+			if (ptr->state != VALID) {
+				ret = 1;
+				continue;
+			}
+			if (!ptr->arena || ptr->size <= SLAB_MAX_SIZE) {
+				if (ptr_free(data)) ret = 1;
+				continue;
+			}
+			ptr->state = CACHED;
+			c = SIZE_CLASS(ptr->size);
+		}
+		if (g_numa_nodes > 1 && block_node(data) != g_node) {
+			if (block_release(data)) ret = 1;
+			continue;
+		}
+		if (n && c != i) {
+			if (tcache_push(i, head, tail, n)) ret = 1;
+			n = 0;
+		}
+		if (!n) {
+			i = c;
+			tail = data;
+			head = NULL;
+		}
+		*(void**)data = head;
+		head = data;
+		n++;
+	}
+	if (n && tcache_push(i, head, tail, n)) ret = 1;
+	if (ret) RET_ERR("Failed to free pointers.", 1);
+	RET_OK(0);
+}
+
+/** Acquires the global mutexes before fork() so the child process doesn't
+ * inherit one held by a thread that doesn't exist in it. */
+static inline void fork_prepare() {
+#ifdef ALLOC_DEBUG
+	pthread_mutex_lock(&g_debug_mutex);
+#endif
+	pthread_mutex_lock(&g_config_mutex);
+	pthread_mutex_lock(&g_decay_mutex);
+	pthread_mutex_lock(&g_heap_mutex);
+	for (heap_t *heap = g_heaps; heap; heap = heap->next)
+		pthread_mutex_lock(&heap->dirty_mutex);
+	pthread_mutex_lock(&g_slab_mutex);
+	pthread_mutex_lock(&g_prof_mutex);
+}
+
+/** Releases the global mutexes acquired by fork_prepare() in the parent
+ * process after fork(). */
+static inline void fork_parent() {
+	pthread_mutex_unlock(&g_prof_mutex);
+	pthread_mutex_unlock(&g_slab_mutex);
+	for (heap_t *heap = g_heaps; heap; heap = heap->next)
+		pthread_mutex_unlock(&heap->dirty_mutex);
+	pthread_mutex_unlock(&g_heap_mutex);
+	pthread_mutex_unlock(&g_decay_mutex);
+	pthread_mutex_unlock(&g_config_mutex);
+#ifdef ALLOC_DEBUG
+	pthread_mutex_unlock(&g_debug_mutex);
+#endif
+}
+
+/** Reinitializes the global mutexes acquired by fork_prepare() in the child
+ * process after fork(). The background decay thread doesn't survive the
+ * fork, so it's marked stopped. Neither does the trace thread, so the child
+ * isn't traced. */
+static inline void fork_child() {
+	pthread_mutex_init(&g_prof_mutex, NULL);
+	pthread_mutex_init(&g_slab_mutex, NULL);
+	for (heap_t *heap = g_heaps; heap; heap = heap->next)
+		pthread_mutex_init(&heap->dirty_mutex, NULL);
+	pthread_mutex_init(&g_heap_mutex, NULL);
+	g_decay_running = false;
+	pthread_cond_init(&g_decay_cond, NULL);
+	pthread_mutex_init(&g_decay_mutex, NULL);
+	pthread_mutex_init(&g_config_mutex, NULL);
+#ifdef ALLOC_DEBUG
+	pthread_mutex_init(&g_debug_mutex, NULL);
+#endif
+#ifdef ALLOC_TRACE
+	atomic_store(&g_trace_on, false);
+	g_trace_running = false;
+	pthread_cond_init(&g_trace_cond, NULL);
+	pthread_mutex_init(&g_trace_mutex, NULL);
+	for (trace_slot_t *slot = g_trace_slots; slot; slot = slot->next)
+		pthread_mutex_init(&slot->mutex, NULL);
+#endif
+}
+
+/** Returns the usable size of a block.
+ * \param data The pointer to the block.
+ * \return The size of the block. */
+static inline size_t block_size(void *data) {
+	return IS_SLAB(data) ? SLAB(data)->size : PTR(data)->size;
+}
+
+/** Records blocks handed out by the calling thread in its stats.
+ * \param size The usable size of the blocks.
+ * \param header Whether the blocks have a header.
+ * \param count The number of blocks. */
+static inline void stats_new(size_t size, bool header, size_t count) {
+	STAT_ADD(new_bytes, size * count);
+	if (header) STAT_ADD(ptr_new, count);
+	if (size <= MAX_ARENA_ALLOC_SIZE)
+		STAT_ADD(class_new[SIZE_CLASS(size)], count);
+}
+
+/** Records blocks freed by the calling thread in its stats.
+ * \param size The usable size of the blocks.
+ * \param header Whether the blocks have a header.
+ * \param count The number of blocks. */
+static inline void stats_del(size_t size, bool header, size_t count) {
+	STAT_ADD(del_bytes, size * count);
+	if (header) STAT_ADD(ptr_del, count);
+	if (size <= MAX_ARENA_ALLOC_SIZE)
+		STAT_ADD(class_del[SIZE_CLASS(size)], count);
+}
+
+/** Adds the counters of a heap to a stats struct. Blocks freed by another
+ * thread than the one that allocated them only balance out once the heaps
+ * of both threads are added.
+ * \param stats The stats struct to add the counters to.
+ * \param heap The heap whose counters are to be added. */
+static inline void stats_add(alloc_stats_t *stats, heap_t *heap) {
+	stats->live_bytes += STAT_LOAD(heap, new_bytes) - STAT_LOAD(heap, del_bytes);
+	stats->mapped_bytes +=
+		STAT_LOAD(heap, mapped_bytes) - STAT_LOAD(heap, unmapped_bytes);
+	stats->header_bytes += (STAT_LOAD(heap, ptr_new) - STAT_LOAD(heap, ptr_del)) *
+		PTR_ALIGNED_SIZE;
+	stats->arena_count += STAT_LOAD(heap, arena_new) - STAT_LOAD(heap, arena_del);
+	stats->mmap_count += STAT_LOAD(heap, mmap_new) - STAT_LOAD(heap, mmap_del);
+	stats->thread_count++;
+	stats->fast_path += STAT_LOAD(heap, fast_path);
+	stats->slow_path += STAT_LOAD(heap, slow_path);
+	stats->mmap_calls += STAT_LOAD(heap, mmap_calls);
+	stats->munmap_calls += STAT_LOAD(heap, munmap_calls);
+	stats->mremap_calls += STAT_LOAD(heap, mremap_calls);
+	stats->madvise_calls += STAT_LOAD(heap, madvise_calls);
+	stats->dirty_bytes +=
+		atomic_load_explicit(&heap->dirty_count, memory_order_relaxed) * ARENA_SIZE;
+}
+
+/** Completes a stats struct with the global counters and derived values.
+ * \param stats The stats struct to be completed. */
+static inline void stats_finish(alloc_stats_t *stats) {
+	stats->slab_count =
+		atomic_load(&g_slab_count) - atomic_load(&g_slab_free_count);
+	stats->mapped_bytes +=
+		stats->arena_count * ARENA_SIZE + stats->slab_count * SLAB_SIZE;
+	stats->fragmentation = stats->mapped_bytes > stats->live_bytes ?
+		1.0 - (double)stats->live_bytes / (double)stats->mapped_bytes : 0;
+}
+
+/** Allocates a block on the fast path of the thread cache or on the slow
+ * path of slabs, arenas or mmap(), initializing the heap of the calling
+ * thread on first use. Small blocks are carved from an arena like bigger
+ * ones if no slab can be had. Blocks carved from an arena past its clean
+ * mark and blocks mapped with mmap() are known to be zero-filled.
+ * \param size The size of the block to be allocated.
+ * \param zero Pointer to the variable that's set to whether the block is
+ * known to be zero-filled or NULL.
+ * \return The pointer to the allocated block or NULL on failure. */
+static inline void *block_new(size_t size, bool *zero) {
+	if (!g_heap && heap_init()) RET_ERR("Failed to initialize heap.", NULL);
+	if (atomic_load_explicit(&g_heap->remote_free, memory_order_relaxed))
+		if (remote_free_drain()) ERROR_SET("Failed to release remote frees.");
+	void *ptr = NULL;
+	bool clean = false;
+	if (size <= MAX_ARENA_ALLOC_SIZE && (ptr = tcache_use(size))) {
+		STAT_INC(fast_path);
+	} else {
+		STAT_INC(slow_path);
+		decay_tick();
+		if (size <= SLAB_MAX_SIZE) ptr = slab_use(size);
+		if (!ptr && TOTAL_SIZE(size) > ARENA_BUFF_SIZE) {
+			ptr = large_use(size, &clean);
+		} else if (!ptr && free_ptr_find(size) < NUM_SIZE_CLASSES) {
+			ptr = free_ptr_use(size);
+		} else if (!ptr && (ptr = arena_use(size))) {
+			arena_t *arena = PTR(ptr)->arena;
+			clean = (size_t)((unsigned char*)PTR(ptr) - arena->buff) >= arena->clean;
+		}
+	}
+	if (zero) *zero = clean;
+	return ptr;
+}
+
+/** Moves a region to its next page, taking a new page from the chunks of
+ * the calling thread if the region has no more pages.
+ * \param region The region to be expanded.
+ * \return 0 on success or 1 on failure. */
+static inline int region_expand(alloc_region_t *region) {
+	if (!region) RET_ERR("region cannot be NULL.", 1);
+	if (!region->page->next) {
+		region_page_t *page = (region_page_t*)page_use();
+		if (!page) RET_ERR("Failed to allocate new region page.", 1);
+		page->next = NULL;
+		region->page->next = page;
+	}
+	region->page = region->page->next;
+	region->offset = REGION_PAGE_HEADER;
+	RET_OK(0);
+}
+
+/** Returns a pointer to a block bumped from a region.
+ * Blocks that don't fit in a page are allocated with mmap() and tracked
+ * by the region.
+ * \param region The region to allocate from.
+ * \param size The size of the block to be allocated.
+ * \return The pointer to the allocated block or NULL on failure. */
+static inline void *region_use(alloc_region_t *region, size_t size) {
+	if (!region) RET_ERR("region cannot be NULL.", NULL);
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (size > MAX_REGION_ALLOC_SIZE) {
+		region_large_t *large = (region_large_t*)region_use(
+			region, sizeof(region_large_t));
+		if (!large) RET_ERR("Failed to allocate large block node.", NULL);
+		large->data = mmap_use(size);
+		if (!large->data) RET_ERR("Failed to allocate large block.", NULL);
+		large->next = region->large;
+		region->large = large;
+		RET_OK(large->data);
+	}
+	size = ROUNDUP(size);
+	if (region->offset + size > ARENA_SIZE && region_expand(region))
+		RET_ERR("Failed to expand region.", NULL);
+	void *data = (unsigned char*)region->page + region->offset;
+	region->offset += size;
+	RET_OK(data);
+}
+
+/** Unmaps the blocks of a region allocated with mmap().
+ * \param region The region whose large blocks are to be released.
+ * \return 0 on success or 1 on failure. */
+static inline int region_release(alloc_region_t *region) {
+	if (!region) RET_ERR("region cannot be NULL.", 1);
+	int ret = 0;
+	for (region_large_t *large = region->large; large; large = large->next)
+		if (ptr_free(large->data)) ret = 1;
+	region->large = NULL;
+	if (ret) RET_ERR("Failed to release large blocks.", 1);
+	RET_OK(0);
+}
+
+/** Takes a constructed object from the free list of a cache or allocates
+ * and constructs a new one if the free list is empty.
+ * \param cache The cache to take the object from.
+ * \return A pointer to the object or NULL on failure. */
+static inline void *cache_use(alloc_cache_t *cache) {
+	if (!cache) RET_ERR("cache cannot be NULL.", NULL);
+	void *tail;
+	size_t count;
+	void *link = central_pop(&cache->free, &tail, &count);
+	if (link) {
+		atomic_fetch_add_explicit(&cache->gets, 1, memory_order_relaxed);
+		RET_OK(CACHE_OBJ(cache, link));
+	}
+	size_t size = cache->link + sizeof(void*) * 2;
+	void *obj = cache->align > MIN_ALLOC_SIZE ?
+		alloc_new_aligned(size, cache->align) : alloc_new(size);
+	if (!obj) RET_ERR("Failed to allocate object.", NULL);
+	if (cache->ctor) cache->ctor(obj);
+	atomic_fetch_add_explicit(&cache->gets, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&cache->ctor_calls, 1, memory_order_relaxed);
+	RET_OK(obj);
+}
+
+/** Puts a constructed object on the free list of a cache.
+ * \param cache The cache the object was taken from.
+ * \param obj The pointer to the object.
+ * \return 0 on success or 1 on failure. */
+static inline int cache_free(alloc_cache_t *cache, void *obj) {
+	if (!cache || !obj) RET_ERR("Invalid argument.", 1);
+	void *link = CACHE_LINK(cache, obj);
+	if (central_push(&cache->free, link, link, 1))
+		RET_ERR("Failed to push object.", 1);
+	RET_OK(0);
+}
+
+/** Destroys and frees the objects on the free list of a cache.
+ * Must not run concurrently with other uses of the cache, since popped
+ * objects are freed right away.
+ * \param cache The cache to be drained.
+ * \return 0 on success or 1 on failure. */
+static inline int cache_drain(alloc_cache_t *cache) {
+	if (!cache) RET_ERR("cache cannot be NULL.", 1);
+	void *tail;
+	size_t count;
+	void *link;
+	while ((link = central_pop(&cache->free, &tail, &count))) {
+		void *obj = CACHE_OBJ(cache, link);
+		if (cache->dtor) cache->dtor(obj);
+		alloc_del(obj);
+	}
+	RET_OK(0);
+}
+
+/** Returns the next number of the random generator of the calling thread.
+ * The generator is seeded from the clock and the address of its state on
+ * first use.
+ * \return A random number. */
+static inline uint64_t prof_rand() {
+	if (!g_prof_seed) {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		g_prof_seed = ((uint64_t)ts.tv_nsec ^ (uint64_t)(uintptr_t)&g_prof_seed) | 1;
+	}
+	g_prof_seed ^= g_prof_seed >> 12;
+	g_prof_seed ^= g_prof_seed << 25;
+	g_prof_seed ^= g_prof_seed >> 27;
+	return g_prof_seed * 0x2545F4914F6CDD1DLLU;
+}
+
+/** Draws the number of bytes until the next sample from an exponential
+ * distribution, so the samples form a Poisson process over the allocated
+ * bytes and every byte is equally likely to be sampled.
+ * \param rate The mean sampling interval in bytes.
+ * \return The number of bytes until the next sample. */
+static inline int64_t prof_interval(size_t rate) {
+	double u = (double)((prof_rand() >> 11) + 1) * 0x1p-53;
+	return (int64_t)(-log(u) * (double)rate) + 1;
+}
+
+/** Finds the site of a backtrace, adding it if it's not in the table yet.
+ * The profile mutex must be held.
+ * \param frames The return addresses of the backtrace.
+ * \param depth The number of return addresses.
+ * \return A pointer to the site or NULL if the table is full. */
+static inline prof_site_t *prof_site_find(void **frames, size_t depth) {
+	if (!depth) return NULL;
+	uint64_t hash = depth;
+	for (size_t i = 0; i < depth; i++)
+		hash = (hash ^ (uint64_t)(uintptr_t)frames[i]) * 0x100000001B3LLU;
+	size_t i = PROF_HASH(hash, LG_PROF_SITES);
+	for (size_t n = 0; n < PROF_SITES; n++, i = (i + 1) & (PROF_SITES - 1)) {
+		prof_site_t *site = &g_prof_sites[i];
+		if (!site->depth) {
+			site->hash = hash;
+			site->depth = depth;
+			memcpy(site->frames, frames, depth * sizeof(void*));
+			return site;
+		}
+		if (
+			site->hash == hash && site->depth == depth &&
+			!memcmp(site->frames, frames, depth * sizeof(void*))
+		) return site;
+	}
+	return NULL;
+}
+
+/** Finds a sampled block in the table of live blocks.
+ * The profile mutex must be held.
+ * \param data The pointer to the block.
+ * \return The index of the entry or PROF_LIVE if the block wasn't sampled. */
+static inline size_t prof_live_find(void *data) {
+	size_t i = PROF_PTR_HASH(data, LG_PROF_LIVE);
+	for (size_t n = 0; n < PROF_LIVE && g_prof_live[i].data; n++) {
+		if (g_prof_live[i].data == data) return i;
+		i = (i + 1) & (PROF_LIVE - 1);
+	}
+	return PROF_LIVE;
+}
+
+/** Adds a sampled block to the table of live blocks. The table is kept at
+ * most half full so lookups stay short.
+ * The profile mutex must be held.
+ * \param data The pointer to the block.
+ * \param site The site the block was allocated at.
+ * \param count The estimated number of blocks the sample stands for.
+ * \param bytes The estimated number of bytes the sample stands for.
+ * \return 0 on success or 1 if the table is full. */
+static inline int prof_live_insert(
+	void *data, prof_site_t *site, size_t count, size_t bytes
+) {
+	if (atomic_load_explicit(&g_prof_live_count, memory_order_relaxed) >= PROF_LIVE / 2)
+		RET_ERR("Table of live samples is full.", 1);
+	size_t i = PROF_PTR_HASH(data, LG_PROF_LIVE);
+	while (g_prof_live[i].data) i = (i + 1) & (PROF_LIVE - 1);
+	g_prof_live[i] = (prof_live_t){data, site, count, bytes};
+	atomic_fetch_add_explicit(&g_prof_live_count, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&g_prof_filter[PROF_PTR_HASH(data, LG_PROF_FILTER)],
+		1, memory_order_relaxed);
+	RET_OK(0);
+}
+
+/** Removes an entry from the table of live blocks, shifting the entries
+ * after it back so no tombstones are needed.
+ * The profile mutex must be held.
+ * \param i The index of the entry. */
+static inline void prof_live_remove(size_t i) {
+	atomic_fetch_sub_explicit(&g_prof_filter[PROF_PTR_HASH(g_prof_live[i].data,
+		LG_PROF_FILTER)], 1, memory_order_relaxed);
+	atomic_fetch_sub_explicit(&g_prof_live_count, 1, memory_order_relaxed);
+	size_t j = i;
+	while (true) {
+		g_prof_live[i].data = NULL;
+		while (true) {
+			j = (j + 1) & (PROF_LIVE - 1);
+			if (!g_prof_live[j].data) return;
+			size_t k = PROF_PTR_HASH(g_prof_live[j].data, LG_PROF_LIVE);
+			if (i <= j ? (i >= k || k > j) : (i >= k && k > j)) break;
+		}
+		g_prof_live[i] = g_prof_live[j];
+		i = j;
+	}
+}
+
+/** Records a sampled allocation and draws the next sampling interval of
+ * the calling thread. The sample is weighted by the inverse of the chance
+ * of a block of its size being sampled. The first call of every thread
+ * only seeds the generator. It's never inlined so the backtrace always
+ * starts with its own frame and the frame of the public function.
+ * \param data The pointer to the allocated block.
+ * \param size The size of the block. */
+__attribute__((noinline, unused))
+static void prof_sample(void *data, size_t size) {
+	size_t rate = atomic_load_explicit(&g_prof_rate, memory_order_relaxed);
+	if (!rate) {
+		g_prof_bytes = PROF_RECHECK;
+		return;
+	}
+	bool seeded = g_prof_seed;
+	g_prof_bytes = prof_interval(rate);
+	if (!seeded || g_prof_busy) return;
+	g_prof_busy = true;
+	void *frames[PROF_DEPTH + PROF_SKIP];
+	int depth = backtrace(frames, (int)(PROF_DEPTH + PROF_SKIP));
+	double scale = 1.0 / (1.0 - exp(-(double)size / (double)rate));
+	size_t count = (size_t)(scale + 0.5);
+	size_t bytes = (size_t)((double)size * scale + 0.5);
+	pthread_mutex_lock(&g_prof_mutex);
+	prof_site_t *site = depth > PROF_SKIP ?
+		prof_site_find(frames + PROF_SKIP, (size_t)depth - PROF_SKIP) : NULL;
+	if (site) {
+		site->alloc_count += count;
+		site->alloc_bytes += bytes;
+		if (!prof_live_insert(data, site, count, bytes)) {
+			site->live_count += count;
+			site->live_bytes += bytes;
+		}
+	}
+	pthread_mutex_unlock(&g_prof_mutex);
+	g_prof_busy = false;
+}
+
+/** Forgets a sampled block that's being freed. Blocks that weren't sampled
+ * are told apart by the filter without taking the mutex.
+ * \param data The pointer to the block. */
+static inline void prof_free(void *data) {
+	if (!atomic_load_explicit(&g_prof_filter[PROF_PTR_HASH(data, LG_PROF_FILTER)],
+		memory_order_relaxed)) return;
+	pthread_mutex_lock(&g_prof_mutex);
+	size_t i = prof_live_find(data);
+	if (i < PROF_LIVE) {
+		g_prof_live[i].site->live_count -= g_prof_live[i].count;
+		g_prof_live[i].site->live_bytes -= g_prof_live[i].bytes;
+		prof_live_remove(i);
+	}
+	pthread_mutex_unlock(&g_prof_mutex);
+}
+
+/** Writes the name of the function a return address belongs to, or the
+ * address itself if it has no symbol.
+ * \param file The file to write to.
+ * \param frame The return address. */
+static inline void prof_frame(FILE *file, void *frame) {
+	Dl_info info;
+	if (dladdr(frame, &info) && info.dli_sname) fputs(info.dli_sname, file);
+	else fprintf(file, "%p", frame);
+}
+
+/** Writes a heap profile from a copy of the site table.
+ * \param file The file to write to.
+ * \param sites The copy of the site table.
+ * \param format The format of the profile.
+ * \param elapsed The milliseconds since sampling was enabled.
+ * \return 0 on success or 1 on failure. */
+static inline int prof_write(
+	FILE *file, prof_site_t *sites, alloc_prof_format_t format, uint64_t elapsed
+) {
+	if (!file || !sites) RET_ERR("Invalid argument.", 1);
+	if (format == ALLOC_PROF_PPROF) {
+		size_t total[4] = {0};
+		for (size_t i = 0; i < PROF_SITES; i++) {
+			total[0] += sites[i].live_count;
+			total[1] += sites[i].live_bytes;
+			total[2] += sites[i].alloc_count;
+			total[3] += sites[i].alloc_bytes;
+		}
+		fprintf(file, "heap profile: %zu: %zu [%zu: %zu] @ heapprofile\n",
+			total[0], total[1], total[2], total[3]);
+		for (size_t i = 0; i < PROF_SITES; i++) {
+			if (!sites[i].depth) continue;
+			fprintf(file, "%zu: %zu [%zu: %zu] @",
+				sites[i].live_count, sites[i].live_bytes,
+				sites[i].alloc_count, sites[i].alloc_bytes);
+			for (size_t j = 0; j < sites[i].depth; j++)
+				fprintf(file, " %p", sites[i].frames[j]);
+			fputc('\n', file);
+		}
+		fputs("\nMAPPED_LIBRARIES:\n", file);
+		FILE *maps = fopen("/proc/self/maps", "r");
+		if (maps) {
+			char buff[1024];
+			size_t n;
+			while ((n = fread(buff, 1, sizeof(buff), maps))) fwrite(buff, 1, n, file);
+			fclose(maps);
+		}
+	} else {
+		for (size_t i = 0; i < PROF_SITES; i++) {
+			size_t value = format == ALLOC_PROF_FOLDED ? sites[i].live_bytes :
+				(size_t)((double)sites[i].alloc_bytes * 1000 /
+				(double)(elapsed ? elapsed : 1));
+			if (!sites[i].depth || !value) continue;
+			for (size_t j = sites[i].depth; j > 0; j--) {
+				prof_frame(file, sites[i].frames[j - 1]);
+				fputc(j > 1 ? ';' : ' ', file);
+			}
+			fprintf(file, "%zu\n", value);
+		}
+	}
+	if (ferror(file)) RET_ERR("Failed to write profile.", 1);
+	RET_OK(0);
+}
+
+#ifdef ALLOC_DEBUG
+/** Reports a corrupted block. With DEBUG_ABORT enabled the message is
+ * written to stderr and the process is aborted.
+ * \param msg The message describing the corruption. */
+static inline void debug_report(const char *msg) {
+	if (!(atomic_load_explicit(&g_debug, memory_order_relaxed) & DEBUG_ABORT))
+		return;
+	fprintf(stderr, "alloc: %s\n", msg);
+	abort();
+}
+
+/** Returns the entry of a block in the debug table or the unused entry it
+ * would take. The debug mutex must be held and the table must be mapped.
+ * \param data The pointer to the block.
+ * \return A pointer to the entry. */
+static inline debug_block_t *debug_slot(void *data) {
+	size_t mask = ((size_t)1 << g_debug_lg) - 1;
+	size_t i = PROF_PTR_HASH(data, g_debug_lg);
+	while (g_debug_blocks[i].data && g_debug_blocks[i].data != data)
+		i = (i + 1) & mask;
+	return &g_debug_blocks[i];
+}
+
+/** Finds a block in the debug table.
+ * The debug mutex must be held.
+ * \param data The pointer to the block.
+ * \return A pointer to the entry or NULL if the block isn't tracked. */
+static inline debug_block_t *debug_find(void *data) {
+	if (!g_debug_blocks) return NULL;
+	debug_block_t *block = debug_slot(data);
+	return block->data ? block : NULL;
+}
+
+/** Doubles the size of the debug table, mapping the first one on first use.
+ * The debug mutex must be held.
+ * \return 0 on success or 1 on failure. */
+static inline int debug_grow() {
+	size_t lg = g_debug_blocks ? g_debug_lg + 1 : LG_DEBUG_BLOCKS;
+	debug_block_t *blocks = (debug_block_t*)MMAP(sizeof(debug_block_t) << lg);
+	if (blocks == MAP_FAILED) RET_ERR("Failed to map debug table with mmap().", 1);
+	debug_block_t *old = g_debug_blocks;
+	size_t old_lg = g_debug_lg;
+	g_debug_blocks = blocks;
+	g_debug_lg = lg;
+	if (!old) RET_OK(0);
+	for (size_t i = 0; i < (size_t)1 << old_lg; i++)
+		if (old[i].data) *debug_slot(old[i].data) = old[i];
+	munmap(old, sizeof(debug_block_t) << old_lg);
+	RET_OK(0);
+}
+
+/** Adds a block to the debug table. The table is grown to be kept at most
+ * half full so lookups stay short.
+ * The debug mutex must be held.
+ * \param block The entry of the block.
+ * \return 0 on success or 1 on failure. */
+static inline int debug_insert(debug_block_t block) {
+	if (!block.data) RET_ERR("Invalid argument.", 1);
+	if (
+		(!g_debug_blocks || (g_debug_count + 1) * 2 > (size_t)1 << g_debug_lg) &&
+		debug_grow()
+	) RET_ERR("Failed to grow debug table.", 1);
+	*debug_slot(block.data) = block;
+	g_debug_count++;
+	RET_OK(0);
+}
+
+/** Removes an entry from the debug table, shifting the entries after it
+ * back so no tombstones are needed.
+ * The debug mutex must be held.
+ * \param block The entry to be removed. */
+static inline void debug_remove(debug_block_t *block) {
+	size_t mask = ((size_t)1 << g_debug_lg) - 1;
+	size_t i = (size_t)(block - g_debug_blocks);
+	size_t j = i;
+	g_debug_count--;
+	while (true) {
+		g_debug_blocks[i].data = NULL;
+		while (true) {
+			j = (j + 1) & mask;
+			if (!g_debug_blocks[j].data) return;
+			size_t k = PROF_PTR_HASH(g_debug_blocks[j].data, g_debug_lg);
+			if (i <= j ? (i >= k || k > j) : (i >= k && k > j)) break;
+		}
+		g_debug_blocks[i] = g_debug_blocks[j];
+		i = j;
+	}
+}
+
+/** Returns the end of the redzone after a block. A guarded block's redzone
+ * ends at its guard page.
+ * \param block The entry of the block.
+ * \return A pointer to the end of the redzone. */
+static inline unsigned char *debug_end(debug_block_t *block) {
+	return block->len ? block->base + block->len - 2 * MMAP_PAGE_SIZE :
+		(unsigned char*)block->data + block->size + DEBUG_REDZONE;
+}
+
+/** Tells whether every byte of a range holds the same value.
+ * \param from The start of the range.
+ * \param to The end of the range.
+ * \param value The expected value.
+ * \return true if every byte holds the value or false otherwise. */
+static inline bool debug_intact(
+	unsigned char *from, unsigned char *to, unsigned char value
+) {
+	for (; from < to; from++) if (*from != value) return false;
+	return true;
+}
+
+/** Checks the canaries around a block.
+ * \param block The entry of the block.
+ * \return 0 if the canaries are intact or 1 otherwise. */
+static inline int debug_check(debug_block_t *block) {
+	unsigned char *data = (unsigned char*)block->data;
+	if (!debug_intact(block->base, data, CANARY_BYTE)) {
+		debug_report("Buffer underflow detected.");
+		RET_ERR("Buffer underflow detected.", 1);
+	}
+	if (!debug_intact(data + block->size, debug_end(block), CANARY_BYTE)) {
+		debug_report("Buffer overflow detected.");
+		RET_ERR("Buffer overflow detected.", 1);
+	}
+	RET_OK(0);
+}
+
+/** Returns the memory of a block that's no longer tracked. Guarded blocks
+ * are unmapped, everything else is freed through the regular path.
+ * The calling thread must be inside the debug layer.
+ * \param block The entry of the block. */
+static inline void debug_release(debug_block_t *block) {
+	if (!block->len) {
+		alloc_del(block->base);
+		return;
+	}
+	if (munmap(block->base - MMAP_PAGE_SIZE, block->len)) {
+		ERROR_SET("Failed to unmap guarded block with munmap().");
+		return;
+	}
+	STAT_ADD(unmapped_bytes, block->len);
+	STAT_INC(munmap_calls);
+	STAT_INC(mmap_del);
+	stats_del(block->size, false, 1);
+}
+
+/** Releases the oldest block of the quarantine. A poisoned block is checked
+ * for writes made after it was freed first.
+ * The debug mutex must be held and the calling thread must be inside the
+ * debug layer.
+ * \return 0 on success or 1 if the block was written after it was freed. */
+static inline int debug_evict() {
+	if (!g_quarantine_count) RET_ERR("Quarantine is empty.", 1);
+	void *data = g_quarantine[g_quarantine_head];
+	g_quarantine_head = (g_quarantine_head + 1) % QUARANTINE_COUNT;
+	g_quarantine_count--;
+	debug_block_t *entry = debug_find(data);
+	if (!entry) RET_ERR("Invalid argument.", 1);
+	debug_block_t block = *entry;
+	debug_remove(entry);
+	g_quarantine_bytes -= block.size;
+	bool intact = !block.poisoned ||
+		debug_intact(block.base, debug_end(&block), POISON_BYTE);
+	debug_release(&block);
+	if (!intact) {
+		debug_report("Use after free detected.");
+		RET_ERR("Use after free detected.", 1);
+	}
+	RET_OK(0);
+}
+
+/** Allocates a block surrounded by canaries and tracks it in the debug
+ * table. In guard mode blocks that would be allocated with mmap() get
+ * their own mapping, placed right before a guard page.
+ * \param size The size of the block.
+ * \param alignment The alignment of the block. It must be a power of two.
+ * \return A pointer to the block or NULL on failure. */
+static inline void *debug_new(size_t size, size_t alignment) {
+	if (!size) RET_ERR("size cannot be 0.", NULL);
+	if (size > SIZE_MAX / 2 || alignment > SIZE_MAX / 4)
+		RET_ERR("size is too big.", NULL);
+	if (alignment < MIN_ALLOC_SIZE) alignment = MIN_ALLOC_SIZE;
+	debug_block_t block = {.size = size, .state = VALID};
+	g_debug_busy = true;
+	if (
+		atomic_load_explicit(&g_debug, memory_order_relaxed) & DEBUG_GUARD &&
+		TOTAL_SIZE(size) > ARENA_BUFF_SIZE && alignment <= MMAP_PAGE_SIZE
+	) {
+		size_t body = PAGE_CEIL(ALIGN_UP(size, alignment) + DEBUG_REDZONE);
+		block.len = body + 2 * MMAP_PAGE_SIZE;
+		unsigned char *map = (unsigned char*)MMAP(block.len);
+		if (map == MAP_FAILED) {
+			g_debug_busy = false;
+			RET_ERR("Failed to map guarded block with mmap().", NULL);
+		}
+		block.base = map + MMAP_PAGE_SIZE;
+		if (
+			mprotect(map, MMAP_PAGE_SIZE, PROT_NONE) ||
+			mprotect(block.base + body, MMAP_PAGE_SIZE, PROT_NONE)
+		) {
+			munmap(map, block.len);
+			g_debug_busy = false;
+			RET_ERR("Failed to protect guard pages with mprotect().", NULL);
+		}
+		block.data = block.base + body - ALIGN_UP(size, alignment);
+		STAT_ADD(mapped_bytes, block.len);
+		STAT_INC(mmap_calls);
+		STAT_INC(mmap_new);
+		stats_new(size, false, 1);
+	} else {
+		size_t pad = alignment > DEBUG_REDZONE ? alignment : DEBUG_REDZONE;
+		size_t total = pad + size + DEBUG_REDZONE;
+		block.base = (unsigned char*)(alignment > MIN_ALLOC_SIZE ?
+			alloc_new_aligned(total, alignment) : alloc_new(total));
+		if (!block.base) {
+			g_debug_busy = false;
+			RET_ERR("Failed to allocate block.", NULL);
+		}
+		block.data = block.base + pad;
+	}
+	unsigned char *data = (unsigned char*)block.data;
+	memset(block.base, CANARY_BYTE, (size_t)(data - block.base));
+	memset(data + size, CANARY_BYTE, (size_t)(debug_end(&block) - (data + size)));
+	pthread_mutex_lock(&g_debug_mutex);
+	int ret = debug_insert(block);
+	pthread_mutex_unlock(&g_debug_mutex);
+	if (ret) debug_release(&block);
+	g_debug_busy = false;
+	if (ret) RET_ERR("Failed to track block.", NULL);
+	RET_OK(block.data);
+}
+
+/** Frees a block tracked in the debug table. Double frees and broken
+ * canaries are reported and the block is kept. In quarantine mode the
+ * block is poisoned, or made inaccessible if it's guarded, and only
+ * released once it's evicted from the quarantine.
+ * \param data The pointer to the block.
+ * \return 0 on success or 1 on failure. */
+static inline int debug_del(void *data) {
+	if (!data) RET_ERR("data cannot be NULL.", 1);
+	unsigned flags = atomic_load_explicit(&g_debug, memory_order_relaxed);
+	pthread_mutex_lock(&g_debug_mutex);
+	debug_block_t *block = debug_find(data);
+	if (!block) {
+		pthread_mutex_unlock(&g_debug_mutex);
+		RET_ERR("Block is not tracked.", 1);
+	}
+	if (block->state != VALID) {
+		pthread_mutex_unlock(&g_debug_mutex);
+		debug_report("Double free detected.");
+		RET_ERR("Double free detected.", 1);
+	}
+	if (flags & DEBUG_CANARY && debug_check(block)) {
+		pthread_mutex_unlock(&g_debug_mutex);
+		RET_ERR("Block is corrupted.", 1);
+	}
+	g_debug_busy = true;
+	if (!(flags & DEBUG_QUARANTINE)) {
+		debug_block_t copy = *block;
+		debug_remove(block);
+		pthread_mutex_unlock(&g_debug_mutex);
+		debug_release(&copy);
+		g_debug_busy = false;
+		RET_OK(0);
+	}
+	block->state = FREE;
+	if (block->len) {
+		mprotect(block->base, block->len - 2 * MMAP_PAGE_SIZE, PROT_NONE);
+	} else if (flags & DEBUG_POISON) {
+		memset(block->base, POISON_BYTE, (size_t)(debug_end(block) - block->base));
+		block->poisoned = true;
+	}
+	size_t size = block->size;
+	int ret = 0;
+	while (
+		g_quarantine_count == QUARANTINE_COUNT ||
+		(g_quarantine_count && g_quarantine_bytes + size > QUARANTINE_BYTES)
+	) if (debug_evict()) ret = 1;
+	g_quarantine[(g_quarantine_head + g_quarantine_count) % QUARANTINE_COUNT] = data;
+	g_quarantine_count++;
+	g_quarantine_bytes += size;
+	pthread_mutex_unlock(&g_debug_mutex);
+	g_debug_busy = false;
+	if (ret) RET_ERR("Failed to evict blocks from quarantine.", 1);
+	RET_OK(0);
+}
+
+/** Returns the size of a block tracked in the debug table.
+ * \param data The pointer to the block.
+ * \return The size of the block or 0 if it isn't tracked. */
+static inline size_t debug_size(void *data) {
+	pthread_mutex_lock(&g_debug_mutex);
+	debug_block_t *block = debug_find(data);
+	size_t size = block ? block->size : 0;
+	pthread_mutex_unlock(&g_debug_mutex);
+	return size;
+}
+
+/** Checks the size passed to alloc_del_sized() against a block. A block
+ * tracked in the debug table must be freed with the size it was allocated
+ * or last resized with, any other block with a size that fits in it.
+ * Mismatches are reported.
+ * \param data The pointer to the block.
+ * \param size The size passed to alloc_del_sized().
+ * \return true if the size matches or the check is disabled. */
+static inline bool debug_size_match(void *data, size_t size) {
+	if (!(atomic_load_explicit(&g_debug, memory_order_relaxed) & DEBUG_SIZE))
+		return true;
+	size_t tracked = debug_size(data);
+	if (tracked ? tracked == size : size && size <= block_size(data))
+		return true;
+	debug_report("Size mismatch detected.");
+	return false;
+}
+
+/** Resizes a block tracked in the debug table. The block is always moved,
+ * so stale pointers to it end up in the quarantine.
+ * \param data Pointer to the pointer to the block.
+ * \param size The new size of the block.
+ * \return 0 on success or 1 on failure. */
+static inline int debug_resize(void **data, size_t size) {
+	if (!data || !*data) RET_ERR("data cannot be NULL.", 1);
+	pthread_mutex_lock(&g_debug_mutex);
+	debug_block_t *block = debug_find(*data);
+	size_t old_size = block && block->state == VALID ? block->size : 0;
+	pthread_mutex_unlock(&g_debug_mutex);
+	if (!old_size) {
+		debug_report("Use after free detected.");
+		RET_ERR("Use after free detected.", 1);
+	}
+	void *new_data = debug_new(size, MIN_ALLOC_SIZE);
+	if (!new_data) RET_ERR("Failed to allocate new block.", 1);
+	memcpy(new_data, *data, old_size < size ? old_size : size);
+	if (debug_del(*data)) {
+		debug_del(new_data);
+		RET_ERR("Failed to free old block.", 1);
+	}
+	*data = new_data;
+	RET_OK(0);
+}
+#endif
 
 #endif
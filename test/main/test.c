@@ -3,6 +3,45 @@
 TEST_INIT;
 
 int main(void) {
+	test_numa_parse();
+	test_numa_init();
+	test_numa_node();
+	test_numa_bind();
+	test_chunk_new();
+	test_page_use();
+	test_chunk_find_run();
+	test_pages_use();
+	test_pages_free();
+	test_page_free();
+	test_clock_ms();
+	test_clock_ns();
+	test_pages_purge();
+	test_page_purge();
+	test_dirty_push();
+	test_dirty_unlink();
+	test_heap_decay();
+	test_decay_tick();
+	test_decay_all();
+	test_decay_thread();
+	test_decay_start();
+	test_decay_stop();
+	test_trace_put();
+	test_trace_get();
+	test_trace_encode();
+	test_trace_decode();
+#ifdef ALLOC_TRACE
+	test_trace_buf_get();
+	test_trace_queue();
+	test_trace_slot_get();
+	test_trace_record();
+	test_trace_flush();
+	test_trace_write();
+	test_trace_thread();
+	test_trace_start();
+	test_trace_stop();
+	test_trace_exit();
+#endif
+	test_config_env();
 	test_arena_expand();
 	test_arena_reset();
 	test_arena_del();
@@ -10,14 +49,129 @@ int main(void) {
 	test_ptr_aligned_size();
 	test_total_size();
 	test_arena_use();
-	test_free_ptr_index();
+	test_size_class();
+	test_ptr_capacity();
+	test_ptr_unlink();
+	test_free_ptr_push();
+	test_free_ptr_unlink();
+	test_ptr_coalesce();
+	test_run_use();
+	test_run_use_aligned();
+	test_run_free();
+	test_run_resize();
+	test_map_cache_put();
+	test_map_cache_use();
+	test_map_cache_flush();
 	test_ptr_free();
+	test_free_ptr_find();
 	test_free_ptr_use();
 	test_mmap_use();
+	test_mmap_use_aligned();
+	test_arena_resize();
+	test_mmap_resize();
+	test_large_use();
+	test_slab_region_init();
+	test_slab_new();
+	test_slab_use();
+	test_slab_release();
+	test_slab_pool_put();
+	test_slab_pool_flush();
+	test_slab_free();
+	test_remote_free_push();
+	test_remote_free_drain();
+	test_block_release();
+	test_fast_fold();
+	test_fast_grant();
+	test_fast_revoke();
+	test_heap_exit();
+	test_heap_adopt();
+	test_orphan_drain();
+	test_heap_init();
+	test_central_push();
+	test_central_pop();
+	test_central_refill();
+	test_central_flush();
+	test_tcache_use();
+	test_tcache_free();
+	test_tcache_free_sized();
+	test_tcache_use_batch();
+	test_slab_use_batch();
+	test_fast_stash();
+	test_tcache_push();
+	test_tcache_free_batch();
+	test_fork_prepare();
+	test_fork_parent();
+	test_fork_child();
+	test_block_node();
+	test_block_size();
+	test_stats_new();
+	test_stats_del();
+	test_stats_add();
+	test_stats_finish();
+	test_block_new();
+	test_region_expand();
+	test_region_use();
+	test_region_release();
+	test_cache_use();
+	test_cache_free();
+	test_cache_drain();
 
+	test_prof_rand();
+	test_prof_interval();
+	test_prof_site_find();
+	test_prof_live_find();
+	test_prof_live_insert();
+	test_prof_live_remove();
+	test_prof_sample();
+	test_prof_free();
+	test_prof_frame();
+	test_prof_write();
+#ifdef ALLOC_DEBUG
+	test_debug_report();
+	test_debug_slot();
+	test_debug_find();
+	test_debug_grow();
+	test_debug_insert();
+	test_debug_remove();
+	test_debug_end();
+	test_debug_intact();
+	test_debug_check();
+	test_debug_release();
+	test_debug_evict();
+	test_debug_new();
+	test_debug_del();
+	test_debug_size();
+	test_debug_size_match();
+	test_debug_resize();
+#endif
 	test_alloc_new();
+	test_alloc_new_zeroed();
+	test_alloc_new_aligned();
+	test_alloc_new_batch();
 	test_alloc_del();
+	test_alloc_del_sized();
+	test_alloc_del_batch();
 	test_alloc_resize();
+	test_alloc_stats();
+	test_alloc_stats_thread();
+	test_alloc_stats_class();
+	test_alloc_config();
+	test_alloc_config_get();
+	test_alloc_purge();
+	test_alloc_prof_enable();
+	test_alloc_prof_dump();
+	test_alloc_region_create();
+	test_alloc_region_new();
+	test_alloc_region_reset();
+	test_alloc_region_destroy();
+	test_alloc_cache_create();
+	test_alloc_cache_get();
+	test_alloc_cache_put();
+	test_alloc_cache_stats();
+	test_alloc_cache_destroy();
+	test_alloc_fast_get();
+	test_alloc_fast_refill();
+	test_alloc_new_fast();
 
 	test_print_results();
 	return 0;
@@ -1,10 +1,923 @@
 #include "test_utils.h"
 #include "alloc_utils.h"
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 /**
  * alloc_utils.
  * */
 
+void test_numa_parse() {
+	{ // Normal case
+		ASSERT(numa_parse("0\n") == 1);
+		ASSERT(numa_parse("0-1\n") == 2);
+		ASSERT(numa_parse("0-3,5\n") == 6);
+		ASSERT(numa_parse("12") == 13);
+	}
+	{ // Empty list
+		ASSERT(numa_parse("") == 1);
+		ASSERT(numa_parse(NULL) == 1);
+	}
+}
+
+void test_numa_init() {
+	{ // Normal case: fake topology
+		setenv("ALLOC_NUMA_NODES", "4", 1);
+		ASSERT(!numa_init());
+		ASSERT(g_numa_nodes == 4);
+		ASSERT(g_numa_fake);
+		unsetenv("ALLOC_NUMA_NODES");
+	}
+	{ // Normal case: detected topology
+		ASSERT(!numa_init());
+		ASSERT(g_numa_nodes >= 1);
+		ASSERT(!g_numa_fake);
+		g_numa_nodes = 1;
+	}
+}
+
+void test_numa_node() {
+	{ // Normal case: single node
+		ASSERT(!numa_node());
+	}
+	{ // Normal case: fake topology
+		g_numa_nodes = 1024 * 1024;
+		g_numa_fake = true;
+		bool found = false;
+		for (size_t i = 0; i < 100 && !found; i++) {
+			int cpu = sched_getcpu();
+			size_t node = numa_node();
+			found = cpu == sched_getcpu() && node == (size_t)cpu;
+		}
+		ASSERT(found);
+		g_numa_nodes = 1;
+		g_numa_fake = false;
+	}
+}
+
+void test_numa_bind() {
+	{ // Normal case
+		g_numa_nodes = 2;
+		void *map = MMAP(MMAP_PAGE_SIZE * 4);
+		ASSERT(map != MAP_FAILED);
+		ASSERT(!numa_bind(map, MMAP_PAGE_SIZE * 4, 0));
+		memset(map, 1, MMAP_PAGE_SIZE * 4);
+		munmap(map, MMAP_PAGE_SIZE * 4);
+		g_numa_nodes = 1;
+	}
+	{ // Normal case: fake topology
+		g_numa_nodes = 2;
+		g_numa_fake = true;
+		ASSERT(!numa_bind(NULL, MMAP_PAGE_SIZE, 1));
+		g_numa_nodes = 1;
+		g_numa_fake = false;
+	}
+	{ // Node out of range
+		g_numa_nodes = 2;
+		ASSERT(numa_bind(NULL, MMAP_PAGE_SIZE, NUMA_MASK_BITS));
+		g_numa_nodes = 1;
+	}
+}
+
+void test_chunk_new() {
+	{ // Normal case
+		chunk_t *prev = g_chunks;
+		ASSERT(!chunk_new());
+		ASSERT(g_chunks);
+		ASSERT(g_chunks->next == prev);
+		ASSERT(!((uintptr_t)g_chunks % CHUNK_SIZE));
+		ASSERT(g_chunks->offset == 1);
+		ASSERT(!g_chunks->free);
+		unsigned char *last = (unsigned char*)g_chunks + CHUNK_SIZE - 1;
+		*last = 1;
+		ASSERT(*last == 1);
+	}
+}
+
+void test_page_use() {
+	{ // Normal case
+		ASSERT(!chunk_new());
+		arena_t *page1 = page_use();
+		arena_t *page2 = page_use();
+		ASSERT(page1);
+		ASSERT(page2);
+		ASSERT(CHUNK(page1) == g_chunks);
+		ASSERT(CHUNK_PAGE_INDEX(page1) == 1);
+		ASSERT((unsigned char*)page2 - (unsigned char*)page1 == ARENA_SIZE);
+		ASSERT(g_chunks->offset == 3);
+		ASSERT(!page1->clean);
+	}
+	{ // Normal case: chunk of the node of the thread
+		ASSERT(!reset());
+		g_numa_nodes = 2;
+		g_numa_fake = true;
+		arena_t *page1 = page_use();
+		g_node = 1;
+		arena_t *page2 = page_use();
+		ASSERT(CHUNK(page2) != CHUNK(page1));
+		ASSERT(CHUNK(page2)->node == 1);
+		g_node = 0;
+		arena_t *page3 = page_use();
+		ASSERT(CHUNK(page3) == CHUNK(page1));
+		ASSERT(CHUNK(page1)->node == 0);
+		ASSERT(!reset());
+	}
+	{ // Normal case: reuse released page
+		ASSERT(!chunk_new());
+		arena_t *page1 = page_use();
+		ASSERT(page_use());
+		ASSERT(!page_free(page1));
+		ASSERT(page_use() == page1);
+		ASSERT(page1->clean == ARENA_BUFF_SIZE);
+		ASSERT(!g_chunks->free);
+		ASSERT(!g_chunk_free_pages);
+	}
+	{ // Normal case: reuse lowest page first
+		ASSERT(!reset());
+		arena_t *page1 = page_use();
+		arena_t *page2 = page_use();
+		ASSERT(!page_free(page1));
+		ASSERT(!heap_decay(g_heap, UINT64_MAX));
+		ASSERT(!page_free(page2));
+		ASSERT(page_use() == page1);
+		ASSERT(g_heap->dirty_head == (dirty_t*)page2);
+		ASSERT(page_use() == page2);
+		ASSERT(!g_heap->dirty_head);
+	}
+	{ // Normal case: growing buffers don't spread over chunks
+		ASSERT(!reset());
+		static void *pages[CHUNK_PAGES / 4];
+		size_t count = 0;
+		size_t chunks = 0;
+		for (chunk_t *c = g_chunks; c; c = c->next) chunks++;
+		for (size_t i = 0; i < 200; i++) {
+			void *data = alloc_new(MIN_ALLOC_SIZE);
+			for (size_t size = MIN_ALLOC_SIZE * 2; size <= 1024 * 1024; size = size * 3 / 2) {
+				ASSERT(!alloc_resize(&data, size));
+				if (count < CHUNK_PAGES / 4) pages[count++] = alloc_new(ARENA_SIZE / 2);
+			}
+			alloc_del(data);
+		}
+		size_t new_chunks = 0;
+		for (chunk_t *c = g_chunks; c; c = c->next) new_chunks++;
+		ASSERT(new_chunks - chunks <= 2);
+		for (size_t i = 0; i < count; i++) alloc_del(pages[i]);
+	}
+	{ // Normal case: new chunk when full
+		ASSERT(!reset());
+		g_chunk_free_pages = 0;
+		ASSERT(!chunk_new());
+		chunk_t *chunk = g_chunks;
+		chunk->offset = CHUNK_PAGES;
+		arena_t *page = page_use();
+		ASSERT(page);
+		ASSERT(CHUNK(page) != chunk);
+		ASSERT(g_chunks->next == chunk);
+	}
+}
+
+void test_chunk_find_run() {
+	{ // Normal case
+		ASSERT(!chunk_new());
+		chunk_t *c = g_chunks;
+		c->offset = 130;
+		c->free_pages[0] = 0x6;
+		c->free_pages[1] = 0x1LLU << 63;
+		c->free_pages[2] = 0x3;
+		ASSERT(chunk_find_run(c, 2) == 1);
+		ASSERT(chunk_find_run(c, 3) == 127);
+		ASSERT(!chunk_find_run(c, 4));
+		memset(c->free_pages, 0, sizeof(c->free_pages));
+		c->offset = 1;
+	}
+}
+
+void test_pages_use() {
+	{ // Normal case
+		ASSERT(!reset());
+		g_chunk_free_pages = 0;
+		bool zero = false;
+		arena_t *page = pages_use(4, &zero);
+		ASSERT(page);
+		ASSERT(zero);
+		ASSERT(CHUNK(page)->offset == CHUNK_PAGE_INDEX(page) + 4);
+	}
+	{ // Normal case: reuse released run
+		ASSERT(!reset());
+		arena_t *page = pages_use(4, NULL);
+		ASSERT(page_use());
+		ASSERT(!pages_free(page, 4));
+		bool zero = true;
+		ASSERT(pages_use(3, &zero) == page);
+		ASSERT(!zero);
+		ASSERT(g_chunk_free_pages == 1);
+		ASSERT(g_heap->dirty_head == (dirty_t*)((unsigned char*)page + ARENA_SIZE * 3));
+		ASSERT(atomic_load(&g_heap->dirty_count) == 1);
+	}
+	{ // Normal case: new chunk when the run doesn't fit
+		ASSERT(!reset());
+		g_chunk_free_pages = 0;
+		ASSERT(!chunk_new());
+		chunk_t *chunk = g_chunks;
+		chunk->offset = CHUNK_PAGES - 2;
+		arena_t *page = pages_use(4, NULL);
+		ASSERT(page);
+		ASSERT(CHUNK(page) != chunk);
+	}
+	{ // Invalid count
+		ASSERT(!pages_use(0, NULL));
+		ASSERT(!pages_use(CHUNK_PAGES, NULL));
+	}
+}
+
+void test_pages_free() {
+	{ // Normal case
+		ASSERT(!reset());
+		arena_t *page = pages_use(3, NULL);
+		size_t free_pages = g_chunk_free_pages;
+		ASSERT(!pages_free(page, 3));
+		ASSERT(g_chunk_free_pages == free_pages + 3);
+		ASSERT(atomic_load(&g_heap->dirty_count) == 3);
+		size_t i = CHUNK_PAGE_INDEX(page);
+		ASSERT(CHUNK(page)->dirty_pages[i / 64] & (1LLU << (i % 64)));
+		ASSERT(!heap_decay(g_heap, UINT64_MAX));
+		ASSERT(!(CHUNK(page)->dirty_pages[i / 64] & (1LLU << (i % 64))));
+	}
+	{ // Normal case: purge right away without decay
+		ASSERT(!reset());
+		arena_t *page = pages_use(3, NULL);
+		atomic_store(&g_decay_ms, 0);
+		ASSERT(!pages_free(page, 3));
+		atomic_store(&g_decay_ms, DECAY_MS);
+		ASSERT(!g_heap->dirty_tail);
+		ASSERT(STAT_LOAD(g_heap, madvise_calls) == 1);
+	}
+	{ // Page already released
+		ASSERT(!reset());
+		arena_t *page = pages_use(3, NULL);
+		ASSERT(!page_free((arena_t*)((unsigned char*)page + ARENA_SIZE)));
+		ASSERT(pages_free(page, 3));
+	}
+	{ // Invalid argument
+		ASSERT(!reset());
+		ASSERT(pages_free(NULL, 1));
+		ASSERT(pages_free(page_use(), 0));
+	}
+}
+
+void test_page_free() {
+	{ // Normal case
+		ASSERT(!chunk_new());
+		arena_t *page = page_use();
+		page->offset = 5;
+		ASSERT(!page_free(page));
+		ASSERT(g_chunks->free == 1);
+		ASSERT(g_chunk_free_pages == 1);
+		ASSERT(g_chunks->free_pages[0] & 2);
+		ASSERT(page_use() == page);
+	}
+	{ // Normal case: keep page dirty
+		ASSERT(!reset());
+		arena_t *page = page_use();
+		size_t calls = STAT_LOAD(g_heap, madvise_calls);
+		ASSERT(!page_free(page));
+		ASSERT(g_heap->dirty_tail == (dirty_t*)page);
+		ASSERT(STAT_LOAD(g_heap, madvise_calls) == calls);
+	}
+	{ // Normal case: purge right away without decay
+		ASSERT(!reset());
+		arena_t *page = page_use();
+		atomic_store(&g_decay_ms, 0);
+		ASSERT(!page_free(page));
+		atomic_store(&g_decay_ms, DECAY_MS);
+		ASSERT(!g_heap->dirty_tail);
+		ASSERT(STAT_LOAD(g_heap, madvise_calls) == 1);
+	}
+	{ // Page NULL
+		ASSERT(page_free(NULL));
+	}
+	{ // Page already released
+		ASSERT(!chunk_new());
+		arena_t *page = page_use();
+		ASSERT(!page_free(page));
+		ASSERT(page_free(page));
+		ASSERT(page_use() == page);
+	}
+	{ // Chunk header
+		ASSERT(!chunk_new());
+		ASSERT(page_free((arena_t*)g_chunks));
+	}
+}
+
+void test_clock_ms() {
+	{ // Normal case
+		uint64_t start = clock_ms();
+		struct timespec ts = {0, 2000000};
+		nanosleep(&ts, NULL);
+		ASSERT(clock_ms() >= start + 2);
+	}
+}
+
+void test_clock_ns() {
+	{ // Normal case
+		uint64_t start = clock_ns();
+		struct timespec ts = {0, 2000000};
+		nanosleep(&ts, NULL);
+		ASSERT(clock_ns() >= start + 2000000);
+	}
+}
+
+void test_pages_purge() {
+	{ // Normal case
+		ASSERT(!reset());
+		arena_t *page = pages_use(3, NULL);
+		page->buff[0] = 1;
+		size_t calls = STAT_LOAD(g_heap, madvise_calls);
+		ASSERT(!pages_purge(g_heap, page, 3));
+		ASSERT(STAT_LOAD(g_heap, madvise_calls) == calls + 1);
+		ASSERT(!pages_free(page, 3));
+	}
+	{ // Invalid argument
+		ASSERT(pages_purge(g_heap, NULL, 1));
+		ASSERT(pages_purge(g_heap, page_use(), 0));
+	}
+}
+
+void test_page_purge() {
+	{ // Normal case
+		ASSERT(!reset());
+		arena_t *page = page_use();
+		page->buff[0] = 1;
+		size_t calls = STAT_LOAD(g_heap, madvise_calls);
+		ASSERT(!page_purge(g_heap, page));
+		ASSERT(STAT_LOAD(g_heap, madvise_calls) == calls + 1);
+		ASSERT(!page_free(page));
+	}
+	{ // Page NULL
+		ASSERT(page_purge(g_heap, NULL));
+	}
+}
+
+void test_dirty_push() {
+	{ // Normal case
+		heap_t heap = {0};
+		arena_t *page1 = page_use();
+		arena_t *page2 = page_use();
+		dirty_push(&heap, page1, 1);
+		dirty_push(&heap, page2, 2);
+		ASSERT(heap.dirty_head == (dirty_t*)page1);
+		ASSERT(heap.dirty_tail == (dirty_t*)page2);
+		ASSERT(heap.dirty_head->next == heap.dirty_tail);
+		ASSERT(heap.dirty_tail->prev == heap.dirty_head);
+		ASSERT(heap.dirty_tail->time == 2);
+		ASSERT(atomic_load(&heap.dirty_count) == 2);
+	}
+}
+
+void test_dirty_unlink() {
+	{ // Normal case
+		heap_t heap = {0};
+		arena_t *page1 = page_use();
+		arena_t *page2 = page_use();
+		arena_t *page3 = page_use();
+		dirty_push(&heap, page1, 1);
+		dirty_push(&heap, page2, 2);
+		dirty_push(&heap, page3, 3);
+		dirty_unlink(&heap, (dirty_t*)page2);
+		ASSERT(heap.dirty_head->next == (dirty_t*)page3);
+		ASSERT(heap.dirty_tail->prev == (dirty_t*)page1);
+		dirty_unlink(&heap, (dirty_t*)page1);
+		dirty_unlink(&heap, (dirty_t*)page3);
+		ASSERT(!heap.dirty_head);
+		ASSERT(!heap.dirty_tail);
+		ASSERT(!atomic_load(&heap.dirty_count));
+	}
+}
+
+void test_heap_decay() {
+	{ // Normal case: decayed pages
+		ASSERT(!reset());
+		arena_t *page1 = page_use();
+		arena_t *page2 = page_use();
+		ASSERT(!page_free(page1));
+		ASSERT(!page_free(page2));
+		((dirty_t*)page1)->time -= DECAY_MS;
+		ASSERT(!heap_decay(g_heap, clock_ms()));
+		ASSERT(g_heap->dirty_head == (dirty_t*)page2);
+		ASSERT(atomic_load(&g_heap->dirty_count) == 1);
+		ASSERT(g_chunk_free_pages == 2);
+	}
+	{ // Normal case: dirty limit
+		ASSERT(!reset());
+		arena_t *page1 = page_use();
+		arena_t *page2 = page_use();
+		ASSERT(!page_free(page1));
+		ASSERT(!page_free(page2));
+		atomic_store(&g_max_dirty, ARENA_SIZE);
+		ASSERT(!heap_decay(g_heap, clock_ms()));
+		atomic_store(&g_max_dirty, MAX_DIRTY);
+		ASSERT(g_heap->dirty_head == (dirty_t*)page2);
+	}
+	{ // Normal case: purge everything
+		ASSERT(!reset());
+		ASSERT(!page_free(page_use()));
+		ASSERT(!heap_decay(g_heap, UINT64_MAX));
+		ASSERT(!g_heap->dirty_head);
+	}
+	{ // Normal case: released run purged at once
+		ASSERT(!reset());
+		arena_t *page = pages_use(RUN_MAX_PAGES, NULL);
+		ASSERT(page);
+		size_t calls = STAT_LOAD(g_heap, madvise_calls);
+		atomic_store(&g_max_dirty, 0);
+		ASSERT(!pages_free(page, RUN_MAX_PAGES));
+		atomic_store(&g_max_dirty, MAX_DIRTY);
+		ASSERT(!g_heap->dirty_head);
+		ASSERT(STAT_LOAD(g_heap, madvise_calls) == calls + 1);
+	}
+	{ // Normal case: neighbours that aren't due are kept
+		ASSERT(!reset());
+		arena_t *page = pages_use(3, NULL);
+		ASSERT(!pages_free(page, 3));
+		((dirty_t*)page)->time -= DECAY_MS;
+		size_t calls = STAT_LOAD(g_heap, madvise_calls);
+		ASSERT(!heap_decay(g_heap, clock_ms()));
+		ASSERT(STAT_LOAD(g_heap, madvise_calls) == calls + 1);
+		ASSERT(atomic_load(&g_heap->dirty_count) == 2);
+		ASSERT(g_heap->dirty_head == (dirty_t*)((unsigned char*)page + ARENA_SIZE));
+	}
+	{ // Heap NULL
+		ASSERT(heap_decay(NULL, 0));
+	}
+}
+
+void test_decay_tick() {
+	{ // Normal case
+		ASSERT(!reset());
+		ASSERT(!page_free(page_use()));
+		((dirty_t*)g_heap->dirty_head)->time -= DECAY_MS;
+		g_decay_tick = 0;
+		for (size_t i = 0; i < DECAY_TICK - 1; i++) decay_tick();
+		ASSERT(g_heap->dirty_head);
+		decay_tick();
+		ASSERT(!g_heap->dirty_head);
+		ASSERT(!g_decay_tick);
+	}
+}
+
+void test_decay_all() {
+	{ // Normal case
+		ASSERT(!reset());
+		ASSERT(!page_free(page_use()));
+		ASSERT(!decay_all(clock_ms()));
+		ASSERT(g_heap->dirty_head);
+		ASSERT(!decay_all(UINT64_MAX));
+		ASSERT(!g_heap->dirty_head);
+	}
+}
+
+void test_decay_thread() {
+	{ // Normal case
+		ASSERT(!reset());
+		ASSERT(!page_free(page_use()));
+		atomic_store(&g_decay_ms, 1);
+		ASSERT(!decay_start());
+		for (size_t i = 0; i < 1000 && atomic_load(&g_heap->dirty_count); i++) {
+			struct timespec ts = {0, 1000000};
+			nanosleep(&ts, NULL);
+		}
+		ASSERT(!decay_stop());
+		atomic_store(&g_decay_ms, DECAY_MS);
+		ASSERT(!g_heap->dirty_head);
+	}
+}
+
+void test_decay_start() {
+	{ // Normal case
+		ASSERT(!decay_start());
+		ASSERT(g_decay_running);
+		ASSERT(!decay_start());
+		ASSERT(!decay_stop());
+	}
+}
+
+void test_decay_stop() {
+	{ // Normal case
+		ASSERT(!decay_start());
+		ASSERT(!decay_stop());
+		ASSERT(!g_decay_running);
+	}
+	{ // Normal case: not running
+		ASSERT(!decay_stop());
+	}
+}
+
+#ifdef ALLOC_TRACE
+static size_t trace_load(const char *path, trace_record_t *recs, size_t max) {
+	static trace_buf_t buf;
+	size_t count = 0;
+	FILE *file = fopen(path, "rb");
+	if (!file) return 0;
+	while (fread(&buf.chunk, sizeof(trace_chunk_t), 1, file) == 1) {
+		if (buf.chunk.magic != TRACE_MAGIC || buf.chunk.len > TRACE_BUF_SIZE) break;
+		if (fread(buf.data, 1, buf.chunk.len, file) != buf.chunk.len) break;
+		const unsigned char *pos = buf.data;
+		trace_record_t last = {
+			.seq = buf.chunk.seq, .time = buf.chunk.time,
+			.thread = buf.chunk.thread
+		};
+		while (pos < buf.data + buf.chunk.len && count < max)
+			if (trace_decode(&pos, buf.data + buf.chunk.len, &last, &recs[count++]))
+				break;
+	}
+	fclose(file);
+	return count;
+}
+#endif
+
+void test_trace_put() {
+	{ // Normal case
+		unsigned char buf[10] = {0};
+		ASSERT(trace_put(buf, 0) == 1 && buf[0] == 0);
+		ASSERT(trace_put(buf, 127) == 1 && buf[0] == 127);
+		ASSERT(trace_put(buf, 128) == 2 && buf[0] == 0x80 && buf[1] == 1);
+		ASSERT(trace_put(buf, UINT64_MAX) == 10 && buf[9] == 1);
+	}
+}
+
+void test_trace_get() {
+	{ // Normal case
+		unsigned char buf[20];
+		size_t len = trace_put(buf, 300);
+		len += trace_put(buf + len, UINT64_MAX);
+		const unsigned char *pos = buf;
+		uint64_t value = 0;
+		ASSERT(!trace_get(&pos, buf + len, &value) && value == 300);
+		ASSERT(!trace_get(&pos, buf + len, &value) && value == UINT64_MAX);
+		ASSERT(pos == buf + len);
+	}
+	{ // Truncated varint
+		unsigned char buf[1] = {0x80};
+		const unsigned char *pos = buf;
+		uint64_t value = 0;
+		ASSERT(trace_get(&pos, buf + 1, &value));
+		pos = buf;
+		ASSERT(trace_get(&pos, buf, &value));
+	}
+	{ // Invalid arguments
+		uint64_t value = 0;
+		ASSERT(trace_get(NULL, NULL, &value));
+	}
+}
+
+void test_trace_encode() {
+	{ // Normal case
+		unsigned char buf[TRACE_RECORD_MAX];
+		trace_record_t last = {.seq = 10, .time = 100};
+		trace_record_t rec = {
+			.seq = 10, .time = 150, .id = 0x1000, .size = 64, .op = TRACE_NEW
+		};
+		size_t len = trace_encode(buf, &last, &rec);
+		ASSERT(len == 6);
+		ASSERT(buf[0] == TRACE_NEW);
+		ASSERT(last.id == 0x1000 && last.time == 150);
+		rec = (trace_record_t){.seq = 11, .time = 150, .id = 0x1000, .op = TRACE_DEL};
+		ASSERT(trace_encode(buf, &last, &rec) == 4);
+		rec = (trace_record_t){
+			.seq = 12, .time = 150, .id = 0x1000, .new_id = 0x2000,
+			.size = 64, .op = TRACE_RESIZE
+		};
+		ASSERT(trace_encode(buf, &last, &rec) == 7);
+		rec = (trace_record_t){
+			UINT64_MAX, UINT64_MAX, UINT64_MAX, 0, UINT64_MAX, 0, TRACE_RESIZE
+		};
+		last = (trace_record_t){0};
+		ASSERT(trace_encode(buf, &last, &rec) <= TRACE_RECORD_MAX);
+	}
+}
+
+void test_trace_decode() {
+	{ // Normal case
+		unsigned char buf[TRACE_RECORD_MAX * 3];
+		trace_record_t recs[3] = {
+			{1, 5, 0x7000, 0, 4096, 2, TRACE_NEW},
+			{2, 9, 0x3000, 0x9000, 8192, 2, TRACE_RESIZE},
+			{7, 9, 0x9000, 0, 0, 2, TRACE_DEL},
+		};
+		trace_record_t last = {.seq = 1, .time = 5, .thread = 2};
+		size_t len = 0;
+		for (size_t i = 0; i < 3; i++)
+			len += trace_encode(buf + len, &last, &recs[i]);
+		const unsigned char *pos = buf;
+		last = (trace_record_t){.seq = 1, .time = 5, .thread = 2};
+		for (size_t i = 0; i < 3; i++) {
+			trace_record_t rec = {0};
+			ASSERT(!trace_decode(&pos, buf + len, &last, &rec));
+			ASSERT(!memcmp(&rec, &recs[i], sizeof(rec)));
+		}
+		ASSERT(pos == buf + len);
+	}
+	{ // Invalid op
+		unsigned char buf[4] = {TRACE_RESIZE + 1, 0, 0, 0};
+		const unsigned char *pos = buf;
+		trace_record_t last = {0};
+		trace_record_t rec = {0};
+		ASSERT(trace_decode(&pos, buf + 4, &last, &rec));
+	}
+	{ // Truncated record
+		unsigned char buf[3] = {TRACE_NEW, 0, 0};
+		const unsigned char *pos = buf;
+		trace_record_t last = {0};
+		trace_record_t rec = {0};
+		ASSERT(trace_decode(&pos, buf + 3, &last, &rec));
+	}
+}
+
+#ifdef ALLOC_TRACE
+void test_trace_buf_get() {
+	{ // Normal case
+		pthread_mutex_lock(&g_trace_mutex);
+		trace_buf_t *buf = trace_buf_get();
+		ASSERT(buf && !buf->chunk.len && !buf->next);
+		buf->chunk.len = 10;
+		buf->next = g_trace_pool;
+		g_trace_pool = buf;
+		ASSERT(trace_buf_get() == buf);
+		ASSERT(!buf->chunk.len);
+		buf->next = g_trace_pool;
+		g_trace_pool = buf;
+		pthread_mutex_unlock(&g_trace_mutex);
+	}
+}
+
+void test_trace_queue() {
+	{ // Normal case
+		pthread_mutex_lock(&g_trace_mutex);
+		trace_buf_t *buf1 = trace_buf_get();
+		trace_buf_t *buf2 = trace_buf_get();
+		trace_queue(buf1);
+		trace_queue(buf2);
+		ASSERT(g_trace_queue == buf1 && buf1->next == buf2);
+		ASSERT(g_trace_queue_tail == buf2 && !buf2->next);
+		buf2->next = g_trace_pool;
+		g_trace_pool = buf1;
+		g_trace_queue = NULL;
+		g_trace_queue_tail = NULL;
+		pthread_mutex_unlock(&g_trace_mutex);
+	}
+}
+
+void test_trace_slot_get() {
+	{ // Normal case
+		unsigned threads = atomic_load(&g_trace_threads);
+		trace_slot_t *slot = trace_slot_get();
+		ASSERT(slot && slot->used);
+		ASSERT(slot->thread == threads);
+		slot->used = false;
+		ASSERT(trace_slot_get() == slot);
+		ASSERT(slot->thread == threads + 1);
+		slot->used = false;
+	}
+}
+
+void test_trace_record() {
+	{ // Normal case
+		ASSERT(!reset());
+		atomic_store(&g_trace_on, true);
+		int data = 0;
+		trace_record(TRACE_NEW, &data, NULL, 32);
+		trace_slot_t *slot = g_trace_slot;
+		ASSERT(slot && slot->buf && slot->buf->chunk.len);
+		ASSERT(slot->buf->chunk.magic == TRACE_MAGIC);
+		ASSERT(slot->buf->chunk.thread == slot->thread);
+		uint64_t seq = slot->buf->chunk.seq;
+		trace_record(TRACE_DEL, &data, NULL, 0);
+		ASSERT(atomic_load(&g_trace_seq) == seq + 2);
+		const unsigned char *pos = slot->buf->data;
+		const unsigned char *end = pos + slot->buf->chunk.len;
+		trace_record_t last = {.seq = seq, .time = slot->buf->chunk.time};
+		trace_record_t rec = {0};
+		ASSERT(!trace_decode(&pos, end, &last, &rec));
+		ASSERT(rec.op == TRACE_NEW && rec.id == (uintptr_t)&data && rec.size == 32);
+		ASSERT(!trace_decode(&pos, end, &last, &rec));
+		ASSERT(rec.op == TRACE_DEL && rec.seq == seq + 1);
+		ASSERT(pos == end);
+	}
+	{ // Normal case: busy
+		size_t len = g_trace_slot->buf->chunk.len;
+		g_trace_busy = true;
+		trace_record(TRACE_NEW, &len, NULL, 8);
+		g_trace_busy = false;
+		ASSERT(g_trace_slot->buf->chunk.len == len);
+	}
+	{ // Normal case: full buffer
+		trace_buf_t *buf = g_trace_slot->buf;
+		buf->chunk.len = TRACE_BUF_SIZE - TRACE_RECORD_MAX + 1;
+		trace_record(TRACE_NEW, buf, NULL, 8);
+		ASSERT(g_trace_slot->buf != buf);
+		ASSERT(g_trace_queue_tail == buf);
+	}
+	{ // Normal case: off
+		atomic_store(&g_trace_on, false);
+		size_t len = g_trace_slot->buf->chunk.len;
+		trace_record(TRACE_NEW, &len, NULL, 8);
+		ASSERT(g_trace_slot->buf->chunk.len == len);
+	}
+}
+
+void test_trace_flush() {
+	{ // Normal case
+		trace_buf_t *buf = g_trace_slot->buf;
+		ASSERT(buf && buf->chunk.len);
+		trace_flush();
+		ASSERT(!g_trace_slot->buf);
+		ASSERT(g_trace_queue_tail == buf);
+	}
+}
+
+void test_trace_write() {
+	{ // Normal case
+		char path[] = "/tmp/test_trace_XXXXXX";
+		g_trace_fd = mkstemp(path);
+		ASSERT(g_trace_fd >= 0);
+		size_t len = 0;
+		for (trace_buf_t *buf = g_trace_queue; buf; buf = buf->next)
+			len += sizeof(trace_chunk_t) + buf->chunk.len;
+		ASSERT(len);
+		pthread_mutex_lock(&g_trace_mutex);
+		ASSERT(!trace_write());
+		ASSERT(!g_trace_queue && !g_trace_queue_tail && g_trace_pool);
+		pthread_mutex_unlock(&g_trace_mutex);
+		ASSERT(lseek(g_trace_fd, 0, SEEK_END) == (off_t)len);
+		close(g_trace_fd);
+		g_trace_fd = -1;
+		unlink(path);
+	}
+	{ // Invalid file
+		pthread_mutex_lock(&g_trace_mutex);
+		trace_buf_t *buf = trace_buf_get();
+		buf->chunk.len = 1;
+		trace_queue(buf);
+		ASSERT(trace_write());
+		ASSERT(g_trace_pool == buf);
+		pthread_mutex_unlock(&g_trace_mutex);
+	}
+}
+
+void test_trace_thread() {
+	{ // Normal case
+		char path[] = "/tmp/test_trace_XXXXXX";
+		int fd = mkstemp(path);
+		ASSERT(fd >= 0);
+		close(fd);
+		ASSERT(!trace_start(path));
+		int data = 0;
+		trace_record(TRACE_NEW, &data, NULL, 4);
+		struct timespec ts = {0, TRACE_FLUSH_MS * 3000000};
+		nanosleep(&ts, NULL);
+		trace_record_t rec = {0};
+		ASSERT(trace_load(path, &rec, 1) == 1);
+		ASSERT(rec.op == TRACE_NEW && rec.id == (uintptr_t)&data);
+		ASSERT(!trace_stop());
+		unlink(path);
+	}
+}
+
+void test_trace_start() {
+	{ // Normal case
+		char path[] = "/tmp/test_trace_XXXXXX";
+		int fd = mkstemp(path);
+		ASSERT(fd >= 0);
+		close(fd);
+		ASSERT(!reset());
+		ASSERT(!trace_start(path));
+		ASSERT(g_trace_running && atomic_load(&g_trace_on));
+		ASSERT(g_trace_fd >= 0);
+		void *data = alloc_new(MIN_ALLOC_SIZE);
+		void *old = data;
+		ASSERT(!alloc_resize(&data, SLAB_MAX_SIZE * 2));
+		alloc_del(data);
+		ASSERT(!trace_stop());
+		trace_record_t recs[4] = {0};
+		ASSERT(trace_load(path, recs, 4) == 3);
+		ASSERT(recs[0].op == TRACE_NEW && recs[0].id == (uintptr_t)old);
+		ASSERT(recs[0].size == MIN_ALLOC_SIZE && recs[0].seq == 0);
+		ASSERT(recs[1].op == TRACE_RESIZE && recs[1].id == (uintptr_t)old);
+		ASSERT(recs[1].new_id == (uintptr_t)data && recs[1].size == SLAB_MAX_SIZE * 2);
+		ASSERT(recs[2].op == TRACE_DEL && recs[2].id == (uintptr_t)data);
+		ASSERT(recs[2].seq == 2);
+		unlink(path);
+	}
+	{ // Already running
+		ASSERT(!trace_start("/dev/null"));
+		ASSERT(trace_start("/dev/null"));
+		ASSERT(!trace_stop());
+	}
+	{ // Invalid path
+		ASSERT(trace_start(NULL));
+		ASSERT(trace_start("/nonexistent/trace"));
+		ASSERT(!g_trace_running);
+	}
+}
+
+void test_trace_stop() {
+	{ // Normal case
+		ASSERT(!trace_start("/dev/null"));
+		ASSERT(!trace_stop());
+		ASSERT(!g_trace_running && !atomic_load(&g_trace_on));
+		ASSERT(g_trace_fd == -1);
+	}
+	{ // Normal case: not running
+		ASSERT(!trace_stop());
+	}
+}
+
+static void *trace_exit_thread(void *arg) {
+	void *data = alloc_new(MIN_ALLOC_SIZE);
+	*(trace_slot_t**)arg = g_trace_slot;
+	alloc_del(data);
+	return NULL;
+}
+
+void test_trace_exit() {
+	{ // Normal case
+		char path[] = "/tmp/test_trace_XXXXXX";
+		int fd = mkstemp(path);
+		ASSERT(fd >= 0);
+		close(fd);
+		ASSERT(!reset());
+		ASSERT(!trace_start(path));
+		trace_slot_t *slot = NULL;
+		pthread_t thread;
+		ASSERT(!pthread_create(&thread, NULL, trace_exit_thread, &slot));
+		ASSERT(!pthread_join(thread, NULL));
+		ASSERT(slot && !slot->used && !slot->buf);
+		ASSERT(!trace_stop());
+		trace_record_t recs[2] = {0};
+		ASSERT(trace_load(path, recs, 2) == 2);
+		ASSERT(recs[0].thread == slot->thread && recs[1].thread == slot->thread);
+		ASSERT(recs[0].op == TRACE_NEW && recs[1].op == TRACE_DEL);
+		unlink(path);
+	}
+	{ // Normal case: no slot
+		trace_slot_t *slot = g_trace_slot;
+		g_trace_slot = NULL;
+		trace_exit();
+		g_trace_slot = slot;
+	}
+}
+#endif
+
+void test_config_env() {
+	{ // Normal case
+		setenv("ALLOC_DECAY_MS", "5", 1);
+		setenv("ALLOC_MAX_DIRTY", "8192", 1);
+		setenv("ALLOC_BACKGROUND", "1", 1);
+		setenv("ALLOC_PROF_RATE", "4096", 1);
+		setenv("ALLOC_DEBUG", "3", 1);
+		setenv("ALLOC_NUMA_NODES", "2", 1);
+		setenv("ALLOC_TRACE", "/dev/null", 1);
+		ASSERT(!config_env());
+#ifdef ALLOC_TRACE
+		ASSERT(g_trace_running);
+		ASSERT(!trace_stop());
+#endif
+		ASSERT(g_numa_nodes == 2);
+#ifdef ALLOC_DEBUG
+		ASSERT(atomic_load(&g_debug) == 3);
+#endif
+		ASSERT(atomic_load(&g_prof_rate) == 4096);
+		ASSERT(atomic_load(&g_prof_start));
+		ASSERT(atomic_load(&g_decay_ms) == 5);
+		ASSERT(atomic_load(&g_max_dirty) == 8192);
+		ASSERT(g_decay_running);
+		ASSERT(!decay_stop());
+		unsetenv("ALLOC_DECAY_MS");
+		unsetenv("ALLOC_MAX_DIRTY");
+		unsetenv("ALLOC_BACKGROUND");
+		unsetenv("ALLOC_PROF_RATE");
+		unsetenv("ALLOC_DEBUG");
+		unsetenv("ALLOC_NUMA_NODES");
+		unsetenv("ALLOC_TRACE");
+		g_numa_nodes = 1;
+		g_numa_fake = false;
+#ifdef ALLOC_DEBUG
+		atomic_store(&g_debug, 0);
+#endif
+		atomic_store(&g_prof_rate, 0);
+		atomic_store(&g_decay_ms, DECAY_MS);
+		atomic_store(&g_max_dirty, MAX_DIRTY);
+	}
+	{ // Normal case: no environment variables
+		ASSERT(!config_env());
+		ASSERT(atomic_load(&g_decay_ms) == DECAY_MS);
+		ASSERT(!g_decay_running);
+	}
+}
+
 void test_arena_expand() {
 	{ // Normal case
 		reset();
@@ -13,6 +926,7 @@ void test_arena_expand() {
 		ASSERT(!arena_expand());
 		ASSERT(g_arena_tail == g_arena_head.next);
 		ASSERT(g_arena_tail->prev == &g_arena_head);
+		ASSERT(CHUNK(g_arena_tail) == g_chunks);
 		ASSERT(!arena_expand());
 		ASSERT(g_arena_tail == g_arena_head.next->next);
 		ASSERT(g_arena_tail->prev->prev == &g_arena_head);
@@ -36,9 +950,13 @@ void test_arena_del() {
 		ASSERT(!reset());
 		ASSERT(!arena_expand());
 		ASSERT(!arena_expand());
-		ASSERT(!arena_del(g_arena_head.next));
+		arena_t *arena = g_arena_head.next;
+		size_t free_pages = g_chunk_free_pages;
+		ASSERT(!arena_del(arena));
 		ASSERT(g_arena_head.next == g_arena_tail);
 		ASSERT(g_arena_tail->prev == &g_arena_head);
+		ASSERT(g_chunk_free_pages == free_pages + 1);
+		ASSERT(page_use() == arena);
 	}
 	{ // arena NULL
 		ASSERT(!reset());
@@ -124,81 +1042,483 @@ void test_arena_use() {
 	}
 }
 
-void test_free_ptr_index() {
+void test_size_class() {
+	{ // Normal case
+		ASSERT(SIZE_CLASS(1) == 0);
+		ASSERT(SIZE_CLASS(MIN_ALLOC_SIZE) == 0);
+		ASSERT(SIZE_CLASS(MIN_ALLOC_SIZE * 2) == 1);
+		ASSERT(SIZE_CLASS(MIN_ALLOC_SIZE * 3) == 2);
+		ASSERT(SIZE_CLASS(MIN_ALLOC_SIZE * 3 - 8) == 2);
+		ASSERT(CLASS_SIZE(0) == MIN_ALLOC_SIZE);
+		ASSERT(CLASS_SIZE(SIZE_CLASS(MIN_ALLOC_SIZE * 8 + 1)) == MIN_ALLOC_SIZE * 10);
+		ASSERT(CLASS_SIZE(NUM_SIZE_CLASSES - 1) == MAX_ARENA_ALLOC_SIZE);
+	}
+	{ // Every size fits its class and classes grow geometrically
+		int fits = 1;
+		int monotonic = 1;
+		for (size_t size = 1; size <= MAX_ARENA_ALLOC_SIZE; size++) {
+			size_t i = SIZE_CLASS(size);
+			if (i >= NUM_SIZE_CLASSES || CLASS_SIZE(i) < size) fits = 0;
+			if (i && CLASS_SIZE(i - 1) >= size) fits = 0;
+			if (size > 1 && i < SIZE_CLASS(size - 1)) monotonic = 0;
+		}
+		ASSERT(fits);
+		ASSERT(monotonic);
+		ASSERT(SIZE_CLASS(MIN_ALLOC_SIZE * 64) - SIZE_CLASS(MIN_ALLOC_SIZE * 32) == 4);
+	}
+}
+
+void test_ptr_capacity() {
 	{ // Normal case
 		ASSERT(!reset());
-		ASSERT(FREE_PTR_INDEX(MIN_ALLOC_SIZE) == 0);
-		ASSERT(!reset());;
-		ASSERT(FREE_PTR_INDEX(MIN_ALLOC_SIZE * 2) == 1);
-		ASSERT(!reset());;
-		ASSERT(FREE_PTR_INDEX(MIN_ALLOC_SIZE * 3) == 2);
-		ASSERT(!reset());;
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data1 = arena_use(size);
+		void *data2 = arena_use(MIN_ALLOC_SIZE);
+		ASSERT(ptr_capacity(PTR(data1)) == CLASS_SIZE(SIZE_CLASS(size)));
+		ASSERT(ptr_capacity(PTR(data2)) == MIN_ALLOC_SIZE);
+		g_arena_tail->offset += MIN_ALLOC_SIZE;
+		ASSERT(ptr_capacity(PTR(data2)) == MIN_ALLOC_SIZE * 2);
 	}
 }
 
-void test_ptr_free() {
+void test_ptr_unlink() {
 	{ // Normal case
 		ASSERT(!reset());
-		size_t size1 = MIN_ALLOC_SIZE / 2;
-		size_t size2 = MIN_ALLOC_SIZE * 2;
-		size_t index1 = FREE_PTR_INDEX(size1);
-		size_t index2 = FREE_PTR_INDEX(size2);
-		void *data1 = arena_use(size1);
-		void *data2 = arena_use(size1);
-		void *data3 = arena_use(size2);
-		void *data4 = arena_use(size2);
-		ptr_t *ptr1 = (ptr_t*)((unsigned char*)data1 - PTR_ALIGNED_SIZE);
-		ptr_t *ptr2 = (ptr_t*)((unsigned char*)data2 - PTR_ALIGNED_SIZE);
-		ptr_t *ptr3 = (ptr_t*)((unsigned char*)data3 - PTR_ALIGNED_SIZE);
-		ptr_t *ptr4 = (ptr_t*)((unsigned char*)data4 - PTR_ALIGNED_SIZE);
-		ASSERT(!ptr_free(data1));
-		ASSERT(!ptr_free(data2));
-		ASSERT(!ptr_free(data3));
-		ASSERT(!ptr_free(data4));
-		ASSERT(g_free_ptr_tails[index1] == ptr2);
-		ASSERT(g_free_ptr_tails[index1]->prev_free == ptr1);
-		ASSERT(g_free_ptr_tails[index2] == ptr4);
-		ASSERT(g_free_ptr_tails[index2]->prev_free == ptr3);
-		ASSERT(!g_free_ptr_tails[index1]->next_free)
-		ASSERT(!g_free_ptr_tails[index2]->next_free)
-		ASSERT(ptr1->state == FREE);
-		ASSERT(ptr2->state == FREE);
-		ASSERT(ptr3->state == FREE);
-		ASSERT(ptr4->state == FREE);
+		void *data1 = arena_use(MIN_ALLOC_SIZE);
+		void *data2 = arena_use(MIN_ALLOC_SIZE);
+		void *data3 = arena_use(MIN_ALLOC_SIZE);
+		ptr_unlink(PTR(data2));
+		ASSERT(PTR(data1)->next_valid == PTR(data3));
+		ASSERT(PTR(data3)->prev_valid == PTR(data1));
+		ASSERT(ptr_capacity(PTR(data1)) == MIN_ALLOC_SIZE * 2 + PTR_ALIGNED_SIZE);
+		ptr_unlink(PTR(data3));
+		ASSERT(!PTR(data1)->next_valid);
+		ASSERT(g_arena_tail->ptrs_tail == PTR(data1));
 	}
-	{ // Normal case: delete arena
+}
+
+void test_free_ptr_push() {
+	{ // Normal case
 		ASSERT(!reset());
-		ASSERT(g_arena_tail == &g_arena_head);
-		ASSERT(!arena_expand());
-		void *data = arena_use(MIN_ALLOC_SIZE);
-		ASSERT(data);
-		ptr_t *ptr = (ptr_t*)((unsigned char*)data - PTR_ALIGNED_SIZE);
-		ASSERT(ptr->arena == g_arena_head.next);
-		ASSERT(g_arena_head.next == g_arena_tail);
-		ASSERT(g_arena_head.offset < ARENA_SIZE - MIN_ALLOC_SIZE - PTR_ALIGNED_SIZE);
-		ASSERT(g_arena_head.next->prev);
-		ASSERT(!ptr_free(data));
-		ASSERT(g_arena_tail == &g_arena_head);
+		size_t size = SLAB_MAX_SIZE * 2;
+		size_t index = SIZE_CLASS(size);
+		void *data1 = arena_use(size);
+		void *data2 = arena_use(size);
+		ASSERT(arena_use(MIN_ALLOC_SIZE));
+		free_ptr_push(PTR(data1));
+		free_ptr_push(PTR(data2));
+		ASSERT(g_free_ptr_tails[index] == PTR(data2));
+		ASSERT(PTR(data2)->prev_free == PTR(data1));
+		ASSERT(PTR(data1)->next_free == PTR(data2));
+		ASSERT(!PTR(data2)->next_free);
+		ASSERT(PTR(data1)->state == FREE);
+		ASSERT(PTR(data2)->state == FREE);
+	}
+	{ // Normal case: capacity between size classes
 		ASSERT(!reset());
-		ASSERT(g_arena_tail == &g_arena_head);
-		ASSERT(!arena_expand());
-		data = arena_use(MIN_ALLOC_SIZE);
-		ASSERT(data);
-		ptr = (ptr_t*)((unsigned char*)data - PTR_ALIGNED_SIZE);
-		ASSERT(!arena_expand());
-		ASSERT(ptr->arena == g_arena_head.next);
-		ASSERT(g_arena_head.next == ptr->arena);
-		ASSERT(g_arena_tail->prev == ptr->arena);
-		ASSERT(!ptr_free(data));
-		ASSERT(g_arena_tail == g_arena_head.next);
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data1 = arena_use(size);
+		void *data2 = arena_use(MIN_ALLOC_SIZE);
+		ASSERT(arena_use(MIN_ALLOC_SIZE));
+		ptr_unlink(PTR(data2));
+		free_ptr_push(PTR(data1));
+		ASSERT(g_free_ptr_tails[SIZE_CLASS(size)] == PTR(data1));
+	}
+}
+
+void test_free_ptr_unlink() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		size_t index = SIZE_CLASS(size);
+		void *data1 = arena_use(size);
+		void *data2 = arena_use(size);
+		void *data3 = arena_use(size);
+		ASSERT(arena_use(MIN_ALLOC_SIZE));
+		free_ptr_push(PTR(data1));
+		free_ptr_push(PTR(data2));
+		free_ptr_push(PTR(data3));
+		free_ptr_unlink(PTR(data2));
+		ASSERT(PTR(data3)->prev_free == PTR(data1));
+		ASSERT(PTR(data1)->next_free == PTR(data3));
+		free_ptr_unlink(PTR(data3));
+		ASSERT(g_free_ptr_tails[index] == PTR(data1));
+		ASSERT(!PTR(data1)->next_free);
+		free_ptr_unlink(PTR(data1));
+		ASSERT(!g_free_ptr_tails[index]);
+	}
+}
+
+void test_ptr_coalesce() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data1 = arena_use(size);
+		void *data2 = arena_use(size);
+		void *data3 = arena_use(size);
+		void *data4 = arena_use(MIN_ALLOC_SIZE);
+		free_ptr_push(PTR(data1));
+		free_ptr_push(PTR(data3));
+		ptr_t *ptr = ptr_coalesce(PTR(data2));
+		ASSERT(ptr == PTR(data1));
+		ASSERT(ptr->next_valid == PTR(data4));
+		ASSERT(PTR(data4)->prev_valid == ptr);
+		ASSERT(ptr_capacity(ptr) == CLASS_SIZE(SIZE_CLASS(size)) * 3 + PTR_ALIGNED_SIZE * 2);
+		for (size_t i = 0; i < NUM_SIZE_CLASSES; i++)
+			ASSERT(!g_free_ptr_tails[i]);
+	}
+	{ // Normal case: neighbours in use
+		ASSERT(!reset());
+		void *data1 = arena_use(MIN_ALLOC_SIZE);
+		void *data2 = arena_use(MIN_ALLOC_SIZE);
+		void *data3 = arena_use(MIN_ALLOC_SIZE);
+		PTR(data3)->state = CACHED;
+		ASSERT(ptr_coalesce(PTR(data2)) == PTR(data2));
+		ASSERT(PTR(data1)->next_valid == PTR(data2));
+		ASSERT(PTR(data2)->next_valid == PTR(data3));
+	}
+}
+
+void test_run_use() {
+	{ // Normal case
+		ASSERT(!reset());
+		g_chunk_free_pages = 0;
+		bool zero = false;
+		void *data = run_use(ARENA_SIZE * 2, &zero);
+		ASSERT(data);
+		ASSERT(zero);
+		ptr_t *ptr = PTR(data);
+		ASSERT(!ptr->arena);
+		ASSERT(ptr->pages == 3);
+		ASSERT(ptr->size == ARENA_SIZE * 2);
+		ASSERT(ptr->state == VALID);
+		ASSERT(PAGE_FLOOR(ptr) == (uintptr_t)ptr);
+		ASSERT(CHUNK(ptr)->owner == g_heap);
+	}
+	{ // Size out of range
+		ASSERT(!reset());
+		ASSERT(!run_use(0, NULL));
+		ASSERT(!run_use(MIN_ALLOC_SIZE, NULL));
+		ASSERT(!run_use(MAX_RUN_ALLOC_SIZE + 1, NULL));
+	}
+}
+
+void test_run_use_aligned() {
+	{ // Normal case: alignment up to a page
+		ASSERT(!reset());
+		size_t alignments[] = {MIN_ALLOC_SIZE, 256, 1024, ARENA_SIZE};
+		for (size_t i = 0; i < sizeof(alignments) / sizeof(*alignments); i++) {
+			unsigned char *data = run_use_aligned(ARENA_SIZE * 2, alignments[i]);
+			ASSERT(data);
+			ASSERT(!((uintptr_t)data % alignments[i]));
+			ptr_t *ptr = PTR(data);
+			ASSERT(!ptr->arena);
+			ASSERT(ptr->size == ARENA_SIZE * 2);
+			ASSERT(ptr->pages == RUN_SPAN(ptr, ARENA_SIZE * 2));
+			ASSERT((uintptr_t)RUN_HEAD(ptr) == PAGE_FLOOR(data - 1));
+			data[ARENA_SIZE * 2 - 1] = 1;
+			size_t free_pages = g_chunk_free_pages;
+			ASSERT(!run_free(data));
+			ASSERT(g_chunk_free_pages == free_pages + RUN_SPAN(ptr, ARENA_SIZE * 2));
+		}
+	}
+	{ // Normal case: alignment above a page
+		ASSERT(!reset());
+		g_chunk_free_pages = 0;
+		unsigned char *data = run_use_aligned(ARENA_SIZE, ARENA_SIZE * 16);
+		ASSERT(data);
+		ASSERT(!((uintptr_t)data % (ARENA_SIZE * 16)));
+		ASSERT(PTR(data)->pages == 2);
+		ASSERT(CHUNK(data)->owner == g_heap);
+		size_t free_pages = g_chunk_free_pages;
+		ASSERT(!run_free(data));
+		ASSERT(g_chunk_free_pages == free_pages + 2);
+		for (size_t i = 0; i < 64; i++) {
+			void *next = run_use_aligned(ARENA_SIZE * (i % 4 + 1), ARENA_SIZE * 16);
+			ASSERT(next);
+			ASSERT(!((uintptr_t)next % (ARENA_SIZE * 16)));
+			free_pages = g_chunk_free_pages;
+			ASSERT(!run_free(next));
+			ASSERT(g_chunk_free_pages == free_pages + PTR(next)->pages);
+		}
+	}
+	{ // Normal case: small block
+		ASSERT(!reset());
+		void *data = run_use_aligned(MIN_ALLOC_SIZE, ARENA_SIZE);
+		ASSERT(data);
+		ASSERT(!((uintptr_t)data % ARENA_SIZE));
+		ASSERT(PTR(data)->pages == 2);
+		ASSERT(!run_free(data));
+	}
+	{ // Invalid argument
+		ASSERT(!reset());
+		ASSERT(!run_use_aligned(0, ARENA_SIZE));
+		ASSERT(!run_use_aligned(MAX_RUN_ALLOC_SIZE + 1, ARENA_SIZE));
+		ASSERT(!run_use_aligned(ARENA_SIZE, 0));
+		ASSERT(!run_use_aligned(ARENA_SIZE, 96));
+		ASSERT(!run_use_aligned(ARENA_SIZE, RUN_MAX_ALIGNMENT * 2));
+	}
+}
+
+void test_run_free() {
+	{ // Normal case
+		ASSERT(!reset());
+		void *data = run_use(ARENA_SIZE * 2, NULL);
+		size_t free_pages = g_chunk_free_pages;
+		ASSERT(!run_free(data));
+		ASSERT(g_chunk_free_pages == free_pages + 3);
+		ASSERT(run_use(ARENA_SIZE * 2, NULL) == data);
+	}
+	{ // Invalid argument
+		ASSERT(!reset());
+		ASSERT(run_free(NULL));
+		ASSERT(run_free(arena_use(SLAB_MAX_SIZE * 2)));
+	}
+}
+
+void test_run_resize() {
+	{ // Normal case: grow within the run
+		ASSERT(!reset());
+		void *data = run_use(ARENA_SIZE * 2, NULL);
+		ASSERT(!run_resize(data, ARENA_SIZE * 2 + MIN_ALLOC_SIZE));
+		ASSERT(PTR(data)->size == ARENA_SIZE * 2 + MIN_ALLOC_SIZE);
+		ASSERT(PTR(data)->pages == 3);
+	}
+	{ // Normal case: shrink releases pages
+		ASSERT(!reset());
+		void *data = run_use(ARENA_SIZE * 8, NULL);
+		size_t free_pages = g_chunk_free_pages;
+		ASSERT(!run_resize(data, ARENA_SIZE * 2));
+		ASSERT(PTR(data)->pages == 3);
+		ASSERT(g_chunk_free_pages == free_pages + 6);
+		ASSERT(!run_free(data));
+	}
+	{ // Normal case: aligned block keeps its head page
+		ASSERT(!reset());
+		void *data = run_use_aligned(ARENA_SIZE * 8, ARENA_SIZE);
+		arena_t *head = RUN_HEAD(PTR(data));
+		size_t free_pages = g_chunk_free_pages;
+		ASSERT(!run_resize(data, ARENA_SIZE * 2));
+		ASSERT(PTR(data)->pages == 3);
+		ASSERT(g_chunk_free_pages == free_pages + 6);
+		ASSERT(RUN_HEAD(PTR(data)) == head);
+		ASSERT(!run_free(data));
+		ASSERT(g_chunk_free_pages == free_pages + 9);
+	}
+	{ // Not enough pages
+		ASSERT(!reset());
+		void *data = run_use(ARENA_SIZE * 2, NULL);
+		ASSERT(run_resize(data, ARENA_SIZE * 4));
+		ASSERT(PTR(data)->size == ARENA_SIZE * 2);
+	}
+	{ // Invalid argument
+		ASSERT(!reset());
+		void *data = run_use(ARENA_SIZE * 2, NULL);
+		ASSERT(run_resize(NULL, ARENA_SIZE));
+		ASSERT(run_resize(data, MIN_ALLOC_SIZE));
+		ASSERT(run_resize(data, MAX_RUN_ALLOC_SIZE + 1));
+		ASSERT(run_resize(arena_use(SLAB_MAX_SIZE * 2), ARENA_SIZE * 2));
+	}
+}
+
+void test_map_cache_put() {
+	{ // Normal case
+		ASSERT(!reset());
+		void *map = MMAP(ARENA_SIZE * 2);
+		ASSERT(!map_cache_put(map, ARENA_SIZE * 2));
+		ASSERT(g_map_count == 1);
+		ASSERT(g_map_bytes == ARENA_SIZE * 2);
+		ASSERT(g_map_cache[0].head == map);
+	}
+	{ // Normal case: oldest mapping evicted
+		ASSERT(!reset());
+		void *first = MMAP(ARENA_SIZE);
+		ASSERT(!map_cache_put(first, ARENA_SIZE));
+		for (size_t i = 1; i < MAP_CACHE_COUNT; i++)
+			ASSERT(!map_cache_put(MMAP(ARENA_SIZE), ARENA_SIZE));
+		void *last = MMAP(ARENA_SIZE);
+		ASSERT(!map_cache_put(last, ARENA_SIZE));
+		ASSERT(g_map_count == MAP_CACHE_COUNT);
+		ASSERT(g_map_cache[0].head != first);
+		ASSERT(g_map_cache[MAP_CACHE_COUNT - 1].head == last);
+		ASSERT(STAT_LOAD(g_heap, munmap_calls) == 1);
+	}
+	{ // Mapping too big
+		ASSERT(!reset());
+		ASSERT(map_cache_put(g_heap, MAP_CACHE_BYTES));
+		ASSERT(!g_map_count);
+	}
+	{ // Head NULL
+		ASSERT(!reset());
+		ASSERT(map_cache_put(NULL, ARENA_SIZE));
+	}
+}
+
+void test_map_cache_use() {
+	{ // Normal case: best fit
+		ASSERT(!reset());
+		size_t len = MAX_RUN_ALLOC_SIZE * 2;
+		void *big = MMAP(len * 2);
+		void *fit = MMAP(len + ARENA_SIZE * 2);
+		ASSERT(!map_cache_put(big, len * 2));
+		ASSERT(!map_cache_put(fit, len + ARENA_SIZE * 2));
+		unsigned char *data = map_cache_use(len, MIN_ALLOC_SIZE);
+		ASSERT(data);
+		ASSERT((void*)PTR(data) == fit);
+		ASSERT(PTR(data)->size == len);
+		ASSERT(!PTR(data)->pages);
+		ASSERT(g_map_count == 1);
+		ASSERT(g_map_bytes == len * 2);
+		ASSERT(STAT_LOAD(g_heap, munmap_calls) == 1);
+		data[len - 1] = 1;
+		ASSERT(!ptr_free(data));
+		ASSERT(g_map_count == 2);
+	}
+	{ // Normal case: aligned
+		ASSERT(!reset());
+		size_t len = MAX_RUN_ALLOC_SIZE * 2;
+		size_t alignment = ARENA_SIZE * 16;
+		void *map = MMAP(len + alignment * 2);
+		ASSERT(!map_cache_put(map, len + alignment * 2));
+		unsigned char *data = map_cache_use(len, alignment);
+		ASSERT(data);
+		ASSERT(!((uintptr_t)data % alignment));
+		ASSERT(PTR(data)->size == len);
+		ASSERT(!g_map_count);
+		data[0] = 1;
+		data[len - 1] = 1;
+		ASSERT(!ptr_free(data));
+		ASSERT(g_map_count == 1);
+		ASSERT(g_map_cache[0].head == (void*)PAGE_FLOOR(PTR(data)));
+	}
+	{ // No mapping fits
+		ASSERT(!reset());
+		ASSERT(!map_cache_put(MMAP(ARENA_SIZE), ARENA_SIZE));
+		ASSERT(!map_cache_use(ARENA_SIZE, MIN_ALLOC_SIZE));
+		ASSERT(!map_cache_use(MIN_ALLOC_SIZE, ARENA_SIZE));
+		ASSERT(g_map_count == 1);
+	}
+	{ // alignment not a power of two
+		ASSERT(!reset());
+		ASSERT(!map_cache_use(ARENA_SIZE, 96));
+	}
+}
+
+void test_map_cache_flush() {
+	{ // Normal case
+		ASSERT(!reset());
+		ASSERT(!map_cache_put(MMAP(ARENA_SIZE), ARENA_SIZE));
+		ASSERT(!map_cache_put(MMAP(ARENA_SIZE), ARENA_SIZE));
+		ASSERT(!map_cache_flush());
+		ASSERT(!g_map_count);
+		ASSERT(!g_map_bytes);
+		ASSERT(STAT_LOAD(g_heap, munmap_calls) == 2);
+	}
+}
+
+void test_ptr_free() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t size1 = SLAB_MAX_SIZE * 2;
+		size_t size2 = SLAB_MAX_SIZE * 3;
+		size_t index1 = SIZE_CLASS(size1);
+		size_t index2 = SIZE_CLASS(size2);
+		void *data1 = arena_use(size1);
+		ASSERT(arena_use(size1));
+		void *data3 = arena_use(size2);
+		ASSERT(arena_use(MIN_ALLOC_SIZE));
+		ptr_t *ptr1 = PTR(data1);
+		ptr_t *ptr3 = PTR(data3);
+		ASSERT(!ptr_free(data1));
+		ASSERT(!ptr_free(data3));
+		ASSERT(g_free_ptr_tails[index1] == ptr1);
+		ASSERT(g_free_ptr_tails[index2] == ptr3);
+		ASSERT(!ptr1->next_free);
+		ASSERT(!ptr3->next_free);
+		ASSERT(ptr1->state == FREE);
+		ASSERT(ptr3->state == FREE);
+	}
+	{ // Normal case: coalesce
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data1 = arena_use(size);
+		void *data2 = arena_use(size);
+		void *data3 = arena_use(size);
+		void *data4 = arena_use(MIN_ALLOC_SIZE);
+		ASSERT(!ptr_free(data1));
+		ASSERT(!ptr_free(data3));
+		ASSERT(!ptr_free(data2));
+		ptr_t *ptr = PTR(data1);
+		ASSERT(ptr->state == FREE);
+		ASSERT(ptr->next_valid == PTR(data4));
+		ASSERT(g_free_ptr_tails[FREE_CLASS(ptr_capacity(ptr))] == ptr);
+		ASSERT(!g_free_ptr_tails[SIZE_CLASS(size)]);
+		size_t offset = g_arena_tail->offset;
+		ASSERT(!ptr_free(data4));
+		ASSERT(!g_arena_tail->offset);
+		ASSERT(g_arena_tail->clean >= offset);
+		ASSERT(!g_arena_tail->ptrs_tail);
+		for (size_t i = 0; i < NUM_SIZE_CLASSES; i++)
+			ASSERT(!g_free_ptr_tails[i]);
+	}
+	{ // Normal case: give last block back to the arena
+		ASSERT(!reset());
+		void *data1 = arena_use(SLAB_MAX_SIZE * 2);
+		size_t offset = g_arena_tail->offset;
+		void *data2 = arena_use(SLAB_MAX_SIZE * 2);
+		ASSERT(!ptr_free(data2));
+		ASSERT(g_arena_tail->offset == offset);
+		ASSERT(g_arena_tail->ptrs_tail == PTR(data1));
+		ASSERT(!PTR(data1)->next_valid);
+		ASSERT(arena_use(SLAB_MAX_SIZE * 2) == data2);
+	}
+	{ // Normal case: delete empty arena
+		ASSERT(!reset());
+		ASSERT(!arena_expand());
+		arena_t *arena = g_arena_tail;
+		void *data = arena_use(MIN_ALLOC_SIZE);
+		ASSERT(PTR(data)->arena == arena);
+		ASSERT(!arena_expand());
+		size_t free_pages = g_chunk_free_pages;
+		ASSERT(!ptr_free(data));
+		ASSERT(g_arena_head.next == g_arena_tail);
 		ASSERT(g_arena_tail->prev == &g_arena_head);
+		ASSERT(g_chunk_free_pages == free_pages + 1);
+		ASSERT(page_use() == arena);
 	}
-	{ // Normal case: munmap
+	{ // Normal case: keep empty current arena
+		ASSERT(!reset());
+		void *data = arena_use(MIN_ALLOC_SIZE);
+		arena_t *arena = g_arena_tail;
+		ASSERT(!ptr_free(data));
+		ASSERT(g_arena_tail == arena);
+		ASSERT(!arena->offset);
+	}
+	{ // Normal case: mapping kept
 		ASSERT(!reset());
 		void *data = mmap_use(ARENA_SIZE * 2);
 		ASSERT(data);
 		ASSERT(!PTR(data)->arena);
 		ASSERT(!ptr_free(data));
+		ASSERT(g_map_count == 1);
+	}
+	{ // Normal case: munmap
+		ASSERT(!reset());
+		void *data = mmap_use(MAP_CACHE_BYTES);
+		ASSERT(data);
+		ASSERT(!ptr_free(data));
+		ASSERT(!g_map_count);
+		ASSERT(STAT_LOAD(g_heap, munmap_calls) == 1);
+	}
+	{ // Normal case: page run of another thread
+		ASSERT(!reset());
+		void *data = run_use(ARENA_SIZE * 2, NULL);
+		heap_t heap = {0};
+		CHUNK(data)->owner = &heap;
+		ASSERT(!ptr_free(data));
+		CHUNK(data)->owner = g_heap;
+		ASSERT(atomic_load(&heap.remote_free) == data);
+		ASSERT(PTR(data)->state == REMOTE);
 	}
 	{ // Data NULL
 		ASSERT(!reset());
@@ -212,52 +1532,65 @@ void test_ptr_free() {
 	}
 }
 
+void test_free_ptr_find() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		ASSERT(free_ptr_find(MIN_ALLOC_SIZE) == NUM_SIZE_CLASSES);
+		void *data = arena_use(size);
+		ASSERT(arena_use(MIN_ALLOC_SIZE));
+		ASSERT(!ptr_free(data));
+		ASSERT(free_ptr_find(MIN_ALLOC_SIZE) == SIZE_CLASS(size));
+		ASSERT(free_ptr_find(size) == SIZE_CLASS(size));
+		ASSERT(free_ptr_find(size + 1) == NUM_SIZE_CLASSES);
+	}
+}
+
 void test_free_ptr_use() {
 	{ // Normal case
 		ASSERT(!reset());
-		size_t size1 = MIN_ALLOC_SIZE / 2;
-		size_t size2 = MIN_ALLOC_SIZE * 2;
+		size_t size1 = SLAB_MAX_SIZE * 2;
+		size_t size2 = SLAB_MAX_SIZE * 3;
 		void *data1 = arena_use(size1);
+		ASSERT(arena_use(MIN_ALLOC_SIZE));
 		void *data2 = arena_use(size1);
+		ASSERT(arena_use(MIN_ALLOC_SIZE));
 		void *data3 = arena_use(size2);
-		void *data4 = arena_use(size2);
-		ptr_t *ptr1 = (ptr_t*)((unsigned char*)data1 - PTR_ALIGNED_SIZE);
-		ptr_t *ptr2 = (ptr_t*)((unsigned char*)data2 - PTR_ALIGNED_SIZE);
-		ptr_t *ptr3 = (ptr_t*)((unsigned char*)data3 - PTR_ALIGNED_SIZE);
-		ptr_t *ptr4 = (ptr_t*)((unsigned char*)data4 - PTR_ALIGNED_SIZE);
+		ASSERT(arena_use(MIN_ALLOC_SIZE));
 		ASSERT(!ptr_free(data1));
 		ASSERT(!ptr_free(data2));
 		ASSERT(!ptr_free(data3));
-		ASSERT(!ptr_free(data4));
-
+		void *data4 = free_ptr_use(size1);
 		void *data5 = free_ptr_use(size1);
-		void *data6 = free_ptr_use(size1);
-		void *data7 = free_ptr_use(size2);
-		void *data8 = free_ptr_use(size2);
-		ptr_t *ptr5 = (ptr_t*)((unsigned char*)data5 - PTR_ALIGNED_SIZE);
-		ptr_t *ptr6 = (ptr_t*)((unsigned char*)data6 - PTR_ALIGNED_SIZE);
-		ptr_t *ptr7 = (ptr_t*)((unsigned char*)data7 - PTR_ALIGNED_SIZE);
-		ptr_t *ptr8 = (ptr_t*)((unsigned char*)data8 - PTR_ALIGNED_SIZE);
-		ASSERT(ptr5 == ptr2);
-		ASSERT(ptr6 == ptr1);
-		ASSERT(ptr7 == ptr4);
-		ASSERT(ptr8 == ptr3);
-		ASSERT(ptr5->state == VALID);
-		ASSERT(ptr6->state == VALID);
-		ASSERT(ptr7->state == VALID);
-		ASSERT(ptr8->state == VALID);
-		ASSERT(!ptr5->next_free);
-		ASSERT(!ptr6->next_free);
-		ASSERT(!ptr7->next_free);
-		ASSERT(!ptr8->next_free);
-		ASSERT(!ptr5->prev_free);
-		ASSERT(!ptr6->prev_free);
-		ASSERT(!ptr7->prev_free);
-		ASSERT(!ptr8->prev_free);
-		ASSERT(ptr5->size == size1);
-		ASSERT(ptr6->size == size1);
-		ASSERT(ptr7->size == size2);
-		ASSERT(ptr8->size == size2);
+		void *data6 = free_ptr_use(size2);
+		ASSERT(data4 == data2);
+		ASSERT(data5 == data1);
+		ASSERT(data6 == data3);
+		ptr_t *ptr = PTR(data4);
+		ASSERT(ptr->state == VALID);
+		ASSERT(!ptr->next_free);
+		ASSERT(!ptr->prev_free);
+		ASSERT(ptr->size == size1);
+		ASSERT(PTR(data6)->size == size2);
+	}
+	{ // Normal case: split larger block
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data1 = arena_use(size);
+		void *data2 = arena_use(size);
+		void *data3 = arena_use(MIN_ALLOC_SIZE);
+		ASSERT(!ptr_free(data1));
+		ASSERT(!ptr_free(data2));
+		void *data4 = free_ptr_use(SLAB_MAX_SIZE + 1);
+		ASSERT(data4 == data1);
+		ASSERT(ptr_capacity(PTR(data4)) == CLASS_SIZE(SIZE_CLASS(SLAB_MAX_SIZE + 1)));
+		ptr_t *rest = PTR(data4)->next_valid;
+		ASSERT(rest->state == FREE);
+		ASSERT(rest->next_valid == PTR(data3));
+		ASSERT(PTR(data3)->prev_valid == rest);
+		ASSERT(g_free_ptr_tails[FREE_CLASS(ptr_capacity(rest))] == rest);
+		ASSERT(free_ptr_find(ptr_capacity(rest)) == NUM_SIZE_CLASSES);
+		ASSERT(free_ptr_use(CLASS_SIZE(FREE_CLASS(ptr_capacity(rest)))) == rest->data);
 	}
 	{ // size 0
 		ASSERT(!reset());
@@ -291,72 +1624,3627 @@ void test_mmap_use() {
 	}
 }
 
-/** 
- * alloc.c
- * */
+void test_mmap_use_aligned() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t alignments[] = {MIN_ALLOC_SIZE, 256, MMAP_PAGE_SIZE, CHUNK_SIZE};
+		for (size_t i = 0; i < sizeof(alignments) / sizeof(*alignments); i++) {
+			unsigned char *data = mmap_use_aligned(MIN_ALLOC_SIZE, alignments[i]);
+			ASSERT(data);
+			ASSERT(!((uintptr_t)data % alignments[i]));
+			ASSERT(PTR(data)->state == VALID);
+			ASSERT(PTR(data)->size == MIN_ALLOC_SIZE);
+			ASSERT(PTR(data)->data == data);
+			ASSERT(!PTR(data)->arena);
+			data[MIN_ALLOC_SIZE - 1] = 1;
+			ASSERT(!ptr_free(data));
+		}
+	}
+	{ // Normal case: resize
+		ASSERT(!reset());
+		unsigned char *data = mmap_use_aligned(ARENA_SIZE * 2, MMAP_PAGE_SIZE);
+		ASSERT(data);
+		data[ARENA_SIZE * 2 - 1] = 1;
+		data = mmap_resize(data, ARENA_SIZE * 64);
+		ASSERT(data);
+		ASSERT(!((uintptr_t)data % MMAP_PAGE_SIZE));
+		ASSERT(data[ARENA_SIZE * 2 - 1] == 1);
+		data[ARENA_SIZE * 64 - 1] = 2;
+		ASSERT(!ptr_free(data));
+	}
+	{ // size 0
+		ASSERT(!mmap_use_aligned(0, MMAP_PAGE_SIZE));
+	}
+	{ // alignment not a power of two
+		ASSERT(!mmap_use_aligned(MIN_ALLOC_SIZE, 0));
+		ASSERT(!mmap_use_aligned(MIN_ALLOC_SIZE, 96));
+	}
+}
 
-void test_alloc_new() {
+void test_arena_resize() {
+	{ // Normal case: grow last block
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data = arena_use(size);
+		size_t offset = g_arena_tail->offset;
+		ASSERT(!arena_resize(data, size * 2));
+		ASSERT(PTR(data)->size == size * 2);
+		ASSERT(g_arena_tail->offset == offset + ROUNDUP(size));
+	}
+	{ // Normal case: shrink last block
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data = arena_use(size);
+		size_t offset = g_arena_tail->offset;
+		ASSERT(!arena_resize(data, size / 2));
+		ASSERT(PTR(data)->size == size / 2);
+		ASSERT(g_arena_tail->offset == offset - ROUNDUP(size / 2));
+		ASSERT(g_arena_tail->clean >= offset);
+	}
+	{ // Normal case: shrink block in the middle
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data = arena_use(size);
+		ASSERT(arena_use(MIN_ALLOC_SIZE));
+		size_t offset = g_arena_tail->offset;
+		ASSERT(!arena_resize(data, size / 2));
+		ASSERT(PTR(data)->size == size);
+		ASSERT(g_arena_tail->offset == offset);
+	}
+	{ // Block in the middle cannot grow
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data = arena_use(size);
+		ASSERT(arena_use(MIN_ALLOC_SIZE));
+		ASSERT(arena_resize(data, size * 2));
+		ASSERT(PTR(data)->size == size);
+	}
+	{ // Not enough space in arena
+		ASSERT(!reset());
+		void *data = arena_use(SLAB_MAX_SIZE * 2);
+		ASSERT(arena_resize(data, ARENA_SIZE));
+	}
+	{ // Data NULL
+		ASSERT(!reset());
+		ASSERT(arena_resize(NULL, MIN_ALLOC_SIZE));
+	}
+}
+
+void test_mmap_resize() {
 	{ // Normal case
 		ASSERT(!reset());
-		int *data = alloc_new(sizeof(int));
+		unsigned char *data = mmap_use(ARENA_SIZE * 2);
+		ASSERT(data);
+		data[0] = 1;
+		data[ARENA_SIZE * 2 - 1] = 2;
+		data = mmap_resize(data, ARENA_SIZE * 64);
 		ASSERT(data);
+		ASSERT(PTR(data)->size == ARENA_SIZE * 64);
+		ASSERT(PTR(data)->data == data);
+		ASSERT(data[0] == 1);
+		ASSERT(data[ARENA_SIZE * 2 - 1] == 2);
+		data[ARENA_SIZE * 64 - 1] = 3;
+		ASSERT(!ptr_free(data));
 	}
-	{ // Normal case: use free list
+	{ // size too small
 		ASSERT(!reset());
-		int *data = alloc_new(sizeof(int));
-		ASSERT(!g_free_ptr_tails[FREE_PTR_INDEX(sizeof(int))]);
+		void *data = mmap_use(ARENA_SIZE * 2);
+		ASSERT(!mmap_resize(data, MIN_ALLOC_SIZE));
+		ASSERT(!ptr_free(data));
+	}
+	{ // Invalid argument
+		ASSERT(!reset());
+		void *data = arena_use(SLAB_MAX_SIZE * 2);
+		ASSERT(!mmap_resize(data, ARENA_SIZE * 2));
+	}
+}
+
+void test_large_use() {
+	{ // Normal case: page run
+		ASSERT(!reset());
+		void *data = large_use(ARENA_SIZE * 2, NULL);
+		ASSERT(PTR(data)->pages == 3);
+		ASSERT(!ptr_free(data));
+	}
+	{ // Normal case: mapping
+		ASSERT(!reset());
+		bool zero = false;
+		void *data = large_use(MAX_RUN_ALLOC_SIZE * 2, &zero);
+		ASSERT(!PTR(data)->pages);
+		ASSERT(zero);
 		ASSERT(!ptr_free(data));
-		ASSERT(g_free_ptr_tails[FREE_PTR_INDEX(sizeof(int))]);
-		int *data2 = alloc_new(sizeof(int));
+		ASSERT(large_use(MAX_RUN_ALLOC_SIZE * 2, &zero) == data);
+		ASSERT(!zero);
+		ASSERT(STAT_LOAD(g_heap, mmap_calls) == 1);
+		ASSERT(!ptr_free(data));
+	}
+	{ // size too small
+		ASSERT(!reset());
+		ASSERT(!large_use(MIN_ALLOC_SIZE, NULL));
+	}
+}
+
+void test_slab_region_init() {
+	{ // Normal case
+		ASSERT(!slab_region_init());
+		ASSERT(g_slab_region);
+		ASSERT(g_slabs);
+		unsigned char *region = g_slab_region;
+		ASSERT(!slab_region_init());
+		ASSERT(g_slab_region == region);
+	}
+	{ // Normal case: slabs disabled
+		ASSERT(!reset());
+		unsigned char *region = g_slab_region;
+		g_slab_region = NULL;
+		ASSERT(slab_region_init());
+		void *small = alloc_new(MIN_ALLOC_SIZE);
+		void *large = alloc_new(SLAB_MAX_SIZE);
+		void *aligned = alloc_new_aligned(64, 64);
+		void *ptrs[4];
+		ASSERT(small);
+		ASSERT(large);
+		ASSERT(aligned);
+		ASSERT(!((uintptr_t)aligned % 64));
+		ASSERT(!alloc_new_batch(MIN_ALLOC_SIZE, 4, ptrs));
+		alloc_del(small);
+		alloc_del(large);
+		alloc_del(aligned);
+		alloc_del_batch(ptrs, 4);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(!stats.live_bytes);
+		g_slab_region = region;
+		ASSERT(!reset());
+	}
+}
+
+void test_slab_new() {
+	{ // Normal case
+		ASSERT(!reset());
+		slab_t *slab = slab_new(MIN_ALLOC_SIZE / 2);
+		ASSERT(slab);
+		ASSERT(slab->size == MIN_ALLOC_SIZE);
+		ASSERT(slab->capacity == SLAB_SIZE / MIN_ALLOC_SIZE);
+		ASSERT(!slab->used);
+		ASSERT(g_slab_tails[SIZE_CLASS(MIN_ALLOC_SIZE)] == slab);
+		slab_t *slab2 = slab_new(MIN_ALLOC_SIZE);
+		ASSERT(slab2);
+		ASSERT(slab2->prev == slab);
+		ASSERT(slab->next == slab2);
+		ASSERT(g_slab_tails[SIZE_CLASS(MIN_ALLOC_SIZE)] == slab2);
+	}
+	{ // Normal case: node of the thread
+		ASSERT(!reset());
+		g_node = 1;
+		slab_t *slab = slab_new(MIN_ALLOC_SIZE);
+		ASSERT(slab->node == 1);
+		ASSERT(!reset());
+	}
+	{ // Normal case: reuse pooled slab
+		ASSERT(!reset());
+		slab_t *slab = slab_new(MIN_ALLOC_SIZE);
+		ASSERT(slab);
+		slab_unlink(slab);
+		ASSERT(!slab_pool_put(slab));
+		slab_t *slab2 = slab_new(SLAB_MAX_SIZE);
+		ASSERT(slab2 == slab);
+		ASSERT(slab2->size == SLAB_MAX_SIZE);
+		ASSERT(!g_slab_pool);
+		ASSERT(!g_slab_pool_count);
+	}
+	{ // Normal case: reuse shared slab
+		ASSERT(!reset());
+		slab_t *slab = slab_new(MIN_ALLOC_SIZE);
+		slab_unlink(slab);
+		ASSERT(!slab_release(slab));
+		g_node = 1;
+		slab_t *slab2 = slab_new(SLAB_MAX_SIZE);
+		ASSERT(slab2 == slab);
+		ASSERT(slab2->node == 1);
+		ASSERT(!g_slab_free);
+		ASSERT(!atomic_load(&g_slab_free_count));
+		ASSERT(atomic_load(&g_slab_count) == 1);
+		ASSERT(!reset());
+	}
+	{ // Slab region exhausted
+		ASSERT(!reset());
+		atomic_store(&g_slab_count, NUM_SLABS);
+		ASSERT(!slab_new(MIN_ALLOC_SIZE));
+		ASSERT(atomic_load(&g_slab_count) == NUM_SLABS);
+		atomic_store(&g_slab_count, 0);
+	}
+	{ // size 0
+		ASSERT(!reset());
+		ASSERT(!slab_new(0));
+	}
+	{ // size too big
+		ASSERT(!reset());
+		ASSERT(!slab_new(SLAB_MAX_SIZE + 1));
+	}
+}
+
+void test_slab_use() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t size = MIN_ALLOC_SIZE * 3;
+		void *data1 = slab_use(size);
+		void *data2 = slab_use(size);
+		ASSERT(data1);
 		ASSERT(data2);
-		ASSERT(!g_free_ptr_tails[FREE_PTR_INDEX(sizeof(int))]);
-	} 
-	{ // Normal case: use arena
+		ASSERT(IS_SLAB(data1));
+		ASSERT(SLAB(data1) == SLAB(data2));
+		ASSERT((unsigned char*)data2 - (unsigned char*)data1 == (long)size);
+		ASSERT(data1 == SLAB_PAGE(SLAB(data1)));
+		ASSERT(SLAB(data1)->used == 2);
+		ASSERT(SLAB(data1)->size == size);
+	}
+	{ // Normal case: full slab is unlinked
 		ASSERT(!reset());
-		int *data = alloc_new(sizeof(int));
+		void *data = slab_use(SLAB_MAX_SIZE);
 		ASSERT(data);
-		ASSERT(g_arena_tail->ptrs_tail == PTR(data));
+		slab_t *slab = SLAB(data);
+		for (size_t i = 1; i < slab->capacity; i++)
+			ASSERT(slab_use(SLAB_MAX_SIZE));
+		ASSERT(slab->used == slab->capacity);
+		ASSERT(!g_slab_tails[SIZE_CLASS(SLAB_MAX_SIZE)]);
+		void *data2 = slab_use(SLAB_MAX_SIZE);
+		ASSERT(data2);
+		ASSERT(SLAB(data2) != slab);
 	}
-	{ // Normal case: use mmap
+	{ // size 0
 		ASSERT(!reset());
-		typedef struct obj {
-			char buff[ARENA_SIZE * 10];
-		} obj_t;
-		obj_t *obj = alloc_new(sizeof(obj_t));
-		ASSERT(obj);
-		ASSERT(munmap(PTR(obj), TOTAL_SIZE(ARENA_SIZE * 10)) != -1);
+		ASSERT(!slab_use(0));
 	}
-	{ // size is 0
+	{ // size too big
 		ASSERT(!reset());
-		ASSERT(!alloc_new(0));
+		ASSERT(!slab_use(SLAB_MAX_SIZE + 1));
 	}
 }
 
-void test_alloc_del() {
+void test_slab_release() {
 	{ // Normal case
 		ASSERT(!reset());
-		void *data = alloc_new(MIN_ALLOC_SIZE);
-		alloc_del(data);
-		ASSERT(g_free_ptr_tails[FREE_PTR_INDEX(MIN_ALLOC_SIZE)]->data == data);
+		slab_t *slab = SLAB(slab_use(MIN_ALLOC_SIZE));
+		slab_t *slab2 = SLAB(slab_use(SLAB_MAX_SIZE));
+		slab->used = 0;
+		slab2->used = 0;
+		slab_unlink(slab);
+		slab_unlink(slab2);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		size_t madvise_calls = stats.madvise_calls;
+		ASSERT(!slab_release(slab));
+		ASSERT(!slab_release(slab2));
+		ASSERT(g_slab_free == slab2);
+		ASSERT(slab2->next == slab);
+		ASSERT(!slab->size);
+		ASSERT(atomic_load(&g_slab_free_count) == 2);
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(stats.madvise_calls == madvise_calls + 2);
+		ASSERT(!stats.slab_count);
+	}
+	{ // slab NULL
+		ASSERT(slab_release(NULL));
 	}
 }
 
-void test_alloc_resize() {
+void test_slab_pool_put() {
 	{ // Normal case
 		ASSERT(!reset());
-		int *data = alloc_new(sizeof(int));
-		*data = 5;
-		ASSERT(PTR(data)->size == sizeof(int));
-		ASSERT(!alloc_resize((void**)&data, sizeof(int) * 2));
-		ASSERT(PTR(data)->size == sizeof(int) * 2);
-		ASSERT(*data == 5);
+		slab_t *slab = slab_new(MIN_ALLOC_SIZE);
+		slab_unlink(slab);
+		ASSERT(!slab_pool_put(slab));
+		ASSERT(g_slab_pool == slab);
+		ASSERT(g_slab_pool_count == 1);
+		ASSERT(!slab->size);
+		ASSERT(!g_slab_free);
 	}
-	{ // size is 0
-		int x = 5;
-		void *ptr = &x;
+	{ // Normal case: full pool
+		ASSERT(!reset());
+		slab_t *slabs[SLAB_POOL_MAX + 1];
+		for (size_t i = 0; i <= SLAB_POOL_MAX; i++) {
+			slabs[i] = slab_new(MIN_ALLOC_SIZE);
+			slab_unlink(slabs[i]);
+		}
+		for (size_t i = 0; i <= SLAB_POOL_MAX; i++)
+			ASSERT(!slab_pool_put(slabs[i]));
+		ASSERT(g_slab_pool_count == SLAB_POOL_MAX);
+		ASSERT(g_slab_pool == slabs[SLAB_POOL_MAX - 1]);
+		ASSERT(g_slab_free == slabs[SLAB_POOL_MAX]);
+		ASSERT(atomic_load(&g_slab_free_count) == 1);
+	}
+	{ // slab NULL
+		ASSERT(slab_pool_put(NULL));
+	}
+}
+
+void test_slab_pool_flush() {
+	{ // Normal case
+		ASSERT(!reset());
+		slab_t *slab = slab_new(MIN_ALLOC_SIZE);
+		slab_unlink(slab);
+		ASSERT(!slab_pool_put(slab));
+		ASSERT(!slab_pool_flush());
+		ASSERT(!g_slab_pool);
+		ASSERT(!g_slab_pool_count);
+		ASSERT(g_slab_free == slab);
+	}
+	{ // Normal case: empty pool
+		ASSERT(!reset());
+		ASSERT(!slab_pool_flush());
+		ASSERT(!g_slab_free);
+	}
+}
+
+void test_slab_free() {
+	{ // Normal case
+		ASSERT(!reset());
+		void *data1 = slab_use(MIN_ALLOC_SIZE);
+		void *data2 = slab_use(MIN_ALLOC_SIZE);
+		slab_t *slab = SLAB(data1);
+		ASSERT(!slab_free(data1));
+		ASSERT(slab->used == 1);
+		ASSERT(slab->free == data1);
+		ASSERT(slab_use(MIN_ALLOC_SIZE) == data1);
+		ASSERT(!slab_free(data2));
+		ASSERT(!slab_free(data1));
+		ASSERT(!slab->used);
+		ASSERT(g_slab_tails[SIZE_CLASS(MIN_ALLOC_SIZE)] == slab);
+	}
+	{ // Normal case: full slab is relinked
+		ASSERT(!reset());
+		void *data = slab_use(SLAB_MAX_SIZE);
+		slab_t *slab = SLAB(data);
+		for (size_t i = 1; i < slab->capacity; i++)
+			ASSERT(slab_use(SLAB_MAX_SIZE));
+		ASSERT(!g_slab_tails[SIZE_CLASS(SLAB_MAX_SIZE)]);
+		ASSERT(!slab_free(data));
+		ASSERT(g_slab_tails[SIZE_CLASS(SLAB_MAX_SIZE)] == slab);
+	}
+	{ // Normal case: empty slab is moved to the pool
+		ASSERT(!reset());
+		void *data = slab_use(SLAB_MAX_SIZE);
+		slab_t *slab = SLAB(data);
+		for (size_t i = 1; i < slab->capacity; i++)
+			ASSERT(slab_use(SLAB_MAX_SIZE));
+		void *data2 = slab_use(SLAB_MAX_SIZE);
+		ASSERT(SLAB(data2) != slab);
+		ASSERT(!slab_free(data));
+		ASSERT(g_slab_tails[SIZE_CLASS(SLAB_MAX_SIZE)] == slab);
+		ASSERT(!slab_free(data2));
+		ASSERT(g_slab_pool == SLAB(data2));
+		ASSERT(!SLAB(data2)->size);
+		ASSERT(g_slab_tails[SIZE_CLASS(SLAB_MAX_SIZE)] == slab);
+	}
+	{ // Data NULL
+		ASSERT(!reset());
+		ASSERT(slab_free(NULL));
+	}
+	{ // Invalid argument
+		ASSERT(!reset());
+		void *data = slab_use(MIN_ALLOC_SIZE * 2);
+		ASSERT(slab_free((unsigned char*)data + MIN_ALLOC_SIZE));
+		int x = 5;
+		ASSERT(slab_free(&x));
+	}
+}
+
+void test_remote_free_push() {
+	{ // Normal case
+		ASSERT(!reset());
+		heap_t heap = {0};
+		void *data1 = slab_use(MIN_ALLOC_SIZE);
+		void *data2 = slab_use(MIN_ALLOC_SIZE);
+		remote_free_push(&heap, data1);
+		remote_free_push(&heap, data2);
+		ASSERT(atomic_load(&heap.remote_free) == data2);
+		ASSERT(*(void**)data2 == data1);
+		ASSERT(!*(void**)data1);
+	}
+}
+
+void test_remote_free_drain() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data1 = slab_use(MIN_ALLOC_SIZE);
+		void *data2 = arena_use(size);
+		ASSERT(arena_use(MIN_ALLOC_SIZE));
+		PTR(data2)->state = REMOTE;
+		remote_free_push(g_heap, data1);
+		remote_free_push(g_heap, data2);
+		ASSERT(!remote_free_drain());
+		ASSERT(!atomic_load(&g_heap->remote_free));
+		ASSERT(!SLAB(data1)->used);
+		ASSERT(PTR(data2)->state == FREE);
+		ASSERT(g_free_ptr_tails[SIZE_CLASS(size)] == PTR(data2));
+	}
+	{ // Normal case: empty list
+		ASSERT(!reset());
+		ASSERT(!remote_free_drain());
+	}
+}
+
+void test_block_release() {
+	{ // Normal case
+		ASSERT(!reset());
+		void *data1 = slab_use(MIN_ALLOC_SIZE);
+		void *data2 = arena_use(SLAB_MAX_SIZE * 2);
+		PTR(data2)->state = CACHED;
+		ASSERT(!block_release(data1));
+		ASSERT(!block_release(data2));
+		ASSERT(!SLAB(data1)->used);
+		ASSERT(PTR(data2)->state == FREE);
+	}
+	{ // Data NULL
+		ASSERT(block_release(NULL));
+	}
+}
+
+void test_fast_fold() {
+	{ // Normal case
+		ASSERT(!reset());
+		ASSERT(!heap_init());
+		g_prof_bytes = 1000;
+		g_fast.granted = 500;
+		g_fast.budget = 500 - MIN_ALLOC_SIZE * 3;
+		g_fast.counts[0] = 3;
+		fast_fold();
+		ASSERT(g_prof_bytes == 1000 - MIN_ALLOC_SIZE * 3);
+		ASSERT(g_fast.granted == g_fast.budget);
+		ASSERT(!g_fast.counts[0]);
+		ASSERT(STAT_LOAD(g_heap, fast_path) == 3);
+		ASSERT(STAT_LOAD(g_heap, new_bytes) == MIN_ALLOC_SIZE * 3);
+		ASSERT(STAT_LOAD(g_heap, class_new[0]) == 3);
+	}
+	{ // Normal case: nothing handed out
+		ASSERT(!reset());
+		ASSERT(!heap_init());
+		g_prof_bytes = 1000;
+		g_fast.granted = g_fast.budget = 500;
+		fast_fold();
+		ASSERT(g_prof_bytes == 1000);
+		ASSERT(g_fast.budget == 500);
+		ASSERT(!STAT_LOAD(g_heap, fast_path));
+	}
+}
+void test_fast_grant() {
+	{ // Normal case
+		ASSERT(!reset());
+		ASSERT(!heap_init());
+		g_prof_bytes = INT64_MAX;
+		fast_grant();
+		ASSERT(g_fast.budget == FAST_BUDGET);
+		ASSERT(g_fast.granted == FAST_BUDGET);
+	}
+	{ // Normal case: next sample is close
+		ASSERT(!reset());
+		ASSERT(!heap_init());
+		g_prof_bytes = 100;
+		fast_grant();
+		ASSERT(g_fast.budget == 100);
+		g_prof_bytes = -1;
+		fast_grant();
+		ASSERT(!g_fast.budget);
+	}
+#ifdef ALLOC_DEBUG
+	{ // Normal case: debug mode
+		ASSERT(!reset());
+		ASSERT(!heap_init());
+		g_prof_bytes = INT64_MAX;
+		atomic_store(&g_debug, DEBUG_CANARY);
+		fast_grant();
+		ASSERT(!g_fast.budget);
+		ASSERT(!reset());
+	}
+#endif
+#ifdef ALLOC_TRACE
+	{ // Normal case: tracing
+		ASSERT(!reset());
+		ASSERT(!heap_init());
+		g_prof_bytes = INT64_MAX;
+		atomic_store(&g_trace_on, true);
+		fast_grant();
+		ASSERT(!g_fast.budget);
+		atomic_store(&g_trace_on, false);
+	}
+#endif
+}
+void test_fast_revoke() {
+	{ // Normal case
+		ASSERT(!reset());
+		ASSERT(!heap_init());
+		g_fast.granted = 500;
+		g_fast.budget = 500 - MIN_ALLOC_SIZE;
+		g_fast.counts[0] = 1;
+		fast_revoke();
+		ASSERT(!g_fast.budget);
+		ASSERT(!g_fast.granted);
+		ASSERT(!g_fast.counts[0]);
+		ASSERT(STAT_LOAD(g_heap, fast_path) == 1);
+	}
+}
+void test_heap_exit() {
+	{ // Normal case
+		ASSERT(!reset());
+		void *live = alloc_new(SLAB_MAX_SIZE * 2);
+		void *cached = alloc_new(MIN_ALLOC_SIZE);
+		alloc_del(cached);
+		heap_t *heap = g_heap;
+		heap_exit(heap);
+		ASSERT(!g_heap);
+		ASSERT(!g_arena_tail);
+		ASSERT(!g_chunks);
+		ASSERT(g_orphans == heap);
+		ASSERT(heap->arenas == PTR(live)->arena);
+		ASSERT(heap->arena_tail == PTR(live)->arena);
+		ASSERT(!g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE)].head);
+		ASSERT(!SLAB(cached)->used);
+		ASSERT(g_slab_free == SLAB(cached));
+		ASSERT(!g_slab_pool);
+		ASSERT(!heap->dirty_head);
+		ASSERT(!heap_init());
+		ASSERT(g_heap == heap);
+		alloc_del(live);
+	}
+	{ // Normal case: free blocks of alloc_new_fast()
+		ASSERT(!reset());
+		alloc_fast_t *fast = alloc_fast_get();
+		alloc_del(alloc_new_fast(fast, MIN_ALLOC_SIZE));
+		void *data = alloc_new_fast(fast, MIN_ALLOC_SIZE);
+		ASSERT(g_fast.heads[SIZE_CLASS(MIN_ALLOC_SIZE)]);
+		heap_t *heap = g_heap;
+		heap_exit(heap);
+		ASSERT(!g_fast.heads[SIZE_CLASS(MIN_ALLOC_SIZE)]);
+		ASSERT(!g_fast.budget);
+		ASSERT(SLAB(data)->used == 1);
+		ASSERT(STAT_LOAD(heap, fast_path) == 1);
+		ASSERT(!heap_init());
+		alloc_del(data);
+	}
+	{ // Normal case: empty arena
+		ASSERT(!reset());
+		void *data = arena_use(SLAB_MAX_SIZE * 2);
+		arena_t *arena = PTR(data)->arena;
+		size_t i = CHUNK_PAGE_INDEX(arena);
+		ASSERT(!ptr_free(data));
+		heap_t *heap = g_heap;
+		heap_exit(heap);
+		ASSERT(!heap->arenas);
+		ASSERT(CHUNK(arena)->free_pages[i / 64] & (1LLU << (i % 64)));
+		ASSERT(heap->chunk_free_pages);
+		ASSERT(!heap->dirty_head);
+		ASSERT(!heap_init());
+	}
+	{ // Heap of another thread
+		ASSERT(!reset());
+		heap_t *heap = g_heap;
+		heap_t other = {0};
+		heap_exit(&other);
+		heap_exit(NULL);
+		ASSERT(g_heap == heap);
+		ASSERT(!g_orphans);
+	}
+}
+
+void test_heap_adopt() {
+	{ // Normal case
+		ASSERT(!reset());
+		void *data = arena_use(SLAB_MAX_SIZE * 2);
+		heap_t *heap = g_heap;
+		heap_exit(heap);
+		pthread_mutex_lock(&g_heap_mutex);
+		ASSERT(heap_adopt() == heap);
+		pthread_mutex_unlock(&g_heap_mutex);
+		g_heap = heap;
+		ASSERT(!g_orphans);
+		ASSERT(g_arena_head.next == PTR(data)->arena);
+		ASSERT(PTR(data)->arena->prev == &g_arena_head);
+		ASSERT(g_arena_tail == PTR(data)->arena);
+		ASSERT(g_chunks == heap->chunks);
+		ASSERT(!ptr_free(data));
+	}
+	{ // Normal case: no orphan
+		ASSERT(!reset());
+		pthread_mutex_lock(&g_heap_mutex);
+		ASSERT(!heap_adopt());
+		pthread_mutex_unlock(&g_heap_mutex);
+	}
+}
+
+#define ORPHAN_BLOCKS 24
+
+static void *orphan_thread(void *arg) {
+	void **ptrs = arg;
+	size_t sizes[] = {MIN_ALLOC_SIZE, SLAB_MAX_SIZE * 2, ARENA_SIZE * 8};
+	for (size_t i = 0; i < ORPHAN_BLOCKS; i++)
+		ptrs[i] = alloc_new(sizes[i % 3]);
+	return NULL;
+}
+
+void test_orphan_drain() {
+	{ // Normal case
+		ASSERT(!reset());
+		void *ptrs[ORPHAN_BLOCKS];
+		pthread_t thread;
+		ASSERT(!pthread_create(&thread, NULL, orphan_thread, ptrs));
+		ASSERT(!pthread_join(thread, NULL));
+		heap_t *heap = g_orphans;
+		ASSERT(heap);
+		for (size_t i = 0; i < ORPHAN_BLOCKS; i++) {
+			ASSERT(ptrs[i]);
+			alloc_del(ptrs[i]);
+		}
+		ASSERT(atomic_load(&heap->remote_free));
+		heap_t *self = g_heap;
+		arena_t *tail = g_arena_tail;
+		chunk_t *chunks = g_chunks;
+		pthread_mutex_lock(&g_heap_mutex);
+		ASSERT(!orphan_drain());
+		pthread_mutex_unlock(&g_heap_mutex);
+		ASSERT(!atomic_load(&heap->remote_free));
+		ASSERT(g_orphans == heap);
+		ASSERT(g_heap == self);
+		ASSERT(g_arena_head.owner == self);
+		ASSERT(g_arena_tail == tail);
+		ASSERT(g_chunks == chunks);
+	}
+	{ // Normal case: no remote frees
+		ASSERT(!reset());
+		heap_t *self = g_heap;
+		pthread_mutex_lock(&g_heap_mutex);
+		ASSERT(!orphan_drain());
+		pthread_mutex_unlock(&g_heap_mutex);
+		ASSERT(g_heap == self);
+	}
+}
+
+static size_t rss() {
+	size_t pages = 0;
+	size_t resident = 0;
+	FILE *file = fopen("/proc/self/statm", "r");
+	if (!file) return 0;
+	if (fscanf(file, "%zu %zu", &pages, &resident) != 2) resident = 0;
+	fclose(file);
+	return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+#define CHURN_THREADS 4096
+
+static void *del_thread(void *arg) {
+	alloc_del(arg);
+	return NULL;
+}
+
+static void *churn_thread(void *arg) {
+	void *small = alloc_new(MIN_ALLOC_SIZE);
+	void *large = alloc_new(SLAB_MAX_SIZE * 2);
+	*(void**)arg = alloc_new(SLAB_MAX_SIZE * 4);
+	alloc_del(small);
+	alloc_del(large);
+	return NULL;
+}
+
+void test_heap_init() {
+	{ // Normal case: orphan adopted
+		ASSERT(!reset());
+		void *data = NULL;
+		pthread_t thread;
+		ASSERT(!pthread_create(&thread, NULL, churn_thread, &data));
+		ASSERT(!pthread_join(thread, NULL));
+		heap_t *heap = PTR(data)->arena->owner;
+		ASSERT(g_orphans == heap);
+		ASSERT(!pthread_create(&thread, NULL, del_thread, data));
+		ASSERT(!pthread_join(thread, NULL));
+		ASSERT(g_orphans == heap);
+		ASSERT(!heap->arenas);
+	}
+	{ // Normal case: thread churn
+		ASSERT(!reset());
+		size_t base = 0;
+		size_t heaps = 0;
+		for (size_t i = 0; i < CHURN_THREADS; i++) {
+			void *data = NULL;
+			pthread_t thread;
+			ASSERT(!pthread_create(&thread, NULL, churn_thread, &data));
+			ASSERT(!pthread_join(thread, NULL));
+			alloc_del(data);
+			if (i != CHURN_THREADS / 8) continue;
+			base = rss();
+			heaps = g_heap_count;
+		}
+		ASSERT(g_heap_count == heaps);
+		ASSERT(rss() < base + ARENA_SIZE * 64);
+	}
+}
+
+void test_central_push() {
+	{ // Normal case
+		ASSERT(!reset());
+		central_t central = {0};
+		void *data1 = slab_use(MIN_ALLOC_SIZE);
+		void *data2 = slab_use(MIN_ALLOC_SIZE);
+		void *data3 = slab_use(MIN_ALLOC_SIZE);
+		*(void**)data1 = data2;
+		ASSERT(!central_push(&central, data1, data2, 2));
+		ASSERT(CENTRAL_PTR(central.head) == data1);
+		ASSERT(!*(void**)data2);
+		ASSERT(!NEXT_BATCH(data1));
+		ASSERT(central.count == 2);
+		uint64_t head = central.head;
+		ASSERT(!central_push(&central, data3, data3, 1));
+		ASSERT(CENTRAL_PTR(central.head) == data3);
+		ASSERT(NEXT_BATCH(data3) == data1);
+		ASSERT(central.head >> CENTRAL_TAG_SHIFT == (head >> CENTRAL_TAG_SHIFT) + 1);
+		ASSERT(central.count == 3);
+	}
+	{ // Invalid argument
+		central_t central = {0};
+		ASSERT(central_push(NULL, &central, &central, 1));
+		ASSERT(central_push(&central, NULL, NULL, 0));
+	}
+	{ // Block above the range of the tagged head
+		central_t central = {0};
+		void *data = (void*)((uintptr_t)1 << CENTRAL_TAG_SHIFT);
+		ASSERT(central_push(&central, data, data, 1));
+		ASSERT(!central.head);
+		ASSERT(!central.count);
+		ASSERT(CENTRAL_FITS(g_slab_region, SLAB_REGION_SIZE));
+	}
+}
+
+#define STRESS_THREADS 8
+#define STRESS_ROUNDS 20000
+#define STRESS_BATCHES 64
+#define STRESS_BATCH 4
+
+static void *central_thread(void *arg) {
+	central_t *central = arg;
+	for (size_t r = 0; r < STRESS_ROUNDS; r++) {
+		void *tail;
+		size_t count;
+		void *head = central_pop(central, &tail, &count);
+		if (!head) {
+			sched_yield();
+			continue;
+		}
+		if (r % 16 == 0) sched_yield();
+		if (central_push(central, head, tail, count)) return arg;
+	}
+	return NULL;
+}
+
+void test_central_pop() {
+	{ // Normal case
+		ASSERT(!reset());
+		central_t central = {0};
+		void *data1 = slab_use(MIN_ALLOC_SIZE);
+		void *data2 = slab_use(MIN_ALLOC_SIZE);
+		void *data3 = slab_use(MIN_ALLOC_SIZE);
+		*(void**)data1 = data2;
+		ASSERT(!central_push(&central, data1, data2, 2));
+		ASSERT(!central_push(&central, data3, data3, 1));
+		void *tail = NULL;
+		size_t count = 0;
+		ASSERT(central_pop(&central, &tail, &count) == data3);
+		ASSERT(tail == data3);
+		ASSERT(count == 1);
+		ASSERT(central_pop(&central, &tail, &count) == data1);
+		ASSERT(tail == data2);
+		ASSERT(count == 2);
+		ASSERT(!central.count);
+		ASSERT(!CENTRAL_PTR(central.head));
+		ASSERT(central.head >> CENTRAL_TAG_SHIFT == 4);
+		ASSERT(!central_pop(&central, &tail, &count));
+	}
+	{ // Normal case: many threads
+		ASSERT(!reset());
+		static void *blocks[STRESS_BATCHES * STRESS_BATCH];
+		central_t central = {0};
+		for (size_t b = 0; b < STRESS_BATCHES; b++) {
+			void *head = NULL;
+			void *tail = NULL;
+			for (size_t j = 0; j < STRESS_BATCH; j++) {
+				void *data = slab_use(MIN_ALLOC_SIZE);
+				*(void**)data = head;
+				if (!head) tail = data;
+				head = data;
+			}
+			ASSERT(!central_push(&central, head, tail, STRESS_BATCH));
+		}
+		pthread_t threads[STRESS_THREADS];
+		for (size_t t = 0; t < STRESS_THREADS; t++)
+			ASSERT(!pthread_create(&threads[t], NULL, central_thread, &central));
+		for (size_t t = 0; t < STRESS_THREADS; t++) {
+			void *ret = &central;
+			ASSERT(!pthread_join(threads[t], &ret));
+			ASSERT(!ret);
+		}
+		ASSERT(central.count == STRESS_BATCHES * STRESS_BATCH);
+		size_t n = 0;
+		void *tail;
+		size_t count;
+		for (void *head; (head = central_pop(&central, &tail, &count));) {
+			ASSERT(count == STRESS_BATCH);
+			for (void *data = head; data && n < STRESS_BATCHES * STRESS_BATCH; data = *(void**)data)
+				blocks[n++] = data;
+		}
+		ASSERT(n == STRESS_BATCHES * STRESS_BATCH);
+		bool unique = true;
+		for (size_t j = 0; j < n; j++)
+			for (size_t k = j + 1; k < n; k++)
+				if (blocks[j] == blocks[k]) unique = false;
+		ASSERT(unique);
+		ASSERT(!central.count);
+	}
+}
+
+static void central_fill(size_t node, size_t i, void *data) {
+	*(void**)data = NULL;
+	ASSERT(!central_push(&g_central[node][i], data, data, 1));
+}
+
+void test_central_refill() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		void *head = NULL;
+		void *tail = NULL;
+		for (size_t j = 0; j < TCACHE_BATCH; j++) {
+			void *data = slab_use(MIN_ALLOC_SIZE);
+			*(void**)data = head;
+			if (!head) tail = data;
+			head = data;
+		}
+		ASSERT(!central_push(&g_central[0][i], head, tail, TCACHE_BATCH));
+		central_fill(0, i, slab_use(MIN_ALLOC_SIZE));
+		ASSERT(central_refill(i) == 1);
+		ASSERT(g_tcache[i].count == 1);
+		ASSERT(g_central[0][i].count == TCACHE_BATCH);
+		ASSERT(central_refill(i) == TCACHE_BATCH);
+		ASSERT(g_tcache[i].count == TCACHE_BATCH + 1);
+		ASSERT(g_tcache[i].head == head);
+		ASSERT(!CENTRAL_PTR(g_central[0][i].head));
+		ASSERT(!central_refill(i));
+	}
+	{ // Normal case: central free list of the node of the thread
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		void *data = slab_use(MIN_ALLOC_SIZE);
+		central_fill(1, i, data);
+		ASSERT(!central_refill(i));
+		g_node = 1;
+		ASSERT(central_refill(i) == 1);
+		ASSERT(g_tcache[i].head == data);
+		ASSERT(!reset());
+	}
+}
+
+void test_central_flush() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		for (size_t j = 0; j < TCACHE_BATCH + 1; j++)
+			ASSERT(!tcache_free(slab_use(MIN_ALLOC_SIZE)));
+		ASSERT(!central_flush(i));
+		ASSERT(g_tcache[i].count == 1);
+		ASSERT(g_central[0][i].count == TCACHE_BATCH);
+		ASSERT(!central_flush(i));
+		ASSERT(!g_tcache[i].head);
+		ASSERT(g_central[0][i].count == TCACHE_BATCH + 1);
+	}
+	{ // Normal case: central free list full
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		void *data = slab_use(MIN_ALLOC_SIZE);
+		ASSERT(!tcache_free(data));
+		g_central[0][i].count = CENTRAL_MAX;
+		ASSERT(!central_flush(i));
+		ASSERT(!g_tcache[i].head);
+		ASSERT(!CENTRAL_PTR(g_central[0][i].head));
+		ASSERT(!SLAB(data)->used);
+	}
+}
+
+void test_tcache_use() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data = arena_use(size);
+		ASSERT(!tcache_free(data));
+		ASSERT(tcache_use(size - MIN_ALLOC_SIZE) == data);
+		ASSERT(PTR(data)->state == VALID);
+		ASSERT(PTR(data)->size == size - MIN_ALLOC_SIZE);
+		ASSERT(!g_tcache[SIZE_CLASS(size)].count);
+	}
+	{ // Normal case: refill from central free list
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		void *data = slab_use(MIN_ALLOC_SIZE);
+		central_fill(0, i, data);
+		ASSERT(tcache_use(MIN_ALLOC_SIZE) == data);
+		ASSERT(!g_central[0][i].count);
+	}
+	{ // Empty cache
+		ASSERT(!reset());
+		ASSERT(!tcache_use(MIN_ALLOC_SIZE));
+	}
+	{ // size 0
+		ASSERT(!tcache_use(0));
+	}
+	{ // size too big
+		ASSERT(!tcache_use(MAX_ARENA_ALLOC_SIZE + 1));
+	}
+}
+
+void test_tcache_free() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		void *data1 = slab_use(MIN_ALLOC_SIZE);
+		void *data2 = slab_use(MIN_ALLOC_SIZE);
+		ASSERT(!tcache_free(data1));
+		ASSERT(!tcache_free(data2));
+		ASSERT(g_tcache[i].head == data2);
+		ASSERT(*(void**)data2 == data1);
+		ASSERT(g_tcache[i].count == 2);
+	}
+	{ // Normal case: flush full cache
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		for (size_t j = 0; j < TCACHE_MAX + 1; j++)
+			ASSERT(!tcache_free(slab_use(MIN_ALLOC_SIZE)));
+		ASSERT(g_tcache[i].count == TCACHE_MAX + 1 - TCACHE_BATCH);
+		ASSERT(g_central[0][i].count == TCACHE_BATCH);
+	}
+	{ // Normal case: munmap
+		ASSERT(!reset());
+		void *data = mmap_use(ARENA_SIZE * 2);
+		ASSERT(!tcache_free(data));
+	}
+	{ // Normal case: small arena block
+		ASSERT(!reset());
+		void *data = arena_use(MIN_ALLOC_SIZE);
+		ASSERT(arena_use(MIN_ALLOC_SIZE));
+		ASSERT(!tcache_free(data));
+		ASSERT(!g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE)].head);
+		ASSERT(PTR(data)->state == FREE);
+	}
+	{ // Normal case: block on another node
+		ASSERT(!reset());
+		g_numa_nodes = 2;
+		g_numa_fake = true;
+		void *data = slab_use(MIN_ALLOC_SIZE);
+		g_node = 1;
+		ASSERT(!tcache_free(data));
+		ASSERT(!g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE)].head);
+		ASSERT(!SLAB(data)->used);
+		ASSERT(!reset());
+	}
+	{ // Double free of a slab block
+		ASSERT(!reset());
+		void *data = slab_use(MIN_ALLOC_SIZE);
+		ASSERT(!tcache_free(data));
+		ASSERT(tcache_free(data));
+		ASSERT(g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE)].count == 1);
+	}
+	{ // Invalid argument
+		ASSERT(!reset());
+		void *data = arena_use(SLAB_MAX_SIZE * 2);
+		ASSERT(!tcache_free(data));
+		ASSERT(tcache_free(data));
+		ASSERT(tcache_free(NULL));
+	}
+}
+void test_tcache_free_sized() {
+	{ // Normal case
+		ASSERT(!reset());
+		void *data = slab_use(MIN_ALLOC_SIZE * 3);
+		ASSERT(!tcache_free_sized(data, MIN_ALLOC_SIZE * 3 - 1));
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE * 3);
+		ASSERT(g_tcache[i].head == data);
+		ASSERT(g_tcache[i].count == 1);
+	}
+	{ // Normal case: flush full cache
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		for (size_t j = 0; j < TCACHE_MAX + 1; j++)
+			ASSERT(!tcache_free_sized(slab_use(MIN_ALLOC_SIZE), MIN_ALLOC_SIZE));
+		ASSERT(g_tcache[i].count == TCACHE_MAX + 1 - TCACHE_BATCH);
+		ASSERT(g_central[0][i].count == TCACHE_BATCH);
+	}
+	{ // Normal case: block on another node
+		ASSERT(!reset());
+		g_numa_nodes = 2;
+		g_numa_fake = true;
+		void *data = slab_use(MIN_ALLOC_SIZE);
+		g_node = 1;
+		ASSERT(!tcache_free_sized(data, MIN_ALLOC_SIZE));
+		ASSERT(!g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE)].head);
+		ASSERT(!SLAB(data)->used);
+		ASSERT(!reset());
+	}
+	{ // Double free
+		ASSERT(!reset());
+		void *data = slab_use(MIN_ALLOC_SIZE);
+		ASSERT(!tcache_free_sized(data, MIN_ALLOC_SIZE));
+		ASSERT(tcache_free_sized(data, MIN_ALLOC_SIZE));
+		ASSERT(g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE)].count == 1);
+	}
+	{ // Invalid argument
+		ASSERT(!reset());
+		void *data = arena_use(SLAB_MAX_SIZE * 2);
+		ASSERT(tcache_free_sized(data, SLAB_MAX_SIZE * 2));
+		ASSERT(tcache_free_sized(slab_use(MIN_ALLOC_SIZE), 0));
+		ASSERT(tcache_free_sized(slab_use(MIN_ALLOC_SIZE), SLAB_MAX_SIZE + 1));
+		ASSERT(tcache_free_sized(NULL, MIN_ALLOC_SIZE));
+	}
+}
+
+/** 
+ * alloc.c
+ * */
+
+void test_tcache_use_batch() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		void *data[3];
+		for (size_t j = 0; j < 3; j++) data[j] = slab_use(MIN_ALLOC_SIZE);
+		for (size_t j = 0; j < 3; j++) ASSERT(!tcache_free(data[j]));
+		void *ptrs[4] = {0};
+		ASSERT(tcache_use_batch(MIN_ALLOC_SIZE, 4, ptrs) == 3);
+		ASSERT(ptrs[0] == data[2]);
+		ASSERT(ptrs[2] == data[0]);
+		ASSERT(!g_tcache[i].count);
+	}
+	{ // Normal case: arena blocks
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data = arena_use(size);
+		ASSERT(!tcache_free(data));
+		void *ptrs[1] = {0};
+		ASSERT(tcache_use_batch(size - MIN_ALLOC_SIZE, 1, ptrs) == 1);
+		ASSERT(ptrs[0] == data);
+		ASSERT(PTR(data)->state == VALID);
+		ASSERT(PTR(data)->size == size - MIN_ALLOC_SIZE);
+	}
+	{ // Normal case: refill from central free list
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		void *data = slab_use(MIN_ALLOC_SIZE);
+		central_fill(0, i, data);
+		void *ptrs[2] = {0};
+		ASSERT(tcache_use_batch(MIN_ALLOC_SIZE, 2, ptrs) == 1);
+		ASSERT(ptrs[0] == data);
+	}
+}
+
+void test_slab_use_batch() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t capacity = SLAB_SIZE / MIN_ALLOC_SIZE;
+		void *ptrs[SLAB_SIZE / MIN_ALLOC_SIZE + 2] = {0};
+		ASSERT(slab_use_batch(MIN_ALLOC_SIZE, capacity + 2, ptrs) == capacity + 2);
+		for (size_t j = 1; j < capacity; j++)
+			ASSERT((unsigned char*)ptrs[j] == (unsigned char*)ptrs[j - 1] + MIN_ALLOC_SIZE);
+		ASSERT(SLAB(ptrs[0])->used == capacity);
+		ASSERT(SLAB(ptrs[capacity])->used == 2);
+		ASSERT(SLAB(ptrs[0]) != SLAB(ptrs[capacity]));
+		ASSERT(g_slab_tails[SIZE_CLASS(MIN_ALLOC_SIZE)] == SLAB(ptrs[capacity]));
+	}
+	{ // Normal case: free slots first
+		ASSERT(!reset());
+		void *data = slab_use(MIN_ALLOC_SIZE);
+		void *next = slab_use(MIN_ALLOC_SIZE);
+		ASSERT(!slab_free(data));
+		void *ptrs[2] = {0};
+		ASSERT(slab_use_batch(MIN_ALLOC_SIZE, 2, ptrs) == 2);
+		ASSERT(ptrs[0] == data);
+		ASSERT((unsigned char*)ptrs[1] == (unsigned char*)next + MIN_ALLOC_SIZE);
+	}
+}
+
+void test_fast_stash() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		void *cached = slab_use(MIN_ALLOC_SIZE);
+		ASSERT(!tcache_free(cached));
+		fast_stash(i);
+		ASSERT(g_fast.heads[i] == cached);
+		ASSERT(!g_tcache[i].head);
+		size_t n = 0;
+		for (void *data = g_fast.heads[i]; data; data = *(void**)data) {
+			ASSERT(IS_SLAB(data));
+			ASSERT(SLAB(data)->size == MIN_ALLOC_SIZE);
+			n++;
+		}
+		ASSERT(n == FAST_BATCH);
+	}
+	{ // Normal case: arena blocks shrunk into the size class
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		for (size_t j = 0; j < FAST_BATCH; j++) {
+			void *data = alloc_new(SLAB_MAX_SIZE * 2);
+			ASSERT(!alloc_resize(&data, MIN_ALLOC_SIZE));
+			alloc_del(data);
+		}
+		fast_stash(i);
+		for (void *data = g_fast.heads[i]; data; data = *(void**)data)
+			ASSERT(IS_SLAB(data));
+		alloc_fast_t *fast = alloc_fast_get();
+		void *ptrs[FAST_BATCH];
+		for (size_t j = 0; j < FAST_BATCH; j++)
+			ASSERT((ptrs[j] = alloc_new_fast(fast, MIN_ALLOC_SIZE)));
+		for (size_t j = 0; j < FAST_BATCH; j++) alloc_del(ptrs[j]);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(!stats.live_bytes);
+		ASSERT(!stats.header_bytes);
+	}
+	{ // Normal case: blocks left
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		void *data = slab_use(MIN_ALLOC_SIZE);
+		*(void**)data = NULL;
+		g_fast.heads[i] = data;
+		fast_stash(i);
+		ASSERT(g_fast.heads[i] == data);
+		ASSERT(!*(void**)data);
+	}
+	{ // Class out of range
+		ASSERT(!reset());
+		fast_stash(ALLOC_FAST_CLASSES);
+		ASSERT(!g_tcache[ALLOC_FAST_CLASSES].head);
+	}
+}
+
+void test_tcache_push() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		void *head = slab_use(MIN_ALLOC_SIZE);
+		void *tail = slab_use(MIN_ALLOC_SIZE);
+		*(void**)head = tail;
+		ASSERT(!tcache_push(i, head, tail, 2));
+		ASSERT(g_tcache[i].head == head);
+		ASSERT(!*(void**)tail);
+		ASSERT(g_tcache[i].count == 2);
+	}
+	{ // Normal case: flush
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		void *head = NULL;
+		void *tail = NULL;
+		for (size_t j = 0; j < TCACHE_MAX + TCACHE_BATCH + 1; j++) {
+			void *data = slab_use(MIN_ALLOC_SIZE);
+			*(void**)data = head;
+			if (!head) tail = data;
+			head = data;
+		}
+		ASSERT(!tcache_push(i, head, tail, TCACHE_MAX + TCACHE_BATCH + 1));
+		ASSERT(g_tcache[i].count <= TCACHE_MAX);
+		ASSERT(g_central[0][i].count == TCACHE_BATCH * 2);
+	}
+	{ // Invalid argument
+		ASSERT(tcache_push(0, NULL, NULL, 0));
+	}
+}
+
+void test_tcache_free_batch() {
+	{ // Normal case
+		ASSERT(!reset());
+		void *ptrs[5];
+		ptrs[0] = slab_use(MIN_ALLOC_SIZE);
+		ptrs[1] = slab_use(MIN_ALLOC_SIZE);
+		ptrs[2] = arena_use(SLAB_MAX_SIZE * 2);
+		ptrs[3] = mmap_use(ARENA_SIZE * 2);
+		ptrs[4] = slab_use(MIN_ALLOC_SIZE);
+		ASSERT(!tcache_free_batch(ptrs, 5));
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE);
+		ASSERT(g_tcache[i].count == 3);
+		ASSERT(g_tcache[i].head == ptrs[4]);
+		ASSERT(*(void**)ptrs[4] == ptrs[1]);
+		ASSERT(*(void**)ptrs[1] == ptrs[0]);
+		ASSERT(g_tcache[SIZE_CLASS(SLAB_MAX_SIZE * 2)].head == ptrs[2]);
+		ASSERT(PTR(ptrs[2])->state == CACHED);
+	}
+	{ // Normal case: small arena blocks
+		ASSERT(!reset());
+		void *ptrs[2];
+		ptrs[0] = arena_use(MIN_ALLOC_SIZE);
+		ptrs[1] = arena_use(SLAB_MAX_SIZE);
+		ASSERT(arena_use(MIN_ALLOC_SIZE));
+		ASSERT(!tcache_free_batch(ptrs, 2));
+		ASSERT(!g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE)].head);
+		ASSERT(!g_tcache[SIZE_CLASS(SLAB_MAX_SIZE)].head);
+		ASSERT(PTR(ptrs[0])->state == FREE);
+	}
+	{ // Invalid argument
+		ASSERT(!reset());
+		void *data = slab_use(MIN_ALLOC_SIZE);
+		void *ptrs[2] = {NULL, data};
+		ASSERT(tcache_free_batch(ptrs, 2));
+		ASSERT(g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE)].head == data);
+	}
+	{ // Double free of a slab block
+		ASSERT(!reset());
+		void *data = slab_use(MIN_ALLOC_SIZE);
+		void *ptrs[2] = {data, data};
+		ASSERT(tcache_free_batch(ptrs, 2));
+		ASSERT(g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE)].count == 1);
+		ASSERT(tcache_free_batch(ptrs, 1));
+		ASSERT(g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE)].count == 1);
+	}
+	{ // ptrs NULL
+		ASSERT(tcache_free_batch(NULL, 1));
+	}
+}
+
+void test_fork_prepare() {
+	{ // Normal case
+		ASSERT(!reset());
+		fork_prepare();
+		ASSERT(pthread_mutex_trylock(&g_heap_mutex));
+		ASSERT(pthread_mutex_trylock(&g_heap->dirty_mutex));
+		ASSERT(pthread_mutex_trylock(&g_decay_mutex));
+		ASSERT(pthread_mutex_trylock(&g_config_mutex));
+		fork_parent();
+	}
+}
+
+void test_fork_parent() {
+	{ // Normal case
+		fork_prepare();
+		fork_parent();
+		ASSERT(!pthread_mutex_trylock(&g_heap_mutex));
+		pthread_mutex_unlock(&g_heap_mutex);
+	}
+}
+
+void test_fork_child() {
+	{ // Normal case
+		pthread_mutex_lock(&g_heap_mutex);
+		fork_child();
+		ASSERT(!pthread_mutex_trylock(&g_heap_mutex));
+		pthread_mutex_unlock(&g_heap_mutex);
+	}
+	{ // Normal case: decay thread stopped in child
+		ASSERT(!decay_start());
+		pid_t pid = fork();
+		if (!pid) _exit(g_decay_running || decay_start() || decay_stop());
+		int status = 1;
+		ASSERT(waitpid(pid, &status, 0) == pid);
+		ASSERT(WIFEXITED(status) && !WEXITSTATUS(status));
+		ASSERT(!decay_stop());
+	}
+#ifdef ALLOC_TRACE
+	{ // Normal case: trace stopped in child
+		ASSERT(!trace_start("/dev/null"));
+		pid_t pid = fork();
+		if (!pid) _exit(g_trace_running || atomic_load(&g_trace_on));
+		int status = 1;
+		ASSERT(waitpid(pid, &status, 0) == pid);
+		ASSERT(WIFEXITED(status) && !WEXITSTATUS(status));
+		ASSERT(!trace_stop());
+	}
+#endif
+	{ // Normal case: handlers registered for fork()
+		pid_t pid = fork();
+		if (!pid) {
+			int ret = pthread_mutex_trylock(&g_heap_mutex);
+#ifdef ALLOC_DEBUG
+			ret = ret || pthread_mutex_trylock(&g_debug_mutex);
+#endif
+			_exit(ret);
+		}
+		int status = 1;
+		ASSERT(waitpid(pid, &status, 0) == pid);
+		ASSERT(WIFEXITED(status) && !WEXITSTATUS(status));
+	}
+	{ // Normal case: allocate in child
+		void *data = alloc_new(MIN_ALLOC_SIZE);
+		pid_t pid = fork();
+		if (!pid) {
+			alloc_del(data);
+			_exit(!alloc_new(MIN_ALLOC_SIZE) || !alloc_new(SLAB_MAX_SIZE * 2));
+		}
+		int status = 1;
+		ASSERT(waitpid(pid, &status, 0) == pid);
+		ASSERT(WIFEXITED(status) && !WEXITSTATUS(status));
+		alloc_del(data);
+	}
+}
+
+void test_block_node() {
+	{ // Normal case
+		ASSERT(!reset());
+		g_node = 1;
+		void *slab = slab_use(MIN_ALLOC_SIZE);
+		void *arena = arena_use(SLAB_MAX_SIZE * 2);
+		ASSERT(block_node(slab) == 1);
+		ASSERT(block_node(arena) == 1);
+		ASSERT(!reset());
+	}
+}
+
+void test_block_size() {
+	{ // Normal case: slab
+		ASSERT(!reset());
+		void *data = slab_use(MIN_ALLOC_SIZE + 1);
+		ASSERT(block_size(data) == MIN_ALLOC_SIZE * 2);
+	}
+	{ // Normal case: arena
+		ASSERT(!reset());
+		void *data = arena_use(SLAB_MAX_SIZE * 2);
+		ASSERT(block_size(data) == SLAB_MAX_SIZE * 2);
+	}
+}
+
+void test_stats_new() {
+	{ // Normal case
+		ASSERT(!reset());
+		stats_new(MIN_ALLOC_SIZE, false, 1);
+		stats_new(SLAB_MAX_SIZE * 2, true, 1);
+		ASSERT(STAT_LOAD(g_heap, new_bytes) == MIN_ALLOC_SIZE + SLAB_MAX_SIZE * 2);
+		ASSERT(STAT_LOAD(g_heap, ptr_new) == 1);
+		ASSERT(STAT_LOAD(g_heap, class_new[SIZE_CLASS(MIN_ALLOC_SIZE)]) == 1);
+		ASSERT(STAT_LOAD(g_heap, class_new[SIZE_CLASS(SLAB_MAX_SIZE * 2)]) == 1);
+	}
+	{ // Normal case: no size class
+		ASSERT(!reset());
+		stats_new(ARENA_SIZE * 2, true, 1);
+		ASSERT(STAT_LOAD(g_heap, new_bytes) == ARENA_SIZE * 2);
+		for (size_t i = 0; i < NUM_SIZE_CLASSES; i++)
+			ASSERT(!STAT_LOAD(g_heap, class_new[i]));
+	}
+}
+
+void test_stats_del() {
+	{ // Normal case
+		ASSERT(!reset());
+		stats_del(MIN_ALLOC_SIZE, false, 1);
+		stats_del(SLAB_MAX_SIZE * 2, true, 1);
+		ASSERT(STAT_LOAD(g_heap, del_bytes) == MIN_ALLOC_SIZE + SLAB_MAX_SIZE * 2);
+		ASSERT(STAT_LOAD(g_heap, ptr_del) == 1);
+		ASSERT(STAT_LOAD(g_heap, class_del[SIZE_CLASS(MIN_ALLOC_SIZE)]) == 1);
+		ASSERT(STAT_LOAD(g_heap, class_del[SIZE_CLASS(SLAB_MAX_SIZE * 2)]) == 1);
+	}
+}
+
+void test_stats_add() {
+	{ // Normal case
+		ASSERT(!reset());
+		stats_new(SLAB_MAX_SIZE * 2, true, 1);
+		stats_new(MIN_ALLOC_SIZE, false, 1);
+		stats_del(MIN_ALLOC_SIZE, false, 1);
+		STAT_INC(fast_path);
+		STAT_ADD(mmap_calls, 2);
+		alloc_stats_t stats = {0};
+		stats_add(&stats, g_heap);
+		stats_add(&stats, g_heap);
+		ASSERT(stats.live_bytes == SLAB_MAX_SIZE * 4);
+		ASSERT(stats.header_bytes == PTR_ALIGNED_SIZE * 2);
+		ASSERT(stats.fast_path == 2);
+		ASSERT(stats.mmap_calls == 4);
+		ASSERT(stats.thread_count == 2);
+	}
+}
+
+void test_stats_finish() {
+	{ // Normal case
+		ASSERT(!reset());
+		ASSERT(slab_use(MIN_ALLOC_SIZE));
+		alloc_stats_t stats = {0};
+		stats.live_bytes = SLAB_SIZE / 4;
+		stats.arena_count = 1;
+		stats_finish(&stats);
+		ASSERT(stats.slab_count == 1);
+		ASSERT(stats.mapped_bytes == ARENA_SIZE + SLAB_SIZE);
+		ASSERT(stats.fragmentation > 0.87 && stats.fragmentation < 0.88);
+	}
+	{ // Normal case: nothing mapped
+		alloc_stats_t stats = {0};
+		ASSERT(!reset());
+		stats_finish(&stats);
+		ASSERT(stats.fragmentation == 0);
+	}
+}
+
+void test_block_new() {
+	{ // Normal case: fresh arena space
+		ASSERT(!reset());
+		size_t free_pages = g_chunk_free_pages;
+		g_chunk_free_pages = 0;
+		bool zero = false;
+		void *data = block_new(SLAB_MAX_SIZE * 2, &zero);
+		g_chunk_free_pages = free_pages;
+		ASSERT(data);
+		ASSERT(!IS_SLAB(data));
+		ASSERT(zero);
+		ASSERT(!ptr_free(data));
+		ASSERT(block_new(SLAB_MAX_SIZE * 2, &zero) == data);
+		ASSERT(!zero);
+	}
+	{ // Normal case: reused arena page
+		ASSERT(!reset());
+		bool zero = true;
+		ASSERT(block_new(SLAB_MAX_SIZE * 2, &zero));
+		ASSERT(!zero);
+	}
+	{ // Normal case: thread cache
+		ASSERT(!reset());
+		bool zero = true;
+		void *data = block_new(SLAB_MAX_SIZE * 2, NULL);
+		ASSERT(!tcache_free(data));
+		ASSERT(block_new(SLAB_MAX_SIZE * 2, &zero) == data);
+		ASSERT(!zero);
+	}
+	{ // Normal case: slab
+		ASSERT(!reset());
+		bool zero = true;
+		ASSERT(IS_SLAB(block_new(MIN_ALLOC_SIZE, &zero)));
+		ASSERT(!zero);
+	}
+	{ // Normal case: slab region exhausted
+		ASSERT(!reset());
+		atomic_store(&g_slab_count, NUM_SLABS);
+		void *data = block_new(MIN_ALLOC_SIZE, NULL);
+		ASSERT(data);
+		ASSERT(!IS_SLAB(data));
+		ASSERT(PTR(data)->size == MIN_ALLOC_SIZE);
+		ASSERT(PTR(data)->arena);
+		ASSERT(!ptr_free(data));
+		atomic_store(&g_slab_count, 0);
+	}
+	{ // Normal case: reused page run
+		ASSERT(!reset());
+		bool zero = true;
+		void *data = block_new(ARENA_SIZE * 2, &zero);
+		ASSERT(PTR(data)->pages);
+		ASSERT(!ptr_free(data));
+		ASSERT(block_new(ARENA_SIZE * 2, &zero) == data);
+		ASSERT(!zero);
+		ASSERT(!ptr_free(data));
+	}
+	{ // Normal case: mmap
+		ASSERT(!reset());
+		bool zero = false;
+		void *data = block_new(MAX_RUN_ALLOC_SIZE * 2, &zero);
+		ASSERT(!PTR(data)->arena);
+		ASSERT(!PTR(data)->pages);
+		ASSERT(zero);
+		ASSERT(!ptr_free(data));
+	}
+}
+
+void test_region_expand() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_region_t *region = alloc_region_create();
+		ASSERT(region);
+		ASSERT(!region_expand(region));
+		ASSERT(region->page == region->head->next);
+		ASSERT(!region->page->next);
+		ASSERT(region->offset == REGION_PAGE_HEADER);
+		region_page_t *page = region->page;
+		region->page = region->head;
+		ASSERT(!region_expand(region));
+		ASSERT(region->page == page);
+		ASSERT(!alloc_region_destroy(region));
+	}
+	{ // region NULL
+		ASSERT(region_expand(NULL));
+	}
+}
+
+void test_region_use() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_region_t *region = alloc_region_create();
+		unsigned char *data = region_use(region, 1);
+		ASSERT(data == (unsigned char*)region->head + REGION_START);
+		ASSERT(region_use(region, MIN_ALLOC_SIZE) == data + MIN_ALLOC_SIZE);
+		ASSERT(!alloc_region_destroy(region));
+	}
+	{ // Normal case: next page
+		ASSERT(!reset());
+		alloc_region_t *region = alloc_region_create();
+		ASSERT(region_use(region, ARENA_SIZE - REGION_START));
+		ASSERT(region->page == region->head);
+		unsigned char *data = region_use(region, MIN_ALLOC_SIZE);
+		ASSERT(region->page != region->head);
+		ASSERT(data == (unsigned char*)region->page + REGION_PAGE_HEADER);
+		ASSERT(!alloc_region_destroy(region));
+	}
+	{ // Normal case: large block
+		ASSERT(!reset());
+		alloc_region_t *region = alloc_region_create();
+		void *data = region_use(region, MAX_REGION_ALLOC_SIZE + 1);
+		ASSERT(data);
+		ASSERT(region->large);
+		ASSERT(region->large->data == data);
+		ASSERT(PTR(data)->state == VALID);
+		ASSERT(!alloc_region_destroy(region));
+	}
+	{ // region NULL
+		ASSERT(!region_use(NULL, MIN_ALLOC_SIZE));
+	}
+	{ // size 0
+		ASSERT(!reset());
+		alloc_region_t *region = alloc_region_create();
+		ASSERT(!region_use(region, 0));
+		ASSERT(!alloc_region_destroy(region));
+	}
+}
+
+void test_region_release() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_region_t *region = alloc_region_create();
+		ASSERT(region_use(region, ARENA_SIZE * 2));
+		ASSERT(region_use(region, ARENA_SIZE * 3));
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(stats.mmap_count == 2);
+		ASSERT(!region_release(region));
+		ASSERT(!region->large);
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(!stats.mmap_count);
+		ASSERT(!alloc_region_destroy(region));
+	}
+	{ // region NULL
+		ASSERT(region_release(NULL));
+	}
+}
+
+static size_t g_ctor_calls;
+static size_t g_dtor_calls;
+
+static void obj_ctor(void *obj) {
+	memset(obj, 0xab, MIN_ALLOC_SIZE);
+	g_ctor_calls++;
+}
+
+static void obj_dtor(void *obj) {
+	(void)obj;
+	g_dtor_calls++;
+}
+
+void test_cache_use() {
+	{ // Normal case: new object
+		ASSERT(!reset());
+		g_ctor_calls = 0;
+		alloc_cache_t *cache = alloc_cache_create(MIN_ALLOC_SIZE, 0, obj_ctor, NULL);
+		unsigned char *obj = cache_use(cache);
+		ASSERT(obj);
+		ASSERT(obj[0] == 0xab && obj[MIN_ALLOC_SIZE - 1] == 0xab);
+		ASSERT(g_ctor_calls == 1);
+		ASSERT(cache->gets == 1);
+		ASSERT(cache->ctor_calls == 1);
+		ASSERT(block_size(obj) >= MIN_ALLOC_SIZE + sizeof(void*) * 2);
+		alloc_del(obj);
+		ASSERT(!alloc_cache_destroy(cache));
+	}
+	{ // Normal case: free object
+		ASSERT(!reset());
+		g_ctor_calls = 0;
+		alloc_cache_t *cache = alloc_cache_create(MIN_ALLOC_SIZE, 0, obj_ctor, NULL);
+		unsigned char *obj = cache_use(cache);
+		ASSERT(!cache_free(cache, obj));
+		ASSERT(cache_use(cache) == obj);
+		ASSERT(obj[0] == 0xab && obj[MIN_ALLOC_SIZE - 1] == 0xab);
+		ASSERT(g_ctor_calls == 1);
+		ASSERT(cache->gets == 2);
+		alloc_del(obj);
+		ASSERT(!alloc_cache_destroy(cache));
+	}
+	{ // Normal case: aligned
+		ASSERT(!reset());
+		alloc_cache_t *cache = alloc_cache_create(24, 256, NULL, NULL);
+		void *obj = cache_use(cache);
+		ASSERT(!((uintptr_t)obj % 256));
+		alloc_del(obj);
+		ASSERT(!alloc_cache_destroy(cache));
+	}
+	{ // cache NULL
+		ASSERT(!cache_use(NULL));
+	}
+}
+
+void test_cache_free() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_cache_t *cache = alloc_cache_create(20, 0, NULL, NULL);
+		ASSERT(cache->link == 24);
+		unsigned char *obj = cache_use(cache);
+		ASSERT(!cache_free(cache, obj));
+		ASSERT(CENTRAL_PTR(cache->free.head) == obj + 24);
+		ASSERT(cache->free.count == 1);
+		ASSERT(!alloc_cache_destroy(cache));
+	}
+	{ // Invalid argument
+		ASSERT(cache_free(NULL, &g_ctor_calls));
+	}
+}
+
+void test_cache_drain() {
+	{ // Normal case
+		ASSERT(!reset());
+		g_dtor_calls = 0;
+		alloc_cache_t *cache = alloc_cache_create(MIN_ALLOC_SIZE, 0, NULL, obj_dtor);
+		void *obj1 = cache_use(cache);
+		void *obj2 = cache_use(cache);
+		void *obj3 = cache_use(cache);
+		ASSERT(!cache_free(cache, obj1));
+		ASSERT(!cache_free(cache, obj2));
+		alloc_stats_t before;
+		ASSERT(!alloc_stats_thread(&before));
+		ASSERT(!cache_drain(cache));
+		ASSERT(g_dtor_calls == 2);
+		ASSERT(!cache->free.count);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(before.live_bytes - stats.live_bytes == block_size(obj3) * 2);
+		alloc_del(obj3);
+		ASSERT(!alloc_cache_destroy(cache));
+	}
+	{ // cache NULL
+		ASSERT(cache_drain(NULL));
+	}
+}
+
+void test_prof_rand() {
+	{ // Normal case
+		g_prof_seed = 0;
+		uint64_t a = prof_rand();
+		ASSERT(g_prof_seed);
+		ASSERT(prof_rand() != a);
+	}
+}
+
+void test_prof_interval() {
+	{ // Normal case
+		size_t rate = 1024 * 512;
+		double sum = 0;
+		for (size_t i = 0; i < 100000; i++) {
+			int64_t interval = prof_interval(rate);
+			ASSERT(interval > 0);
+			sum += (double)interval;
+		}
+		double mean = sum / 100000;
+		ASSERT(mean > (double)rate * 0.97 && mean < (double)rate * 1.03);
+	}
+}
+
+void test_prof_site_find() {
+	{ // Normal case
+		ASSERT(!reset());
+		void *frames1[] = {(void*)0x10, (void*)0x20};
+		void *frames2[] = {(void*)0x10, (void*)0x30};
+		prof_site_t *site1 = prof_site_find(frames1, 2);
+		prof_site_t *site2 = prof_site_find(frames2, 2);
+		ASSERT(site1 && site2 && site1 != site2);
+		ASSERT(site1->depth == 2);
+		ASSERT(site1->frames[1] == (void*)0x20);
+		ASSERT(prof_site_find(frames1, 2) == site1);
+		ASSERT(prof_site_find(frames1, 1) != site1);
+	}
+	{ // Depth 0
+		ASSERT(!prof_site_find(NULL, 0));
+	}
+}
+
+void test_prof_live_find() {
+	{ // Normal case
+		ASSERT(!reset());
+		int x, y;
+		ASSERT(!prof_live_insert(&x, NULL, 1, 4));
+		ASSERT(g_prof_live[prof_live_find(&x)].data == &x);
+		ASSERT(prof_live_find(&y) == PROF_LIVE);
+	}
+}
+
+void test_prof_live_insert() {
+	{ // Normal case
+		ASSERT(!reset());
+		int x;
+		void *frames[] = {(void*)0x10};
+		prof_site_t *site = prof_site_find(frames, 1);
+		ASSERT(!prof_live_insert(&x, site, 2, 8));
+		prof_live_t *live = &g_prof_live[prof_live_find(&x)];
+		ASSERT(live->site == site);
+		ASSERT(live->count == 2);
+		ASSERT(live->bytes == 8);
+		ASSERT(atomic_load(&g_prof_live_count) == 1);
+		ASSERT(atomic_load(&g_prof_filter[PROF_PTR_HASH(&x, LG_PROF_FILTER)]) == 1);
+	}
+	{ // Table full
+		ASSERT(!reset());
+		atomic_store(&g_prof_live_count, PROF_LIVE / 2);
+		int x;
+		ASSERT(prof_live_insert(&x, NULL, 1, 4));
+	}
+}
+
+void test_prof_live_remove() {
+	{ // Normal case: colliding entries stay reachable
+		ASSERT(!reset());
+		size_t home = PROF_PTR_HASH(g_prof_live, LG_PROF_LIVE);
+		unsigned char *base = (unsigned char*)g_prof_live;
+		void *data[4] = {0};
+		size_t n = 0;
+		for (size_t i = 0; n < 4; i++)
+			if (PROF_PTR_HASH(base + i * 16, LG_PROF_LIVE) == home)
+				data[n++] = base + i * 16;
+		for (size_t i = 0; i < 4; i++)
+			ASSERT(!prof_live_insert(data[i], NULL, 1, 1));
+		prof_live_remove(prof_live_find(data[1]));
+		ASSERT(prof_live_find(data[1]) == PROF_LIVE);
+		ASSERT(prof_live_find(data[0]) < PROF_LIVE);
+		ASSERT(prof_live_find(data[2]) < PROF_LIVE);
+		ASSERT(prof_live_find(data[3]) < PROF_LIVE);
+		ASSERT(!g_prof_live[(home + 3) & (PROF_LIVE - 1)].data);
+		ASSERT(atomic_load(&g_prof_live_count) == 3);
+	}
+}
+
+void test_prof_sample() {
+	{ // Normal case
+		ASSERT(!reset());
+		atomic_store(&g_prof_rate, 1024);
+		g_prof_bytes = INT64_MAX;
+		void *data = alloc_new(MIN_ALLOC_SIZE);
+		prof_sample(data, MIN_ALLOC_SIZE);
+		ASSERT(g_prof_bytes > 0);
+		ASSERT(atomic_load(&g_prof_live_count) == 1);
+		prof_live_t *live = &g_prof_live[prof_live_find(data)];
+		ASSERT(live->bytes >= 1024);
+		ASSERT(live->site->live_bytes == live->bytes);
+		ASSERT(live->site->alloc_count == live->count);
+	}
+	{ // Normal case: disabled
+		ASSERT(!reset());
+		void *data = alloc_new(MIN_ALLOC_SIZE);
+		prof_sample(data, MIN_ALLOC_SIZE);
+		ASSERT(g_prof_bytes == PROF_RECHECK);
+		ASSERT(!atomic_load(&g_prof_live_count));
+	}
+}
+
+void test_prof_free() {
+	{ // Normal case
+		ASSERT(!reset());
+		atomic_store(&g_prof_rate, 1024);
+		g_prof_bytes = INT64_MAX;
+		void *data = alloc_new(MIN_ALLOC_SIZE);
+		prof_sample(data, MIN_ALLOC_SIZE);
+		prof_site_t *site = g_prof_live[prof_live_find(data)].site;
+		prof_free(data);
+		ASSERT(!atomic_load(&g_prof_live_count));
+		ASSERT(!site->live_bytes);
+		ASSERT(!site->live_count);
+		ASSERT(site->alloc_bytes);
+		prof_free(data);
+		ASSERT(!site->live_bytes);
+	}
+}
+
+void test_prof_frame() {
+	{ // Normal case
+		char *buff = NULL;
+		size_t len = 0;
+		FILE *file = open_memstream(&buff, &len);
+		Dl_info info;
+		ASSERT(dladdr(dlsym(RTLD_DEFAULT, "fopen"), &info));
+		prof_frame(file, dlsym(RTLD_DEFAULT, "fopen"));
+		prof_frame(file, (void*)0x10);
+		fclose(file);
+		char expected[64];
+		snprintf(expected, sizeof(expected), "%s0x10", info.dli_sname);
+		ASSERT(!strcmp(buff, expected));
+		free(buff);
+	}
+}
+
+void test_prof_write() {
+	void *fopen_frame = dlsym(RTLD_DEFAULT, "fopen");
+	Dl_info info;
+	ASSERT(dladdr(fopen_frame, &info));
+	char expected[64];
+	{ // Normal case: pprof
+		ASSERT(!reset());
+		void *frames[] = {fopen_frame, (void*)0x10};
+		prof_site_t *site = prof_site_find(frames, 2);
+		*site = (prof_site_t){site->hash, 2, {fopen_frame, (void*)0x10}, 4, 400, 1, 100};
+		char *buff = NULL;
+		size_t len = 0;
+		FILE *file = open_memstream(&buff, &len);
+		ASSERT(!prof_write(file, g_prof_sites, ALLOC_PROF_PPROF, 1000));
+		fclose(file);
+		ASSERT(strstr(buff, "heap profile: 1: 100 [4: 400] @ heapprofile\n"));
+		ASSERT(strstr(buff, "1: 100 [4: 400] @ 0x"));
+		ASSERT(strstr(buff, "MAPPED_LIBRARIES:"));
+		free(buff);
+	}
+	{ // Normal case: folded
+		char *buff = NULL;
+		size_t len = 0;
+		FILE *file = open_memstream(&buff, &len);
+		ASSERT(!prof_write(file, g_prof_sites, ALLOC_PROF_FOLDED, 1000));
+		fclose(file);
+		snprintf(expected, sizeof(expected), "0x10;%s 100\n", info.dli_sname);
+		ASSERT(!strcmp(buff, expected));
+		free(buff);
+	}
+	{ // Normal case: folded rate
+		char *buff = NULL;
+		size_t len = 0;
+		FILE *file = open_memstream(&buff, &len);
+		ASSERT(!prof_write(file, g_prof_sites, ALLOC_PROF_FOLDED_RATE, 2000));
+		fclose(file);
+		snprintf(expected, sizeof(expected), "0x10;%s 200\n", info.dli_sname);
+		ASSERT(!strcmp(buff, expected));
+		free(buff);
+	}
+	{ // File NULL
+		ASSERT(prof_write(NULL, g_prof_sites, ALLOC_PROF_FOLDED, 1000));
+	}
+}
+
+#ifdef ALLOC_DEBUG
+void test_debug_report() {
+	{ // Normal case: no abort
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_CANARY);
+		debug_report("Double free detected.");
+	}
+	{ // Normal case: abort
+		atomic_store(&g_debug, DEBUG_ABORT);
+		pid_t pid = fork();
+		if (!pid) {
+			close(STDERR_FILENO);
+			debug_report("Double free detected.");
+			_exit(0);
+		}
+		int status = 0;
+		ASSERT(waitpid(pid, &status, 0) == pid);
+		ASSERT(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+	}
+}
+
+void test_debug_slot() {
+	{ // Normal case
+		ASSERT(!reset());
+		ASSERT(!debug_grow());
+		int x;
+		debug_block_t *slot = debug_slot(&x);
+		ASSERT(!slot->data);
+		ASSERT(slot == &g_debug_blocks[PROF_PTR_HASH(&x, g_debug_lg)]);
+		slot->data = &x;
+		ASSERT(debug_slot(&x) == slot);
+	}
+}
+
+void test_debug_find() {
+	{ // Normal case
+		ASSERT(!reset());
+		int x, y;
+		ASSERT(!debug_find(&x));
+		ASSERT(!debug_insert((debug_block_t){.data = &x, .size = 4}));
+		ASSERT(debug_find(&x)->size == 4);
+		ASSERT(!debug_find(&y));
+	}
+}
+
+void test_debug_grow() {
+	{ // Normal case
+		ASSERT(!reset());
+		ASSERT(!debug_grow());
+		ASSERT(g_debug_lg == LG_DEBUG_BLOCKS);
+		int x;
+		ASSERT(!debug_insert((debug_block_t){.data = &x, .size = 4}));
+		ASSERT(!debug_grow());
+		ASSERT(g_debug_lg == LG_DEBUG_BLOCKS + 1);
+		ASSERT(debug_find(&x)->size == 4);
+	}
+}
+
+void test_debug_insert() {
+	{ // Normal case: the table grows
+		ASSERT(!reset());
+		unsigned char buff[1];
+		size_t count = (1LU << LG_DEBUG_BLOCKS) / 2 + 1;
+		for (size_t i = 0; i < count; i++)
+			ASSERT(!debug_insert((debug_block_t){.data = buff + i * 16, .size = i + 1}));
+		ASSERT(g_debug_count == count);
+		ASSERT(g_debug_lg == LG_DEBUG_BLOCKS + 1);
+		for (size_t i = 0; i < count; i++)
+			ASSERT(debug_find(buff + i * 16)->size == i + 1);
+	}
+	{ // Data NULL
+		ASSERT(debug_insert((debug_block_t){0}));
+	}
+}
+
+void test_debug_remove() {
+	{ // Normal case: colliding entries stay reachable
+		ASSERT(!reset());
+		ASSERT(!debug_grow());
+		unsigned char *base = (unsigned char*)g_debug_blocks;
+		size_t home = PROF_PTR_HASH(base, g_debug_lg);
+		void *data[4] = {0};
+		size_t n = 0;
+		for (size_t i = 0; n < 4; i++)
+			if (PROF_PTR_HASH(base + i * 16, g_debug_lg) == home)
+				data[n++] = base + i * 16;
+		for (size_t i = 0; i < 4; i++)
+			ASSERT(!debug_insert((debug_block_t){.data = data[i]}));
+		debug_remove(debug_find(data[1]));
+		ASSERT(!debug_find(data[1]));
+		ASSERT(debug_find(data[0]));
+		ASSERT(debug_find(data[2]));
+		ASSERT(debug_find(data[3]));
+		ASSERT(g_debug_count == 3);
+	}
+}
+
+void test_debug_end() {
+	{ // Normal case
+		unsigned char buff[64];
+		debug_block_t block = {.data = buff + 16, .base = buff, .size = 5};
+		ASSERT(debug_end(&block) == buff + 16 + 5 + DEBUG_REDZONE);
+	}
+	{ // Normal case: guarded
+		unsigned char buff[64];
+		debug_block_t block = {.data = buff, .base = buff, .size = 5,
+			.len = MMAP_PAGE_SIZE * 3};
+		ASSERT(debug_end(&block) == buff + MMAP_PAGE_SIZE);
+	}
+}
+
+void test_debug_intact() {
+	{ // Normal case
+		unsigned char buff[16];
+		memset(buff, CANARY_BYTE, sizeof(buff));
+		ASSERT(debug_intact(buff, buff + 16, CANARY_BYTE));
+		buff[15] = 0;
+		ASSERT(!debug_intact(buff, buff + 16, CANARY_BYTE));
+		ASSERT(debug_intact(buff, buff + 15, CANARY_BYTE));
+	}
+}
+
+void test_debug_check() {
+	{ // Normal case
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_CANARY);
+		unsigned char *data = debug_new(5, MIN_ALLOC_SIZE);
+		debug_block_t *block = debug_find(data);
+		ASSERT(!debug_check(block));
+		memset(data, 0, 5);
+		ASSERT(!debug_check(block));
+	}
+	{ // Overflow
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_CANARY);
+		unsigned char *data = debug_new(5, MIN_ALLOC_SIZE);
+		data[5] = 0;
+		ASSERT(debug_check(debug_find(data)));
+	}
+	{ // Underflow
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_CANARY);
+		unsigned char *data = debug_new(5, MIN_ALLOC_SIZE);
+		data[-1] = 0;
+		ASSERT(debug_check(debug_find(data)));
+	}
+}
+
+void test_debug_release() {
+	{ // Normal case
+		ASSERT(!reset());
+		void *base = alloc_new(MIN_ALLOC_SIZE);
+		debug_block_t block = {.data = base, .base = base, .size = MIN_ALLOC_SIZE};
+		debug_release(&block);
+		ASSERT(g_tcache[0].head == base);
+	}
+	{ // Normal case: guarded
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_GUARD);
+		void *data = debug_new(ARENA_SIZE, MIN_ALLOC_SIZE);
+		debug_block_t block = *debug_find(data);
+		debug_release(&block);
+		ASSERT(STAT_LOAD(g_heap, mmap_del) == 1);
+		ASSERT(STAT_LOAD(g_heap, unmapped_bytes) == block.len);
+	}
+}
+
+void test_debug_evict() {
+	{ // Normal case
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_POISON | DEBUG_QUARANTINE);
+		void *data = debug_new(MIN_ALLOC_SIZE, MIN_ALLOC_SIZE);
+		ASSERT(!debug_del(data));
+		ASSERT(g_quarantine_count == 1);
+		ASSERT(!debug_evict());
+		ASSERT(!g_quarantine_count);
+		ASSERT(!g_quarantine_bytes);
+		ASSERT(!debug_find(data));
+	}
+	{ // Written after free
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_POISON | DEBUG_QUARANTINE);
+		unsigned char *data = debug_new(MIN_ALLOC_SIZE, MIN_ALLOC_SIZE);
+		ASSERT(!debug_del(data));
+		data[0] = 0;
+		ASSERT(debug_evict());
+		ASSERT(!g_quarantine_count);
+	}
+	{ // Quarantine empty
+		ASSERT(!reset());
+		ASSERT(debug_evict());
+	}
+}
+
+void test_debug_new() {
+	{ // Normal case
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_CANARY);
+		unsigned char *data = debug_new(5, MIN_ALLOC_SIZE);
+		ASSERT(data);
+		ASSERT(!((uintptr_t)data % MIN_ALLOC_SIZE));
+		debug_block_t *block = debug_find(data);
+		ASSERT(block->base == data - DEBUG_REDZONE);
+		ASSERT(block->size == 5);
+		ASSERT(block->state == VALID);
+		ASSERT(debug_intact(block->base, data, CANARY_BYTE));
+		ASSERT(debug_intact(data + 5, data + 5 + DEBUG_REDZONE, CANARY_BYTE));
+		ASSERT(!g_debug_busy);
+	}
+	{ // Normal case: aligned
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_CANARY);
+		unsigned char *data = debug_new(100, 256);
+		ASSERT(!((uintptr_t)data % 256));
+		ASSERT(debug_find(data)->base == data - 256);
+	}
+	{ // Normal case: guarded
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_GUARD);
+		size_t size = ARENA_SIZE + 8;
+		unsigned char *data = debug_new(size, MIN_ALLOC_SIZE);
+		ASSERT(data);
+		debug_block_t *block = debug_find(data);
+		ASSERT(block->len);
+		ASSERT(debug_end(block) == data + ALIGN_UP(size, MIN_ALLOC_SIZE));
+		ASSERT(!((uintptr_t)debug_end(block) % MMAP_PAGE_SIZE));
+		memset(data, 1, size);
+		pid_t pid = fork();
+		if (!pid) {
+			data[ALIGN_UP(size, MIN_ALLOC_SIZE)] = 0;
+			_exit(0);
+		}
+		int status = 0;
+		ASSERT(waitpid(pid, &status, 0) == pid);
+		ASSERT(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+	}
+	{ // Size 0
+		ASSERT(!debug_new(0, MIN_ALLOC_SIZE));
+	}
+}
+
+void test_debug_del() {
+	{ // Normal case
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_CANARY);
+		void *data = debug_new(5, MIN_ALLOC_SIZE);
+		void *base = debug_find(data)->base;
+		ASSERT(!debug_del(data));
+		ASSERT(!debug_find(data));
+		ASSERT(g_tcache[SIZE_CLASS(5 + DEBUG_REDZONE * 2)].head == base);
+	}
+	{ // Normal case: quarantine and poison
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_POISON | DEBUG_QUARANTINE);
+		unsigned char *data = debug_new(5, MIN_ALLOC_SIZE);
+		ASSERT(!debug_del(data));
+		debug_block_t *block = debug_find(data);
+		ASSERT(block->state == FREE);
+		ASSERT(block->poisoned);
+		ASSERT(debug_intact(block->base, debug_end(block), POISON_BYTE));
+		ASSERT(g_quarantine[0] == data);
+		ASSERT(g_quarantine_bytes == 5);
+	}
+	{ // Normal case: full quarantine evicts the oldest block
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_QUARANTINE);
+		void *first = debug_new(5, MIN_ALLOC_SIZE);
+		ASSERT(!debug_del(first));
+		for (size_t i = 0; i < QUARANTINE_COUNT; i++)
+			ASSERT(!debug_del(debug_new(5, MIN_ALLOC_SIZE)));
+		ASSERT(g_quarantine_count == QUARANTINE_COUNT);
+		ASSERT(!debug_find(first));
+	}
+	{ // Normal case: guarded block is made inaccessible
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_GUARD | DEBUG_QUARANTINE);
+		unsigned char *data = debug_new(ARENA_SIZE, MIN_ALLOC_SIZE);
+		ASSERT(!debug_del(data));
+		pid_t pid = fork();
+		if (!pid) {
+			data[0] = 0;
+			_exit(0);
+		}
+		int status = 0;
+		ASSERT(waitpid(pid, &status, 0) == pid);
+		ASSERT(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+	}
+	{ // Double free
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_QUARANTINE);
+		void *data = debug_new(5, MIN_ALLOC_SIZE);
+		ASSERT(!debug_del(data));
+		ASSERT(debug_del(data));
+		ASSERT(g_quarantine_count == 1);
+	}
+	{ // Broken canary
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_CANARY);
+		unsigned char *data = debug_new(5, MIN_ALLOC_SIZE);
+		data[5] = 0;
+		ASSERT(debug_del(data));
+		ASSERT(debug_find(data)->state == VALID);
+	}
+	{ // Block not tracked
+		ASSERT(!reset());
+		int x;
+		ASSERT(debug_del(&x));
+	}
+}
+
+void test_debug_size() {
+	{ // Normal case
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_CANARY);
+		void *data = debug_new(5, MIN_ALLOC_SIZE);
+		ASSERT(debug_size(data) == 5);
+		int x;
+		ASSERT(!debug_size(&x));
+	}
+}
+void test_debug_size_match() {
+	{ // Normal case
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_SIZE);
+		void *data = debug_new(5, MIN_ALLOC_SIZE);
+		ASSERT(debug_size_match(data, 5));
+		ASSERT(!debug_size_match(data, 6));
+		ASSERT(!debug_size_match(data, 4));
+	}
+	{ // Normal case: block allocated before debug mode
+		ASSERT(!reset());
+		void *data = alloc_new(MIN_ALLOC_SIZE * 3);
+		atomic_store(&g_debug, DEBUG_SIZE);
+		ASSERT(debug_size_match(data, MIN_ALLOC_SIZE * 3));
+		ASSERT(debug_size_match(data, 1));
+		ASSERT(!debug_size_match(data, MIN_ALLOC_SIZE * 4));
+	}
+	{ // Normal case: check disabled
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_CANARY);
+		void *data = debug_new(5, MIN_ALLOC_SIZE);
+		ASSERT(debug_size_match(data, 6));
+	}
+}
+
+void test_debug_resize() {
+	{ // Normal case
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_CANARY);
+		void *data = debug_new(5, MIN_ALLOC_SIZE);
+		void *old = data;
+		memcpy(data, "abcde", 5);
+		ASSERT(!debug_resize(&data, 100));
+		ASSERT(data != old);
+		ASSERT(!memcmp(data, "abcde", 5));
+		ASSERT(debug_size(data) == 100);
+		ASSERT(!debug_find(old));
+	}
+	{ // Freed block
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_QUARANTINE);
+		void *data = debug_new(5, MIN_ALLOC_SIZE);
+		ASSERT(!debug_del(data));
+		ASSERT(debug_resize(&data, 100));
+	}
+}
+#endif
+
+static void *slab_thread(void *arg) {
+	void *(*ptrs)[SLAB_SIZE / SLAB_MAX_SIZE] = arg;
+	for (size_t i = 0; i < SLAB_POOL_MAX * 2; i++)
+		for (size_t j = 0; j < SLAB_SIZE / SLAB_MAX_SIZE; j++)
+			ptrs[i][j] = alloc_new(SLAB_MAX_SIZE);
+	for (size_t i = 0; i < SLAB_POOL_MAX * 2; i++)
+		for (size_t j = 0; j < SLAB_SIZE / SLAB_MAX_SIZE; j++)
+			if (ptrs[i][j]) alloc_del(ptrs[i][j]);
+	return NULL;
+}
+
+void test_alloc_new() {
+	{ // Normal case
+		ASSERT(!reset());
+		int *data = alloc_new(sizeof(int));
+		ASSERT(data);
+	}
+#ifdef ALLOC_DEBUG
+	{ // Normal case: debug mode
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_CANARY);
+		void *data = alloc_new(5);
+		ASSERT(debug_size(data) == 5);
+		alloc_del(data);
+		ASSERT(!debug_find(data));
+	}
+#endif
+	{ // Normal case: use slab
+		ASSERT(!reset());
+		int *data = alloc_new(sizeof(int));
+		ASSERT(data);
+		ASSERT(IS_SLAB(data));
+		ASSERT(SLAB(data)->size == MIN_ALLOC_SIZE);
+	}
+	{ // Normal case: use free list
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data = alloc_new(size);
+		ASSERT(alloc_new(size));
+		ASSERT(!g_free_ptr_tails[SIZE_CLASS(size)]);
+		ASSERT(!ptr_free(data));
+		ASSERT(g_free_ptr_tails[SIZE_CLASS(size)]);
+		void *data2 = alloc_new(size);
+		ASSERT(data2);
+		ASSERT(!g_free_ptr_tails[SIZE_CLASS(size)]);
+	} 
+	{ // Normal case: free block serves any size of its class
+		ASSERT(!reset());
+		size_t size = CLASS_SIZE(SIZE_CLASS(SLAB_MAX_SIZE * 2 + 1));
+		void *data = alloc_new(size);
+		ASSERT(alloc_new(size));
+		ASSERT(!ptr_free(data));
+		void *data2 = alloc_new(CLASS_SIZE(SIZE_CLASS(size) - 1) + 1);
+		ASSERT(data2 == data);
+		ASSERT(PTR(data2)->size == CLASS_SIZE(SIZE_CLASS(size) - 1) + 1);
+	}
+	{ // Normal case: use arena
+		ASSERT(!reset());
+		void *data = alloc_new(SLAB_MAX_SIZE * 2);
+		ASSERT(data);
+		ASSERT(!IS_SLAB(data));
+		ASSERT(g_arena_tail->ptrs_tail == PTR(data));
+	}
+	{ // Normal case: use mmap
+		ASSERT(!reset());
+		typedef struct obj {
+			char buff[ARENA_SIZE * 10];
+		} obj_t;
+		obj_t *obj = alloc_new(sizeof(obj_t));
+		ASSERT(obj);
+		ASSERT(munmap(PTR(obj), TOTAL_SIZE(ARENA_SIZE * 10)) != -1);
+	}
+	{ // Normal case: slab region exhausted
+		ASSERT(!reset());
+		atomic_store(&g_slab_count, NUM_SLABS);
+		void *small = alloc_new(MIN_ALLOC_SIZE);
+		void *large = alloc_new(SLAB_MAX_SIZE);
+		ASSERT(small);
+		ASSERT(large);
+		ASSERT(!IS_SLAB(small));
+		ASSERT(!IS_SLAB(large));
+		alloc_del(small);
+		alloc_del(large);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(!stats.live_bytes);
+		atomic_store(&g_slab_count, 0);
+	}
+	{ // Normal case: slabs freed by a live thread are reused
+		ASSERT(!reset());
+		static void *ptrs[SLAB_POOL_MAX * 4][SLAB_SIZE / SLAB_MAX_SIZE];
+		for (size_t i = 0; i < SLAB_POOL_MAX * 4; i++)
+			for (size_t j = 0; j < SLAB_SIZE / SLAB_MAX_SIZE; j++)
+				ASSERT((ptrs[i][j] = alloc_new(SLAB_MAX_SIZE)));
+		for (size_t i = 0; i < SLAB_POOL_MAX * 4; i++)
+			for (size_t j = 0; j < SLAB_SIZE / SLAB_MAX_SIZE; j++)
+				ASSERT(!slab_free(ptrs[i][j]));
+		size_t count = atomic_load(&g_slab_count);
+		ASSERT(g_slab_pool_count == SLAB_POOL_MAX);
+		ASSERT(atomic_load(&g_slab_free_count) >= SLAB_POOL_MAX * 2);
+		pthread_t thread;
+		ASSERT(!pthread_create(&thread, NULL, slab_thread, ptrs));
+		ASSERT(!pthread_join(thread, NULL));
+		ASSERT(ptrs[0][0]);
+		ASSERT(atomic_load(&g_slab_count) == count);
+	}
+	{ // size is 0
+		ASSERT(!reset());
+		ASSERT(!alloc_new(0));
+	}
+}
+
+typedef struct owner_thread_arg {
+	pthread_barrier_t barrier;
+	void *slab_data;
+	void *arena_data;
+	size_t slab_used;
+	ptr_state_t arena_state;
+} owner_thread_arg_t;
+
+static void *owner_thread(void *arg) {
+	owner_thread_arg_t *a = arg;
+	a->slab_data = alloc_new(MIN_ALLOC_SIZE);
+	a->arena_data = alloc_new(SLAB_MAX_SIZE * 2);
+	pthread_barrier_wait(&a->barrier);
+	pthread_barrier_wait(&a->barrier);
+	void *data = alloc_new(MIN_ALLOC_SIZE * 2);
+	a->slab_used = SLAB(a->slab_data)->used;
+	a->arena_state = PTR(a->arena_data)->state;
+	alloc_del(data);
+	return NULL;
+}
+
+typedef struct stress_thread_arg {
+	pthread_barrier_t *barrier;
+	unsigned char *objs[STRESS_BATCHES];
+	size_t sizes[STRESS_BATCHES];
+	size_t id;
+	bool ok;
+} stress_thread_arg_t;
+
+static stress_thread_arg_t g_stress_args[STRESS_THREADS];
+
+static void *stress_thread(void *arg) {
+	stress_thread_arg_t *a = arg;
+	stress_thread_arg_t *next = &g_stress_args[(a->id + 1) % STRESS_THREADS];
+	a->ok = true;
+	for (size_t r = 0; r < STRESS_ROUNDS / STRESS_BATCHES; r++) {
+		for (size_t j = 0; j < STRESS_BATCHES; j++) {
+			a->sizes[j] = MIN_ALLOC_SIZE + (j * 7919 + r) % (SLAB_MAX_SIZE * 4);
+			a->objs[j] = alloc_new(a->sizes[j]);
+			if (!a->objs[j]) a->ok = false;
+			else memset(a->objs[j], (int)a->id, a->sizes[j]);
+		}
+		pthread_barrier_wait(a->barrier);
+		for (size_t j = 0; j < STRESS_BATCHES; j++) {
+			unsigned char *data = next->objs[j];
+			if (!data) continue;
+			if (data[0] != next->id || data[next->sizes[j] - 1] != next->id)
+				a->ok = false;
+			alloc_del(data);
+		}
+		pthread_barrier_wait(a->barrier);
+	}
+	return NULL;
+}
+
+static bool is_zero(unsigned char *data, size_t size) {
+	for (size_t i = 0; i < size; i++)
+		if (data[i]) return false;
+	return true;
+}
+
+void test_alloc_new_zeroed() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t sizes[] = {MIN_ALLOC_SIZE, SLAB_MAX_SIZE * 2, ARENA_SIZE * 2};
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+			unsigned char *data = alloc_new_zeroed(sizes[i]);
+			ASSERT(data);
+			ASSERT(is_zero(data, sizes[i]));
+			memset(data, 0xff, sizes[i]);
+			alloc_del(data);
+			data = alloc_new_zeroed(sizes[i]);
+			ASSERT(is_zero(data, sizes[i]));
+			alloc_del(data);
+		}
+	}
+	{ // Normal case: reused block
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		unsigned char *data = alloc_new(size);
+		memset(data, 0xff, size);
+		alloc_del(data);
+		ASSERT(alloc_new_zeroed(size) == data);
+		ASSERT(is_zero(data, size));
+		alloc_del(data);
+	}
+#ifdef ALLOC_DEBUG
+	{ // Normal case: debug
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_ALL & ~DEBUG_ABORT);
+		unsigned char *data = alloc_new_zeroed(SLAB_MAX_SIZE * 2);
+		ASSERT(debug_find(data));
+		ASSERT(is_zero(data, SLAB_MAX_SIZE * 2));
+		alloc_del(data);
+		ASSERT(!reset());
+	}
+#endif
+	{ // size 0
+		ASSERT(!alloc_new_zeroed(0));
+	}
+	{ // size too big
+		ASSERT(!alloc_new_zeroed(SIZE_MAX));
+	}
+}
+
+void test_alloc_new_aligned() {
+	{ // Normal case: slab
+		ASSERT(!reset());
+		for (size_t alignment = MIN_ALLOC_SIZE * 2; alignment <= SLAB_MAX_SIZE; alignment *= 2) {
+			for (size_t size = 1; size <= alignment * 2 && size <= SLAB_MAX_SIZE; size += 24) {
+				void *data = alloc_new_aligned(size, alignment);
+				ASSERT(data);
+				ASSERT(IS_SLAB(data));
+				ASSERT(!((uintptr_t)data % alignment));
+				alloc_del(data);
+			}
+		}
+	}
+	{ // Normal case: page run
+		ASSERT(!reset());
+		size_t alignments[] = {64, 1024, MMAP_PAGE_SIZE, ARENA_SIZE * 16};
+		size_t sizes[] = {SLAB_MAX_SIZE * 2, ARENA_SIZE * 8};
+		for (size_t i = 0; i < sizeof(alignments) / sizeof(*alignments); i++) {
+			for (size_t j = 0; j < sizeof(sizes) / sizeof(*sizes); j++) {
+				size_t mmap_calls = STAT_LOAD(g_heap, mmap_calls);
+				unsigned char *data = alloc_new_aligned(sizes[j], alignments[i]);
+				ASSERT(data);
+				ASSERT(!IS_SLAB(data));
+				ASSERT(PTR(data)->pages);
+				ASSERT(!((uintptr_t)data % alignments[i]));
+				ASSERT(STAT_LOAD(g_heap, mmap_calls) <= mmap_calls + 1);
+				data[sizes[j] - 1] = 1;
+				alloc_del(data);
+			}
+		}
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats(&stats));
+		ASSERT(!stats.live_bytes);
+	}
+	{ // Normal case: map cache
+		ASSERT(!reset());
+		size_t size = MAX_RUN_ALLOC_SIZE * 2;
+		unsigned char *data = alloc_new_aligned(size, CHUNK_SIZE);
+		ASSERT(data);
+		ASSERT(!PTR(data)->pages);
+		ASSERT(!((uintptr_t)data % CHUNK_SIZE));
+		data[size - 1] = 1;
+		alloc_del(data);
+		ASSERT(g_map_count == 1);
+		size_t mmap_calls = STAT_LOAD(g_heap, mmap_calls);
+		data = alloc_new_aligned(size, MMAP_PAGE_SIZE * 2);
+		ASSERT(data);
+		ASSERT(!((uintptr_t)data % (MMAP_PAGE_SIZE * 2)));
+		ASSERT(STAT_LOAD(g_heap, mmap_calls) == mmap_calls);
+		ASSERT(!g_map_count);
+		alloc_del(data);
+	}
+	{ // Normal case: arena blocks shrunk into a slab size class
+		ASSERT(!reset());
+		void *ptrs[8];
+		for (size_t i = 0; i < 8; i++) ASSERT((ptrs[i] = alloc_new(1000)));
+		for (size_t i = 0; i < 8; i++) ASSERT(!alloc_resize(&ptrs[i], 500));
+		for (size_t i = 0; i < 8; i++) alloc_del(ptrs[i]);
+		for (size_t i = 0; i < 8; i++) {
+			ptrs[i] = alloc_new_aligned(500, 512);
+			ASSERT(ptrs[i]);
+			ASSERT(IS_SLAB(ptrs[i]));
+			ASSERT(!((uintptr_t)ptrs[i] % 512));
+		}
+		for (size_t i = 0; i < 8; i++) alloc_del(ptrs[i]);
+	}
+	{ // Normal case: small alignment
+		ASSERT(!reset());
+		void *data = alloc_new_aligned(MIN_ALLOC_SIZE, 8);
+		ASSERT(data);
+		alloc_del(data);
+	}
+	{ // size 0
+		ASSERT(!alloc_new_aligned(0, 64));
+	}
+	{ // alignment not a power of two
+		ASSERT(!alloc_new_aligned(MIN_ALLOC_SIZE, 0));
+		ASSERT(!alloc_new_aligned(MIN_ALLOC_SIZE, 48));
+	}
+}
+
+void test_alloc_new_batch() {
+#ifdef ALLOC_DEBUG
+	{ // Normal case: debug mode
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_QUARANTINE);
+		void *ptrs[10] = {0};
+		ASSERT(!alloc_new_batch(MIN_ALLOC_SIZE, 10, ptrs));
+		for (size_t j = 0; j < 10; j++) ASSERT(debug_size(ptrs[j]) == MIN_ALLOC_SIZE);
+		alloc_del_batch(ptrs, 10);
+		ASSERT(g_quarantine_count == 10);
+	}
+#endif
+	size_t sizes[] = {MIN_ALLOC_SIZE, SLAB_MAX_SIZE, SLAB_MAX_SIZE * 2, ARENA_SIZE * 2};
+	for (size_t k = 0; k < sizeof(sizes) / sizeof(*sizes); k++) { // Normal case
+		ASSERT(!reset());
+		void *ptrs[100] = {0};
+		ASSERT(!alloc_new_batch(sizes[k], 100, ptrs));
+		for (size_t j = 0; j < 100; j++) {
+			ASSERT(ptrs[j]);
+			memset(ptrs[j], (int)j, sizes[k]);
+		}
+		for (size_t j = 0; j < 100; j++)
+			ASSERT(((unsigned char*)ptrs[j])[sizes[k] - 1] == (unsigned char)j);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(stats.live_bytes >= sizes[k] * 100);
+		alloc_del_batch(ptrs, 100);
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(!stats.live_bytes);
+	}
+	{ // Normal case: slab region exhausted
+		ASSERT(!reset());
+		ASSERT(slab_use(SLAB_MAX_SIZE));
+		atomic_store(&g_slab_count, NUM_SLABS);
+		size_t capacity = SLAB_SIZE / SLAB_MAX_SIZE;
+		void *ptrs[SLAB_SIZE / SLAB_MAX_SIZE * 2] = {0};
+		ASSERT(!alloc_new_batch(SLAB_MAX_SIZE, capacity * 2, ptrs));
+		for (size_t j = 0; j < capacity - 1; j++) ASSERT(IS_SLAB(ptrs[j]));
+		for (size_t j = capacity - 1; j < capacity * 2; j++) {
+			ASSERT(!IS_SLAB(ptrs[j]));
+			ASSERT(PTR(ptrs[j])->size == SLAB_MAX_SIZE);
+		}
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(stats.live_bytes == SLAB_MAX_SIZE * capacity * 2);
+		ASSERT(stats.header_bytes == PTR_ALIGNED_SIZE * (capacity + 1));
+		alloc_del_batch(ptrs, capacity * 2);
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(!stats.live_bytes);
+		ASSERT(!stats.header_bytes);
+		atomic_store(&g_slab_count, 0);
+	}
+	{ // Normal case: arena blocks shrunk into the size class
+		ASSERT(!reset());
+		for (size_t j = 0; j < 20; j++) {
+			void *data = alloc_new(1000);
+			ASSERT(!alloc_resize(&data, 300));
+			alloc_del(data);
+		}
+		void *ptrs[20] = {0};
+		ASSERT(!alloc_new_batch(300, 20, ptrs));
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		size_t live = 0;
+		size_t headers = 0;
+		for (size_t j = 0; j < 20; j++) {
+			live += block_size(ptrs[j]);
+			if (!IS_SLAB(ptrs[j])) headers += PTR_ALIGNED_SIZE;
+		}
+		ASSERT(stats.live_bytes == live);
+		ASSERT(stats.header_bytes == headers);
+		alloc_del_batch(ptrs, 20);
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(!stats.live_bytes);
+		ASSERT(!stats.header_bytes);
+	}
+	{ // Normal case: reuse cached blocks
+		ASSERT(!reset());
+		void *data = alloc_new(MIN_ALLOC_SIZE);
+		alloc_del(data);
+		void *ptrs[2] = {0};
+		ASSERT(!alloc_new_batch(MIN_ALLOC_SIZE, 2, ptrs));
+		ASSERT(ptrs[0] == data);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(stats.fast_path == 1);
+		ASSERT(stats.slow_path == 2);
+	}
+	{ // count 0
+		void *ptrs[1] = {0};
+		ASSERT(!alloc_new_batch(MIN_ALLOC_SIZE, 0, ptrs));
+		ASSERT(!ptrs[0]);
+	}
+	{ // size 0
+		void *ptrs[1] = {0};
+		ASSERT(alloc_new_batch(0, 1, ptrs));
+	}
+	{ // ptrs NULL
+		ASSERT(alloc_new_batch(MIN_ALLOC_SIZE, 1, NULL));
+	}
+}
+
+void test_alloc_del() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data = alloc_new(size);
+		alloc_del(data);
+		ASSERT(g_tcache[SIZE_CLASS(size)].head == data);
+		ASSERT(PTR(data)->state == CACHED);
+		ASSERT(alloc_new(size) == data);
+	}
+#ifdef ALLOC_DEBUG
+	{ // Normal case: block allocated before debug mode
+		ASSERT(!reset());
+		void *data = alloc_new(MIN_ALLOC_SIZE);
+		atomic_store(&g_debug, DEBUG_CANARY);
+		alloc_del(data);
+		ASSERT(g_tcache[0].head == data);
+	}
+	{ // Double free in debug mode
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_QUARANTINE);
+		void *data = alloc_new(MIN_ALLOC_SIZE);
+		alloc_del(data);
+		void *base = debug_find(data)->base;
+		alloc_del(data);
+		ASSERT(g_quarantine_count == 1);
+		ASSERT(!g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE * 3)].head ||
+			g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE * 3)].head != base);
+	}
+#endif
+	{ // Normal case: slab
+		ASSERT(!reset());
+		void *data = alloc_new(MIN_ALLOC_SIZE);
+		alloc_del(data);
+		ASSERT(g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE)].head == data);
+		ASSERT(SLAB(data)->used == 1);
+		ASSERT(alloc_new(MIN_ALLOC_SIZE) == data);
+	}
+	{ // Normal case: mmap
+		ASSERT(!reset());
+		void *data = alloc_new(ARENA_SIZE * 2);
+		alloc_del(data);
+		ASSERT(!g_tcache[NUM_SIZE_CLASSES - 1].head);
+	}
+	{ // Normal case: free from a thread other than the owner
+		ASSERT(!reset());
+		owner_thread_arg_t arg = {0};
+		pthread_barrier_init(&arg.barrier, NULL, 2);
+		pthread_t thread;
+		ASSERT(!pthread_create(&thread, NULL, owner_thread, &arg));
+		pthread_barrier_wait(&arg.barrier);
+		alloc_del(arg.slab_data);
+		alloc_del(arg.arena_data);
+		ASSERT(alloc_new(MIN_ALLOC_SIZE) == arg.slab_data);
+		ASSERT(alloc_new(SLAB_MAX_SIZE * 2) == arg.arena_data);
+		ASSERT(!block_release(arg.slab_data));
+		ASSERT(!block_release(arg.arena_data));
+		ASSERT(SLAB(arg.slab_data)->used == 1);
+		ASSERT(PTR(arg.arena_data)->state == REMOTE);
+		ASSERT(!g_free_ptr_tails[SIZE_CLASS(SLAB_MAX_SIZE * 2)]);
+		pthread_barrier_wait(&arg.barrier);
+		ASSERT(!pthread_join(thread, NULL));
+		pthread_barrier_destroy(&arg.barrier);
+		ASSERT(!arg.slab_used);
+		ASSERT(arg.arena_state == FREE);
+	}
+	{ // Normal case: many threads freeing each other's blocks
+		ASSERT(!reset());
+		pthread_barrier_t barrier;
+		pthread_barrier_init(&barrier, NULL, STRESS_THREADS);
+		pthread_t threads[STRESS_THREADS];
+		for (size_t t = 0; t < STRESS_THREADS; t++) {
+			g_stress_args[t].barrier = &barrier;
+			g_stress_args[t].id = t;
+			ASSERT(!pthread_create(&threads[t], NULL, stress_thread,
+				&g_stress_args[t]));
+		}
+		for (size_t t = 0; t < STRESS_THREADS; t++) {
+			ASSERT(!pthread_join(threads[t], NULL));
+			ASSERT(g_stress_args[t].ok);
+		}
+		pthread_barrier_destroy(&barrier);
+	}
+	{ // Double free
+		ASSERT(!reset());
+		void *data = alloc_new(SLAB_MAX_SIZE * 2);
+		alloc_del(data);
+		alloc_del(data);
+		ASSERT(g_tcache[SIZE_CLASS(SLAB_MAX_SIZE * 2)].count == 1);
+	}
+	{ // Double free of a slab block
+		ASSERT(!reset());
+		void *data = alloc_new(MIN_ALLOC_SIZE);
+		alloc_del(data);
+		alloc_del(data);
+		ASSERT(g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE)].count == 1);
+		void *data1 = alloc_new(MIN_ALLOC_SIZE);
+		void *data2 = alloc_new(MIN_ALLOC_SIZE);
+		ASSERT(data1 == data);
+		ASSERT(data2 != data1);
+	}
+}
+void test_alloc_del_sized() {
+	{ // Normal case
+		ASSERT(!reset());
+		void *data = alloc_new(MIN_ALLOC_SIZE * 3);
+		alloc_stats_t stats;
+		alloc_del_sized(data, MIN_ALLOC_SIZE * 3);
+		ASSERT(g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE * 3)].head == data);
+		ASSERT(SLAB(data)->used == 1);
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(!stats.live_bytes);
+		ASSERT(alloc_new(MIN_ALLOC_SIZE * 3) == data);
+	}
+	{ // Normal case: resized in place
+		ASSERT(!reset());
+		void *data = alloc_new(100);
+		void *old = data;
+		ASSERT(!alloc_resize(&data, 98));
+		ASSERT(data == old);
+		ASSERT(SLAB(data)->size == 112);
+		alloc_del_sized(data, 98);
+		ASSERT(g_tcache[SIZE_CLASS(112)].head == data);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats(&stats));
+		ASSERT(!stats.live_bytes);
+		alloc_class_stats_t class_stats;
+		ASSERT(!alloc_stats_class(SIZE_CLASS(112), &class_stats));
+		ASSERT(!class_stats.count);
+	}
+	{ // Normal case: resized into a smaller class
+		ASSERT(!reset());
+		void *data = alloc_new(100);
+		ASSERT(!alloc_resize(&data, 40));
+		ASSERT(SLAB(data)->size == CLASS_SIZE(SIZE_CLASS(40)));
+		alloc_del_sized(data, 40);
+		ASSERT(g_tcache[SIZE_CLASS(40)].head == data);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats(&stats));
+		ASSERT(!stats.live_bytes);
+	}
+	{ // Normal case: arena
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data = alloc_new(size);
+		alloc_del_sized(data, size);
+		ASSERT(g_tcache[SIZE_CLASS(size)].head == data);
+		ASSERT(PTR(data)->state == CACHED);
+	}
+	{ // Normal case: mmap
+		ASSERT(!reset());
+		void *data = alloc_new(ARENA_SIZE * 2);
+		alloc_del_sized(data, ARENA_SIZE * 2);
+		ASSERT(!g_tcache[NUM_SIZE_CLASSES - 1].head);
+	}
+#ifdef ALLOC_DEBUG
+	{ // Normal case: debug mode
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_SIZE);
+		void *data = alloc_new(5);
+		alloc_del_sized(data, 5);
+		ASSERT(!debug_find(data));
+	}
+	{ // Size mismatch in debug mode
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_SIZE);
+		void *data = alloc_new(5);
+		alloc_del_sized(data, 6);
+		ASSERT(debug_size(data) == 5);
+		alloc_del_sized(data, 5);
+		ASSERT(!debug_find(data));
+	}
+#endif
+	{ // ptr is NULL
+		ASSERT(!reset());
+		alloc_del_sized(NULL, MIN_ALLOC_SIZE);
+	}
+}
+
+void test_alloc_del_batch() {
+	{ // Normal case
+		ASSERT(!reset());
+		void *ptrs[4];
+		ptrs[0] = alloc_new(MIN_ALLOC_SIZE);
+		ptrs[1] = alloc_new(SLAB_MAX_SIZE * 2);
+		ptrs[2] = alloc_new(ARENA_SIZE * 2);
+		ptrs[3] = alloc_new(MIN_ALLOC_SIZE);
+		alloc_del_batch(ptrs, 4);
+		ASSERT(alloc_new(MIN_ALLOC_SIZE) == ptrs[3]);
+		ASSERT(alloc_new(MIN_ALLOC_SIZE) == ptrs[0]);
+		ASSERT(alloc_new(SLAB_MAX_SIZE * 2) == ptrs[1]);
+	}
+	{ // ptrs NULL
+		alloc_del_batch(NULL, 1);
+	}
+}
+
+void test_alloc_resize() {
+	{ // Normal case
+		ASSERT(!reset());
+		int *data = alloc_new(sizeof(int));
+		*data = 5;
+		ASSERT(SLAB(data)->size == MIN_ALLOC_SIZE);
+		ASSERT(!alloc_resize((void**)&data, SLAB_MAX_SIZE * 2));
+		ASSERT(PTR(data)->size == SLAB_MAX_SIZE * 2);
+		ASSERT(*data == 5);
+		ASSERT(!alloc_resize((void**)&data, MIN_ALLOC_SIZE * 2));
+		ASSERT(PTR(data)->size == MIN_ALLOC_SIZE * 2);
+		ASSERT(*data == 5);
+	}
+#ifdef ALLOC_DEBUG
+	{ // Normal case: debug mode
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_CANARY);
+		int *data = alloc_new(sizeof(int));
+		*data = 5;
+		ASSERT(!alloc_resize((void**)&data, SLAB_MAX_SIZE * 2));
+		ASSERT(debug_size(data) == SLAB_MAX_SIZE * 2);
+		ASSERT(*data == 5);
+	}
+#endif
+	{ // Normal case: arena block keeps its size class in the stats
+		ASSERT(!reset());
+		void *data1 = alloc_new(1000);
+		void *data2 = alloc_new(1000);
+		ASSERT(!alloc_resize(&data1, 600));
+		ASSERT(PTR(data1)->size == 1000);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(stats.live_bytes == 2000);
+		alloc_del(data1);
+		alloc_del(data2);
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(!stats.live_bytes);
+	}
+	{ // Normal case: slab object grows into a new slab and is freed
+		ASSERT(!reset());
+		int *data = alloc_new(sizeof(int));
+		int *old = data;
+		*data = 5;
+		ASSERT(!alloc_resize((void**)&data, MIN_ALLOC_SIZE * 2));
+		ASSERT(data != old);
+		ASSERT(SLAB(data)->size == MIN_ALLOC_SIZE * 2);
+		ASSERT(*data == 5);
+		ASSERT(g_tcache[SIZE_CLASS(MIN_ALLOC_SIZE)].head == old);
+	}
+	{ // Normal case: slab object shrinks in place within its class
+		ASSERT(!reset());
+		void *data = alloc_new(SLAB_MAX_SIZE);
+		void *old = data;
+		ASSERT(!alloc_resize(&data, SLAB_MAX_SIZE - 1));
+		ASSERT(data == old);
+	}
+	{ // Normal case: slab object shrinks into a smaller class
+		ASSERT(!reset());
+		int *data = alloc_new(SLAB_MAX_SIZE);
+		int *old = data;
+		*data = 5;
+		ASSERT(!alloc_resize((void**)&data, MIN_ALLOC_SIZE));
+		ASSERT(data != old);
+		ASSERT(SLAB(data)->size == MIN_ALLOC_SIZE);
+		ASSERT(*data == 5);
+		ASSERT(g_tcache[SIZE_CLASS(SLAB_MAX_SIZE)].head == old);
+	}
+	{ // Normal case: arena block moves and the old one is freed
+		ASSERT(!reset());
+		size_t size = SLAB_MAX_SIZE * 2;
+		void *data = alloc_new(size);
+		void *old = data;
+		ASSERT(alloc_new(size));
+		ASSERT(!alloc_resize(&data, size * 2));
+		ASSERT(data != old);
+		ASSERT(PTR(old)->state == CACHED);
+		ASSERT(g_tcache[SIZE_CLASS(size)].head == old);
+	}
+	{ // Normal case: mmap block is remapped
+		ASSERT(!reset());
+		unsigned char *data = alloc_new(ARENA_SIZE * 2);
+		data[0] = 7;
+		ASSERT(!alloc_resize((void**)&data, ARENA_SIZE * 32));
+		ASSERT(!PTR(data)->arena);
+		ASSERT(PTR(data)->size == ARENA_SIZE * 32);
+		ASSERT(data[0] == 7);
+		alloc_del(data);
+	}
+	{ // size is 0
+		int x = 5;
+		void *ptr = &x;
 		ASSERT(alloc_resize(&ptr, 0));
 	}
 	{ // ptr is NULL
 		ASSERT(alloc_resize(NULL, 4));
 	}
 }
+
+#define STATS_THREADS 4
+#define STATS_BLOCKS 64
+
+static void *stats_new_thread(void *arg) {
+	void **ptrs = arg;
+	size_t sizes[] = {MIN_ALLOC_SIZE, SLAB_MAX_SIZE, SLAB_MAX_SIZE * 2,
+		MAX_RUN_ALLOC_SIZE, MAX_RUN_ALLOC_SIZE * 2};
+	for (size_t i = 0; i < STATS_BLOCKS; i++)
+		ptrs[i] = alloc_new(sizes[i % (sizeof(sizes) / sizeof(*sizes))]);
+	return NULL;
+}
+
+static void *stats_del_thread(void *arg) {
+	void **ptrs = arg;
+	for (size_t i = 0; i < STATS_BLOCKS; i++) alloc_del(ptrs[i]);
+	return NULL;
+}
+
+void test_alloc_stats() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_stats_t before;
+		ASSERT(!alloc_stats(&before));
+		void *small = alloc_new(MIN_ALLOC_SIZE);
+		void *medium = alloc_new(SLAB_MAX_SIZE * 2);
+		void *large = alloc_new(MAX_RUN_ALLOC_SIZE * 2);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats(&stats));
+		ASSERT(stats.live_bytes - before.live_bytes ==
+			MIN_ALLOC_SIZE + SLAB_MAX_SIZE * 2 + MAX_RUN_ALLOC_SIZE * 2);
+		ASSERT(stats.header_bytes - before.header_bytes == PTR_ALIGNED_SIZE * 2);
+		ASSERT(stats.mmap_count - before.mmap_count == 1);
+		ASSERT(stats.slow_path - before.slow_path == 3);
+		ASSERT(stats.mmap_calls > before.mmap_calls);
+		ASSERT(stats.arena_count >= 1);
+		ASSERT(stats.slab_count >= 1);
+		ASSERT(stats.thread_count >= 1);
+		ASSERT(stats.mapped_bytes >= stats.live_bytes);
+		alloc_del(small);
+		alloc_del(medium);
+		alloc_del(large);
+		ASSERT(!alloc_stats(&stats));
+		ASSERT(stats.live_bytes == before.live_bytes);
+		ASSERT(stats.mmap_count == before.mmap_count);
+		ASSERT(g_map_count == 1);
+		ASSERT(alloc_new(MIN_ALLOC_SIZE) == small);
+		ASSERT(!alloc_stats(&stats));
+		ASSERT(stats.fast_path - before.fast_path == 1);
+		alloc_del(small);
+	}
+	{ // Normal case: cross-thread free
+		ASSERT(!reset());
+		alloc_stats_t before;
+		ASSERT(!alloc_stats(&before));
+		void *data = alloc_new(MIN_ALLOC_SIZE);
+		pthread_t thread;
+		ASSERT(!pthread_create(&thread, NULL, del_thread, data));
+		ASSERT(!pthread_join(thread, NULL));
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats(&stats));
+		ASSERT(stats.live_bytes == before.live_bytes);
+		ASSERT(stats.thread_count == before.thread_count + 1);
+	}
+	{ // Normal case: threads free the blocks of each other
+		ASSERT(!reset());
+		static void *ptrs[STATS_THREADS][STATS_BLOCKS];
+		pthread_t threads[STATS_THREADS];
+		for (size_t t = 0; t < STATS_THREADS; t++)
+			ASSERT(!pthread_create(&threads[t], NULL, stats_new_thread, ptrs[t]));
+		for (size_t t = 0; t < STATS_THREADS; t++)
+			ASSERT(!pthread_join(threads[t], NULL));
+		for (size_t t = 0; t < STATS_THREADS; t++)
+			for (size_t i = 0; i < STATS_BLOCKS; i++) ASSERT(ptrs[t][i]);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats(&stats));
+		ASSERT(stats.live_bytes >= STATS_THREADS * STATS_BLOCKS * MIN_ALLOC_SIZE);
+		for (size_t t = 0; t < STATS_THREADS; t++)
+			ASSERT(!pthread_create(&threads[t], NULL, stats_del_thread,
+				ptrs[(t + 1) % STATS_THREADS]));
+		for (size_t t = 0; t < STATS_THREADS; t++)
+			ASSERT(!pthread_join(threads[t], NULL));
+		ASSERT(!alloc_stats(&stats));
+		ASSERT(stats.live_bytes == 0);
+		ASSERT(stats.header_bytes == 0);
+		ASSERT(stats.mmap_count == 0);
+	}
+	{ // stats NULL
+		ASSERT(alloc_stats(NULL));
+	}
+}
+
+void test_alloc_stats_thread() {
+	{ // Normal case
+		ASSERT(!reset());
+		void *data = alloc_new(SLAB_MAX_SIZE * 2);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(stats.live_bytes == SLAB_MAX_SIZE * 2);
+		ASSERT(stats.header_bytes == PTR_ALIGNED_SIZE);
+		ASSERT(stats.arena_count == 1);
+		ASSERT(stats.thread_count == 1);
+		ASSERT(stats.slow_path == 1);
+		alloc_del(data);
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(!stats.live_bytes);
+	}
+	{ // Normal case: block of another thread
+		ASSERT(!reset());
+		static void *ptrs[STATS_BLOCKS];
+		pthread_t thread;
+		ASSERT(!pthread_create(&thread, NULL, stats_new_thread, ptrs));
+		ASSERT(!pthread_join(thread, NULL));
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(!stats.live_bytes);
+		alloc_del(ptrs[0]);
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT((ptrdiff_t)stats.live_bytes == -(ptrdiff_t)MIN_ALLOC_SIZE);
+		alloc_del(ptrs[4]);
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT((ptrdiff_t)stats.mmap_count == -1);
+		for (size_t i = 1; i < STATS_BLOCKS; i++)
+			if (i != 4) alloc_del(ptrs[i]);
+		ASSERT(!alloc_stats(&stats));
+		ASSERT(stats.live_bytes == 0);
+	}
+	{ // stats NULL
+		ASSERT(alloc_stats_thread(NULL));
+	}
+}
+
+void test_alloc_stats_class() {
+	{ // Normal case
+		ASSERT(!reset());
+		size_t i = SIZE_CLASS(MIN_ALLOC_SIZE * 3);
+		alloc_class_stats_t before;
+		ASSERT(!alloc_stats_class(i, &before));
+		ASSERT(before.size == MIN_ALLOC_SIZE * 3);
+		void *data = alloc_new(MIN_ALLOC_SIZE * 3);
+		void *other = alloc_new(MIN_ALLOC_SIZE * 3 - 1);
+		alloc_class_stats_t stats;
+		ASSERT(!alloc_stats_class(i, &stats));
+		ASSERT(stats.count - before.count == 2);
+		ASSERT(stats.total - before.total == 2);
+		alloc_del(data);
+		alloc_del(other);
+		ASSERT(!alloc_stats_class(i, &stats));
+		ASSERT(stats.count == before.count);
+		ASSERT(stats.total - before.total == 2);
+	}
+	{ // Normal case: iterate classes
+		alloc_class_stats_t stats;
+		size_t i = 0;
+		while (!alloc_stats_class(i, &stats)) i++;
+		ASSERT(i == NUM_SIZE_CLASSES);
+		ASSERT(stats.size == MAX_ARENA_ALLOC_SIZE);
+	}
+	{ // stats NULL
+		ASSERT(alloc_stats_class(0, NULL));
+	}
+}
+
+void test_alloc_config() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_config_t config = {0, MAX_DIRTY, false};
+		ASSERT(!page_free(page_use()));
+		ASSERT(!alloc_config(&config));
+		ASSERT(!g_heap->dirty_head);
+		ASSERT(!page_free(page_use()));
+		ASSERT(!g_heap->dirty_head);
+		config.decay_ms = DECAY_MS;
+		config.background = true;
+		ASSERT(!alloc_config(&config));
+		ASSERT(g_decay_running);
+		config.background = false;
+		ASSERT(!alloc_config(&config));
+		ASSERT(!g_decay_running);
+	}
+	{ // Config NULL
+		ASSERT(alloc_config(NULL));
+	}
+}
+
+void test_alloc_config_get() {
+	{ // Normal case
+		alloc_config_t config = {DECAY_MS * 2, ARENA_SIZE, true};
+		ASSERT(!alloc_config(&config));
+		alloc_config_t got = {0};
+		ASSERT(!alloc_config_get(&got));
+		ASSERT(got.decay_ms == DECAY_MS * 2);
+		ASSERT(got.max_dirty_bytes == ARENA_SIZE);
+		ASSERT(got.background);
+		config = (alloc_config_t){DECAY_MS, MAX_DIRTY, false};
+		ASSERT(!alloc_config(&config));
+	}
+	{ // Config NULL
+		ASSERT(alloc_config_get(NULL));
+	}
+}
+
+void test_alloc_purge() {
+	{ // Normal case
+		ASSERT(!reset());
+		void *data = alloc_new(SLAB_MAX_SIZE * 2);
+		ASSERT(!arena_expand());
+		alloc_stats_t stats = {0};
+		ASSERT(!ptr_free(data));
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(stats.dirty_bytes == ARENA_SIZE);
+		ASSERT(!alloc_purge());
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(!stats.dirty_bytes);
+		ASSERT(stats.madvise_calls == 1);
+	}
+	{ // Normal case: empty slabs
+		ASSERT(!reset());
+		slab_t *slab = slab_new(MIN_ALLOC_SIZE);
+		slab_unlink(slab);
+		ASSERT(!slab_pool_put(slab));
+		ASSERT(!alloc_purge());
+		ASSERT(!g_slab_pool);
+		ASSERT(g_slab_free == slab);
+	}
+	{ // Normal case: blocks freed into the heap of an exited thread
+		ASSERT(!reset());
+		void *ptrs[ORPHAN_BLOCKS];
+		pthread_t thread;
+		ASSERT(!pthread_create(&thread, NULL, orphan_thread, ptrs));
+		ASSERT(!pthread_join(thread, NULL));
+		heap_t *heap = g_orphans;
+		alloc_stats_t before;
+		ASSERT(!alloc_stats(&before));
+		for (size_t i = 0; i < ORPHAN_BLOCKS; i++) alloc_del(ptrs[i]);
+		ASSERT(!alloc_purge());
+		ASSERT(!atomic_load(&heap->remote_free));
+		ASSERT(!heap->dirty_head);
+		alloc_stats_t after;
+		ASSERT(!alloc_stats(&after));
+		ASSERT(after.arena_count < before.arena_count);
+		ASSERT(after.mapped_bytes < before.mapped_bytes);
+		ASSERT(g_orphans == heap);
+	}
+}
+
+void test_alloc_prof_enable() {
+	{ // Normal case
+		ASSERT(!reset());
+		ASSERT(!alloc_prof_enable(1024));
+		ASSERT(atomic_load(&g_prof_rate) == 1024);
+		ASSERT(g_prof_bytes > 0);
+		ASSERT(atomic_load(&g_prof_start));
+		void *data[1000];
+		for (size_t i = 0; i < 1000; i++) data[i] = alloc_new(MIN_ALLOC_SIZE * 8);
+		size_t live = atomic_load(&g_prof_live_count);
+		ASSERT(live > 20 && live < 500);
+		for (size_t i = 0; i < 1000; i++) alloc_del(data[i]);
+		ASSERT(!atomic_load(&g_prof_live_count));
+		ASSERT(!alloc_prof_enable(0));
+		ASSERT(g_prof_bytes == PROF_RECHECK);
+	}
+	{ // Rate too big
+		ASSERT(alloc_prof_enable(SIZE_MAX));
+	}
+}
+
+void test_alloc_prof_dump() {
+	{ // Normal case
+		ASSERT(!reset());
+		ASSERT(!alloc_prof_enable(1024));
+		void *data[100];
+		for (size_t i = 0; i < 100; i++) data[i] = alloc_new(MIN_ALLOC_SIZE * 8);
+		char *buff = NULL;
+		size_t len = 0;
+		FILE *file = open_memstream(&buff, &len);
+		ASSERT(!alloc_prof_dump(file, ALLOC_PROF_FOLDED));
+		fclose(file);
+		size_t bytes = 0;
+		for (char *end = strchr(buff, '\n'); end; end = strchr(end + 1, '\n')) {
+			char *value = end;
+			while (value[-1] != ' ') value--;
+			bytes += strtoull(value, NULL, 10);
+		}
+		ASSERT(bytes > MIN_ALLOC_SIZE * 8 * 50 && bytes < MIN_ALLOC_SIZE * 8 * 200);
+		free(buff);
+		for (size_t i = 0; i < 100; i++) alloc_del(data[i]);
+		ASSERT(!alloc_prof_enable(0));
+	}
+	{ // File NULL
+		ASSERT(alloc_prof_dump(NULL, ALLOC_PROF_FOLDED));
+	}
+	{ // Invalid format
+		ASSERT(alloc_prof_dump(stdout, (alloc_prof_format_t)3));
+	}
+}
+
+void test_alloc_region_create() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_region_t *region = alloc_region_create();
+		ASSERT(region);
+		ASSERT((unsigned char*)region == (unsigned char*)region->head + REGION_PAGE_HEADER);
+		ASSERT(region->page == region->head);
+		ASSERT(region->offset == REGION_START);
+		ASSERT(region->owner == g_heap);
+		ASSERT(!alloc_region_destroy(region));
+	}
+}
+
+void test_alloc_region_new() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_region_t *region = alloc_region_create();
+		for (size_t i = 0; i < 1000; i++) {
+			unsigned char *data = alloc_region_new(region, i % 100 + 1);
+			ASSERT(data);
+			ASSERT(!((uintptr_t)data % MIN_ALLOC_SIZE));
+			memset(data, 1, i % 100 + 1);
+		}
+		ASSERT(alloc_region_new(region, ARENA_SIZE * 2));
+		ASSERT(!alloc_region_destroy(region));
+	}
+	{ // region NULL
+		ASSERT(!alloc_region_new(NULL, MIN_ALLOC_SIZE));
+	}
+	{ // size 0
+		ASSERT(!reset());
+		alloc_region_t *region = alloc_region_create();
+		ASSERT(!alloc_region_new(region, 0));
+		ASSERT(!alloc_region_destroy(region));
+	}
+	{ // region owned by another thread
+		ASSERT(!reset());
+		alloc_region_t *region = alloc_region_create();
+		heap_t *heap = g_heap;
+		g_heap = NULL;
+		ASSERT(!alloc_region_new(region, MIN_ALLOC_SIZE));
+		g_heap = heap;
+		ASSERT(!alloc_region_destroy(region));
+	}
+}
+
+void test_alloc_region_reset() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_region_t *region = alloc_region_create();
+		void *data = alloc_region_new(region, MIN_ALLOC_SIZE);
+		for (size_t i = 0; i < ARENA_SIZE / MIN_ALLOC_SIZE * 3; i++)
+			ASSERT(alloc_region_new(region, MIN_ALLOC_SIZE));
+		ASSERT(alloc_region_new(region, ARENA_SIZE * 2));
+		region_page_t *page = region->page;
+		alloc_stats_t before;
+		ASSERT(!alloc_stats_thread(&before));
+		ASSERT(!alloc_region_reset(region));
+		ASSERT(!region->large);
+		ASSERT(region->page == region->head);
+		ASSERT(alloc_region_new(region, MIN_ALLOC_SIZE) == data);
+		for (size_t i = 0; i < ARENA_SIZE / MIN_ALLOC_SIZE * 3; i++)
+			ASSERT(alloc_region_new(region, MIN_ALLOC_SIZE));
+		ASSERT(region->page == page);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(stats.arena_count == before.arena_count);
+		ASSERT(!alloc_region_destroy(region));
+	}
+	{ // region NULL
+		ASSERT(alloc_region_reset(NULL));
+	}
+}
+
+void test_alloc_region_destroy() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_stats_t before;
+		ASSERT(!alloc_stats_thread(&before));
+		alloc_region_t *region = alloc_region_create();
+		for (size_t i = 0; i < ARENA_SIZE / MIN_ALLOC_SIZE * 3; i++)
+			ASSERT(alloc_region_new(region, MIN_ALLOC_SIZE));
+		ASSERT(alloc_region_new(region, ARENA_SIZE * 2));
+		ASSERT(!alloc_region_destroy(region));
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(stats.arena_count == before.arena_count);
+		ASSERT(stats.mmap_count == before.mmap_count);
+	}
+	{ // region NULL
+		ASSERT(alloc_region_destroy(NULL));
+	}
+}
+
+void test_alloc_cache_create() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_cache_t *cache = alloc_cache_create(100, 64, obj_ctor, obj_dtor);
+		ASSERT(cache);
+		ASSERT(cache->size == 100);
+		ASSERT(cache->align == 64);
+		ASSERT(cache->link == 104);
+		ASSERT(cache->ctor == obj_ctor);
+		ASSERT(cache->dtor == obj_dtor);
+		ASSERT(!cache->free.count);
+		ASSERT(!alloc_cache_destroy(cache));
+	}
+	{ // size 0
+		ASSERT(!alloc_cache_create(0, 0, NULL, NULL));
+	}
+	{ // size too big
+		ASSERT(!alloc_cache_create(SIZE_MAX, 0, NULL, NULL));
+	}
+	{ // align not a power of two
+		ASSERT(!alloc_cache_create(MIN_ALLOC_SIZE, 24, NULL, NULL));
+	}
+}
+
+typedef struct cache_thread_arg {
+	alloc_cache_t *cache;
+	bool ok;
+} cache_thread_arg_t;
+
+static void *cache_thread(void *arg) {
+	cache_thread_arg_t *a = arg;
+	a->ok = true;
+	unsigned char *objs[STRESS_BATCH];
+	for (size_t r = 0; r < STRESS_ROUNDS; r++) {
+		for (size_t j = 0; j < STRESS_BATCH; j++) {
+			objs[j] = alloc_cache_get(a->cache);
+			if (!objs[j] || objs[j][0] != 0xab) a->ok = false;
+		}
+		for (size_t j = 0; j < STRESS_BATCH; j++)
+			if (objs[j]) alloc_cache_put(a->cache, objs[j]);
+	}
+	return NULL;
+}
+
+void test_alloc_cache_get() {
+	{ // Normal case
+		ASSERT(!reset());
+		g_ctor_calls = 0;
+		alloc_cache_t *cache = alloc_cache_create(MIN_ALLOC_SIZE, 0, obj_ctor, NULL);
+		unsigned char *obj = alloc_cache_get(cache);
+		ASSERT(obj[0] == 0xab);
+		obj[1] = 1;
+		alloc_cache_put(cache, obj);
+		ASSERT(alloc_cache_get(cache) == obj);
+		ASSERT(obj[1] == 1);
+		ASSERT(g_ctor_calls == 1);
+		alloc_cache_put(cache, obj);
+		ASSERT(!alloc_cache_destroy(cache));
+	}
+	{ // Normal case: many threads
+		ASSERT(!reset());
+		alloc_cache_t *cache = alloc_cache_create(MIN_ALLOC_SIZE, 0, obj_ctor, NULL);
+		pthread_t threads[STRESS_THREADS];
+		cache_thread_arg_t args[STRESS_THREADS];
+		for (size_t t = 0; t < STRESS_THREADS; t++) {
+			args[t].cache = cache;
+			ASSERT(!pthread_create(&threads[t], NULL, cache_thread, &args[t]));
+		}
+		for (size_t t = 0; t < STRESS_THREADS; t++) {
+			ASSERT(!pthread_join(threads[t], NULL));
+			ASSERT(args[t].ok);
+		}
+		alloc_cache_stats_t stats;
+		ASSERT(!alloc_cache_stats(cache, &stats));
+		ASSERT(stats.gets == STRESS_THREADS * STRESS_ROUNDS * STRESS_BATCH);
+		ASSERT(!stats.live);
+		ASSERT(stats.free == stats.ctor_calls);
+		ASSERT(stats.ctor_calls <= STRESS_THREADS * STRESS_BATCH);
+		ASSERT(!alloc_cache_destroy(cache));
+	}
+	{ // cache NULL
+		ASSERT(!alloc_cache_get(NULL));
+	}
+}
+
+void test_alloc_cache_put() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_cache_t *cache = alloc_cache_create(MIN_ALLOC_SIZE, 0, NULL, NULL);
+		void *obj1 = alloc_cache_get(cache);
+		void *obj2 = alloc_cache_get(cache);
+		alloc_cache_put(cache, obj1);
+		alloc_cache_put(cache, obj2);
+		ASSERT(cache->free.count == 2);
+		ASSERT(alloc_cache_get(cache) == obj2);
+		ASSERT(alloc_cache_get(cache) == obj1);
+		alloc_cache_put(cache, obj1);
+		alloc_cache_put(cache, obj2);
+		ASSERT(!alloc_cache_destroy(cache));
+	}
+	{ // cache NULL
+		alloc_cache_put(NULL, &g_ctor_calls);
+	}
+	{ // obj NULL
+		ASSERT(!reset());
+		alloc_cache_t *cache = alloc_cache_create(MIN_ALLOC_SIZE, 0, NULL, NULL);
+		alloc_cache_put(cache, NULL);
+		ASSERT(!cache->free.count);
+		ASSERT(!alloc_cache_destroy(cache));
+	}
+}
+
+void test_alloc_cache_stats() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_cache_t *cache = alloc_cache_create(MIN_ALLOC_SIZE * 3, 0, NULL, NULL);
+		void *obj1 = alloc_cache_get(cache);
+		void *obj2 = alloc_cache_get(cache);
+		alloc_cache_put(cache, obj1);
+		obj1 = alloc_cache_get(cache);
+		alloc_cache_put(cache, obj2);
+		alloc_cache_stats_t stats;
+		ASSERT(!alloc_cache_stats(cache, &stats));
+		ASSERT(stats.size == MIN_ALLOC_SIZE * 3);
+		ASSERT(stats.live == 1);
+		ASSERT(stats.free == 1);
+		ASSERT(stats.gets == 3);
+		ASSERT(stats.hits == 1);
+		ASSERT(stats.ctor_calls == 2);
+		alloc_cache_put(cache, obj1);
+		ASSERT(!alloc_cache_destroy(cache));
+	}
+	{ // cache NULL
+		alloc_cache_stats_t stats;
+		ASSERT(alloc_cache_stats(NULL, &stats));
+	}
+	{ // stats NULL
+		ASSERT(!reset());
+		alloc_cache_t *cache = alloc_cache_create(MIN_ALLOC_SIZE, 0, NULL, NULL);
+		ASSERT(alloc_cache_stats(cache, NULL));
+		ASSERT(!alloc_cache_destroy(cache));
+	}
+}
+
+void test_alloc_cache_destroy() {
+	{ // Normal case
+		ASSERT(!reset());
+		g_dtor_calls = 0;
+		alloc_stats_t before;
+		ASSERT(!alloc_stats_thread(&before));
+		alloc_cache_t *cache = alloc_cache_create(MIN_ALLOC_SIZE, 0, NULL, obj_dtor);
+		void *obj1 = alloc_cache_get(cache);
+		void *obj2 = alloc_cache_get(cache);
+		alloc_cache_put(cache, obj1);
+		ASSERT(!alloc_cache_destroy(cache));
+		ASSERT(g_dtor_calls == 1);
+		alloc_del(obj2);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(stats.live_bytes == before.live_bytes);
+	}
+	{ // cache NULL
+		ASSERT(alloc_cache_destroy(NULL));
+	}
+}
+
+void test_alloc_fast_get() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_fast_t *fast = alloc_fast_get();
+		ASSERT(fast == &g_fast);
+		ASSERT(g_heap);
+		ASSERT(!fast->budget);
+	}
+}
+
+void test_alloc_fast_refill() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_fast_t *fast = alloc_fast_get();
+		alloc_del(alloc_new(MIN_ALLOC_SIZE));
+		g_decay_tick = 0;
+		void *data = alloc_fast_refill(fast, MIN_ALLOC_SIZE);
+		ASSERT(data);
+		ASSERT(IS_SLAB(data));
+		ASSERT(fast->budget == FAST_BUDGET || fast->budget == g_prof_bytes);
+		ASSERT(fast->heads[SIZE_CLASS(MIN_ALLOC_SIZE)]);
+		ASSERT(g_decay_tick == 1);
+		alloc_del(data);
+	}
+	{ // Normal case: counts the blocks handed out
+		ASSERT(!reset());
+		alloc_fast_t *fast = alloc_fast_get();
+		alloc_del(alloc_fast_refill(fast, MIN_ALLOC_SIZE));
+		void *data = alloc_new_fast(fast, MIN_ALLOC_SIZE);
+		ASSERT(fast->counts[SIZE_CLASS(MIN_ALLOC_SIZE)] == 1);
+		fast->budget = 0;
+		void *next = alloc_new_fast(fast, MIN_ALLOC_SIZE);
+		ASSERT(next);
+		ASSERT(!fast->counts[SIZE_CLASS(MIN_ALLOC_SIZE)]);
+		ASSERT(STAT_LOAD(g_heap, fast_path) >= 1);
+		alloc_del(data);
+		alloc_del(next);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats(&stats));
+		ASSERT(!stats.live_bytes);
+	}
+	{ // Normal case: releases remote frees
+		ASSERT(!reset());
+		alloc_fast_t *fast = alloc_fast_get();
+		void *data = alloc_new(MIN_ALLOC_SIZE);
+		pthread_t thread;
+		ASSERT(!pthread_create(&thread, NULL, del_thread, data));
+		ASSERT(!pthread_join(thread, NULL));
+		ASSERT(atomic_load(&g_heap->remote_free));
+		fast->budget = 0;
+		void *next = alloc_new_fast(fast, MIN_ALLOC_SIZE);
+		ASSERT(next);
+		ASSERT(!atomic_load(&g_heap->remote_free));
+		alloc_del(next);
+	}
+	{ // Normal case: size too big for the fast path
+		ASSERT(!reset());
+		alloc_fast_t *fast = alloc_fast_get();
+		void *data = alloc_fast_refill(fast, ALLOC_FAST_MAX_SIZE + 1);
+		ASSERT(data);
+		ASSERT(!IS_SLAB(data));
+		alloc_del(data);
+	}
+	{ // State of another thread
+		ASSERT(!reset());
+		alloc_fast_t other = {0};
+		ASSERT(!alloc_fast_refill(&other, MIN_ALLOC_SIZE));
+		ASSERT(!alloc_fast_refill(NULL, MIN_ALLOC_SIZE));
+	}
+	{ // size is 0
+		ASSERT(!reset());
+		ASSERT(!alloc_fast_refill(alloc_fast_get(), 0));
+	}
+}
+
+void test_alloc_new_fast() {
+	{ // Normal case
+		ASSERT(!reset());
+		alloc_fast_t *fast = alloc_fast_get();
+		void *data = alloc_new_fast(fast, MIN_ALLOC_SIZE);
+		ASSERT(data);
+		ASSERT(fast->budget > 0);
+		size_t i = ALLOC_FAST_CLASS(MIN_ALLOC_SIZE);
+		void *head = fast->heads[i];
+		ASSERT(head);
+		int64_t budget = fast->budget;
+		ASSERT(alloc_new_fast(fast, MIN_ALLOC_SIZE) == head);
+		ASSERT(fast->budget == budget - (int64_t)MIN_ALLOC_SIZE);
+		ASSERT(fast->counts[i] == 1);
+		alloc_stats_t stats;
+		ASSERT(!alloc_stats_thread(&stats));
+		ASSERT(stats.live_bytes == MIN_ALLOC_SIZE * 2);
+		ASSERT(!fast->counts[i]);
+		alloc_del(data);
+		alloc_del(head);
+		ASSERT(!alloc_stats(&stats));
+		ASSERT(!stats.live_bytes);
+	}
+	{ // Normal case: size class matches the library
+		for (size_t size = 1; size <= ALLOC_FAST_MAX_SIZE; size++)
+			ASSERT(ALLOC_FAST_CLASS(size) == SIZE_CLASS(size));
+		ASSERT(ALLOC_FAST_CLASSES == NUM_SLAB_SIZES);
+	}
+	{ // Normal case: alloc_new() is a plain function
+		ASSERT(!reset());
+		void *(*new)(size_t size) = &alloc_new;
+		void *data = new(MIN_ALLOC_SIZE);
+		ASSERT(data);
+		ASSERT(!g_fast.budget);
+		alloc_del(data);
+	}
+	{ // Normal case: size too big for the fast path
+		ASSERT(!reset());
+		void *data = alloc_new_fast(alloc_fast_get(), ALLOC_FAST_MAX_SIZE + 1);
+		ASSERT(data);
+		ASSERT(!IS_SLAB(data));
+		alloc_del(data);
+	}
+#ifdef ALLOC_DEBUG
+	{ // Normal case: debug mode
+		ASSERT(!reset());
+		atomic_store(&g_debug, DEBUG_CANARY);
+		alloc_fast_t *fast = alloc_fast_get();
+		void *data = alloc_new_fast(fast, MIN_ALLOC_SIZE);
+		ASSERT(debug_size(data) == MIN_ALLOC_SIZE);
+		ASSERT(!fast->budget);
+		alloc_del(data);
+		ASSERT(!reset());
+	}
+#endif
+	{ // size is 0
+		ASSERT(!reset());
+		ASSERT(!alloc_new_fast(alloc_fast_get(), 0));
+	}
+}
@@ -7,6 +7,45 @@
  * alloc_utils.
  * */
 
+void test_numa_parse();
+void test_numa_init();
+void test_numa_node();
+void test_numa_bind();
+void test_chunk_new();
+void test_page_use();
+void test_chunk_find_run();
+void test_pages_use();
+void test_pages_free();
+void test_page_free();
+void test_clock_ms();
+void test_clock_ns();
+void test_pages_purge();
+void test_page_purge();
+void test_dirty_push();
+void test_dirty_unlink();
+void test_heap_decay();
+void test_decay_tick();
+void test_decay_all();
+void test_decay_thread();
+void test_decay_start();
+void test_decay_stop();
+void test_trace_put();
+void test_trace_get();
+void test_trace_encode();
+void test_trace_decode();
+#ifdef ALLOC_TRACE
+void test_trace_buf_get();
+void test_trace_queue();
+void test_trace_slot_get();
+void test_trace_record();
+void test_trace_flush();
+void test_trace_write();
+void test_trace_thread();
+void test_trace_start();
+void test_trace_stop();
+void test_trace_exit();
+#endif
+void test_config_env();
 void test_arena_expand();
 void test_arena_reset();
 void test_arena_del();
@@ -14,17 +53,132 @@ void test_roundup();
 void test_ptr_aligned_size();
 void test_total_size();
 void test_arena_use();
-void test_free_ptr_index();
+void test_size_class();
+void test_ptr_capacity();
+void test_ptr_unlink();
+void test_free_ptr_push();
+void test_free_ptr_unlink();
+void test_ptr_coalesce();
+void test_run_use();
+void test_run_use_aligned();
+void test_run_free();
+void test_run_resize();
+void test_map_cache_put();
+void test_map_cache_use();
+void test_map_cache_flush();
 void test_ptr_free();
+void test_free_ptr_find();
 void test_free_ptr_use();
 void test_mmap_use();
+void test_mmap_use_aligned();
+void test_arena_resize();
+void test_mmap_resize();
+void test_large_use();
+void test_slab_region_init();
+void test_slab_new();
+void test_slab_use();
+void test_slab_release();
+void test_slab_pool_put();
+void test_slab_pool_flush();
+void test_slab_free();
+void test_remote_free_push();
+void test_remote_free_drain();
+void test_block_release();
+void test_fast_fold();
+void test_fast_grant();
+void test_fast_revoke();
+void test_heap_exit();
+void test_heap_adopt();
+void test_orphan_drain();
+void test_heap_init();
+void test_central_push();
+void test_central_pop();
+void test_central_refill();
+void test_central_flush();
+void test_tcache_use();
+void test_tcache_free();
+void test_tcache_free_sized();
+void test_tcache_use_batch();
+void test_slab_use_batch();
+void test_fast_stash();
+void test_tcache_push();
+void test_tcache_free_batch();
+void test_fork_prepare();
+void test_fork_parent();
+void test_fork_child();
+void test_block_node();
+void test_block_size();
+void test_stats_new();
+void test_stats_del();
+void test_stats_add();
+void test_stats_finish();
+void test_block_new();
+void test_region_expand();
+void test_region_use();
+void test_region_release();
+void test_cache_use();
+void test_cache_free();
+void test_cache_drain();
 
 /**
  * alloc.h
  * */
 
+void test_prof_rand();
+void test_prof_interval();
+void test_prof_site_find();
+void test_prof_live_find();
+void test_prof_live_insert();
+void test_prof_live_remove();
+void test_prof_sample();
+void test_prof_free();
+void test_prof_frame();
+void test_prof_write();
+#ifdef ALLOC_DEBUG
+void test_debug_report();
+void test_debug_slot();
+void test_debug_find();
+void test_debug_grow();
+void test_debug_insert();
+void test_debug_remove();
+void test_debug_end();
+void test_debug_intact();
+void test_debug_check();
+void test_debug_release();
+void test_debug_evict();
+void test_debug_new();
+void test_debug_del();
+void test_debug_size();
+void test_debug_size_match();
+void test_debug_resize();
+#endif
 void test_alloc_new();
+void test_alloc_new_zeroed();
+void test_alloc_new_aligned();
+void test_alloc_new_batch();
 void test_alloc_del();
+void test_alloc_del_sized();
+void test_alloc_del_batch();
 void test_alloc_resize();
+void test_alloc_stats();
+void test_alloc_stats_thread();
+void test_alloc_stats_class();
+void test_alloc_config();
+void test_alloc_config_get();
+void test_alloc_purge();
+void test_alloc_prof_enable();
+void test_alloc_prof_dump();
+void test_alloc_region_create();
+void test_alloc_region_new();
+void test_alloc_region_reset();
+void test_alloc_region_destroy();
+void test_alloc_cache_create();
+void test_alloc_cache_get();
+void test_alloc_cache_put();
+void test_alloc_cache_stats();
+void test_alloc_cache_destroy();
+void test_alloc_fast_get();
+void test_alloc_fast_refill();
+void test_alloc_new_fast();
 
 #endif